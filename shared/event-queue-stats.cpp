@@ -0,0 +1,70 @@
+#include "event-queue-stats.h"
+
+#include <features/frameworks/mbed-client-cli/mbed-client-cli/ns_cmdline.h>
+#include <platform/mbed_critical.h>
+
+#include <cinttypes>
+
+namespace event_queue_stats
+{
+
+namespace
+{
+
+const statistics statistics_init = { 0, 0, 0, 0, UINT32_MAX, 0, 0 };
+
+// Updated from ISRs and the event queue's thread, always in a critical section. It's only a few instructions.
+statistics stats = statistics_init;
+
+}
+
+void posted(const bool succeeded) {
+    core_util_critical_section_enter();
+    if (succeeded) {
+        ++stats.posted;
+        const auto n = pending(stats);
+        if (n > stats.max_pending) {
+            stats.max_pending = n;
+        }
+    } else {
+        ++stats.failed;
+    }
+    core_util_critical_section_exit();
+}
+
+void dispatching(const uint32_t posted_us) {
+    // Unsigned arithmetic so the wrap of the us ticker is handled naturally. The queue counts whole ms
+    // so a delayed event can start a little before it was due by the us ticker.
+    const auto elapsed_us = us_ticker_read() - posted_us;
+    const auto latency_us = static_cast<int32_t>(elapsed_us) < 0 ? 0 : elapsed_us;
+
+    core_util_critical_section_enter();
+    ++stats.dispatched;
+    stats.sum_latency_us += latency_us;
+    if (latency_us < stats.min_latency_us) stats.min_latency_us = latency_us;
+    if (latency_us > stats.max_latency_us) stats.max_latency_us = latency_us;
+    core_util_critical_section_exit();
+}
+
+statistics read() {
+    core_util_critical_section_enter();
+    const auto s = stats;
+    core_util_critical_section_exit();
+    return s;
+}
+
+void reset() {
+    core_util_critical_section_enter();
+    stats = statistics_init;
+    core_util_critical_section_exit();
+}
+
+void print() {
+    const auto s = read();
+    cmd_printf("size %u bytes, %u byte events\n", static_cast<unsigned>(MBED_CONF_APP_EVENT_QUEUE_SIZE), static_cast<unsigned>(EVENTS_EVENT_SIZE));
+    cmd_printf("posted %" PRIu32 " failed %" PRIu32 " pending %" PRIu32 " max pending %" PRIu32 "\n", s.posted, s.failed, pending(s), s.max_pending);
+    cmd_printf("dispatched %" PRIu32 " latency us min %" PRIu32 " mean %" PRIu32 " max %" PRIu32 "\n", s.dispatched,
+        s.dispatched != 0 ? s.min_latency_us : 0, s.dispatched != 0 ? static_cast<uint32_t>(s.sum_latency_us / s.dispatched) : 0, s.max_latency_us);
+}
+
+}
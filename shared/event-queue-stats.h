@@ -0,0 +1,69 @@
+#pragma once
+
+#include <events/EventQueue.h>
+#include <hal/us_ticker_api.h>
+
+#include <chrono>
+#include <cstdint>
+
+// Both images build this, see "Shared Sources" in the README, so it can't include either main.h. Each main.cpp defines its own.
+extern events::EventQueue event_queue;
+
+// Instruments the one-off events posted to 'event_queue' with 'event_queue_stats::call' and 'call_in'
+// instead of 'event_queue.call' and 'call_in'. It counts the posts that failed because the queue was full, the most events
+// waiting at once and how long each waited between being posted and starting to run.
+// Periodic events, from 'call_every', aren't counted, they're allocated once and never wait to be posted.
+// The queue's size is "event-queue-size" in mbed_app.json. Safe to call from ISRs.
+namespace event_queue_stats
+{
+
+struct statistics {
+    uint32_t posted;  // Not including the failures
+    uint32_t failed;
+    uint32_t max_pending;
+    uint32_t dispatched;
+    uint32_t min_latency_us;
+    uint32_t max_latency_us;
+    uint64_t sum_latency_us;
+};
+
+// Used by 'call'. An event can start running before 'posted' is called so the number pending
+// is worked out from the totals rather than counted up and down.
+void posted(const bool succeeded);
+void dispatching(const uint32_t posted_us);
+
+// Returns the event's id, 0 if the queue was full, like 'event_queue.call'.
+template<typename F, typename... Args>
+int call(F f, Args... args) {
+    const auto posted_us = us_ticker_read();
+    const auto id = event_queue.call([=]() {
+        dispatching(posted_us);
+        f(args...);
+    });
+    posted(id != 0);
+    return id;
+}
+
+// The latency of a delayed event is measured from when it was due.
+template<typename F, typename... Args>
+int call_in(const std::chrono::milliseconds delay, F f, Args... args) {
+    const auto due_us = us_ticker_read() + static_cast<uint32_t>(delay.count()) * 1000;
+    const auto id = event_queue.call_in(delay, [=]() {
+        dispatching(due_us);
+        f(args...);
+    });
+    posted(id != 0);
+    return id;
+}
+
+inline uint32_t pending(const statistics &s) {
+    // After a reset events posted before it can still be dispatched.
+    return s.posted > s.dispatched ? s.posted - s.dispatched : 0;
+}
+
+statistics read();
+void reset();
+
+void print();
+
+}
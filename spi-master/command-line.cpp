@@ -1,12 +1,16 @@
 #include "command-line.h"
 
+#include "event-queue-stats.h"
 #include "main.h"
+#include "prbs.h"
 #include "serial-mutex.h"
 #include "version-string.h"
 
 #include <features/frameworks/mbed-client-cli/mbed-client-cli/ns_cmdline.h>
 #include <rtos/Thread.h>
 
+#include <cstring>
+
 namespace command_line
 {
 
@@ -18,12 +22,12 @@ MBED_ALIGN(8) unsigned char stack[stack_size];
 rtos::Thread thread(osPriorityNormal, sizeof(stack), stack, "command-line");
 
 int changing_data_callback(int argc, char *argv[]) {
-    event_queue.call(changing_data);
+    event_queue_stats::call(changing_data);
     return CMDLINE_RETCODE_SUCCESS;
 }
 
 int constant_data_callback(int argc, char *argv[]) {
-    event_queue.call(constant_data);
+    event_queue_stats::call(constant_data);
     return CMDLINE_RETCODE_SUCCESS;
 }
 
@@ -31,7 +35,7 @@ int dma_size_callback(int argc, char *argv[]) {
     if (argc > 1) {
         const auto size = strtoul(argv[1], nullptr, 0);
         if (size <= 256) {
-            event_queue.call(set_dma_size, size);
+            event_queue_stats::call(set_dma_size, size);
             return CMDLINE_RETCODE_SUCCESS;
         } else {
             return CMDLINE_RETCODE_INVALID_PARAMETERS;
@@ -42,6 +46,61 @@ int dma_size_callback(int argc, char *argv[]) {
     return CMDLINE_RETCODE_SUCCESS;
 }
 
+int prescaler_callback(int argc, char *argv[]) {
+    if (argc > 1) {
+        const auto divisor = strtoul(argv[1], nullptr, 0);
+        if (is_valid_prescaler(divisor)) {
+            event_queue_stats::call(set_prescaler, divisor);
+            return CMDLINE_RETCODE_SUCCESS;
+        } else {
+            return CMDLINE_RETCODE_INVALID_PARAMETERS;
+        }
+    } else {
+        event_queue_stats::call(print_prescaler);
+        return CMDLINE_RETCODE_SUCCESS;
+    }
+}
+
+int prbs_callback(int argc, char *argv[]) {
+    if (argc > 1) {
+        const auto degree = strtoul(argv[1], nullptr, 0);
+        if (prbs::find(degree) != nullptr) {
+            event_queue_stats::call(prbs_data, degree);
+            return CMDLINE_RETCODE_SUCCESS;
+        } else {
+            return CMDLINE_RETCODE_INVALID_PARAMETERS;
+        }
+    } else {
+        return CMDLINE_RETCODE_INVALID_PARAMETERS;
+    }
+}
+
+int refill_callback(int argc, char *argv[]) {
+    if (argc == 1) {
+        event_queue_stats::call(print_refill);
+        return CMDLINE_RETCODE_SUCCESS;
+    }
+
+    const auto isr = strcmp(argv[1], "isr") == 0;
+    if (!isr && strcmp(argv[1], "event-queue") != 0) {
+        return CMDLINE_RETCODE_INVALID_PARAMETERS;
+    }
+    const auto size = argc > 2 ? strtoul(argv[2], nullptr, 0) : 256;
+    if (!is_valid_refill_size(size)) {
+        return CMDLINE_RETCODE_INVALID_PARAMETERS;
+    }
+    event_queue_stats::call(set_refill, isr, size);
+    return CMDLINE_RETCODE_SUCCESS;
+}
+
+int underruns_callback(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+        event_queue_stats::call(reset_underruns);
+    }
+    event_queue_stats::call(print_refill);
+    return CMDLINE_RETCODE_SUCCESS;
+}
+
 int print_tx_buffer_callback(int argc, char *argv[]) {
     print_tx_buffers();
     return CMDLINE_RETCODE_SUCCESS;
@@ -50,7 +109,7 @@ int print_tx_buffer_callback(int argc, char *argv[]) {
 int run_dma_for_callback(int argc, char *argv[]) {
     if (argc > 1) {
         const auto number_of_buffers = strtoul(argv[1], nullptr, 0);
-        event_queue.call(run_dma_for, number_of_buffers);
+        event_queue_stats::call(run_dma_for, number_of_buffers);
         return CMDLINE_RETCODE_SUCCESS;
     } else {
         return CMDLINE_RETCODE_INVALID_PARAMETERS;
@@ -59,10 +118,25 @@ int run_dma_for_callback(int argc, char *argv[]) {
 }
 
 int toggle_dma_callback(int argc, char *argv[]) {
-    event_queue.call(toggle_dma);
+    event_queue_stats::call(toggle_dma);
     return CMDLINE_RETCODE_SUCCESS;
 }
 
+// Printed directly rather than from the event queue so it still works when the queue is stuck.
+int event_queue_callback(int argc, char *argv[]) {
+    if (argc > 1) {
+        if (strcmp(argv[1], "reset") == 0) {
+            event_queue_stats::reset();
+            return CMDLINE_RETCODE_SUCCESS;
+        } else {
+            return CMDLINE_RETCODE_INVALID_PARAMETERS;
+        }
+    } else {
+        event_queue_stats::print();
+        return CMDLINE_RETCODE_SUCCESS;
+    }
+}
+
 int version_information(int argc, char *argv[]) {
     cmd_printf("%s\n", version_string);
     cmd_printf("%s\n", mbed_os_version_string);
@@ -88,12 +162,17 @@ void init() {
     cmd_add("changing-data", changing_data_callback, "Transmit Changing Data", nullptr);
     cmd_add("constant-data", constant_data_callback, "Transmit Constant Data", nullptr);
     cmd_add("dma-size", dma_size_callback, "Set DMA size", "Set the size of the SPI DMA transfers\ndma-size <size>");
+    cmd_add("prescaler", prescaler_callback, "Print or set SPI prescaler", "Print or set the SPI baud rate prescaler, SCLK is 108 MHz / prescaler\nprescaler [2|4|8|16|32|64|128|256]");
+    cmd_add("prbs", prbs_callback, "Transmit PRBS", "Transmit a pseudo-random binary sequence, usb-host can check it for bit errors\nprbs <7|15|23|31>");
+    cmd_add("refill", refill_callback, "Print or set where the buffers are refilled", "Print or set where the changing data and PRBS buffers are refilled, isr means in the DMA callbacks\nrefill [isr [<size>]|event-queue]");
+    cmd_add("underruns", underruns_callback, "Print or reset refill underruns", "Print or reset the number of buffers transmitted before they were refilled\nunderruns [reset]");
     cmd_add("print-tx-buffer", print_tx_buffer_callback, "Print tx buffer contents", nullptr);
     cmd_alias_add("pt", "print-tx-buffer");
     cmd_add("run-dma-for", run_dma_for_callback, "Run DMA for specified number of buffers", "Run DMA for specified number of buffer, this makes it easier to check the buffer contents\nrun-dma-for <num buffers>");
     cmd_alias_add("rf", "run-dma-for");
     cmd_add("toggle-dma", toggle_dma_callback, "toggle DMA running", nullptr);
     cmd_alias_add("td", "toggle-dma");
+    cmd_add("event-queue", event_queue_callback, "Print or reset event queue statistics", "Print or reset the failed posts, most pending events and post to run latency of the event queue, in event-queue refill mode the latency has to be less than a buffer's transmit time\nevent-queue [reset]");
     cmd_add("version", version_information, "version information", nullptr);
     cmd_alias_add("ver", "version");
 
@@ -1,6 +1,8 @@
 #include "main.h"
 
 #include "command-line.h"
+#include "event-queue-stats.h"
+#include "prbs.h"
 #include "show-running.h"
 #include "trace.h"
 #include "version-string.h"
@@ -14,12 +16,13 @@
 #include <targets/TARGET_STM/TARGET_STM32F7/STM32Cube_FW/STM32F7xx_HAL_Driver/stm32f7xx_ll_system.h>
 
 #include <atomic>
+#include <cinttypes>
 #include <cstdio>
 
 #define TRACE_GROUP "main"
 
-MBED_ALIGN(4) unsigned char event_queue_buffer[EVENTS_QUEUE_SIZE];
-events::EventQueue event_queue(EVENTS_QUEUE_SIZE, &event_queue_buffer[0]);
+MBED_ALIGN(4) unsigned char event_queue_buffer[MBED_CONF_APP_EVENT_QUEUE_SIZE];
+events::EventQueue event_queue(MBED_CONF_APP_EVENT_QUEUE_SIZE, &event_queue_buffer[0]);
 
 namespace
 {
@@ -37,6 +40,7 @@ SPI_HandleTypeDef hspi = {
         .NSS = SPI_NSS_HARD_OUTPUT,
         // SPI1 uses APB2 clock. From system_clock.c "APB2CLK (MHz) | 108".
         // Hence SCLK = 108/16 = 6.75 MHz. I confirmed this using the scope.
+        // Can be changed at runtime, see 'set_prescaler'.
         .BaudRatePrescaler = SPI_BAUDRATEPRESCALER_16,
         .FirstBit = SPI_FIRSTBIT_MSB,
         .TIMode = SPI_TIMODE_DISABLE,
@@ -110,6 +114,23 @@ DMA_HandleTypeDef hdma = {
     .StreamIndex = 0
 };
 
+const uint32_t apb2_clock_hz = 108000000;
+
+struct prescaler_setting {
+    unsigned divisor;
+    uint32_t baud_rate_prescaler;
+};
+const prescaler_setting prescaler_settings[] = {
+    { 2, SPI_BAUDRATEPRESCALER_2 },
+    { 4, SPI_BAUDRATEPRESCALER_4 },
+    { 8, SPI_BAUDRATEPRESCALER_8 },
+    { 16, SPI_BAUDRATEPRESCALER_16 },
+    { 32, SPI_BAUDRATEPRESCALER_32 },
+    { 64, SPI_BAUDRATEPRESCALER_64 },
+    { 128, SPI_BAUDRATEPRESCALER_128 },
+    { 256, SPI_BAUDRATEPRESCALER_256 }
+};
+
 const size_t tx_buffer_size = 256;
 uint8_t m0_tx_buffer[tx_buffer_size];
 uint8_t m1_tx_buffer[tx_buffer_size];
@@ -119,8 +140,15 @@ bool dma_running = false;
 std::atomic_bool run_dma_for_enabled{false};
 std::atomic_ulong dma_buffer_count{0};
 std::atomic_ulong run_dma_for_number_of_buffers{0};
-bool changing_data_enabled{false};
+// What is transmitted, in the counter and PRBS modes the buffers are refilled as they are transmitted.
+enum class data_mode {
+    constant,  // "spi " repeated
+    counter,  // 32-bit words counting up
+    prbs  // See prbs.h, usb-host can count the bit errors
+};
+data_mode tx_data_mode{data_mode::constant};
 uint32_t changing_data_next_value{0};
+prbs::generator prbs_generator{prbs::prbs31};
 
 enum class buffer_to_fill {
     m0,
@@ -128,6 +156,18 @@ enum class buffer_to_fill {
 };
 buffer_to_fill changing_data_next_buffer = buffer_to_fill::m0;
 
+// Where the buffers are refilled in the counter and PRBS modes.
+// On the event queue the refill can be delayed by anything else on the queue, and the command line
+// thread, so the buffers have to be big enough to cover that. In the DMA callbacks the refill only has
+// to beat the DMA transmitting the other buffer, e.g. 64 words at SCLK 54 MHz is 4.7 us.
+enum class refill_mode {
+    event_queue,
+    isr
+};
+refill_mode tx_refill_mode{refill_mode::isr};
+uint16_t isr_refill_size = tx_buffer_size;  // Must be a whole number of words
+std::atomic_ulong underruns{0};
+
 void tx_buffer_init() {
     uint8_t init_bytes[4] = { 's', 'p', 'i', ' ' };  // length must be power of 2
     size_t init_bytes_index = 0;
@@ -190,52 +230,135 @@ void spi_tx_init() {
     dma_init();
 }
 
+// In double-buffer mode CT says which buffer the DMA is transmitting.
+buffer_to_fill dma_buffer() {
+    return (hdma.Instance->CR & DMA_SxCR_CT) == 0 ? buffer_to_fill::m0 : buffer_to_fill::m1;
+}
+
+// Only 'dma_size' bytes are transmitted so only they are filled, that keeps the sequence continuous.
+void fill_buffer(const buffer_to_fill buffer) {
+    uint8_t *const tx_buffer = buffer == buffer_to_fill::m0 ? m0_tx_buffer : m1_tx_buffer;
+
+    if (tx_data_mode == data_mode::prbs) {
+        prbs_generator.fill(tx_buffer, dma_size);
+    } else {
+        uint32_t *word_ptr = reinterpret_cast<uint32_t*>(tx_buffer);
+
+        for (auto i = 0u; i < dma_size / sizeof(uint32_t); ++i) {
+            *word_ptr = changing_data_next_value;
+            ++changing_data_next_value;  // Deliberate wrap
+            ++word_ptr;
+        }
+    }
+
+    // If the DMA is now transmitting the buffer it either started before the refill finished or it has
+    // already been round both buffers, either way some of what went out was stale.
+    // The buffers are filled before starting the DMA so CT only means something whilst it's running.
+    if (dma_running && dma_buffer() == buffer) {
+        ++underruns;
+    }
+}
+
 void changing_data_fill_next_buffer() {
-    uint8_t *tx_buffer =
-        changing_data_next_buffer == buffer_to_fill::m0 ? m0_tx_buffer : m1_tx_buffer;
+    const auto buffer = changing_data_next_buffer;
     changing_data_next_buffer = changing_data_next_buffer == buffer_to_fill::m0 ? buffer_to_fill::m1 : buffer_to_fill::m0;
 
-    uint32_t *word_ptr = reinterpret_cast<uint32_t*>(tx_buffer);
+    fill_buffer(buffer);
+}
 
-    for (auto i = 0u; i < tx_buffer_size / sizeof(uint32_t); ++i) {
-        *word_ptr = changing_data_next_value;
-        ++changing_data_next_value;  // Deliberate wrap
-        ++word_ptr;
+// Called from the DMA callbacks when 'buffer' has been transmitted.
+void buffer_transmitted(const buffer_to_fill buffer) {
+    if (tx_data_mode == data_mode::constant) {
+        return;
+    }
+
+    if (tx_refill_mode == refill_mode::isr) {
+        fill_buffer(buffer);
+    } else {
+        event_queue_stats::call(changing_data_fill_next_buffer);
     }
 }
 
+// Both buffers are filled before starting so the refills keep the sequence continuous.
+// The caller stops the SPI transmitting first, before changing anything the DMA callbacks use to refill.
+void start_changing_data(const data_mode mode) {
+    // Transmit large buffer so that there is time to refill, unless refilling in the DMA callbacks.
+    dma_size = tx_refill_mode == refill_mode::isr ? isr_refill_size : tx_buffer_size;
+
+    tx_data_mode = mode;
+    changing_data_next_buffer = buffer_to_fill::m0;
+    changing_data_fill_next_buffer();
+    changing_data_fill_next_buffer();
+
+    start_spi_transmitting();
+}
+
 }
 
 void changing_data() {
-    if (changing_data_enabled) {
+    if (tx_data_mode == data_mode::counter) {
         return;
     }
 
     stop_spi_transmitting();
-
     changing_data_next_value = 0;
-    changing_data_fill_next_buffer();
-    changing_data_fill_next_buffer();
+    start_changing_data(data_mode::counter);
+}
 
-    changing_data_enabled = true;
-    dma_size = tx_buffer_size;  // Transmit large buffer so that there is time to refill
+void prbs_data(const unsigned degree) {
+    const auto polynomial = prbs::find(degree);
+    MBED_ASSERT(polynomial != nullptr);
 
-    start_spi_transmitting();
+    stop_spi_transmitting();
+    prbs_generator = prbs::generator(*polynomial);
+    start_changing_data(data_mode::prbs);
+    cmd_printf("%s\n", polynomial->name);
 }
 
 void constant_data() {
-    if (!changing_data_enabled) {
+    if (tx_data_mode == data_mode::constant) {
         return;
     }
 
-    tx_buffer_init();
     stop_spi_transmitting();
 
-    changing_data_enabled = false;
+    // Stopped first so the DMA isn't reading the buffers whilst they are reinitialised.
+    tx_data_mode = data_mode::constant;
+    tx_buffer_init();
 
     start_spi_transmitting();
 }
 
+void set_refill(const bool isr, const uint16_t size) {
+    MBED_ASSERT(is_valid_refill_size(size));
+
+    // Stopped first so a DMA callback can't refill in the new mode, or with the new size, whilst the
+    // DMA is still transmitting the old size. Restarting makes the new size and mode take effect.
+    const auto restart = tx_data_mode != data_mode::constant;
+    if (restart) {
+        stop_spi_transmitting();
+    }
+    tx_refill_mode = isr ? refill_mode::isr : refill_mode::event_queue;
+    isr_refill_size = size;
+    if (restart) {
+        start_changing_data(tx_data_mode);
+    }
+    print_refill();
+}
+
+bool is_valid_refill_size(const uint16_t size) {
+    return size >= sizeof(uint32_t) && size <= tx_buffer_size && size % sizeof(uint32_t) == 0;
+}
+
+void print_refill() {
+    cmd_printf("refill %s size %u underruns %lu\n",
+        tx_refill_mode == refill_mode::isr ? "isr" : "event-queue", static_cast<unsigned>(dma_size), underruns.load());
+}
+
+void reset_underruns() {
+    underruns = 0;
+}
+
 void print_tx_buffers() {
     cmd_printf("m0_tx_buffer\n");
     print_tx_buffer(&m0_tx_buffer[0]);
@@ -262,6 +385,47 @@ void set_dma_size(const uint16_t size) {
     dma_size = size;
 }
 
+bool is_valid_prescaler(const unsigned divisor) {
+    for (const auto &setting: prescaler_settings) {
+        if (setting.divisor == divisor) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// From the reference manual, BR[2:0] must not be changed when communication is ongoing,
+// so the DMA is stopped, the SPI reinitialised and the DMA restarted if it was running.
+// 'HAL_SPI_Init' disables the SPI before writing CR1 and doesn't repeat 'HAL_SPI_MspInit'
+// because the state isn't HAL_SPI_STATE_RESET.
+void set_prescaler(const unsigned divisor) {
+    for (const auto &setting: prescaler_settings) {
+        if (setting.divisor == divisor) {
+            const auto was_running = dma_running;
+            if (was_running) {
+                stop_spi_transmitting();
+            }
+
+            hspi.Init.BaudRatePrescaler = setting.baud_rate_prescaler;
+            spi_init();
+
+            if (was_running) {
+                start_spi_transmitting();
+            }
+            break;
+        }
+    }
+    print_prescaler();
+}
+
+void print_prescaler() {
+    for (const auto &setting: prescaler_settings) {
+        if (setting.baud_rate_prescaler == hspi.Init.BaudRatePrescaler) {
+            cmd_printf("prescaler %u SCLK %" PRIu32 " Hz\n", setting.divisor, apb2_clock_hz / setting.divisor);
+        }
+    }
+}
+
 void toggle_dma() {
     if (!dma_running) {
         start_spi_transmitting();
@@ -307,10 +471,9 @@ extern "C" void HAL_SPI_MspInit(SPI_HandleTypeDef *) {
     LL_GPIO_SetPinPull(GPIOA, LL_GPIO_PIN_7, LL_GPIO_PULL_NO);
 }
 
+// The HAL calls this when the DMA has switched to memory 1, i.e. memory 0 has been transmitted.
 extern "C" void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi) {
-    if (changing_data_enabled) {
-        event_queue.call(changing_data_fill_next_buffer);
-    }
+    buffer_transmitted(buffer_to_fill::m0);
 
     if (!run_dma_for_enabled) {
         return;
@@ -323,14 +486,12 @@ extern "C" void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi) {
         // before the DMA stops. I'm expecting to make 'tx_buffer' which will change things.
         HAL_SPI_DMAStop(hspi);
         run_dma_for_enabled = false;
-        event_queue.call(toggle_dma);  // Will call 'HAL_SPI_DMAStop' again but doesn't seem to matter.
+        event_queue_stats::call(toggle_dma);  // Will call 'HAL_SPI_DMAStop' again but doesn't seem to matter.
     }
 }
 
 extern "C" void HAL_SPI_M1TxCpltCallback(SPI_HandleTypeDef *hspi) {
-    if (changing_data_enabled) {
-        event_queue.call(changing_data_fill_next_buffer);
-    }
+    buffer_transmitted(buffer_to_fill::m1);
 
     if (!run_dma_for_enabled) {
         return;
@@ -343,7 +504,7 @@ extern "C" void HAL_SPI_M1TxCpltCallback(SPI_HandleTypeDef *hspi) {
         // before the DMA stops. I'm expecting to make 'tx_buffer' which will change things.
         HAL_SPI_DMAStop(hspi);
         run_dma_for_enabled = false;
-        event_queue.call(stop_spi_transmitting);  // Will call 'HAL_SPI_DMAStop' again but doesn't seem to matter.
+        event_queue_stats::call(stop_spi_transmitting);  // Will call 'HAL_SPI_DMAStop' again but doesn't seem to matter.
     }
 }
 
@@ -4,9 +4,22 @@
 
 void changing_data();
 void constant_data();
+// 'degree' must be one of 'prbs::polynomials'.
+void prbs_data(const unsigned degree);
+// Where the counter and PRBS modes refill the buffers, 'isr' means in the DMA callbacks.
+// 'size' is the DMA size when refilling in the callbacks, a multiple of 4 up to 256.
+void set_refill(const bool isr, const uint16_t size);
+bool is_valid_refill_size(const uint16_t size);
+// Also prints the number of times the DMA transmitted a buffer before it was refilled.
+void print_refill();
+void reset_underruns();
 void print_tx_buffers();
 void run_dma_for(const unsigned long number_of_buffers);
 void set_dma_size(const uint16_t size);
+// 'divisor' is the SPI baud rate prescaler, a power of 2 from 2 to 256, SCLK is 108 MHz / 'divisor'.
+bool is_valid_prescaler(const unsigned divisor);
+void set_prescaler(const unsigned divisor);
+void print_prescaler();
 void toggle_dma();
 
 extern events::EventQueue event_queue;
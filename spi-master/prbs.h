@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Pseudo-random binary sequences, from ITU-T O.150, for finding bit errors on the SPI link.
+// spi-master fills its transmit buffers with the generator and usb-host checks what the device
+// received.
+//
+// The sequence is transmitted MSB first, the same as the SPI, so a receiver that starts at any bit
+// sees the same sequence from a different point. That's what lets the checker synchronise to a
+// stream received with an unknown bit offset.
+namespace prbs
+{
+
+// The polynomial x^degree + x^tap + 1, i.e. each bit is the XOR of the bits 'degree' and 'tap' before it.
+struct polynomial {
+    const char *name;
+    unsigned degree;
+    unsigned tap;
+};
+
+const polynomial prbs7 = { "prbs7", 7, 6 };
+const polynomial prbs15 = { "prbs15", 15, 14 };
+const polynomial prbs23 = { "prbs23", 23, 18 };
+const polynomial prbs31 = { "prbs31", 31, 28 };
+
+const polynomial polynomials[] = { prbs7, prbs15, prbs23, prbs31 };
+
+// Returns nullptr if 'degree' isn't one of 'polynomials'.
+inline const polynomial *find(const unsigned degree) {
+    for (const auto &p: polynomials) {
+        if (p.degree == degree) {
+            return &p;
+        }
+    }
+    return nullptr;
+}
+
+// Generates 32 bits at a time. Squaring a polynomial over GF(2) doubles its exponents, so the sequence
+// also obeys x^(degree * 2^k) + x^(tap * 2^k) + 1. Once the tap is at least 32 bits back, a whole word
+// only depends on bits already generated and can be computed with 2 shifts and an XOR.
+// The history is at most 64 bits so it fits in a uint64_t.
+class generator {
+public:
+    static const unsigned word_bits = 32;
+
+    explicit generator(const polynomial &p) : base(p), degree(p.degree), tap(p.tap) {
+        while (tap < word_bits) {
+            degree *= 2;
+            tap *= 2;
+        }
+        mask = degree == 64 ? UINT64_MAX : (uint64_t{1} << degree) - 1;
+        seed();
+    }
+
+    // Starts again from the all ones state, the same as every other generator of the polynomial.
+    // The history must be part of the sequence, which isn't true of every history that obeys the
+    // squared polynomial, so it's generated a bit at a time from the original polynomial.
+    void seed() {
+        history = (uint64_t{1} << base.degree) - 1;
+        for (auto bits = base.degree; bits < degree; ++bits) {
+            const auto bit = ((history >> (base.degree - 1)) ^ (history >> (base.tap - 1))) & 1;
+            history = history << 1 | bit;
+        }
+    }
+
+    // Continues the sequence from the words given, oldest first, e.g. to synchronise to a received stream.
+    // 'history_words' must hold 'words_to_seed()' words.
+    void seed(const uint32_t *const history_words) {
+        history = 0;
+        for (auto i = 0u; i < words_to_seed(); ++i) {
+            history = history << word_bits | history_words[i];
+        }
+        history &= mask;
+    }
+
+    // The number of words needed to continue the sequence, see 'seed'.
+    unsigned words_to_seed() const {
+        return (degree + word_bits - 1) / word_bits;
+    }
+
+    // The oldest bit is the MSB.
+    uint32_t next_word() {
+        const uint32_t word = static_cast<uint32_t>((history >> (degree - word_bits)) ^ (history >> (tap - word_bits)));
+        history = (history << word_bits | word) & mask;
+        return word;
+    }
+
+    // Big endian so the bytes go out in the order the bits were generated. 'length' must be a multiple of 4.
+    void fill(uint8_t *const buffer, const size_t length) {
+        for (auto i = 0u; i < length; i += sizeof(uint32_t)) {
+            const uint32_t word = to_big_endian(next_word());
+            memcpy(buffer + i, &word, sizeof(word));
+        }
+    }
+
+    static uint32_t to_big_endian(const uint32_t word) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        return __builtin_bswap32(word);
+#else
+        return word;
+#endif
+    }
+
+private:
+    polynomial base;
+    unsigned degree;
+    unsigned tap;
+    uint64_t mask;
+    uint64_t history;
+};
+
+}
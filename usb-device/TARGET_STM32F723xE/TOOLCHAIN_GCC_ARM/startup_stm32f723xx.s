@@ -89,12 +89,36 @@ LoopFillZerobss:
   cmp  r2, r3
   bcc  FillZerobss
 
+/* Copy the ITCM code and the DTCM data from flash, see STM32F723xE.ld. Both are
+   multiples of 8 bytes long. */
+  ldr  r0, =__itcm_text_start__
+  ldr  r1, =__itcm_text_end__
+  ldr  r2, =__itcm_text_load__
+  bl   CopyTcm
+  ldr  r0, =__dtcm_data_start__
+  ldr  r1, =__dtcm_data_end__
+  ldr  r2, =__dtcm_data_load__
+  bl   CopyTcm
+
 /* Call the clock system initialization function.*/
   bl  SystemInit   
   bl _start
   bx  lr    
 .size  Reset_Handler, .-Reset_Handler
 
+/* Copies words from r2 to r0 until r0 reaches r1, uses r3. There's no stack needed. */
+  .section  .text.CopyTcm
+  .type  CopyTcm, %function
+CopyTcm:
+  cmp  r0, r1
+  bcs  CopyTcmDone
+  ldr  r3, [r2], #4
+  str  r3, [r0], #4
+  b  CopyTcm
+CopyTcmDone:
+  bx  lr
+.size  CopyTcm, .-CopyTcm
+
 /**
  * @brief  This is the code that gets called when the processor receives an 
  *         unexpected interrupt.  This simply enters an infinite loop, preserving
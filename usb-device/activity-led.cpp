@@ -0,0 +1,82 @@
+#include "activity-led.h"
+
+#include "main.h"
+#include "parameters.h"
+#include "spi-rx.h"
+
+#include <platform/mbed_assert.h>
+#include <targets/TARGET_STM/TARGET_STM32F7/STM32Cube_FW/STM32F7xx_HAL_Driver/stm32f7xx_hal.h>
+#include <targets/TARGET_STM/TARGET_STM32F7/STM32Cube_FW/STM32F7xx_HAL_Driver/stm32f7xx_ll_gpio.h>
+
+#include <chrono>
+
+namespace activity_led
+{
+
+namespace
+{
+
+using std::chrono_literals::operator""ms;
+
+// The fast blink rate, the slow blink and the overflow hold are multiples of it.
+const auto tick = 50ms;
+const uint32_t slow_blink_ticks = 10;
+const uint32_t overflow_hold_ticks = 20;
+
+uint32_t ticks = 0;
+uint32_t previous_buffers_filled = 0;
+uint16_t previous_overflows = 0;
+uint32_t overflow_ticks_remaining = 0;
+
+// PA7, SYS_LD_USER1, red
+void led_init() {
+    __HAL_RCC_GPIOA_CLK_ENABLE();
+
+    LL_GPIO_SetPinMode(GPIOA, LL_GPIO_PIN_7, LL_GPIO_MODE_OUTPUT);
+    LL_GPIO_SetPinSpeed(GPIOA, LL_GPIO_PIN_7, LL_GPIO_SPEED_FREQ_LOW);
+    LL_GPIO_SetPinOutputType(GPIOA, LL_GPIO_PIN_7, LL_GPIO_OUTPUT_PUSHPULL);
+    LL_GPIO_SetPinPull(GPIOA, LL_GPIO_PIN_7, LL_GPIO_PULL_NO);
+    LL_GPIO_ResetOutputPin(GPIOA, LL_GPIO_PIN_7);
+}
+
+// Called every 'tick' by the event queue.
+void update() {
+    ++ticks;
+
+    // The overflow count is a parameter so the host can clear it, any change means something happened.
+    const auto overflows = parameters::get(parameters::id::spi_overflows);
+    if (overflows != previous_overflows) {
+        previous_overflows = overflows;
+        overflow_ticks_remaining = overflow_hold_ticks;
+    }
+    if (overflow_ticks_remaining > 0) {
+        --overflow_ticks_remaining;
+        LL_GPIO_TogglePin(GPIOA, LL_GPIO_PIN_7);
+        return;
+    }
+
+    if (ticks % slow_blink_ticks != 0) {
+        return;
+    }
+    const auto buffers_filled = spi_rx::buffers_filled();
+    if (buffers_filled != previous_buffers_filled) {
+        previous_buffers_filled = buffers_filled;
+        LL_GPIO_TogglePin(GPIOA, LL_GPIO_PIN_7);
+    } else {
+        LL_GPIO_ResetOutputPin(GPIOA, LL_GPIO_PIN_7);
+    }
+}
+
+}
+
+void init() {
+    led_init();
+
+    previous_buffers_filled = spi_rx::buffers_filled();
+    previous_overflows = parameters::get(parameters::id::spi_overflows);
+
+    MBED_UNUSED const auto id = event_queue.call_every(tick, update);
+    MBED_ASSERT(id != 0);
+}
+
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+// The red LED shows the health of the SPI stream at a glance:
+//     off, nothing is being received
+//     slow blink, toggling every 500 ms, data is being received
+//     fast blink, toggling every 50 ms, buffers have overflowed in the last second so data has been lost
+// The LED is driven from the event queue by sampling counters the DMA ISR already keeps,
+// so it costs the ISR nothing, see 'spi_rx::buffers_filled' and 'parameters::id::spi_overflows'.
+namespace activity_led
+{
+
+// After 'spi_rx::init'.
+void init();
+
+}
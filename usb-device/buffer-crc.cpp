@@ -0,0 +1,154 @@
+#include "buffer-crc.h"
+
+#include "buffers.h"
+#include "irq-priorities.h"
+#include "parameters.h"
+#include "profiler.h"
+#include "receive-pool.h"
+#include "tcm.h"
+
+#include <platform/mbed_assert.h>
+#include <targets/TARGET_STM/TARGET_STM32F7/STM32Cube_FW/STM32F7xx_HAL_Driver/stm32f7xx_hal.h>
+
+#include <array>
+
+namespace buffer_crc
+{
+
+namespace
+{
+
+// The CRC unit does the polynomial division MSB first a word at a time. Reversing the bits of each
+// input word and of the result gives the reflected CRC of the bytes in memory order, i.e. the common CRC-32,
+// apart from the final XOR which is done in software.
+DTCM_DATA CRC_HandleTypeDef hcrc = {
+    .Instance = CRC,
+    .Init = {
+        .DefaultPolynomialUse = DEFAULT_POLYNOMIAL_ENABLE,
+        .DefaultInitValueUse = DEFAULT_INIT_VALUE_ENABLE,
+        .GeneratingPolynomial = 0,
+        .CRCLength = CRC_POLYLENGTH_32B,
+        .InitValue = 0,
+        .InputDataInversionMode = CRC_INPUTDATA_INVERSION_WORD,
+        .OutputDataInversionMode = CRC_OUTPUTDATA_INVERSION_ENABLE
+    },
+    .Lock = HAL_UNLOCKED,
+    .State = HAL_CRC_STATE_RESET,
+    .InputDataFormat = CRC_INPUTDATA_FORMAT_WORDS
+};
+
+// Only DMA2 can do memory to memory transfers. The 'peripheral' side is the source, the buffer,
+// and the 'memory' side is the destination, the CRC data register, which doesn't increment.
+DTCM_DATA DMA_HandleTypeDef hdma = {
+    .Instance = DMA2_Stream0,
+    .Init = {
+        .Channel = DMA_CHANNEL_0,
+        .Direction = DMA_MEMORY_TO_MEMORY,
+        .PeriphInc = DMA_PINC_ENABLE,
+        .MemInc = DMA_MINC_DISABLE,
+        .PeriphDataAlignment = DMA_PDATAALIGN_WORD,
+        .MemDataAlignment = DMA_MDATAALIGN_WORD,
+        .Mode = DMA_NORMAL,
+        .Priority = DMA_PRIORITY_LOW,
+        // From the reference manual, direct mode isn't allowed for memory to memory transfers.
+        .FIFOMode = DMA_FIFOMODE_ENABLE,
+        .FIFOThreshold = DMA_FIFO_THRESHOLD_FULL,
+        .MemBurst = DMA_MBURST_SINGLE,
+        .PeriphBurst = DMA_PBURST_SINGLE
+    },
+    .Lock = HAL_UNLOCKED,
+    .State = HAL_DMA_STATE_RESET,
+    .Parent = nullptr,
+    .XferCpltCallback = nullptr,
+    .XferHalfCpltCallback = nullptr,
+    .XferM1CpltCallback = nullptr,
+    .XferM1HalfCpltCallback = nullptr,
+    .XferErrorCallback = nullptr,
+    .XferAbortCallback = nullptr,
+    .ErrorCode = HAL_DMA_ERROR_NONE,
+    .StreamBaseAddress = 0,
+    .StreamIndex = 0
+};
+
+static_assert(buffers::size_of % sizeof(uint32_t) == 0, "The CRC is fed a word at a time");
+
+// Buffers waiting for the CRC unit. The SPI DMA ISR adds to it and the CRC DMA ISR takes from it,
+// they have the same priority so they can't interrupt each other.
+DTCM_DATA receive_pool::handoff_queue<uint8_t*, buffers::number_of> pending;
+DTCM_DATA uint8_t *in_progress = nullptr;
+
+struct result {
+    bool valid;
+    uint32_t crc;
+};
+// Written before the buffer is passed on and read after it's been taken from the full buffer queue.
+DTCM_DATA std::array<result, buffers::number_of> results;
+
+void start_next() {
+    MBED_ASSERT(in_progress == nullptr);
+    if (pending.try_pop(in_progress)) {
+        __HAL_CRC_DR_RESET(&hcrc);
+        MBED_UNUSED const auto status = HAL_DMA_Start_IT(&hdma, reinterpret_cast<uint32_t>(in_progress), reinterpret_cast<uint32_t>(&hcrc.Instance->DR), buffers::size_of / sizeof(uint32_t));
+        MBED_ASSERT(status == HAL_OK);
+    }
+}
+
+void transfer_complete(DMA_HandleTypeDef *) {
+    MBED_ASSERT(in_progress != nullptr);
+
+    results[buffers::index_of(in_progress)] = { true, ~hcrc.Instance->DR };
+    buffers::set_buffer_full(in_progress);
+    in_progress = nullptr;
+
+    start_next();
+}
+
+void transfer_error(DMA_HandleTypeDef *) {
+    MBED_ASSERT(false);
+}
+
+}
+
+void submit(uint8_t *const buffer_ptr) {
+    if (parameters::get(parameters::id::crc) == 0) {
+        results[buffers::index_of(buffer_ptr)].valid = false;
+        buffers::set_buffer_full(buffer_ptr);
+        return;
+    }
+
+    // There are only 'buffers::number_of' buffers so there's always room.
+    MBED_UNUSED const auto pushed = pending.try_push(buffer_ptr);
+    MBED_ASSERT(pushed);
+    if (in_progress == nullptr) {
+        start_next();
+    }
+}
+
+bool get(const uint8_t *const buffer_ptr, uint32_t &crc) {
+    const auto &r = results[buffers::index_of(buffer_ptr)];
+    crc = r.crc;
+    return r.valid;
+}
+
+void init() {
+    __HAL_RCC_CRC_CLK_ENABLE();
+    __HAL_RCC_DMA2_CLK_ENABLE();
+
+    MBED_UNUSED auto status = HAL_CRC_Init(&hcrc);
+    MBED_ASSERT(status == HAL_OK);
+
+    status = HAL_DMA_Init(&hdma);
+    MBED_ASSERT(status == HAL_OK);
+    hdma.XferCpltCallback = transfer_complete;
+    hdma.XferErrorCallback = transfer_error;
+
+    irq_priority::enable(DMA2_Stream0_IRQn, irq_priority::crc_dma);
+}
+
+// Override /weak/ implementation provided by startup_stm32f723xx.s.
+extern "C" ITCM_CODE void DMA2_Stream0_IRQHandler() {
+    profiler::scoped_probe probe(profiler::probe::crc_dma_isr);
+    HAL_DMA_IRQHandler(&hdma);
+}
+
+}
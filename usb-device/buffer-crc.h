@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cinttypes>
+
+// Works out the CRC of each full SPI buffer with the CRC unit, fed by DMA so the CPU isn't involved,
+// so the host can tell data corrupted on the USB from data corrupted on the SPI.
+// See 'usb_device::header_flag_crc32' for how the CRC gets to the host.
+namespace buffer_crc
+{
+
+// Called by the SPI from the ISR instead of 'buffers::set_buffer_full'. With the 'crc' parameter off the buffer
+// is passed straight on, otherwise it's passed on when its CRC is known.
+void submit(uint8_t *const buffer_ptr);
+
+// Returns false if the buffer was filled whilst the 'crc' parameter was off.
+bool get(const uint8_t *const buffer_ptr, uint32_t &crc);
+
+void init();
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+
+// What the SPI DMA ISR does when the DMA has filled one of its buffers and switched to the other.
+// The full buffer is handed on and the DMA given an empty buffer, or its overflow buffer if there
+// isn't one, before it finishes filling the buffer it's now writing. There's no thread involved.
+//
+// 'Hooks' provides:
+//     void full(uint8_t *buffer, uint16_t sequence), the buffer has been filled
+//     void overflowed(uint16_t sequence), the overflow buffer was filled so the data is lost
+//     uint8_t *get_empty(), returns nullptr if there isn't an empty buffer
+//     void no_empty(), the DMA is going to fill the overflow buffer
+//     void armed(uint8_t *buffer), the DMA is going to fill the buffer, never called for an overflow buffer
+namespace buffer_handoff
+{
+
+// Returns the buffer the DMA should fill, the overflow buffer if there isn't an empty one.
+template<typename Hooks>
+uint8_t *arm(Hooks &hooks, uint8_t *const overflow_buffer) {
+    uint8_t *const empty_buffer = hooks.get_empty();
+    if (empty_buffer == nullptr) {
+        return overflow_buffer;
+    }
+    hooks.armed(empty_buffer);
+    return empty_buffer;
+}
+
+// Returns the buffer to put in the memory address register that held 'full_buffer'.
+// Every buffer the DMA fills, including the overflow buffer, uses up a sequence number.
+template<typename Hooks>
+uint8_t *buffer_complete(Hooks &hooks, uint8_t *const full_buffer, uint8_t *const overflow_buffer, const uint16_t sequence) {
+    if (full_buffer != overflow_buffer) {
+        hooks.full(full_buffer, sequence);
+    } else {
+        hooks.overflowed(sequence);
+    }
+
+    uint8_t *const next_buffer = arm(hooks, overflow_buffer);
+    if (next_buffer == overflow_buffer) {
+        hooks.no_empty();
+    }
+    return next_buffer;
+}
+
+}
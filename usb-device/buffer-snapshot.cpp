@@ -0,0 +1,73 @@
+#include "buffer-snapshot.h"
+
+#include "spi-rx.h"
+
+#include <features/frameworks/mbed-client-cli/mbed-client-cli/ns_cmdline.h>
+#include <rtos/ThisThread.h>
+
+#include <chrono>
+#include <cinttypes>
+#include <cstring>
+
+namespace buffer_snapshot
+{
+
+namespace
+{
+
+using std::chrono_literals::operator""ms;
+
+// Whilst streaming the consumer takes a buffer every few hundred us.
+const auto poll_interval = 10ms;
+const auto max_polls = 10;
+
+// Only read by the CPU so it doesn't need to be a 'DMA_BUFFER'.
+slot<buffers::size_of> snapshot;
+
+}
+
+bool request() {
+    return snapshot.request();
+}
+
+void capture(const uint8_t *const buffer_ptr) {
+    // Nearly always false, the tag's only looked up when it's needed.
+    if (snapshot.is_requested()) {
+        snapshot.capture(buffer_ptr, spi_rx::get_tag(buffer_ptr));
+    }
+}
+
+size_t read(uint8_t *const data) {
+    header h;
+    const auto ready = snapshot.read(h, data + sizeof(header));
+    memcpy(data, &h, sizeof(h));
+    return sizeof(h) + (ready ? h.length : 0);
+}
+
+void print() {
+    if (!request()) {
+        cmd_printf("the previous snapshot is being read, try again\n");
+        return;
+    }
+
+    // Static because the command line thread has a normal sized stack.
+    static uint32_t words[buffers::size_of / sizeof(uint32_t)];
+    header h;
+    auto polls = 0;
+    while (!snapshot.read(h, reinterpret_cast<uint8_t*>(words))) {
+        if (++polls > max_polls) {
+            cmd_printf("no full buffer was taken, the host has to be reading unless streaming is 0\n");
+            return;
+        }
+        rtos::ThisThread::sleep_for(poll_interval);
+    }
+
+    cmd_printf("snapshot %" PRIu32 " channel %u sequence %u\n", h.number, h.tag.channel, h.tag.sequence);
+    for (auto i = 0u; i < buffers::size_of / sizeof(uint32_t); ++i) {
+        cmd_printf("0x%" PRIx32 " ", words[i]);
+
+        if (((i + 1) % 8) == 0) cmd_printf("\n");
+    }
+}
+
+}
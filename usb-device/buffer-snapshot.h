@@ -0,0 +1,29 @@
+#pragma once
+
+#include "buffers.h"
+#include "snapshot-slot.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// A copy of a full SPI buffer taken by the USB consumer on request, see snapshot-slot.h. It's read by
+// the "snapshot" command, the button's pattern check and the get_snapshot vendor request.
+namespace buffer_snapshot
+{
+
+// Any context, see 'slot::request'.
+bool request();
+
+// Called by the USB consumer with each full buffer it takes before it's released.
+void capture(const uint8_t *const buffer_ptr);
+
+const size_t max_response_length = sizeof(header) + buffers::size_of;
+
+// Any context. Writes the 'header' and, if it's ready, the snapshot, returns the length written.
+// 'data' must have room for 'max_response_length'.
+size_t read(uint8_t *const data);
+
+// The command line thread. Requests a snapshot, waits a little for it and prints it.
+void print();
+
+}
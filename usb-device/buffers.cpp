@@ -1,10 +1,19 @@
 #include "buffers.h"
 
+#include "dma-buffer.h"
+#include "parameters.h"
+#include "profiler.h"
+#include "tcm.h"
+
 #include <features/frameworks/mbed-client-cli/mbed-client-cli/ns_cmdline.h>
 #include <platform/mbed_assert.h>
 #include <rtos/Mail.h>
 #include <rtos/Kernel.h>
 
+#include <atomic>
+
+static_assert(parameters::max_watermark == buffers::number_of, "The watermarks are numbers of buffers");
+
 namespace buffers
 {
 
@@ -29,14 +38,21 @@ namespace
 //     When the USB layer is ready to transmit it attempts to get a full buffer.
 //     If there isn't a full buffer available it will block.
 
-uint8_t buffer[number_of][size_of] = { { 0 } };
+DMA_BUFFER uint8_t buffer[number_of][size_of];
+static_assert(dma_buffer::is_whole_cache_lines(size_of), "Each buffer must be whole cache lines so it can be maintained on its own");
 
 struct mail_t {
     uint8_t *buffer_ptr;
 };
 
-rtos::Mail<mail_t, number_of> empty_buffers_queue;
-rtos::Mail<mail_t, number_of> full_buffers_queue;
+// The queues and counts are used by every SPI DMA interrupt so they're in the DTCM, see tcm.h.
+DTCM_DATA rtos::Mail<mail_t, number_of> empty_buffers_queue;
+DTCM_DATA rtos::Mail<mail_t, number_of> full_buffers_queue;
+
+// The queues are only used to pass pointers around, these count the buffers in each queue so
+// they can be compared to the watermark parameters.
+DTCM_DATA std::atomic<size_t> number_of_empty{0};
+DTCM_DATA std::atomic<size_t> number_of_full{0};
 
 #ifndef NDEBUG
 // Perhaps this should be class to avoid this kind of nonsense.
@@ -47,52 +63,83 @@ bool initialised = false;
 
 uint8_t *get_empty_buffer() {
     MBED_ASSERT(initialised);
+    profiler::scoped_probe probe(profiler::probe::get_empty_buffer);
 
     uint8_t *buffer_ptr = nullptr;
     const auto mail = empty_buffers_queue.try_get();
     if (mail != nullptr) {
         buffer_ptr = mail->buffer_ptr;
         empty_buffers_queue.free(mail);
+
+        if (--number_of_empty <= parameters::get(parameters::id::empty_low_watermark)) {
+            parameters::increment(parameters::id::empty_low_watermark_hits);
+        }
     }
     return buffer_ptr;
 }
 
 void set_buffer_empty(uint8_t *const buffer_ptr) {
     MBED_ASSERT(initialised);
+    profiler::scoped_probe probe(profiler::probe::set_buffer_empty);
+
+    // A DMA engine is going to write the buffer next, any lines the CPU has dirtied mustn't be written back over it.
+    dma_buffer::invalidate(buffer_ptr, size_of);
 
     const auto mail = empty_buffers_queue.try_alloc();
     MBED_ASSERT(mail != nullptr);
     mail->buffer_ptr = buffer_ptr;
     empty_buffers_queue.put(mail);
+    ++number_of_empty;
 }
 
 uint8_t *get_full_buffer() {
     MBED_ASSERT(initialised);
 
     const auto mail = full_buffers_queue.try_get_for(rtos::Kernel::wait_for_u32_forever);
+    // Not interested in how long it waited, just the cost of handling the buffer.
+    profiler::scoped_probe probe(profiler::probe::get_full_buffer);
     const auto buffer_ptr = mail->buffer_ptr;
     full_buffers_queue.free(mail);
+    --number_of_full;
     return buffer_ptr;
 }
 
-uint8_t *peek_full_buffer() {
+// Doesn't block, returns nullptr if there isn't a full buffer available.
+uint8_t *try_get_full_buffer() {
     MBED_ASSERT(initialised);
 
     uint8_t *buffer_ptr = nullptr;
     const auto mail = full_buffers_queue.try_get();
     if (mail != nullptr) {
         buffer_ptr = mail->buffer_ptr;
+        full_buffers_queue.free(mail);
+        --number_of_full;
     }
     return buffer_ptr;
 }
 
 void set_buffer_full(uint8_t *const buffer_ptr) {
     MBED_ASSERT(initialised);
+    profiler::scoped_probe probe(profiler::probe::set_buffer_full);
+
+    // A DMA engine has written the buffer, the CPU mustn't read stale lines from before.
+    // The USB can transmit the buffer without the CPU looking at it, in which case this is wasted but cheap.
+    dma_buffer::invalidate(buffer_ptr, size_of);
 
     const auto mail = full_buffers_queue.try_alloc();
     MBED_ASSERT(mail != nullptr);
     mail->buffer_ptr = buffer_ptr;
     full_buffers_queue.put(mail);
+
+    if (++number_of_full >= parameters::get(parameters::id::full_high_watermark)) {
+        parameters::increment(parameters::id::full_high_watermark_hits);
+    }
+}
+
+size_t index_of(const uint8_t *const buffer_ptr) {
+    const auto index = (buffer_ptr - &buffer[0][0]) / size_of;
+    MBED_ASSERT(buffer_ptr >= &buffer[0][0] && index < number_of && buffer_ptr == &buffer[index][0]);
+    return index;
 }
 
 void print_buffer(const size_t index) {
@@ -8,16 +8,20 @@
 namespace buffers
 {
 
-const size_t number_of = 4;
+// The DMA ISRs hand the buffers over without a thread, the RAM that thread's stack took went on more buffers.
+// A power of 2 because of the queues in buffer-crc.cpp.
+const size_t number_of = 8;
 const size_t size_of = 512;
 
 uint8_t *get_empty_buffer();
 void set_buffer_empty(uint8_t *const buffer_ptr);
 uint8_t *get_full_buffer();
-MBED_DEPRECATED("Added only to check SPI rx data on the Disco, the buffer returned could be overwritten at any time.")
-uint8_t *peek_full_buffer();
+uint8_t *try_get_full_buffer();
 void set_buffer_full(uint8_t *const buffer_ptr);
+// The index of a buffer in the pool, for keeping information about the buffers.
+size_t index_of(const uint8_t *const buffer_ptr);
 
+// Races the DMA whilst the SPI master is running, see buffer-snapshot.h for a copy that doesn't.
 void print_buffer(const size_t index);
 
 void init();
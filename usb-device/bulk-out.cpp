@@ -0,0 +1,95 @@
+#include "bulk-out.h"
+
+#include "dma-buffer.h"
+#include "evk-usb-device-hal.h"
+#include "parameters.h"
+#include "receive-pool.h"
+
+#include <features/frameworks/mbed-client-cli/mbed-client-cli/ns_cmdline.h>
+#include <platform/mbed_assert.h>
+#include <rtos/ThisThread.h>
+#include <rtos/Thread.h>
+
+#include <atomic>
+
+namespace bulk_out
+{
+
+namespace
+{
+
+DMA_BUFFER receive_pool::pool<number_of, size_of> pool;
+static_assert(dma_buffer::is_whole_cache_lines(size_of), "The buffers must be whole cache lines so they can be invalidated");
+
+std::atomic<uint32_t> received_bytes{0};
+std::atomic<uint32_t> received_transfers{0};
+std::atomic<uint32_t> loopback_dropped{0};
+
+const size_t stack_size = OS_STACK_SIZE; // /Normal/ stack size
+MBED_ALIGN(8) unsigned char stack[stack_size];
+rtos::Thread thread(osPriorityNormal, sizeof(stack), stack, "bulk-out");
+
+const uint32_t received_flag = 1 << 0;
+
+void consume(const receive_pool::received &r) {
+    received_bytes += r.length;
+    ++received_transfers;
+
+    switch (static_cast<parameters::out_consumer_t>(parameters::get(parameters::id::out_consumer))) {
+        case parameters::out_consumer_t::discard:
+            break;
+        case parameters::out_consumer_t::loopback:
+            // Looped back data is received into SPI buffers and never gets here, see 'ep1_receive'.
+            // This buffer was armed before the mode changed.
+            ++loopback_dropped;
+            break;
+        case parameters::out_consumer_t::number_of:
+            MBED_ASSERT(false);
+    }
+}
+
+void consumer() {
+    while (1) {
+        MBED_UNUSED const auto flags = rtos::ThisThread::flags_wait_all(received_flag);
+        MBED_ASSERT(flags == received_flag);
+
+        receive_pool::received r;
+        while (pool.take(r)) {
+            consume(r);
+            if (pool.release(r.buffer)) {
+                evk_usb_device_hal::bulk_out_buffer_released();
+            }
+        }
+    }
+}
+
+}
+
+uint8_t *arm() {
+    return pool.arm();
+}
+
+void set_received(uint8_t *const buffer, const uint32_t length) {
+    // The OTG DMA has written the data to SRAM behind the D-cache's back.
+    dma_buffer::invalidate(buffer, size_of);
+
+    pool.set_received(buffer, length);
+
+    MBED_UNUSED const auto flags = thread.flags_set(received_flag);
+    MBED_ASSERT(!(flags & osFlagsError));
+}
+
+void print_statistics() {
+    cmd_printf("received bytes %" PRIu32 "\n", received_bytes.load());
+    cmd_printf("received transfers %" PRIu32 "\n", received_transfers.load());
+    cmd_printf("starved %" PRIu32 "\n", pool.get_starved_count());
+    cmd_printf("loopback dropped %" PRIu32 "\n", loopback_dropped.load());
+    cmd_printf("empty %u full %u\n", static_cast<unsigned>(pool.number_of_empty()), static_cast<unsigned>(pool.number_of_full()));
+}
+
+void init() {
+    MBED_UNUSED const auto os_status = thread.start(consumer);
+    MBED_ASSERT(os_status == osOK);
+}
+
+}
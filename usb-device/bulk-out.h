@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+
+// Data received on the bulk OUT endpoint is passed to a consumer thread in a pool of buffers.
+// The endpoint is re-armed as soon as it has received a buffer, if all the buffers are with
+// the consumer it's left NAKing until one is released.
+namespace bulk_out
+{
+
+const size_t number_of = 8;
+const size_t size_of = 512;
+
+// Called from the OTG ISR. 'arm' returns nullptr if there isn't a buffer available,
+// 'evk_usb_device_hal::bulk_out_buffer_released' is called when there is.
+uint8_t *arm();
+void set_received(uint8_t *const buffer, const uint32_t length);
+
+void print_statistics();
+
+void init();
+
+}
@@ -0,0 +1,56 @@
+#include "bus-load.h"
+
+#include "dma-buffer.h"
+#include "probe-statistics.h"
+#include "spi-rx.h"
+
+#include <features/frameworks/mbed-client-cli/mbed-client-cli/ns_cmdline.h>
+
+#include <cinttypes>
+
+namespace bus_load
+{
+
+namespace
+{
+
+// Bigger than a pass needs to be to see the effect but small enough that interrupts aren't disabled for long,
+// 4 KB is a few microseconds, well within the time the SPI takes to fill a buffer.
+const size_t probe_words = 1024;
+DMA_BUFFER uint32_t probe_buffer[probe_words];
+static_assert(dma_buffer::is_whole_cache_lines(sizeof(probe_buffer)), "The probe buffer is invalidated");
+
+// The sum is returned so the reads can't be optimised away.
+uint32_t read_probe_buffer() {
+    uint32_t sum = 0;
+    for (auto i = 0u; i < probe_words; ++i) {
+        sum += *static_cast<volatile uint32_t*>(&probe_buffer[i]);
+    }
+    return sum;
+}
+
+}
+
+void measure(const uint32_t passes) {
+    auto stats = profiler::probe_statistics_init;
+    uint32_t sum = 0;
+
+    for (auto pass = 0u; pass < passes; ++pass) {
+        const auto primask = __get_PRIMASK();
+        __disable_irq();
+        dma_buffer::invalidate(probe_buffer, sizeof(probe_buffer));
+        const auto start = DWT->CYCCNT;
+        sum += read_probe_buffer();
+        const auto cycles = DWT->CYCCNT - start;
+        __set_PRIMASK(primask);
+
+        profiler::accumulate(stats, cycles);
+    }
+
+    cmd_printf("spi dma mode %s\n", spi_rx::dma_mode_name());
+    cmd_printf("%" PRIu32 " passes of %u bytes (0x%" PRIx32 ")\n", stats.count, static_cast<unsigned>(sizeof(probe_buffer)), sum);
+    cmd_printf("cycles per pass min %" PRIu32 " mean %" PRIu32 " max %" PRIu32 " at %" PRIu32 " MHz\n",
+        stats.count != 0 ? stats.min : 0, profiler::mean(stats), stats.max, profiler::core_clock_mhz);
+}
+
+}
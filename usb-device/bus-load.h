@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+
+// Measures how much the DMA engines slow the CPU's own accesses to SRAM using the DWT cycle counter.
+// The CPU reads a buffer in SRAM1, where 'buffers' are, with the D-cache invalidated first so every line
+// is fetched through the bus matrix and competes with the SPI DMA writes. Comparing the cycles per pass
+// with 'spi-enabled' 0 and 1 gives the cost of the SPI DMA; comparing that cost between a build
+// with SPI_RX_DMA_FIFO_BURST defined and one without compares the two DMA modes, see spi-rx.cpp.
+// The USB should be idle, e.g. 'streaming' 0, otherwise the OTG DMA competes too.
+namespace bus_load
+{
+
+// Runs 'passes' passes with interrupts disabled for each pass and prints the statistics.
+void measure(const uint32_t passes);
+
+}
@@ -1,12 +1,23 @@
 #include "command-line.h"
 
+#include "buffer-snapshot.h"
 #include "buffers.h"
+#include "bulk-out.h"
+#include "bus-load.h"
+#include "console-output.h"
+#include "event-queue-stats.h"
+#include "load-monitor.h"
+#include "parameters.h"
+#include "profiler.h"
 #include "serial-mutex.h"
+#include "trace.h"
 #include "version-string.h"
 
 #include <features/frameworks/mbed-client-cli/mbed-client-cli/ns_cmdline.h>
 #include <rtos/Thread.h>
 
+#include <cstring>
+
 namespace command_line
 {
 
@@ -31,6 +42,105 @@ int print_buffer(int argc, char *argv[]) {
     }
 }
 
+int snapshot(int argc, char *argv[]) {
+    buffer_snapshot::print();
+    return CMDLINE_RETCODE_SUCCESS;
+}
+
+int parameter(int argc, char *argv[]) {
+    if (argc == 1) {
+        parameters::print();
+        return CMDLINE_RETCODE_SUCCESS;
+    } else if (argc == 3) {
+        const auto id = parameters::find(argv[1]);
+        if (id == parameters::id::number_of) {
+            return CMDLINE_RETCODE_INVALID_PARAMETERS;
+        }
+        const auto value = strtoul(argv[2], nullptr, 0);
+        if (value > UINT16_MAX || !parameters::set(id, value)) {
+            return CMDLINE_RETCODE_INVALID_PARAMETERS;
+        }
+        return CMDLINE_RETCODE_SUCCESS;
+    } else {
+        return CMDLINE_RETCODE_INVALID_PARAMETERS;
+    }
+}
+
+int profile(int argc, char *argv[]) {
+    if (argc > 1) {
+        if (strcmp(argv[1], "reset") == 0) {
+            profiler::reset();
+            return CMDLINE_RETCODE_SUCCESS;
+        } else {
+            return CMDLINE_RETCODE_INVALID_PARAMETERS;
+        }
+    } else {
+        profiler::print();
+        return CMDLINE_RETCODE_SUCCESS;
+    }
+}
+
+int event_queue_statistics(int argc, char *argv[]) {
+    if (argc > 1) {
+        if (strcmp(argv[1], "reset") == 0) {
+            event_queue_stats::reset();
+            return CMDLINE_RETCODE_SUCCESS;
+        } else {
+            return CMDLINE_RETCODE_INVALID_PARAMETERS;
+        }
+    } else {
+        event_queue_stats::print();
+        return CMDLINE_RETCODE_SUCCESS;
+    }
+}
+
+int console_statistics(int argc, char *argv[]) {
+    if (argc > 1) {
+        if (strcmp(argv[1], "reset") == 0) {
+            console_output::reset();
+            return CMDLINE_RETCODE_SUCCESS;
+        } else {
+            return CMDLINE_RETCODE_INVALID_PARAMETERS;
+        }
+    } else {
+        console_output::print();
+        return CMDLINE_RETCODE_SUCCESS;
+    }
+}
+
+int bulk_out_statistics(int argc, char *argv[]) {
+    bulk_out::print_statistics();
+    return CMDLINE_RETCODE_SUCCESS;
+}
+
+int bus_load_measurement(int argc, char *argv[]) {
+    const auto passes = argc > 1 ? strtoul(argv[1], nullptr, 0) : 1000;
+    if (passes == 0) {
+        return CMDLINE_RETCODE_INVALID_PARAMETERS;
+    }
+    bus_load::measure(passes);
+    return CMDLINE_RETCODE_SUCCESS;
+}
+
+int cpu_load(int argc, char *argv[]) {
+    load_monitor::print();
+    return CMDLINE_RETCODE_SUCCESS;
+}
+
+int trace_records(int argc, char *argv[]) {
+    if (argc > 1) {
+        if (strcmp(argv[1], "clear") == 0) {
+            trace::clear();
+            return CMDLINE_RETCODE_SUCCESS;
+        } else {
+            return CMDLINE_RETCODE_INVALID_PARAMETERS;
+        }
+    } else {
+        trace::dump();
+        return CMDLINE_RETCODE_SUCCESS;
+    }
+}
+
 int version_information(int argc, char *argv[]) {
     cmd_printf("%s\n", version_string);
     cmd_printf("%s\n", mbed_os_version_string);
@@ -49,12 +159,22 @@ void command_line() {
 }
 
 void init() {
-    cmd_init(nullptr);
+    cmd_init(console_output::command_line_print);
     cmd_mutex_wait_func(serial_mutex::out_lock);
     cmd_mutex_release_func(serial_mutex::out_unlock);
 
-    cmd_add("printf-buffer", print_buffer, "Print SPI rx buffer", "Print contents of specified SPI rx buffer\nprint-buffer <0..4>\nConcurrency issues exist if the SPI if the SPI master is running");
+    cmd_add("printf-buffer", print_buffer, "Print SPI rx buffer", "Print contents of specified SPI rx buffer\nprint-buffer <0..7>\nThe DMA can overwrite it whilst it's printed if the SPI master is running, snapshot doesn't have that problem");
     cmd_alias_add("pb", "printf-buffer");
+    cmd_add("snapshot", snapshot, "Print a copy of the next full buffer", "Print a copy of the next full SPI rx buffer the USB takes, it's safe whilst streaming but the host has to be reading unless streaming is 0\nsnapshot");
+    cmd_add("parameter", parameter, "Print or set runtime parameters", "Print all the parameters or set one of them\nparameter [<name> <value>]");
+    cmd_alias_add("param", "parameter");
+    cmd_add("profile", profile, "Print cycle profile", "Print the DWT cycle counts for each probe\nprofile [reset]");
+    cmd_add("event-queue", event_queue_statistics, "Print or reset event queue statistics", "Print or reset the failed posts, most pending events and post to run latency of the event queue\nevent-queue [reset]");
+    cmd_add("console", console_statistics, "Print or reset console output statistics", "Print or reset the bytes written, dropped and truncated by the console output ring\nconsole [reset]");
+    cmd_add("bulk-out", bulk_out_statistics, "Print bulk OUT statistics", nullptr);
+    cmd_add("bus-load", bus_load_measurement, "Measure SRAM contention", "Time CPU reads of SRAM with the DWT cycle counter, compare with spi-enabled 0 and 1\nbus-load [<passes>]");
+    cmd_add("load", cpu_load, "Print CPU load", "Print the CPU load, and what it's made of, over the last 0.1, 1 and 10 s\nload");
+    cmd_add("trace", trace_records, "Dump or clear the trace records", "Print the trace records that haven't been read, for usb-host trace-decode, or forget them\ntrace [clear]");
     cmd_add("version", version_information, "version information", nullptr);
     cmd_alias_add("ver", "version");
 
@@ -0,0 +1,256 @@
+#include "console-output.h"
+
+#include "dma-buffer.h"
+#include "irq-priorities.h"
+
+#include <drivers/UnbufferedSerial.h>
+#include <features/frameworks/mbed-client-cli/mbed-client-cli/ns_cmdline.h>
+#include <platform/FileHandle.h>
+#include <platform/mbed_assert.h>
+#include <platform/mbed_critical.h>
+#include <rtos/EventFlags.h>
+#include <targets/TARGET_STM/TARGET_STM32F7/STM32Cube_FW/STM32F7xx_HAL_Driver/stm32f7xx_hal.h>
+
+#include <cerrno>
+#include <cinttypes>
+
+namespace console_output
+{
+
+namespace
+{
+
+// About 350 ms of output at 115200 baud.
+const size_t ring_size = 4096;
+DMA_BUFFER uint8_t ring_storage[ring_size];
+static_assert(dma_buffer::is_whole_cache_lines(sizeof(ring_storage)), "The ring is cleaned before the DMA reads it");
+
+// Written by the threads and consumed by the DMA ISR, always in a critical section.
+ring<ring_size> out(ring_storage);
+// The bytes the DMA is transmitting, they stay in the ring until it's finished.
+size_t transmitting = 0;
+bool started = false;
+
+// Set by the DMA ISR each time there's more room, for 'command_line_print'.
+const uint32_t room_flag = 1;
+rtos::EventFlags room;
+
+// The ST-LINK virtual COM port, USART6 on CONSOLE_TX, PC6, and CONSOLE_RX, PC7.
+USART_TypeDef *const uart = USART6;
+
+// From RM0431 Table 28 DMA2 request mapping, USART6_TX is stream 6 or stream 7 channel 5.
+DMA_HandleTypeDef hdma = {
+    .Instance = DMA2_Stream6,
+    .Init = {
+        .Channel = DMA_CHANNEL_5,
+        .Direction = DMA_MEMORY_TO_PERIPH,
+        .PeriphInc = DMA_PINC_DISABLE,
+        .MemInc = DMA_MINC_ENABLE,
+        .PeriphDataAlignment = DMA_PDATAALIGN_BYTE,
+        .MemDataAlignment = DMA_MDATAALIGN_BYTE,
+        .Mode = DMA_NORMAL,
+        .Priority = DMA_PRIORITY_LOW,
+        .FIFOMode = DMA_FIFOMODE_DISABLE,
+        .FIFOThreshold = DMA_FIFO_THRESHOLD_FULL,
+        .MemBurst = DMA_MBURST_SINGLE,
+        .PeriphBurst = DMA_PBURST_SINGLE
+    },
+    .Lock = HAL_UNLOCKED,
+    .State = HAL_DMA_STATE_RESET,
+    .Parent = nullptr,
+    .XferCpltCallback = nullptr,
+    .XferHalfCpltCallback = nullptr,
+    .XferM1CpltCallback = nullptr,
+    .XferM1HalfCpltCallback = nullptr,
+    .XferErrorCallback = nullptr,
+    .XferAbortCallback = nullptr,
+    .ErrorCode = HAL_DMA_ERROR_NONE,
+    .StreamBaseAddress = 0,
+    .StreamIndex = 0
+};
+
+// In a critical section.
+void start_next() {
+    if (!started || transmitting != 0) {
+        return;
+    }
+    const uint8_t *data;
+    const auto length = out.peek(data);
+    if (length == 0) {
+        return;
+    }
+    transmitting = length;
+    dma_buffer::clean_unaligned(data, length);
+    MBED_UNUSED const auto status = HAL_DMA_Start_IT(&hdma, reinterpret_cast<uint32_t>(data), reinterpret_cast<uint32_t>(&uart->TDR), length);
+    MBED_ASSERT(status == HAL_OK);
+}
+
+void transfer_complete(DMA_HandleTypeDef *) {
+    out.consume(transmitting);
+    transmitting = 0;
+    start_next();
+    room.set(room_flag);
+}
+
+void transfer_error(DMA_HandleTypeDef *) {
+    MBED_ASSERT(false);
+}
+
+// Returns false if there wasn't room, the write is dropped if 'drop' is set.
+bool write(const char *const data, const size_t length, const bool drop) {
+    core_util_critical_section_enter();
+    const auto written = drop || out.room() >= length ? out.write(data, length) : false;
+    start_next();
+    core_util_critical_section_exit();
+    return written;
+}
+
+void count_truncated() {
+    core_util_critical_section_enter();
+    out.count_truncated();
+    core_util_critical_section_exit();
+}
+
+// Mbed OS writes its fatal error messages with interrupts disabled so the DMA would never be
+// restarted. The DMA is abandoned and the UART written directly, the console is finished after that.
+void write_polled(const char *const data, const size_t length) {
+    CLEAR_BIT(hdma.Instance->CR, DMA_SxCR_EN);
+    for (auto i = 0u; i < length; ++i) {
+        while ((uart->ISR & USART_ISR_TXE) == 0) {
+        }
+        uart->TDR = data[i];
+    }
+    while ((uart->ISR & USART_ISR_TC) == 0) {
+    }
+}
+
+// What printf, puts and so on write to, see 'mbed::mbed_override_console'.
+class console_file: public mbed::FileHandle {
+public:
+    console_file() : serial(CONSOLE_TX, CONSOLE_RX, MBED_CONF_PLATFORM_STDIO_BAUD_RATE) {}
+
+    ssize_t write(const void *const buffer, const size_t size) override {
+        // Only a write with interrupts disabled, i.e. a fatal error, waits for the UART. An ISR's write
+        // goes into the ring like any other, 'console_output::write' is safe there and never waits.
+        if (!core_util_are_interrupts_enabled()) {
+            write_polled(static_cast<const char*>(buffer), size);
+        } else {
+            // A dropped write is still reported as written, otherwise the C library would retry it.
+            console_output::write(static_cast<const char*>(buffer), size, true);
+        }
+        return size;
+    }
+
+    ssize_t read(void *const buffer, const size_t size) override {
+        return serial.read(buffer, size);
+    }
+
+    off_t seek(off_t, int) override {
+        return -ESPIPE;
+    }
+
+    int close() override {
+        return 0;
+    }
+
+    int isatty() override {
+        return true;
+    }
+
+private:
+    mbed::UnbufferedSerial serial;
+};
+
+// Constructed on first use because the C library can use the console before 'init'.
+console_file &get_console_file() {
+    static console_file file;
+    return file;
+}
+
+}
+
+void command_line_print(const char *const format, va_list args) {
+    char line[max_line];
+    bool truncated;
+    const auto length = format_line(line, format, args, truncated);
+    if (truncated) {
+        count_truncated();
+    }
+    while (!write(line, length, false)) {
+        room.wait_any(room_flag);
+    }
+}
+
+void trace_print(const char *const line) {
+    char text[max_line];
+    const auto n = snprintf(text, sizeof(text), "%s\n", line);
+    if (n < 0) {
+        return;
+    }
+    auto length = static_cast<size_t>(n);
+    if (length >= sizeof(text)) {
+        count_truncated();
+        length = sizeof(text) - 1;
+        text[length - 1] = '\n';
+    }
+    write(text, length, true);
+}
+
+ring_statistics read() {
+    core_util_critical_section_enter();
+    const auto stats = out.statistics();
+    core_util_critical_section_exit();
+    return stats;
+}
+
+void reset() {
+    core_util_critical_section_enter();
+    out.reset_statistics();
+    core_util_critical_section_exit();
+}
+
+void print() {
+    const auto stats = read();
+    cmd_printf("ring %u bytes, most used %" PRIu32 "\n", static_cast<unsigned>(ring_size), stats.max_used);
+    cmd_printf("written %" PRIu32 " bytes\n", stats.written_bytes);
+    cmd_printf("dropped %" PRIu32 " bytes in %" PRIu32 " writes\n", stats.dropped_bytes, stats.dropped_writes);
+    cmd_printf("truncated %" PRIu32 " lines\n", stats.truncated_lines);
+}
+
+void init() {
+    // The UART is initialised by 'console_file'.
+    get_console_file();
+
+    __HAL_RCC_DMA2_CLK_ENABLE();
+
+    MBED_UNUSED const auto status = HAL_DMA_Init(&hdma);
+    MBED_ASSERT(status == HAL_OK);
+    hdma.XferCpltCallback = transfer_complete;
+    hdma.XferErrorCallback = transfer_error;
+
+    irq_priority::enable(DMA2_Stream6_IRQn, irq_priority::console_dma);
+
+    SET_BIT(uart->CR3, USART_CR3_DMAT);
+
+    core_util_critical_section_enter();
+    started = true;
+    start_next();
+    core_util_critical_section_exit();
+}
+
+// Override /weak/ implementation provided by startup_stm32f723xx.s.
+extern "C" void DMA2_Stream6_IRQHandler() {
+    HAL_DMA_IRQHandler(&hdma);
+}
+
+}
+
+// Override /weak/ implementation provided by mbed_retarget.cpp, stdin, stdout and stderr all use it.
+namespace mbed
+{
+
+FileHandle *mbed_override_console(int) {
+    return &console_output::get_console_file();
+}
+
+}
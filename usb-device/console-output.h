@@ -0,0 +1,28 @@
+#pragma once
+
+#include "console-ring.h"
+
+#include <cstdarg>
+
+// Console output that never blocks the streaming threads. Everything printed, by the command line,
+// mbed-trace or printf, goes into a ring and the UART's TX DMA drains it. Only the command line waits
+// for room, so its dumps are complete, everything else is dropped, and counted, when the ring is full.
+// The input is unchanged, the command line thread reads a character at a time from the UART.
+namespace console_output
+{
+
+// The output function for 'cmd_init'. It waits for room so only call it from the command line thread.
+void command_line_print(const char *format, va_list args);
+
+// The print function for 'mbed_trace_print_function_set', mbed-trace doesn't add a newline.
+void trace_print(const char *line);
+
+ring_statistics read();
+void reset();
+
+void print();
+
+// First thing in 'main', until then the output is held in the ring.
+void init();
+
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+// The console's output is written into a ring and the UART's DMA drains it, see console-output.cpp.
+namespace console_output
+{
+
+struct ring_statistics {
+    uint32_t written_bytes;
+    uint32_t dropped_bytes;
+    uint32_t dropped_writes;
+    uint32_t truncated_lines;
+    uint32_t max_used;  // The most bytes waiting to be transmitted
+};
+
+// Bytes are written by the threads and read by the DMA. The indices run freely and are reduced
+// modulo 'Size' when they're used so 'Size' must be a power of 2. Nothing is locked, the caller
+// has to make sure the writers and the reader don't run at the same time.
+// The storage is separate so it can be put in '.dma_buffers' without the indices.
+template<size_t Size>
+class ring {
+    static_assert(Size != 0 && (Size & (Size - 1)) == 0, "The indices wrap so the size must be a power of 2");
+
+public:
+    explicit ring(uint8_t (&storage)[Size]) : storage(storage) {}
+
+    ring(const ring&) = delete;
+    ring &operator=(const ring&) = delete;
+
+    size_t used() const { return head - tail; }
+    size_t room() const { return Size - used(); }
+
+    // All or nothing so a drop never leaves part of a line. Returns false if there wasn't room.
+    bool write(const char *const data, const size_t length) {
+        if (length > room()) {
+            stats.dropped_bytes += length;
+            ++stats.dropped_writes;
+            return false;
+        }
+        const auto offset = head % Size;
+        const auto first = length < Size - offset ? length : Size - offset;
+        memcpy(&storage[offset], data, first);
+        memcpy(&storage[0], data + first, length - first);
+        head += length;
+
+        stats.written_bytes += length;
+        if (used() > stats.max_used) {
+            stats.max_used = used();
+        }
+        return true;
+    }
+
+    // The oldest bytes that are contiguous in the storage, so the DMA can transmit them in one go.
+    // Returns 0 if there's nothing to transmit.
+    size_t peek(const uint8_t *&data) const {
+        const auto offset = tail % Size;
+        const auto n = used();
+        data = &storage[offset];
+        return n < Size - offset ? n : Size - offset;
+    }
+
+    void consume(const size_t length) {
+        tail += length;
+    }
+
+    void count_truncated() {
+        ++stats.truncated_lines;
+    }
+
+    const ring_statistics &statistics() const {
+        return stats;
+    }
+
+    void reset_statistics() {
+        stats = {};
+        stats.max_used = used();
+    }
+
+private:
+    uint8_t (&storage)[Size];
+    uint32_t head = 0;
+    uint32_t tail = 0;
+    ring_statistics stats = {};
+};
+
+// The longest line written in one go, longer ones are truncated. Formatting into a line first
+// means 'vsnprintf' never has to deal with the ring wrapping.
+const size_t max_line = 256;
+
+// Returns the length of the text in 'line', which has room for 'max_line' characters including the terminator.
+inline size_t format_line(char *const line, const char *const format, va_list args, bool &truncated) {
+    const auto n = vsnprintf(line, max_line, format, args);
+    if (n < 0) {
+        truncated = true;
+        line[0] = '\0';
+        return 0;
+    }
+    truncated = static_cast<size_t>(n) >= max_line;
+    return truncated ? max_line - 1 : static_cast<size_t>(n);
+}
+
+}
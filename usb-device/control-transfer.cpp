@@ -0,0 +1,147 @@
+#include "control-transfer.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace control_transfer
+{
+
+engine::engine(port &p) : p(p) {
+}
+
+void engine::setup_received() {
+    current_stage = stage::idle;
+    in_data = nullptr;
+    in_remaining = 0;
+    in_zero_length_packet_required = false;
+    out_data = nullptr;
+    out_expected = 0;
+    out_received = 0;
+    out_callback = nullptr;
+}
+
+void engine::start_in(const uint8_t *const data, const size_t length, const uint16_t wLength) {
+    if (wLength == 0) {
+        // Nothing can be returned so there's no data stage.
+        start_no_data();
+        return;
+    }
+
+    in_data = data;
+    in_remaining = std::min<size_t>(length, wLength);
+    // From 8.5.3.2 Variable-length Data Stage, the host expects a short packet if there is less data than requested.
+    // When the data is a multiple of the packet size the last packet isn't short so a zero length packet is sent.
+    in_zero_length_packet_required = in_remaining < wLength && (in_remaining % max_packet_size) == 0;
+    current_stage = stage::data_in;
+
+    transmit_next_packet();
+}
+
+void engine::start_out(uint8_t *const data, const size_t capacity, const uint16_t wLength, const out_complete_callback callback) {
+    if (wLength > capacity) {
+        stall();
+        return;
+    }
+
+    if (wLength == 0) {
+        // No data stage, let the callback decide what to do with nothing.
+        if (callback == nullptr || callback(data, 0)) {
+            start_no_data();
+        } else {
+            stall();
+        }
+        return;
+    }
+
+    out_data = data;
+    out_expected = wLength;
+    out_received = 0;
+    out_callback = callback;
+    current_stage = stage::data_out;
+
+    receive_next_packet();
+}
+
+void engine::start_no_data() {
+    current_stage = stage::status_in;
+    p.transmit(nullptr, 0);
+}
+
+void engine::stall() {
+    setup_received();
+    p.stall();
+}
+
+void engine::in_complete() {
+    switch (current_stage) {
+        case stage::data_in:
+            if (in_remaining > 0 || in_zero_length_packet_required) {
+                transmit_next_packet();
+            } else {
+                // The host completes a control read by sending a zero length packet.
+                current_stage = stage::status_out;
+                p.receive(nullptr, 0);
+            }
+            break;
+        case stage::status_in:
+            current_stage = stage::idle;
+            break;
+        case stage::idle:
+        case stage::data_out:
+        case stage::status_out:
+            // Not expecting to be transmitting anything, ignore it.
+            break;
+    }
+}
+
+void engine::out_complete(const size_t length) {
+    switch (current_stage) {
+        case stage::data_out: {
+            const auto accepted = std::min(length, out_expected - out_received);
+            memcpy(out_data + out_received, packet, accepted);
+            out_received += accepted;
+
+            // From 5.5.3 Control Transfer Packet Size Constraints, a short packet ends the data stage early.
+            const auto short_packet = length < max_packet_size;
+            if (out_received == out_expected || short_packet) {
+                if (out_callback == nullptr || out_callback(out_data, out_received)) {
+                    start_no_data();
+                } else {
+                    stall();
+                }
+            } else {
+                receive_next_packet();
+            }
+            break;
+        }
+        case stage::status_out:
+            current_stage = stage::idle;
+            break;
+        case stage::idle:
+        case stage::data_in:
+        case stage::status_in:
+            // From 8.5.3.2, the host can end a control read early by starting the status stage.
+            // The data isn't needed anymore.
+            current_stage = stage::idle;
+            break;
+    }
+}
+
+void engine::transmit_next_packet() {
+    const auto length = std::min(in_remaining, max_packet_size);
+    const auto data = in_data;
+
+    in_data += length;
+    in_remaining -= length;
+    if (length == 0) {
+        in_zero_length_packet_required = false;
+    }
+
+    p.transmit(length != 0 ? data : nullptr, length);
+}
+
+void engine::receive_next_packet() {
+    p.receive(packet, max_packet_size);
+}
+
+}
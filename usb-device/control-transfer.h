@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Handles the data and status stages of control transfers on EP0, see 8.5.3 Control Transfers.
+// Data stages longer than a packet are split into packets and ended with a short packet or a zero length packet.
+// The EP0 operations are done through 'port' so the state machine can be driven by a sequence of setup packets and packet completions on the host.
+namespace control_transfer
+{
+
+const size_t max_packet_size = 64;  // USB_OTG_MAX_EP0_SIZE, bMaxPacketSize0 for a high speed device
+
+enum class stage {
+    idle,  // Waiting for a setup packet
+    data_in,  // Control read, transmitting the data
+    data_out,  // Control write, receiving the data
+    status_in,  // Transmitted the zero length status packet, waiting for it to complete
+    status_out  // Waiting for the zero length status packet from the host
+};
+
+// The EP0 operations. Only 1 packet, no more than 'max_packet_size', is transmitted or received at a time.
+class port {
+public:
+    virtual void transmit(const uint8_t *const data, const size_t length) = 0;
+    virtual void receive(uint8_t *const data, const size_t length) = 0;
+    virtual void stall() = 0;
+
+protected:
+    ~port() = default;
+};
+
+// Called when the data stage of a control write is complete. Returning false stalls the status stage.
+using out_complete_callback = bool (*)(const uint8_t *const data, const size_t length);
+
+class engine {
+public:
+    explicit engine(port &p);
+
+    // Must be called for every setup packet before the request is decoded.
+    // A setup packet always aborts whatever was in progress, see 8.5.3.3 Error Handling on the Last Data Transaction.
+    void setup_received();
+
+    // Control read. 'data' must remain valid until the transfer is complete.
+    // The data is truncated to wLength, if it's shorter the host is told by a short or zero length packet.
+    void start_in(const uint8_t *const data, const size_t length, const uint16_t wLength);
+    // Control write. The data is received into 'data', wLength mustn't be more than 'capacity'.
+    void start_out(uint8_t *const data, const size_t capacity, const uint16_t wLength, const out_complete_callback callback);
+    // Control transfer without a data stage, i.e. just the status stage.
+    void start_no_data();
+    void stall();
+
+    // A packet, data or status, has been transmitted.
+    void in_complete();
+    // A packet, data or status, has been received.
+    void out_complete(const size_t length);
+
+    stage get_stage() const { return current_stage; }
+
+private:
+    void transmit_next_packet();
+    void receive_next_packet();
+
+    port &p;
+    stage current_stage = stage::idle;
+
+    const uint8_t *in_data = nullptr;
+    size_t in_remaining = 0;
+    bool in_zero_length_packet_required = false;
+
+    uint8_t *out_data = nullptr;
+    size_t out_expected = 0;
+    size_t out_received = 0;
+    out_complete_callback out_callback = nullptr;
+
+    // With DMA a whole packet is written even if a short packet is received so the
+    // packets are received here and copied to 'out_data'. Aligned for the D-cache maintenance.
+    alignas(32) uint8_t packet[max_packet_size];
+};
+
+}
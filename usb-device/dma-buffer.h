@@ -0,0 +1,42 @@
+#pragma once
+
+#include <platform/mbed_toolchain.h>
+#include <targets/TARGET_STM/TARGET_STM32F7/STM32Cube_FW/STM32F7xx_HAL_Driver/stm32f7xx_hal.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// Memory read or written by the SPI DMA or the OTG DMA is placed in the '.dma_buffers' section, see STM32F723xE.ld.
+// The D-cache doesn't know about the DMA engines so the CPU has to:
+//     clean a buffer it has written before a DMA engine reads it,
+//     invalidate a buffer before a DMA engine writes it, so a dirty line can't be written back over the data,
+//     and again after a DMA engine has written it, so the CPU doesn't read stale lines.
+// The cache maintenance operations work on whole 32 byte lines so the buffers must be aligned to,
+// and be a multiple of, a line otherwise maintaining one buffer could corrupt its neighbour.
+#define DMA_BUFFER MBED_ALIGN(32) __attribute__((section(".dma_buffers")))
+
+namespace dma_buffer
+{
+
+const size_t cache_line_size = 32;
+
+constexpr bool is_whole_cache_lines(const size_t size) {
+    return size != 0 && size % cache_line_size == 0;
+}
+
+inline void clean(const void *const buffer, const size_t size) {
+    SCB_CleanDCache_by_Addr(reinterpret_cast<uint32_t*>(const_cast<void*>(buffer)), size);
+}
+
+inline void invalidate(void *const buffer, const size_t size) {
+    SCB_InvalidateDCache_by_Addr(reinterpret_cast<uint32_t*>(buffer), size);
+}
+
+// For data that isn't in a DMA buffer, e.g. EP0 responses, the range is widened to whole lines.
+// Cleaning a neighbour's line is harmless, it just gets written back early.
+inline void clean_unaligned(const void *const data, const size_t size) {
+    const auto offset = reinterpret_cast<uintptr_t>(data) % cache_line_size;
+    clean(static_cast<const uint8_t*>(data) - offset, size + offset);
+}
+
+}
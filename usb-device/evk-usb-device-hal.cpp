@@ -1,6 +1,19 @@
 #include "evk-usb-device-hal.h"
 
+#include "buffer-crc.h"
+#include "buffer-snapshot.h"
 #include "buffers.h"
+#include "bulk-out.h"
+#include "control-transfer.h"
+#include "dma-buffer.h"
+#include "frame-capture.h"
+#include "irq-priorities.h"
+#include "load-monitor.h"
+#include "parameters.h"
+#include "profiler.h"
+#include "spi-rx.h"
+#include "tcm.h"
+#include "trace.h"
 #include "usb-device.h"
 
 #include <platform/mbed_assert.h>
@@ -8,7 +21,9 @@
 #include <rtos/Thread.h>
 #include <targets/TARGET_STM/TARGET_STM32F7/STM32Cube_FW/STM32F7xx_HAL_Driver/stm32f7xx_hal.h>
 
+#include <algorithm>
 #include <array>
+#include <cstring>
 
 // I didn't want to include stm32f7xx_ll_usb.h in buffers.h so I've done this. I'm not convinced this was the correct decision.
 static_assert(buffers::size_of == USB_OTG_HS_MAX_PACKET_SIZE, "Buffer size should be the same as the USB packet size for maximum throughput");
@@ -123,6 +138,7 @@ const uint8_t ep0_out_ep_addr = 0x00;
 const uint8_t ep0_in_ep_addr = 0x80;
 const uint8_t ep1_out_ep_addr = 0x01;
 const uint8_t ep1_in_ep_addr = 0x81;
+const uint8_t ep2_in_ep_addr = 0x82;
 
 const size_t device_descriptor_length = 18;
 uint8_t device_descriptor[device_descriptor_length] = {
@@ -180,7 +196,11 @@ const uint8_t default_configuration = 1;
 const size_t configuration_descriptor_length = 9;
 const size_t interface_descriptor_length = 9;
 const size_t endpoint_descriptor_length = 7;
-const size_t total_configuration_descriptor_length = configuration_descriptor_length + interface_descriptor_length + 2 * endpoint_descriptor_length;
+const size_t total_configuration_descriptor_length = configuration_descriptor_length + 2 * interface_descriptor_length + 3 * endpoint_descriptor_length;
+
+// From 9.6.6 Endpoint, bits 12..11 of wMaxPacketSize are the number of additional transactions per microframe.
+const uint16_t iso_w_max_packet_size = usb_device::iso_packet_size | ((usb_device::iso_transactions_per_microframe - 1) << 11);
+
 uint8_t configuration_descriptor[total_configuration_descriptor_length] = {
     // configuration descriptor, USB spec 9.6.3
     configuration_descriptor_length,  // bLength
@@ -197,7 +217,7 @@ uint8_t configuration_descriptor[total_configuration_descriptor_length] = {
     interface_descriptor_length, // bLength
     static_cast<uint8_t>(descriptor_t::interface),  // bDescriptorType
     0,                      // bInterfaceNumber
-    0,                      // bAlternateSetting
+    usb_device::bulk_alternate_setting,  // bAlternateSetting
     2,                      // bNumEndpoints
     0xff,                   // bInterfaceClass
     0xff,                   // bInterfaceSubClass
@@ -220,9 +240,32 @@ uint8_t configuration_descriptor[total_configuration_descriptor_length] = {
     lsb(USB_OTG_HS_MAX_PACKET_SIZE),  // wMaxPacketSize
     msb(USB_OTG_HS_MAX_PACKET_SIZE),
     1,                      // bInterval
+
+    // interface descriptor, USB spec 9.6.5
+    // The same interface with the bulk endpoints replaced by an isochronous endpoint, see 9.2.3 Configuring a Device
+    interface_descriptor_length, // bLength
+    static_cast<uint8_t>(descriptor_t::interface),  // bDescriptorType
+    0,                      // bInterfaceNumber
+    usb_device::iso_alternate_setting,  // bAlternateSetting
+    1,                      // bNumEndpoints
+    0xff,                   // bInterfaceClass
+    0xff,                   // bInterfaceSubClass
+    0xff,                   // bInterfaceProtocol
+    0,                      // iInterface
+
+    // endpoint descriptor, USB spec 9.6.6
+    endpoint_descriptor_length, // bLength
+    static_cast<uint8_t>(descriptor_t::endpoint),  // bDescriptorType
+    ep2_in_ep_addr,         // bEndpointAddress - EP2 isochronous in
+    EP_TYPE_ISOC,           // bmAttributes - no synchronisation, data endpoint
+    lsb(iso_w_max_packet_size),  // wMaxPacketSize
+    msb(iso_w_max_packet_size),
+    1,                      // bInterval - every microframe
 };
 
-PCD_HandleTypeDef hpcd = {
+// The OTG DMA writes setup packets straight into 'hpcd.Setup' and nothing invalidates them, that only works
+// because the DTCM isn't cached. It's also read by every OTG interrupt, see tcm.h.
+DTCM_DATA PCD_HandleTypeDef hpcd = {
     .Instance = USB_OTG_HS,
     .Init = {
         .dev_endpoints = 9,  // STM32F72x has 1 bidirectional control endpoint0 and 8 HS endpoints configurable to support bulk, interrupt or isochronous transfers
@@ -256,14 +299,44 @@ PCD_HandleTypeDef hpcd = {
 };
 
 device_state_t device_state = device_state_t::default_;
+uint8_t alternate_setting = usb_device::bulk_alternate_setting;
 
-// usb-host does a /test/ control out request with a payload of "some data"
-// AFAICT, the DMA engine writes a whole packet to the destination buffer even if it is a short transfer.
-std::array<uint8_t, USB_OTG_MAX_EP0_SIZE> vendor_request_receive_buffer{ 0x00 };
-bool vendor_request_receive_buffer_ready = false;
+// usb-host does a /test/ control out request with a payload of "some data".
+// It's written by the OTG DMA and invalidated, see 'ep0_port', so it mustn't share a cache line.
+DMA_BUFFER std::array<uint8_t, USB_OTG_MAX_EP0_SIZE> vendor_request_receive_buffer;
+static_assert(dma_buffer::is_whole_cache_lines(sizeof(vendor_request_receive_buffer)), "The receive buffer is invalidated");
 const auto vendor_request_receive_expected = std::array<uint8_t, 10>{"some data"};
 
-std::array<uint8_t, usb_device::bulk_transfer_length> ep1_receive_buffer;
+// The buffer EP1 OUT is receiving into, it stays with the endpoint when the endpoint is closed.
+// It's nullptr when all the buffers are with the bulk OUT consumer.
+uint8_t *ep1_receive_buffer = nullptr;
+// True when 'ep1_receive_buffer' is an SPI buffer, i.e. it was armed in loopback mode.
+bool ep1_receive_loopback = false;
+static_assert(bulk_out::size_of == buffers::size_of, "Bulk OUT buffers are looped back as SPI buffers");
+
+// The buffer being transmitted on EP1, remembered so it can be returned to the empty buffer queue
+// if the endpoint is closed before the transfer completes. It's nullptr when the payload is being transmitted.
+uint8_t *ep1_transmit_buffer = nullptr;
+bool ep1_transfer_in_progress = false;
+
+// The isochronous endpoint can carry more than a buffer per microframe so the full buffers are
+// gathered into this payload along with a header. The header reduces the number of buffers that fit
+// from 6 to 5 but without it the host can't tell a lost microframe from one with no data.
+// The payload is also used for batched and framed bulk transfers, the alternate settings mean
+// it's never needed by both endpoints at the same time.
+// The payload is written by the CPU and read by the OTG DMA, see 'clean_payload'.
+const auto max_buffers_per_payload = (usb_device::iso_max_microframe_payload - sizeof(usb_device::iso_header)) / buffers::size_of;
+static_assert(parameters::max_batching_factor <= max_buffers_per_payload, "The payload isn't big enough for the maximum batching factor");
+static_assert(sizeof(usb_device::iso_header) + max_buffers_per_payload * (buffers::size_of + usb_device::crc32_trailer_size + sizeof(usb_device::channel_tag) + sizeof(usb_device::frame_trailer)) <= usb_device::iso_max_microframe_payload,
+    "The payload isn't big enough for the CRCs, channel tags and frame trailers");
+static_assert(usb_device::crc32_buffer_size == buffers::size_of, "usb-host needs to know how much each CRC covers");
+DMA_BUFFER std::array<uint8_t, usb_device::iso_max_microframe_payload> payload;
+static_assert(dma_buffer::is_whole_cache_lines(sizeof(payload)), "The payload must be whole cache lines");
+uint32_t payload_length = 0;
+uint32_t bulk_sequence = 0;
+uint32_t iso_sequence = 0;
+bool iso_transfer_in_progress = false;
+uint32_t iso_incomplete_count = 0;
 
 const size_t stack_size = OS_STACK_SIZE; // /Normal/ stack size
 MBED_ALIGN(8) unsigned char stack[stack_size];
@@ -276,6 +349,51 @@ void set_can_transmit_flag() {
     MBED_ASSERT(!(flags & osFlagsError));
 }
 
+// From 8.5.3.4 STALL Handshakes Returned by Control Pipes, a 'protocol stall' tells the host the request isn't supported.
+// 'HAL_PCD_EP_SetStall' prepares EP0 for the next setup packet and the core clears the stall when it arrives.
+void stall_ep0(PCD_HandleTypeDef *const hpcd) {
+    HAL_PCD_EP_SetStall(hpcd, ep0_in_ep_addr);
+    HAL_PCD_EP_SetStall(hpcd, ep0_out_ep_addr);
+}
+
+// Connects 'control_transfer::engine' to EP0. The OTG DMA reads the data being transmitted and writes the data
+// being received directly so the D-cache has to be cleaned before transmitting and invalidated after receiving.
+class ep0_port: public control_transfer::port {
+public:
+    void transmit(const uint8_t *const data, const size_t length) override {
+        if (length > 0) {
+            dma_buffer::clean_unaligned(data, length);
+        }
+        // 'HAL_PCD_EP_Transmit' doesn't modify the data, it just isn't declared const.
+        HAL_PCD_EP_Transmit(&hpcd, ep0_in_ep_addr, const_cast<uint8_t*>(data), length);
+    }
+
+    void receive(uint8_t *const data, const size_t length) override {
+        receive_data = data;
+        receive_length = length;
+        HAL_PCD_EP_Receive(&hpcd, ep0_out_ep_addr, data, length);
+    }
+
+    void stall() override {
+        stall_ep0(&hpcd);
+    }
+
+    // Called from 'HAL_PCD_DataOutStageCallback' before the engine looks at the data.
+    void received() {
+        if (receive_data != nullptr) {
+            dma_buffer::invalidate(receive_data, receive_length);
+        }
+    }
+
+private:
+    uint8_t *receive_data = nullptr;
+    size_t receive_length = 0;
+};
+
+ep0_port ep0;
+control_transfer::engine control(ep0);
+static_assert(control_transfer::max_packet_size == USB_OTG_MAX_EP0_SIZE, "The control transfer engine must use the EP0 packet size");
+
 constexpr uint8_t lsb(const uint16_t word) {
     // Not sure that the explicit mask is necessary.
     return word & 0xff;
@@ -338,7 +456,7 @@ void get_descriptor(PCD_HandleTypeDef *const hpcd, const setup_data &setup_data)
 
     // I thought I had read in the spec that the request can have zero length in which case
     // there's no point decoding the request because nothing can be returned.
-    // Although I haven't seen this happen yet.
+    // Although I haven't seen this happen yet. If it does 'start_in' just does the status stage.
     if (setup_data.wLength > 0) {
         const auto descriptor_type = decode_descriptor_type(setup_data.wValue);
         switch(descriptor_type) {
@@ -348,7 +466,7 @@ void get_descriptor(PCD_HandleTypeDef *const hpcd, const setup_data &setup_data)
                 break;
             case descriptor_t::configuration:
                 pBuf = &configuration_descriptor[0];
-                len = std::min<uint32_t>(setup_data.wLength, total_configuration_descriptor_length);
+                len = total_configuration_descriptor_length;
                 break;
             case descriptor_t::string: {
                 get_string_descriptor(decode_string_index(setup_data.wValue), pBuf, len);
@@ -363,13 +481,10 @@ void get_descriptor(PCD_HandleTypeDef *const hpcd, const setup_data &setup_data)
         }
     }
 
-    if (len <= setup_data.wLength) {
-        HAL_PCD_EP_Transmit(hpcd, 0x00, pBuf, len);
-    } else {
-        // I haven't accounted for the request length being shorter than the descriptor because I haven't seen it happen.
-        // If/when it does happen it is necessary to implement a mechanism for sending the data in multiple packets.
-        MBED_ASSERT(false);
-    }
+    // The host often asks for less than the whole descriptor, e.g. the first 9 bytes of the configuration
+    // descriptor to find out 'wTotalLength', and longer descriptors take more than 1 packet.
+    // 'start_in' deals with both.
+    control.start_in(pBuf, len, setup_data.wLength);
 }
 
 void device_get_status(PCD_HandleTypeDef *const hpcd, const uint16_t wLength) {
@@ -383,7 +498,7 @@ void device_get_status(PCD_HandleTypeDef *const hpcd, const uint16_t wLength) {
     // Not being in one of these states should really solicit a USB error but the implementation doesn't support this yet.
     MBED_ASSERT(device_state == device_state_t::default_ || device_state == device_state_t::addressed || device_state == device_state_t::configured);
 
-    HAL_PCD_EP_Transmit(hpcd, ep0_out_ep_addr, &status[0], 2);
+    control.start_in(&status[0], sizeof(status), wLength);
 }
 
 void set_address(PCD_HandleTypeDef *const hpcd, const setup_data &setup_data) {
@@ -401,28 +516,75 @@ void set_address(PCD_HandleTypeDef *const hpcd, const setup_data &setup_data) {
     //     In the case of the SetAddress() request, the Status stage successfully completes when the device sends
     //     the zero-length Status packet or when the device sees the ACK in response to the Status stage data packet.
     // Hence send "zero-length Status packet".
-    HAL_PCD_EP_Transmit(hpcd, ep0_out_ep_addr, nullptr, 0);
+    control.start_no_data();
 
     device_state = address != 0 ? device_state_t::addressed : device_state_t::default_;
 }
 
+// Each buffer receives 1 packet so a bulk OUT transfer longer than a packet fills several buffers.
+// In loopback mode the packet is received straight into an empty SPI buffer which is then queued for
+// EP1 IN as if it was SPI data, i.e. it's looped back without being copied. The mode is only looked at
+// when a buffer is armed so a change takes effect from the next packet.
+void ep1_receive(PCD_HandleTypeDef *const hpcd) {
+    if (ep1_receive_buffer == nullptr) {
+        ep1_receive_loopback = parameters::get(parameters::id::out_consumer) == static_cast<uint16_t>(parameters::out_consumer_t::loopback);
+        ep1_receive_buffer = ep1_receive_loopback ? buffers::get_empty_buffer() : bulk_out::arm();
+    }
+    if (ep1_receive_buffer != nullptr) {
+        HAL_PCD_EP_Receive(hpcd, ep1_out_ep_addr, ep1_receive_buffer, bulk_out::size_of);
+    }
+}
+
+void open_bulk_endpoints(PCD_HandleTypeDef *const hpcd) {
+    HAL_PCD_EP_Open(hpcd, ep1_in_ep_addr, USB_OTG_HS_MAX_PACKET_SIZE, EP_TYPE_BULK);
+    HAL_PCD_EP_Open(hpcd, ep1_out_ep_addr, USB_OTG_HS_MAX_PACKET_SIZE, EP_TYPE_BULK);
+    ep1_receive(hpcd);
+}
+
+void close_bulk_endpoints(PCD_HandleTypeDef *const hpcd) {
+    HAL_PCD_EP_Close(hpcd, ep1_in_ep_addr);
+    HAL_PCD_EP_Close(hpcd, ep1_out_ep_addr);
+
+    // The data in a transfer that didn't complete is lost, there's no way of getting it to the host now.
+    if (ep1_transfer_in_progress) {
+        if (ep1_transmit_buffer != nullptr) {
+            buffers::set_buffer_empty(ep1_transmit_buffer);
+            ep1_transmit_buffer = nullptr;
+        }
+        ep1_transfer_in_progress = false;
+        set_can_transmit_flag();
+    }
+}
+
+void open_iso_endpoint(PCD_HandleTypeDef *const hpcd) {
+    HAL_PCD_EP_Open(hpcd, ep2_in_ep_addr, usb_device::iso_packet_size, EP_TYPE_ISOC);
+}
+
+void close_iso_endpoint(PCD_HandleTypeDef *const hpcd) {
+    HAL_PCD_EP_Close(hpcd, ep2_in_ep_addr);
+
+    if (iso_transfer_in_progress) {
+        iso_transfer_in_progress = false;
+        set_can_transmit_flag();
+    }
+}
+
 void set_configuration(PCD_HandleTypeDef *const hpcd, const setup_data &setup_data) {
     const auto configuration = setup_data.wValue;
     if (configuration == default_configuration) {
+        // The bulk endpoints belong to the default alternate setting.
         // Open the bulk in endpoint and prepare to transmit data when host requests it.
-        HAL_PCD_EP_Open(hpcd, ep1_in_ep_addr, USB_OTG_HS_MAX_PACKET_SIZE, EP_TYPE_BULK);
-        set_can_transmit_flag();
-
         // Open the bulk out endpoint and prepare to receive data when the host sends it.
-        HAL_PCD_EP_Open(hpcd, ep1_out_ep_addr, USB_OTG_HS_MAX_PACKET_SIZE, EP_TYPE_BULK);
-        HAL_PCD_EP_Receive(hpcd, ep1_out_ep_addr, ep1_receive_buffer.data(), ep1_receive_buffer.size());
+        alternate_setting = usb_device::bulk_alternate_setting;
+        open_bulk_endpoints(hpcd);
+        set_can_transmit_flag();
 
         // Indicate configuration successfully set...
-        HAL_PCD_EP_Transmit(hpcd, ep0_out_ep_addr, nullptr, 0);
+        control.start_no_data();
 
         device_state = device_state_t::configured;
     } else if (configuration == 0) {
-        HAL_PCD_EP_Transmit(hpcd, ep0_out_ep_addr, nullptr, 0);
+        control.start_no_data();
         device_state = device_state_t::addressed;
     } else {
         // The configuration can be 0 in which case the device should enter the 'Address state'.
@@ -457,25 +619,156 @@ void standard_device_request(PCD_HandleTypeDef *const hpcd, const setup_data &se
     }
 }
 
+void get_profile(PCD_HandleTypeDef *const hpcd, const setup_data &setup_data) {
+    // A static buffer is required for the response, see 'device_get_status'.
+    static profiler::probe_statistics stats;
+
+    if (setup_data.bmRequestType.direction != direction_t::device_to_host || setup_data.wIndex >= profiler::number_of_probes) {
+        stall_ep0(hpcd);
+        return;
+    }
+
+    stats = profiler::read(static_cast<profiler::probe>(setup_data.wIndex));
+    control.start_in(reinterpret_cast<const uint8_t*>(&stats), sizeof(stats), setup_data.wLength);
+}
+
+void reset_profile(PCD_HandleTypeDef *const hpcd, const setup_data &setup_data) {
+    if (setup_data.bmRequestType.direction != direction_t::host_to_device || setup_data.wLength != 0) {
+        stall_ep0(hpcd);
+        return;
+    }
+
+    profiler::reset();
+    control.start_no_data();
+}
+
+void get_parameter(PCD_HandleTypeDef *const hpcd, const setup_data &setup_data) {
+    // A static buffer is required for the response, see 'device_get_status'.
+    static uint8_t value[parameters::value_length];
+
+    if (setup_data.bmRequestType.direction != direction_t::device_to_host || !parameters::is_valid(setup_data.wIndex)) {
+        stall_ep0(hpcd);
+        return;
+    }
+
+    parameters::encode_value(parameters::get(static_cast<parameters::id>(setup_data.wIndex)), value);
+    control.start_in(&value[0], sizeof(value), setup_data.wLength);
+}
+
+void set_parameter(PCD_HandleTypeDef *const hpcd, const setup_data &setup_data) {
+    if (setup_data.bmRequestType.direction != direction_t::host_to_device || setup_data.wLength != 0 || !parameters::is_valid(setup_data.wIndex)) {
+        stall_ep0(hpcd);
+        return;
+    }
+
+    // 'set' rejects read-only parameters and values out of range.
+    if (parameters::set(static_cast<parameters::id>(setup_data.wIndex), setup_data.wValue)) {
+        control.start_no_data();
+    } else {
+        stall_ep0(hpcd);
+    }
+}
+
+void get_trace(PCD_HandleTypeDef *const hpcd, const setup_data &setup_data) {
+    // A static buffer is required for the response, see 'device_get_status'.
+    static uint8_t block[trace::max_block_size];
+    // Static too, 512 bytes is half the ISR stack and the DMA and load sampler ISRs can stack on top of this one.
+    static trace::record records[trace::max_records_per_block];
+
+    if (setup_data.bmRequestType.direction != direction_t::device_to_host) {
+        stall_ep0(hpcd);
+        return;
+    }
+
+    // Only read as many records as the host asked for, any more would be lost.
+    const auto max_records = setup_data.wLength < sizeof(trace::block_header) ? 0
+        : std::min<size_t>((setup_data.wLength - sizeof(trace::block_header)) / sizeof(trace::record), trace::max_records_per_block);
+    uint32_t lost = 0;
+    const auto count = trace::read(records, max_records, lost);
+    const auto length = trace::encode_block(block, records, count, lost);
+    control.start_in(block, length, setup_data.wLength);
+}
+
+void get_load(PCD_HandleTypeDef *const hpcd, const setup_data &setup_data) {
+    // A static buffer is required for the response, see 'device_get_status'.
+    static load::window_statistics stats;
+
+    if (setup_data.bmRequestType.direction != direction_t::device_to_host || setup_data.wIndex >= load::number_of_windows) {
+        stall_ep0(hpcd);
+        return;
+    }
+
+    stats = load_monitor::read(setup_data.wIndex);
+    control.start_in(reinterpret_cast<const uint8_t*>(&stats), sizeof(stats), setup_data.wLength);
+}
+
+void request_snapshot(PCD_HandleTypeDef *const hpcd, const setup_data &setup_data) {
+    if (setup_data.bmRequestType.direction != direction_t::host_to_device || setup_data.wLength != 0) {
+        stall_ep0(hpcd);
+        return;
+    }
+
+    // Stalled whilst the previous snapshot is being read, the host can try again.
+    if (buffer_snapshot::request()) {
+        control.start_no_data();
+    } else {
+        stall_ep0(hpcd);
+    }
+}
+
+void get_snapshot(PCD_HandleTypeDef *const hpcd, const setup_data &setup_data) {
+    // A static buffer is required for the response, see 'device_get_status'.
+    static uint8_t response[buffer_snapshot::max_response_length];
+
+    if (setup_data.bmRequestType.direction != direction_t::device_to_host) {
+        stall_ep0(hpcd);
+        return;
+    }
+
+    const auto length = buffer_snapshot::read(response);
+    control.start_in(response, length, setup_data.wLength);
+}
+
+// Called when the data stage of the /test/ control out request is complete.
+// Returning false stalls the status stage so usb-host finds out the data was wrong.
+bool test_request_received(const uint8_t *const data, const size_t length) {
+    return length >= vendor_request_receive_expected.size()
+        && std::equal(begin(vendor_request_receive_expected), end(vendor_request_receive_expected), data);
+}
+
+void test_request(PCD_HandleTypeDef *const, const setup_data &setup_data) {
+    if (setup_data.bmRequestType.direction == direction_t::host_to_device) {
+        vendor_request_receive_buffer.fill(0);
+        // Requests longer than the buffer are stalled.
+        control.start_out(vendor_request_receive_buffer.data(), vendor_request_receive_buffer.size(), setup_data.wLength, test_request_received);
+    } else {
+        static std::array<uint8_t, 13> send_request_data{ "send request" };
+        control.start_in(send_request_data.data(), send_request_data.size(), setup_data.wLength);
+    }
+}
+
+using vendor_request_handler = void (*)(PCD_HandleTypeDef *const hpcd, const setup_data &setup_data);
+
+// Indexed by bRequest, the order must match 'usb_device::vendor_request'.
+const vendor_request_handler vendor_request_handlers[] = {
+    test_request,
+    get_profile,
+    reset_profile,
+    get_parameter,
+    set_parameter,
+    get_trace,
+    get_load,
+    request_snapshot,
+    get_snapshot
+};
+static_assert(sizeof(vendor_request_handlers) / sizeof(vendor_request_handlers[0]) == static_cast<size_t>(usb_device::vendor_request::number_of),
+    "There must be a handler for every vendor request");
+
 void vendor_device_request(PCD_HandleTypeDef *const hpcd, const setup_data &setup_data) {
-    switch (setup_data.bRequest) {
-        case 0:
-            if (setup_data.bmRequestType.direction == direction_t::host_to_device) {
-                vendor_request_receive_buffer.fill(0);
-
-                const auto len = std::min<uint32_t>(setup_data.wLength, vendor_request_receive_expected.size());
-                HAL_PCD_EP_Receive(hpcd, ep0_in_ep_addr, vendor_request_receive_buffer.data(), len);
-                HAL_PCD_EP_Transmit(hpcd, ep0_out_ep_addr, nullptr, 0);
-
-                vendor_request_receive_buffer_ready = true;
-            } else {
-                static std::array<uint8_t, 13> send_request_data{ "send request" };
-                const auto len = std::min<uint32_t>(setup_data.wLength, send_request_data.size());
-                HAL_PCD_EP_Transmit(hpcd, ep0_out_ep_addr, send_request_data.data(), len);
-            }
-            break;
-        default:
-            MBED_ASSERT(false);
+    if (setup_data.bRequest < static_cast<uint8_t>(usb_device::vendor_request::number_of)) {
+        vendor_request_handlers[setup_data.bRequest](hpcd, setup_data);
+    } else {
+        stall_ep0(hpcd);
     }
 }
 
@@ -501,7 +794,7 @@ void endpoint_clear(PCD_HandleTypeDef *const hpcd, const setup_data &setup_data)
             if ((ep_addr & 0x7f) != 0x00) {
                 HAL_PCD_EP_ClrStall(hpcd, ep_addr);
             }
-            HAL_PCD_EP_Transmit(hpcd, ep0_out_ep_addr, nullptr, 0);
+            control.start_no_data();
         }
     }
 }
@@ -537,7 +830,86 @@ void endpoint_request(PCD_HandleTypeDef *const hpcd, const setup_data &setup_dat
     }
 }
 
+// The host chooses every field, so anything unexpected is a request error rather than an assert.
+// From 9.4.10 Set Interface and 9.4.4 Get Interface, the interface must exist and the device must be configured.
+bool is_valid_interface_request(const setup_data &setup_data, const uint16_t expected_length) {
+    return device_state == device_state_t::configured && setup_data.wIndex == 0 && setup_data.wLength == expected_length;
+}
+
+void set_interface(PCD_HandleTypeDef *const hpcd, const setup_data &setup_data) {
+    if (!is_valid_interface_request(setup_data, 0)
+        || (setup_data.wValue != usb_device::iso_alternate_setting && setup_data.wValue != usb_device::bulk_alternate_setting)) {
+        stall_ep0(hpcd);
+        return;
+    }
+
+    const uint8_t new_alternate_setting = setup_data.wValue;
+    if (new_alternate_setting != alternate_setting) {
+        if (new_alternate_setting == usb_device::iso_alternate_setting) {
+            close_bulk_endpoints(hpcd);
+            open_iso_endpoint(hpcd);
+        } else {
+            close_iso_endpoint(hpcd);
+            open_bulk_endpoints(hpcd);
+        }
+        alternate_setting = new_alternate_setting;
+    }
+
+    control.start_no_data();
+}
+
+void get_interface(PCD_HandleTypeDef *const hpcd, const setup_data &setup_data) {
+    // A static buffer is required for the response, see 'device_get_status'.
+    static uint8_t response[1] = { 0 };
+
+    if (!is_valid_interface_request(setup_data, sizeof(response))) {
+        stall_ep0(hpcd);
+        return;
+    }
+
+    response[0] = alternate_setting;
+    control.start_in(&response[0], sizeof(response), setup_data.wLength);
+}
+
+void standard_interface_request(PCD_HandleTypeDef *const hpcd, const setup_data &setup_data) {
+    switch (static_cast<standard_request_codes>(setup_data.bRequest)) {
+        case standard_request_codes::set_interface:
+            set_interface(hpcd, setup_data);
+            break;
+        case standard_request_codes::get_interface:
+            get_interface(hpcd, setup_data);
+            break;
+        case standard_request_codes::get_status:
+        case standard_request_codes::clear_feature:
+        case standard_request_codes::set_feature:
+        case standard_request_codes::set_address:
+        case standard_request_codes::get_descriptor:
+        case standard_request_codes::set_descriptor:
+        case standard_request_codes::get_configuration:
+        case standard_request_codes::set_configuration:
+        case standard_request_codes::synch_frame:
+            stall_ep0(hpcd);
+            break;
+    }
+}
+
+void interface_request(PCD_HandleTypeDef *const hpcd, const setup_data &setup_data) {
+    const auto bmRequestType = setup_data.bmRequestType;
+    switch (bmRequestType.type) {
+        case type_t::standard:
+            standard_interface_request(hpcd, setup_data);
+            break;
+        case type_t::class_:
+        case type_t::vendor:
+            stall_ep0(hpcd);
+            break;
+    }
+}
+
 void setup_stage_callback(PCD_HandleTypeDef *const hpcd) {
+    // Whatever was happening on EP0 has been abandoned by the host.
+    control.setup_received();
+
     const auto setup_data = decode_setup_packet(hpcd->Setup);
     const auto bmRequestType = setup_data.bmRequestType;
 
@@ -545,15 +917,194 @@ void setup_stage_callback(PCD_HandleTypeDef *const hpcd) {
         case recipient_t::device:
             device_request(hpcd, setup_data);
             break;
+        case recipient_t::interface:
+            interface_request(hpcd, setup_data);
+            break;
         case recipient_t::endpoint:
             endpoint_request(hpcd, setup_data);
             break;
-        case recipient_t::interface:
         case recipient_t::other:
             MBED_ASSERT(false);
     }
 }
 
+// 'HAL_PCD_EP_Transmit', via 'USB_EPStartXfer', always sets MULCNT to 1 for isochronous IN endpoints
+// which limits the endpoint to 1 transaction per microframe. From the description of OTG_DIEPTSIZx in the
+// reference manual, MULCNT must be the number of packets to be transmitted per frame for high-bandwidth
+// isochronous endpoints so the transfer is started here instead. The HAL IRQ handler still sees a normal IN transfer
+// and calls 'HAL_PCD_DataInStageCallback' when it completes.
+void iso_start_transfer(PCD_HandleTypeDef *const hpcd) {
+    const uint32_t USBx_BASE = reinterpret_cast<uint32_t>(hpcd->Instance);
+    const uint8_t epnum = ep2_in_ep_addr & 0x7f;
+    PCD_EPTypeDef *const ep = &hpcd->IN_ep[epnum];
+
+    const uint32_t packet_count = std::max<uint32_t>(1, (payload_length + ep->maxpacket - 1) / ep->maxpacket);
+    MBED_ASSERT(packet_count <= usb_device::iso_transactions_per_microframe);
+
+    ep->xfer_buff = payload.data();
+    ep->dma_addr = reinterpret_cast<uint32_t>(payload.data());
+    ep->xfer_len = payload_length;
+    ep->xfer_count = 0;
+
+    USBx_INEP(epnum)->DIEPTSIZ = (USB_OTG_DIEPTSIZ_PKTCNT & (packet_count << 19))
+                               | (USB_OTG_DIEPTSIZ_MULCNT & (packet_count << 29))
+                               | (USB_OTG_DIEPTSIZ_XFRSIZ & payload_length);
+    USBx_INEP(epnum)->DIEPDMA = ep->dma_addr;
+
+    // Same as 'USB_EPStartXfer', i.e. transmit in the next (micro)frame.
+    if ((USBx_DEVICE->DSTS & (1U << 8)) == 0U) {
+        USBx_INEP(epnum)->DIEPCTL |= USB_OTG_DIEPCTL_SODDFRM;
+    } else {
+        USBx_INEP(epnum)->DIEPCTL |= USB_OTG_DIEPCTL_SD0PID_SEVNFRM;
+    }
+    USBx_INEP(epnum)->DIEPCTL |= (USB_OTG_DIEPCTL_CNAK | USB_OTG_DIEPCTL_EPENA);
+
+    iso_transfer_in_progress = true;
+}
+
+// The OTG DMA reads the payload from SRAM so anything the CPU has written that's still in the D-cache must be written back.
+void clean_payload() {
+    dma_buffer::clean(payload.data(), payload_length);
+}
+
+// The header flags say which trailers follow each buffer, see usb-device.h.
+uint16_t trailer_flags() {
+    uint16_t flags = 0;
+    if (parameters::get(parameters::id::crc) != 0) {
+        flags |= usb_device::header_flag_crc32;
+    }
+    if (parameters::get(parameters::id::channel_tags) != 0) {
+        flags |= usb_device::header_flag_channel_tag;
+    }
+    if (frame_capture::enabled) {
+        flags |= usb_device::header_flag_frames;
+    }
+    return flags;
+}
+
+void write_header(uint32_t &sequence, const uint32_t length, const uint16_t flags) {
+    const usb_device::iso_header header = {
+        .sequence = sequence++,
+        .length = static_cast<uint16_t>(length),
+        .flags = flags
+    };
+    memcpy(payload.data(), &header, sizeof(header));
+}
+
+// Copies the buffer, and its trailers, into the payload and returns the buffer to the empty queue.
+// A buffer filled before the 'crc' parameter was turned on doesn't have a CRC, the host sees a CRC error.
+uint8_t *copy_to_payload(uint8_t *payload_ptr, uint8_t *const buffer, const uint16_t flags) {
+    memcpy(payload_ptr, buffer, buffers::size_of);
+    payload_ptr += buffers::size_of;
+
+    if ((flags & usb_device::header_flag_crc32) != 0) {
+        uint32_t crc = 0;
+        buffer_crc::get(buffer, crc);
+        memcpy(payload_ptr, &crc, sizeof(crc));
+        payload_ptr += sizeof(crc);
+    }
+
+    if ((flags & usb_device::header_flag_channel_tag) != 0) {
+        const auto tag = spi_rx::get_tag(buffer);
+        memcpy(payload_ptr, &tag, sizeof(tag));
+        payload_ptr += sizeof(tag);
+    }
+
+    if ((flags & usb_device::header_flag_frames) != 0) {
+        usb_device::frame_trailer trailer;
+        frame_capture::get(buffer, trailer);
+        memcpy(payload_ptr, &trailer, sizeof(trailer));
+        payload_ptr += sizeof(trailer);
+    }
+
+    buffers::set_buffer_empty(buffer);
+    return payload_ptr;
+}
+
+// Copies as many full buffers as will fit into the isochronous payload. Only 'first_buffer'
+// is waited for, the rest are taken if they are available so a microframe is never delayed.
+void iso_transmit(uint8_t *const first_buffer) {
+    const auto flags = trailer_flags();
+    auto payload_ptr = payload.data() + sizeof(usb_device::iso_header);
+    auto number_of_buffers = 0u;
+
+    auto buffer = first_buffer;
+    while (buffer != nullptr) {
+        payload_ptr = copy_to_payload(payload_ptr, buffer, flags);
+        ++number_of_buffers;
+
+        buffer = number_of_buffers < max_buffers_per_payload ? buffers::try_get_full_buffer() : nullptr;
+    }
+
+    payload_length = payload_ptr - payload.data();
+    write_header(iso_sequence, payload_length - sizeof(usb_device::iso_header), flags);
+    clean_payload();
+    trace::write(trace::event::iso_transmit, number_of_buffers, payload_length);
+
+    // The OTG interrupt must not run whilst the endpoint is being programmed
+    // because 'set_interface' could close the endpoint at the same time.
+    HAL_NVIC_DisableIRQ(OTG_HS_IRQn);
+    if (alternate_setting == usb_device::iso_alternate_setting) {
+        iso_start_transfer(&hpcd);
+    } else {
+        // The payload is lost, carry on with the new alternate setting.
+        set_can_transmit_flag();
+    }
+    HAL_NVIC_EnableIRQ(OTG_HS_IRQn);
+}
+
+// Without framing and batching the buffer is transmitted directly, i.e. without copying.
+// Otherwise the buffers are copied into the payload. Unlike the isochronous payload all
+// 'batching_factor' buffers are waited for so the host knows how much to ask for.
+// The trailers are only sent with framing because the host can't tell they're there otherwise.
+void bulk_transmit(uint8_t *const first_buffer) {
+    const auto framed = parameters::get(parameters::id::framed) != 0;
+    const auto batching_factor = parameters::get(parameters::id::batching_factor);
+    const auto flags = framed ? trailer_flags() : uint16_t{0};
+
+    uint8_t *transmit_buffer = first_buffer;
+    uint32_t transmit_length = buffers::size_of;
+    if (framed || batching_factor > 1) {
+        auto payload_ptr = payload.data() + (framed ? sizeof(usb_device::iso_header) : 0);
+
+        auto buffer = first_buffer;
+        for (auto i = 0u; i < batching_factor; ++i) {
+            if (i != 0) {
+                buffer = buffers::get_full_buffer();
+            }
+            payload_ptr = copy_to_payload(payload_ptr, buffer, flags);
+            // In loopback mode EP1 OUT may have been waiting for the buffer just copied, and the next
+            // buffer in the batch can only come from EP1 OUT, so it has to be re-armed before waiting.
+            bulk_out_buffer_released();
+        }
+
+        payload_length = payload_ptr - payload.data();
+        if (framed) {
+            write_header(bulk_sequence, payload_length - sizeof(usb_device::iso_header), flags);
+        }
+        clean_payload();
+
+        transmit_buffer = nullptr;
+        transmit_length = payload_length;
+    }
+    trace::write(trace::event::bulk_transmit, framed || batching_factor > 1 ? batching_factor : 1, transmit_length);
+
+    // See 'iso_transmit'.
+    HAL_NVIC_DisableIRQ(OTG_HS_IRQn);
+    if (alternate_setting == usb_device::bulk_alternate_setting) {
+        ep1_transmit_buffer = transmit_buffer;
+        ep1_transfer_in_progress = true;
+        HAL_PCD_EP_Transmit(&hpcd, ep1_in_ep_addr, transmit_buffer != nullptr ? transmit_buffer : payload.data(), transmit_length);
+    } else {
+        // The data is lost, carry on with the new alternate setting.
+        if (transmit_buffer != nullptr) {
+            buffers::set_buffer_empty(transmit_buffer);
+        }
+        set_can_transmit_flag();
+    }
+    HAL_NVIC_EnableIRQ(OTG_HS_IRQn);
+}
+
 void usb() {
     while(1) {
         MBED_UNUSED const auto flags = rtos::ThisThread::flags_wait_all(can_transmit_flag);
@@ -562,12 +1113,32 @@ void usb() {
         const auto buffer = buffers::get_full_buffer();
         MBED_ASSERT(buffer != nullptr);
 
-        HAL_PCD_EP_Transmit(&hpcd, ep1_in_ep_addr, buffer, buffers::size_of);
+        profiler::scoped_probe probe(profiler::probe::usb_loop);
+        buffer_snapshot::capture(buffer);
+        if (parameters::get(parameters::id::streaming) == 0) {
+            // Nothing is transmitted so there won't be a 'HAL_PCD_DataInStageCallback' to set the flag.
+            buffers::set_buffer_empty(buffer);
+            bulk_out_buffer_released();
+            set_can_transmit_flag();
+        } else if (alternate_setting == usb_device::iso_alternate_setting) {
+            iso_transmit(buffer);
+        } else {
+            bulk_transmit(buffer);
+        }
     }
 }
 
 }
 
+void bulk_out_buffer_released() {
+    // The OTG interrupt must not run whilst the endpoint is being armed, see 'iso_transmit'.
+    HAL_NVIC_DisableIRQ(OTG_HS_IRQn);
+    if (device_state == device_state_t::configured && alternate_setting == usb_device::bulk_alternate_setting && ep1_receive_buffer == nullptr) {
+        ep1_receive(&hpcd);
+    }
+    HAL_NVIC_EnableIRQ(OTG_HS_IRQn);
+}
+
 void init() {
     // 'STM32Cube_FW_F7_V1.16.0/Projects/STM32F723E-Discovery/Applications/USB_Device/HID_Standalone/Src/usbd_conf.c'
     // uses 'HAL_PCD_MspInit' to do some of the configuration. 'HAL_PCD_MspInit' is called from 'HAL_PCD_Init' and it is
@@ -652,20 +1223,25 @@ void init() {
     // and I think this causes the DMA problem. The DMA didn't work when the Tx FIFO was 0x174 words and did when it was 0x100 words.
     // I've been around a few houses and now think the Tx FIFO has to be an integer number of packets, i.e. it worked when I tried 0x100 and 0x200 and not with 0x180.
     // I suspect this still isn't the end of the story.
-    const auto rx_fifo_size = 0x200;
-    const auto ep0_tx_fifo_size = 0x80;
-    MBED_UNUSED const auto available_for_ep1_tx_fifo = hs_usb_data_fifo_ram_size - rx_fifo_size - ep0_tx_fifo_size;
+    // The isochronous endpoint needs room for at least 1 packet of 1024 bytes and 2 is better because there can be
+    // 3 packets in a microframe. There isn't space for that with the arbitrarily large Rx FIFO so the Rx FIFO has
+    // been cut down to just more than the minimum from the equation in the MAXIMISE_TXFIFO_SIZE code above, i.e. 0x98 words,
+    // and the EP0 Tx FIFO has been cut down to 2 control packets.
+    // The alternate settings mean EP1 and EP2 are never in use at the same time but the FIFO RAM is allocated once.
+    const auto rx_fifo_size = 0xc0;
+    const auto ep0_tx_fifo_size = 0x20;
     const auto ep1_tx_fifo_size = (USB_OTG_HS_MAX_PACKET_SIZE * 2) / 4;
-    static_assert(ep1_tx_fifo_size <= available_for_ep1_tx_fifo, "No enough space available for the EP1 Tx FIFO");
+    const auto ep2_tx_fifo_size = (usb_device::iso_packet_size * 2) / 4;
+    MBED_UNUSED const auto available_for_ep_tx_fifos = hs_usb_data_fifo_ram_size - rx_fifo_size - ep0_tx_fifo_size - 12;  // 12 is the magic free unallocated space, see above
+    static_assert(ep1_tx_fifo_size + ep2_tx_fifo_size <= available_for_ep_tx_fifos, "No enough space available for the EP1 and EP2 Tx FIFOs");
 
     HAL_PCDEx_SetRxFiFo(&hpcd, rx_fifo_size);  // Rx FIFO size must be set first
     HAL_PCDEx_SetTxFiFo(&hpcd, 0, ep0_tx_fifo_size);  // Tx FIFOs for IN endpoints must be set in order
     HAL_PCDEx_SetTxFiFo(&hpcd, 1, ep1_tx_fifo_size);
+    HAL_PCDEx_SetTxFiFo(&hpcd, 2, ep2_tx_fifo_size);
 #endif
 
-    // Set USB HS interrupt to the lowest priority
-    HAL_NVIC_SetPriority(OTG_HS_IRQn, 5, 0);
-    HAL_NVIC_EnableIRQ(OTG_HS_IRQn);
+    irq_priority::enable(OTG_HS_IRQn, irq_priority::otg_hs);
 
     HAL_PCD_Start(&hpcd);
 
@@ -674,7 +1250,8 @@ void init() {
 }
 
 // Replace /weak/ definition provided by 'startup_stm32f723xx.s' so needs to be in the global namespace.
-extern "C" void OTG_HS_IRQHandler() {
+extern "C" ITCM_CODE void OTG_HS_IRQHandler() {
+    profiler::scoped_probe probe(profiler::probe::otg_hs_isr);
     HAL_PCD_IRQHandler(&hpcd);
 }
 
@@ -682,51 +1259,98 @@ extern "C" void OTG_HS_IRQHandler() {
 // This is a significantly simplified version of 'HAL_PCD_ResetCallback' from 'usbd_conf.c'.
 // A USB device must always have EP0 open for IN and OUT transactions.
 extern "C" void HAL_PCD_ResetCallback(PCD_HandleTypeDef *const hpcd) {
+    trace::write(trace::event::usb_reset);
     device_state = device_state_t::default_;
+    // A reset ends any isochronous transfer, including one whose retry was given up on.
+    iso_transfer_in_progress = false;
 
     HAL_PCD_EP_Open(hpcd, ep0_out_ep_addr, USB_OTG_MAX_EP0_SIZE, EP_TYPE_CTRL);
 
     HAL_PCD_EP_Open(hpcd, ep0_in_ep_addr, USB_OTG_MAX_EP0_SIZE, EP_TYPE_CTRL);
 }
 
-extern "C" void HAL_PCD_DataOutStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum) {
+extern "C" ITCM_CODE void HAL_PCD_DataOutStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum) {
     if (epnum == 0) {
-        if (vendor_request_receive_buffer_ready) {
-            const auto count = hpcd->OUT_ep[epnum].xfer_count;
-
-            if (count < vendor_request_receive_expected.size()) {
-                MBED_ASSERT(false);
-            }
-
-            const auto equal = std::equal(begin(vendor_request_receive_expected), end(vendor_request_receive_expected), begin(vendor_request_receive_buffer));
-            if (!equal) {
-                MBED_ASSERT(false);
-            }
-            vendor_request_receive_buffer_ready = false;
-        }
+        // Either a data packet or the zero length status packet, the engine knows which.
+        ep0.received();
+        control.out_complete(hpcd->OUT_ep[epnum].xfer_count);
     } else if (epnum == 1) {
-        // ep1_receive_buffer contains data from the bulk transfer so clear ready for the next transfer...
-        ep1_receive_buffer.fill(0);
-        // Prepare for another transfer...
-        HAL_PCD_EP_Receive(hpcd, ep1_out_ep_addr, ep1_receive_buffer.data(), ep1_receive_buffer.size());
+        // Hand the data to the bulk OUT consumer and prepare for another transfer straight away.
+        MBED_ASSERT(ep1_receive_buffer != nullptr);
+        if (ep1_receive_loopback) {
+            // Whole buffers are transmitted so a short packet is looped back with whatever was in the rest of the buffer.
+            buffers::set_buffer_full(ep1_receive_buffer);
+        } else {
+            bulk_out::set_received(ep1_receive_buffer, hpcd->OUT_ep[epnum].xfer_count);
+        }
+        trace::write(trace::event::bulk_out_received, hpcd->OUT_ep[epnum].xfer_count);
+        ep1_receive_buffer = nullptr;
+        ep1_receive(hpcd);
     }
 }
 
-extern "C" void HAL_PCD_DataInStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum) {
+extern "C" ITCM_CODE void HAL_PCD_DataInStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum) {
     // Simplified version of 'USBD_LL_DataInStage' in
     // 'STM32Cube_FW_F7_V1.16.0/Projects/STM32F723E-Discovery/Applications/USB_Device/HID_Standalone/Src/usbd_core.c'.
     if (epnum == 0) {
-        // I believe it is necessary for the device to receive the ack sent by the host in the status stage of the sequence.
-        // See Figure 8-37. Control Read and Write Sequences.
-        // I don't understand what happens if the host doesn't send the ack or sends a nak or something.
-        HAL_PCD_EP_Receive(hpcd, ep0_out_ep_addr, nullptr, 0);
+        // Either the next data packet is transmitted or, after the last one, the device prepares to receive
+        // the status packet sent by the host. See Figure 8-37. Control Read and Write Sequences.
+        control.in_complete();
     } else if (epnum == 1) {
-        const auto buffer_ptr = reinterpret_cast<uint8_t*>(hpcd->IN_ep[epnum].dma_addr);
-        buffers::set_buffer_empty(buffer_ptr);
+        // There's nothing to release if the buffers were copied into the payload.
+        if (ep1_transmit_buffer != nullptr) {
+            MBED_ASSERT(reinterpret_cast<uint8_t*>(hpcd->IN_ep[epnum].dma_addr) == ep1_transmit_buffer);
+            buffers::set_buffer_empty(ep1_transmit_buffer);
+            ep1_transmit_buffer = nullptr;
+
+            // In loopback mode EP1 OUT may have been waiting for the buffer just released.
+            if (ep1_receive_buffer == nullptr && alternate_setting == usb_device::bulk_alternate_setting) {
+                ep1_receive(hpcd);
+            }
+        }
+        ep1_transfer_in_progress = false;
 
         // Prepare for another transfer...
         set_can_transmit_flag();
+    } else if (epnum == (ep2_in_ep_addr & 0x7f)) {
+        // The payload has already been copied out of the buffers so there's nothing to release.
+        iso_transfer_in_progress = false;
+
+        // Prepare for another transfer...
+        set_can_transmit_flag();
+    }
+}
+
+// Called when an isochronous IN transfer was enabled but the host didn't collect it in the targeted microframe.
+// The HAL doesn't work out which endpoint was incomplete so 'epnum' can't be relied upon,
+// fortunately there's only 1 isochronous IN endpoint.
+// From 'Incomplete isochronous IN data transfers' in the reference manual, the endpoint must be
+// disabled and the Tx FIFO flushed before the transfer can be retried.
+extern "C" void HAL_PCD_ISOINIncompleteCallback(PCD_HandleTypeDef *hpcd, uint8_t) {
+    if (!iso_transfer_in_progress) {
+        return;
     }
+
+    ++iso_incomplete_count;
+
+    const uint32_t USBx_BASE = reinterpret_cast<uint32_t>(hpcd->Instance);
+    const uint8_t epnum = ep2_in_ep_addr & 0x7f;
+    if ((USBx_INEP(epnum)->DIEPCTL & USB_OTG_DIEPCTL_EPENA) == USB_OTG_DIEPCTL_EPENA) {
+        USBx_INEP(epnum)->DIEPCTL |= (USB_OTG_DIEPCTL_SNAK | USB_OTG_DIEPCTL_EPDIS);
+        // Bounded like 'USB_EPStopXfer', the disable never completes if the device has been disconnected.
+        // Then there's no retry, the USB thread waits until 'set_configuration' or 'set_interface' lets it carry on.
+        uint32_t count = 0;
+        while ((USBx_INEP(epnum)->DIEPINT & USB_OTG_DIEPINT_EPDISD) == 0U) {
+            if (++count > 10000U) {
+                return;
+            }
+        }
+        USBx_INEP(epnum)->DIEPINT = USB_OTG_DIEPINT_EPDISD;
+    }
+    USB_FlushTxFifo(hpcd->Instance, epnum);
+
+    // Retry the same payload, no SPI data is lost unless the host stops collecting for long enough for the buffers to overflow.
+    iso_start_transfer(hpcd);
 }
 
 // 'HAL_PCD_IRQHandler' decodes setup packets, puts the payload in 'hpcd->Setup'
@@ -3,6 +3,10 @@
 namespace evk_usb_device_hal
 {
 
+// Called from thread context when a buffer has been released that the bulk OUT endpoint may be waiting for,
+// either a bulk OUT buffer or, in loopback mode, an SPI buffer.
+void bulk_out_buffer_released();
+
 void init();
 
 }
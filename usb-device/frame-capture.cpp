@@ -0,0 +1,143 @@
+#include "frame-capture.h"
+
+#include "buffers.h"
+#include "irq-priorities.h"
+#include "profiler.h"
+#include "spi-rx.h"
+#include "tcm.h"
+
+#include <platform/mbed_assert.h>
+#include <targets/TARGET_STM/TARGET_STM32F7/STM32Cube_FW/STM32F7xx_HAL_Driver/stm32f7xx_hal.h>
+#include <targets/TARGET_STM/TARGET_STM32F7/STM32Cube_FW/STM32F7xx_HAL_Driver/stm32f7xx_ll_gpio.h>
+#include <targets/TARGET_STM/TARGET_STM32F7/STM32Cube_FW/STM32F7xx_HAL_Driver/stm32f7xx_ll_tim.h>
+
+#include <array>
+
+namespace frame_capture
+{
+
+namespace
+{
+
+// Written by the DMA and TIM2 ISRs, which have the same priority, and read after the buffer is full.
+DTCM_DATA std::array<usb_device::frame_trailer, buffers::number_of> trailers;
+
+#if defined(SPI_RX_NSS_FRAMED)
+// Where the next frame will start, recorded when NSS rises at the end of the previous frame.
+// The SPI isn't being clocked whilst NSS is high so the DMA position can't change until NSS falls.
+bool next_start_valid = false;
+uint8_t *next_start_buffer = nullptr;
+uint16_t next_start_offset = 0;
+
+// Returns false if the DMA is writing to an overflow buffer, the frame is lost with the data.
+bool read_position() {
+    return spi_rx::framed_position(next_start_buffer, next_start_offset);
+}
+
+void frame_ended() {
+    next_start_valid = read_position();
+}
+
+void frame_started(const uint32_t timestamp) {
+    // Before the first frame NSS hasn't risen since the SPI started. The position is read now
+    // which is only wrong if a byte has already been received, i.e. the ISR was very late.
+    const auto valid = next_start_valid || read_position();
+    next_start_valid = false;
+    if (!valid) {
+        return;
+    }
+
+    auto &trailer = trailers[buffers::index_of(next_start_buffer)];
+    if (trailer.number_of_frames < usb_device::max_frames_per_buffer) {
+        trailer.frames[trailer.number_of_frames++] = { next_start_offset, 0, timestamp };
+    } else if (trailer.lost_frames < UINT8_MAX) {
+        ++trailer.lost_frames;
+    }
+}
+#endif
+
+// NSS must also be connected to PA15 which is TIM2_CH1, the NSS pin itself is taken by SPI2.
+// Channel 1 captures the rising edge, channel 2 captures the falling edge of the same input.
+// TIM2 is 32-bit and counts at 108 MHz, 2 x APB1 from system_clock.c, so it wraps every ~40 s.
+// Mbed OS uses TIM5 for the us ticker so TIM2 is free.
+void timer_init() {
+    __HAL_RCC_TIM2_CLK_ENABLE();
+    __HAL_RCC_GPIOA_CLK_ENABLE();
+
+    LL_GPIO_SetPinMode(GPIOA, LL_GPIO_PIN_15, LL_GPIO_MODE_ALTERNATE);
+    LL_GPIO_SetAFPin_8_15(GPIOA, LL_GPIO_PIN_15, LL_GPIO_AF_1);
+    LL_GPIO_SetPinSpeed(GPIOA, LL_GPIO_PIN_15, LL_GPIO_SPEED_FREQ_VERY_HIGH);
+    LL_GPIO_SetPinPull(GPIOA, LL_GPIO_PIN_15, LL_GPIO_PULL_UP);
+
+    LL_TIM_SetPrescaler(TIM2, 0);
+    LL_TIM_SetAutoReload(TIM2, UINT32_MAX);
+    LL_TIM_SetCounterMode(TIM2, LL_TIM_COUNTERMODE_UP);
+
+    LL_TIM_IC_SetActiveInput(TIM2, LL_TIM_CHANNEL_CH1, LL_TIM_ACTIVEINPUT_DIRECTTI);
+    LL_TIM_IC_SetPolarity(TIM2, LL_TIM_CHANNEL_CH1, LL_TIM_IC_POLARITY_RISING);
+    LL_TIM_IC_SetActiveInput(TIM2, LL_TIM_CHANNEL_CH2, LL_TIM_ACTIVEINPUT_INDIRECTTI);
+    LL_TIM_IC_SetPolarity(TIM2, LL_TIM_CHANNEL_CH2, LL_TIM_IC_POLARITY_FALLING);
+    LL_TIM_CC_EnableChannel(TIM2, LL_TIM_CHANNEL_CH1 | LL_TIM_CHANNEL_CH2);
+
+    LL_TIM_EnableIT_CC1(TIM2);
+    LL_TIM_EnableIT_CC2(TIM2);
+
+    irq_priority::enable(TIM2_IRQn, irq_priority::frame_capture);
+
+    LL_TIM_EnableCounter(TIM2);
+}
+
+}
+
+void buffer_armed(const uint8_t *const buffer_ptr) {
+    if (enabled) {
+        auto &trailer = trailers[buffers::index_of(buffer_ptr)];
+        trailer.number_of_frames = 0;
+        trailer.lost_frames = 0;
+    }
+}
+
+void started() {
+    next_start_valid = false;
+}
+
+void get(const uint8_t *const buffer_ptr, usb_device::frame_trailer &trailer) {
+    trailer = trailers[buffers::index_of(buffer_ptr)];
+}
+
+void init() {
+    if (enabled) {
+        timer_init();
+    }
+}
+
+#if defined(SPI_RX_NSS_FRAMED)
+// Override /weak/ implementation provided by startup_stm32f723xx.s.
+// If a short frame started and ended before the ISR ran both edges are pending,
+// the captures say which came first.
+extern "C" ITCM_CODE void TIM2_IRQHandler() {
+    profiler::scoped_probe probe(profiler::probe::frame_capture_isr);
+    const auto rising = LL_TIM_IsActiveFlag_CC1(TIM2);
+    const auto falling = LL_TIM_IsActiveFlag_CC2(TIM2);
+    const auto rising_capture = LL_TIM_IC_GetCaptureCH1(TIM2);
+    const auto falling_capture = LL_TIM_IC_GetCaptureCH2(TIM2);
+    LL_TIM_ClearFlag_CC1(TIM2);
+    LL_TIM_ClearFlag_CC2(TIM2);
+    LL_TIM_ClearFlag_CC1OVR(TIM2);
+    LL_TIM_ClearFlag_CC2OVR(TIM2);
+
+    // Unsigned arithmetic so the wrap is handled naturally.
+    const auto falling_first = rising && falling && static_cast<int32_t>(rising_capture - falling_capture) > 0;
+    if (falling_first) {
+        frame_started(falling_capture);
+    }
+    if (rising) {
+        frame_ended();
+    }
+    if (falling && !falling_first) {
+        frame_started(falling_capture);
+    }
+}
+#endif
+
+}
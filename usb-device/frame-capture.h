@@ -0,0 +1,30 @@
+#pragma once
+
+#include "usb-device.h"
+
+#include <cstdint>
+
+// Records where the SPI frames start in the buffers and when, see 'header_flag_frames'.
+// Only does anything when built with SPI_RX_NSS_FRAMED, see spi-rx.cpp.
+namespace frame_capture
+{
+
+#if defined(SPI_RX_NSS_FRAMED)
+const bool enabled = true;
+#else
+const bool enabled = false;
+#endif
+
+// Called by the SPI when it gives a buffer to the DMA, from the DMA ISR or with the DMA stopped,
+// the frames recorded for the buffer's previous contents are discarded.
+void buffer_armed(const uint8_t *const buffer_ptr);
+
+// Called by the SPI when it starts receiving, i.e. with NSS high.
+void started();
+
+// Called once the buffer has been taken from the full buffer queue, before it's returned to the empty queue.
+void get(const uint8_t *const buffer_ptr, usb_device::frame_trailer &trailer);
+
+void init();
+
+}
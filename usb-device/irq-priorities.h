@@ -0,0 +1,52 @@
+#pragma once
+
+#include <targets/TARGET_STM/TARGET_STM32F7/STM32Cube_FW/STM32F7xx_HAL_Driver/stm32f7xx_hal.h>
+
+#include <cstdint>
+
+// The priority of every interrupt the application enables, in one place so the preemption between
+// them can be checked at compile time. Lower numbers preempt higher ones. 'HAL_Init' sets
+// NVIC_PRIORITYGROUP_4 so all 4 bits are preemption priority and there are no subpriorities.
+// Mbed OS's own interrupts, e.g. the us ticker, are left as Mbed OS sets them.
+//
+// Nothing that can wait goes in the ISRs at 'spi_dma' priority, e.g. the LED is updated from the
+// event queue, see activity-led.h. Their worst case durations are recorded by the profiler
+// probes, see probe-statistics.h and 'usb-host profile'.
+namespace irq_priority
+{
+
+// Samples what the CPU is doing, including which ISR is running, so it has to preempt all of them,
+// see load-monitor.cpp. It's a few dozen cycles every ~0.5 ms.
+const uint32_t load_sampler = 0;
+
+// The DMA has to be given the next buffer before it finishes filling the one it switched to,
+// otherwise the data is lost, see buffer-handoff.h.
+const uint32_t spi_dma = 1;
+
+// These share state with the SPI DMA ISR without any locking so they mustn't preempt it or be preempted by it,
+// see 'pending' in buffer-crc.cpp and 'trailers' in frame-capture.cpp.
+const uint32_t crc_dma = spi_dma;
+const uint32_t frame_capture = spi_dma;
+
+// A late OTG interrupt only delays the transfer, the full buffers wait in the queue.
+const uint32_t otg_hs = 5;
+
+// Only moves on to the next block of console output, a late one leaves the UART idle for a while.
+const uint32_t console_dma = 14;
+
+// Only defers the pattern check to the event queue.
+const uint32_t button = 15;
+
+static_assert(load_sampler < spi_dma && load_sampler < otg_hs && load_sampler < button, "The load sampler must preempt the ISRs it samples");
+static_assert(spi_dma < otg_hs, "The SPI DMA must preempt the USB, a late handoff loses data");
+static_assert(crc_dma == spi_dma && frame_capture == spi_dma, "The CRC DMA and frame capture ISRs share unprotected state with the SPI DMA ISR");
+static_assert(otg_hs < console_dma && console_dma < button, "The console mustn't delay the USB");
+static_assert(otg_hs < button, "The button mustn't delay the USB");
+static_assert(button < (1u << __NVIC_PRIO_BITS), "There are only 16 priorities");
+
+inline void enable(const IRQn_Type irqn, const uint32_t priority) {
+    HAL_NVIC_SetPriority(irqn, priority, 0);
+    HAL_NVIC_EnableIRQ(irqn);
+}
+
+}
@@ -0,0 +1,223 @@
+#include "load-monitor.h"
+
+#include "irq-priorities.h"
+#include "main.h"
+#include "profiler.h"
+
+#include <features/frameworks/mbed-client-cli/mbed-client-cli/ns_cmdline.h>
+#include <platform/mbed_assert.h>
+#include <rtos_idle.h>
+#include <targets/TARGET_STM/TARGET_STM32F7/STM32Cube_FW/STM32F7xx_HAL_Driver/stm32f7xx_hal.h>
+#include <targets/TARGET_STM/TARGET_STM32F7/STM32Cube_FW/STM32F7xx_HAL_Driver/stm32f7xx_ll_tim.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstring>
+
+namespace load_monitor
+{
+
+namespace
+{
+
+// Only written by the idle thread.
+std::atomic<uint32_t> idle_cycles{0};
+
+// The samples are counted by thread id in the ISR and turned into contexts in 'update', which can
+// ask the RTOS for the thread names. There are only a handful of threads, any more go in 'other'.
+struct thread_samples {
+    osThreadId_t id;
+    uint32_t samples;
+};
+const size_t max_threads = 8;
+std::array<thread_samples, max_threads> threads;
+size_t number_of_threads = 0;
+uint32_t isr_samples = 0;
+uint32_t other_samples = 0;
+
+struct thread_context {
+    const char *name;
+    load::context c;
+};
+const thread_context thread_contexts[] = {
+    { "rtx_idle", load::context::idle },
+    { "main", load::context::event_queue },
+    { "usb", load::context::usb },
+    { "command-line", load::context::command_line },
+    { "bulk-out", load::context::bulk_out }
+};
+
+// What 'update' saw last time so it can work out the interval.
+uint32_t previous_cycles = 0;
+uint32_t previous_idle_cycles = 0;
+std::array<uint32_t, max_threads> previous_thread_samples = {};
+uint32_t previous_isr_samples = 0;
+uint32_t previous_other_samples = 0;
+
+load::history history;
+
+// Copied out of the history after each interval so 'read' doesn't have to sum it.
+std::array<load::window_statistics, load::number_of_windows> windows = {};
+
+// The idle thread replaces the default hook, which only sleeps. The core is stopped in WFI with
+// interrupts disabled so the cycles are counted before the ISR that woke it runs. DBG_SLEEP,
+// set in 'init', keeps HCLK running in sleep mode otherwise the cycle counter would stop too.
+void idle_hook() {
+    __disable_irq();
+    const auto start = DWT->CYCCNT;
+    __DSB();
+    __WFI();
+    idle_cycles.store(idle_cycles.load(std::memory_order_relaxed) + DWT->CYCCNT - start, std::memory_order_relaxed);
+    __enable_irq();
+}
+
+// The sample period is deliberately not a multiple of the 1 ms RTOS tick so the sampling
+// doesn't lock on to anything that's periodic with the tick. ~2 kHz costs ~0.1% of the CPU.
+const uint32_t sample_timer_hz = 1000000;
+const uint32_t sample_period_us = 487;
+
+// TIM7 is a basic timer and unused, TIMxCLK is 108 MHz, 2 x APB1 from system_clock.c.
+void timer_init() {
+    __HAL_RCC_TIM7_CLK_ENABLE();
+
+    LL_TIM_SetPrescaler(TIM7, 108000000 / sample_timer_hz - 1);
+    LL_TIM_SetAutoReload(TIM7, sample_period_us - 1);
+    LL_TIM_EnableIT_UPDATE(TIM7);
+
+    irq_priority::enable(TIM7_IRQn, irq_priority::load_sampler);
+
+    LL_TIM_EnableCounter(TIM7);
+}
+
+load::context find_context(const osThreadId_t id) {
+    const auto name = osThreadGetName(id);
+    if (name != nullptr) {
+        for (const auto &tc: thread_contexts) {
+            if (strcmp(tc.name, name) == 0) {
+                return tc.c;
+            }
+        }
+    }
+    return load::context::other;
+}
+
+// Called every 'interval_ms' by the event queue.
+void update() {
+    load::interval i = {};
+
+    const auto cycles = DWT->CYCCNT;
+    i.cycles = cycles - previous_cycles;
+    previous_cycles = cycles;
+
+    const auto idle = idle_cycles.load(std::memory_order_relaxed);
+    i.idle_cycles = idle - previous_idle_cycles;
+    previous_idle_cycles = idle;
+
+    // The ISR only ever increments the counts or appends a thread so reading them without
+    // disabling interrupts just means a sample might be counted in the next interval.
+    const auto n = number_of_threads;
+    for (auto t = 0u; t < n; ++t) {
+        const auto samples = threads[t].samples;
+        i.samples[static_cast<size_t>(find_context(threads[t].id))] += samples - previous_thread_samples[t];
+        previous_thread_samples[t] = samples;
+    }
+    const auto isr = isr_samples;
+    i.samples[static_cast<size_t>(load::context::isr)] += isr - previous_isr_samples;
+    previous_isr_samples = isr;
+    const auto other = other_samples;
+    i.samples[static_cast<size_t>(load::context::other)] += other - previous_other_samples;
+    previous_other_samples = other;
+
+    history.add(i);
+
+    std::array<load::window_statistics, load::number_of_windows> sums;
+    for (auto w = 0u; w < load::number_of_windows; ++w) {
+        sums[w] = history.sum(load::window_intervals[w]);
+    }
+    const auto primask = __get_PRIMASK();
+    __disable_irq();
+    windows = sums;
+    __set_PRIMASK(primask);
+}
+
+}
+
+load::window_statistics read(const size_t window) {
+    MBED_ASSERT(window < load::number_of_windows);
+
+    // Read by the OTG ISR as well as the command line.
+    const auto primask = __get_PRIMASK();
+    __disable_irq();
+    const auto stats = windows[window];
+    __set_PRIMASK(primask);
+    return stats;
+}
+
+void print() {
+    cmd_printf("%-12s", "window ms");
+    for (auto w = 0u; w < load::number_of_windows; ++w) {
+        cmd_printf(" %8" PRIu32, static_cast<uint32_t>(load::window_intervals[w] * load::interval_ms));
+    }
+    cmd_printf("\n");
+
+    std::array<load::window_statistics, load::number_of_windows> stats;
+    for (auto w = 0u; w < load::number_of_windows; ++w) {
+        stats[w] = read(w);
+    }
+
+    cmd_printf("%-12s", "load %");
+    for (const auto &s: stats) {
+        const auto permille = load::load_permille(s);
+        cmd_printf(" %6" PRIu32 ".%" PRIu32, permille / 10, permille % 10);
+    }
+    cmd_printf("\n");
+
+    for (auto c = 0u; c < load::number_of_contexts; ++c) {
+        cmd_printf("%-12s", load::context_names[c]);
+        for (const auto &s: stats) {
+            const auto permille = load::share_permille(s, static_cast<load::context>(c));
+            cmd_printf(" %6" PRIu32 ".%" PRIu32, permille / 10, permille % 10);
+        }
+        cmd_printf("\n");
+    }
+}
+
+void init() {
+    DBGMCU->CR |= DBGMCU_CR_DBG_SLEEP;
+    previous_cycles = DWT->CYCCNT;
+    rtos_attach_idle_hook(idle_hook);
+    timer_init();
+
+    MBED_UNUSED const auto id = event_queue.call_every(std::chrono::milliseconds(load::interval_ms), update);
+    MBED_ASSERT(id != 0);
+}
+
+// Override /weak/ implementation provided by startup_stm32f723xx.s.
+// RETTOBASE is clear if there's another exception active, i.e. this one preempted an ISR.
+extern "C" void TIM7_IRQHandler() {
+    profiler::scoped_probe probe(profiler::probe::load_sampler_isr);
+    LL_TIM_ClearFlag_UPDATE(TIM7);
+
+    if ((SCB->ICSR & SCB_ICSR_RETTOBASE_Msk) == 0) {
+        ++isr_samples;
+        return;
+    }
+
+    const auto id = osThreadGetId();
+    for (auto t = 0u; t < number_of_threads; ++t) {
+        if (threads[t].id == id) {
+            ++threads[t].samples;
+            return;
+        }
+    }
+    if (number_of_threads < max_threads) {
+        threads[number_of_threads] = { id, 1 };
+        ++number_of_threads;
+    } else {
+        ++other_samples;
+    }
+}
+
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "load-statistics.h"
+
+// Measures the CPU load so we can see how much headroom is left as the throughput goes up.
+// The RTOS idle hook counts the DWT cycles spent idle and a timer interrupt samples which thread,
+// or ISR, is running. It replaces the LED that blinked to show the event queue was running.
+namespace load_monitor
+{
+
+// 'window' is an index into 'load::window_intervals'.
+load::window_statistics read(const size_t window);
+
+void print();
+
+// After 'profiler::init' because the DWT is used.
+void init();
+
+}
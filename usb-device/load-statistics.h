@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// The CPU load aggregation, shared with usb-host.
+namespace load
+{
+
+// What the CPU was doing when it was sampled, see load-monitor.cpp.
+enum class context: uint8_t {
+    idle,
+    event_queue,  // The main thread
+    usb,
+    command_line,
+    bulk_out,
+    isr,  // Including the RTOS kernel's SVC and PendSV handlers
+    other,  // Any other thread, e.g. the RTOS timer thread
+    number_of
+};
+
+const size_t number_of_contexts = static_cast<size_t>(context::number_of);
+
+const char *const context_names[number_of_contexts] = {
+    "idle",
+    "event_queue",
+    "usb",
+    "command-line",
+    "bulk-out",
+    "isr",
+    "other"
+};
+
+// The measurements are made in intervals of 'interval_ms' and summed over the last 1, 10 and 100 intervals.
+const uint32_t interval_ms = 100;
+const size_t number_of_windows = 3;
+const size_t window_intervals[number_of_windows] = { 1, 10, 100 };
+const size_t max_window_intervals = 100;
+
+// One interval's worth. The cycles are DWT cycles so the idle time is exact, the samples are taken
+// from a timer interrupt so the share of each context is statistical.
+struct interval {
+    uint32_t cycles;
+    uint32_t idle_cycles;
+    uint32_t samples[number_of_contexts];
+};
+
+// This is also the format sent over USB. Both ends are little endian and the members
+// have been ordered so there's no padding.
+struct window_statistics {
+    uint64_t cycles;
+    uint64_t idle_cycles;
+    uint32_t samples[number_of_contexts];
+    uint32_t intervals;  // Fewer than the window's size until it has filled up
+};
+static_assert(sizeof(window_statistics) == 48, "window_statistics is sent over USB so its size must not change");
+
+// In tenths of a percent so usb-device can print them without floating point.
+inline uint32_t load_permille(const window_statistics &stats) {
+    return stats.cycles != 0 ? static_cast<uint32_t>(1000 * (stats.cycles - stats.idle_cycles) / stats.cycles) : 0;
+}
+
+inline uint32_t share_permille(const window_statistics &stats, const context c) {
+    uint64_t total = 0;
+    for (const auto samples: stats.samples) {
+        total += samples;
+    }
+    return total != 0 ? static_cast<uint32_t>(1000 * static_cast<uint64_t>(stats.samples[static_cast<size_t>(c)]) / total) : 0;
+}
+
+// Remembers the last 'max_window_intervals' intervals so any window up to that size can be summed.
+class history {
+public:
+    void add(const interval &i) {
+        intervals[next] = i;
+        next = (next + 1) % max_window_intervals;
+        if (count < max_window_intervals) {
+            ++count;
+        }
+    }
+
+    window_statistics sum(const size_t window) const {
+        window_statistics stats = {};
+        const auto n = window < count ? window : count;
+        for (auto k = 0u; k < n; ++k) {
+            const auto &i = intervals[(next + max_window_intervals - 1 - k) % max_window_intervals];
+            stats.cycles += i.cycles;
+            stats.idle_cycles += i.idle_cycles;
+            for (auto c = 0u; c < number_of_contexts; ++c) {
+                stats.samples[c] += i.samples[c];
+            }
+        }
+        stats.intervals = n;
+        return stats;
+    }
+
+    void clear() {
+        next = 0;
+        count = 0;
+    }
+
+private:
+    interval intervals[max_window_intervals];
+    size_t next = 0;
+    size_t count = 0;
+};
+
+}
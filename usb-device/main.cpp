@@ -1,9 +1,16 @@
 #include "main.h"
 
+#include "activity-led.h"
+#include "buffer-crc.h"
 #include "buffers.h"
+#include "bulk-out.h"
 #include "command-line.h"
+#include "console-output.h"
 #include "evk-usb-device-hal.h"
-#include "show-running.h"
+#include "frame-capture.h"
+#include "load-monitor.h"
+#include "parameters.h"
+#include "profiler.h"
 #include "spi-rx.h"
 #include "trace.h"
 #include "version-string.h"
@@ -14,14 +21,21 @@
 
 #define TRACE_GROUP "main"
 
-MBED_ALIGN(4) unsigned char event_queue_buffer[EVENTS_QUEUE_SIZE];
-events::EventQueue event_queue(EVENTS_QUEUE_SIZE, &event_queue_buffer[0]);
+MBED_ALIGN(4) unsigned char event_queue_buffer[MBED_CONF_APP_EVENT_QUEUE_SIZE];
+events::EventQueue event_queue(MBED_CONF_APP_EVENT_QUEUE_SIZE, &event_queue_buffer[0]);
 
 int main() {
+    console_output::init();  // First so nothing waits on the UART.
     trace::init();
-    show_running::init();
+    profiler::init();  // Before anything that has a probe.
+    load_monitor::init();
+    parameters::init();
     buffers::init();  // Initialise the buffers first because the SPI will want an empty buffer during its initialisation.
+    buffer_crc::init();  // Before the SPI because the SPI passes the full buffers to it.
+    frame_capture::init();  // Before the SPI because the SPI records the frames in the buffers it starts receiving into.
     spi_rx::init();
+    activity_led::init();
+    bulk_out::init();  // Before the USB so the consumer is running when the first bulk OUT transfer arrives.
     evk_usb_device_hal::init();
     command_line::init();
 
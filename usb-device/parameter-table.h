@@ -0,0 +1,132 @@
+#pragma once
+
+#include "usb-device.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Runtime parameters that can be read and written using vendor requests so performance
+// experiments don't need the firmware rebuilding. The table and the encoding of the requests
+// are shared with usb-host.
+namespace parameters
+{
+
+enum class id: uint16_t {
+    streaming,
+    framed,
+    batching_factor,
+    spi_enabled,
+    empty_low_watermark,
+    full_high_watermark,
+    empty_low_watermark_hits,
+    full_high_watermark_hits,
+    out_consumer,
+    crc,
+    spi_overflows,
+    channel_tags,
+    number_of
+};
+
+const size_t number_of_parameters = static_cast<size_t>(id::number_of);
+
+struct description {
+    const char *name;
+    uint16_t min;
+    uint16_t max;
+    uint16_t default_value;
+    bool writable;
+};
+
+// What is done with the data received on the bulk OUT endpoint.
+enum class out_consumer_t: uint16_t {
+    discard,  // Counted and thrown away
+    loopback,  // Received into SPI buffers and transmitted on the bulk IN endpoint without copying, turn 'spi-enabled' off to stop the SPI data getting mixed in
+    number_of
+};
+
+// The batching factor is limited by the size of the payload buffer in evk-usb-device-hal.cpp.
+const uint16_t max_batching_factor = 5;
+
+// The watermarks are numbers of buffers, see 'buffers::number_of'.
+const uint16_t max_watermark = 8;
+
+const description descriptions[number_of_parameters] = {
+    // name, min, max, default, writable
+    { "streaming", 0, 1, 1, true },  // 0 means full buffers are discarded instead of being sent to the host
+    { "framed", 0, 1, 0, true },  // 1 means each bulk transfer starts with a 'usb_device::iso_header'
+    { "batching-factor", 1, max_batching_factor, 1, true },  // Number of buffers per bulk transfer
+    { "spi-enabled", 0, 1, 1, true },
+    { "empty-low-watermark", 0, max_watermark, 0, true },  // Counts when the number of empty buffers falls to this
+    { "full-high-watermark", 0, max_watermark, max_watermark, true },  // Counts when the number of full buffers rises to this
+    { "empty-low-watermark-hits", 0, UINT16_MAX, 0, false },
+    { "full-high-watermark-hits", 0, UINT16_MAX, 0, false },
+    { "out-consumer", 0, static_cast<uint16_t>(out_consumer_t::number_of) - 1, 0, true },  // See 'out_consumer_t'
+    { "crc", 0, 1, 0, true },  // 1 means each SPI buffer gets a CRC, only isochronous and framed bulk payloads carry it
+    { "spi-overflows", 0, UINT16_MAX, 0, false },  // Counts buffers of SPI data lost because there wasn't an empty buffer
+    { "channel-tags", 0, 1, 0, true }  // 1 means each SPI buffer is tagged with its channel, only isochronous and framed bulk payloads carry it
+};
+
+inline bool is_valid(const uint16_t index) {
+    return index < number_of_parameters;
+}
+
+inline bool is_valid(const id parameter, const uint16_t value) {
+    const auto &description = descriptions[static_cast<size_t>(parameter)];
+    return value >= description.min && value <= description.max;
+}
+
+// Returns id::number_of if the name isn't recognised.
+inline id find(const char *const name) {
+    for (auto i = 0u; i < number_of_parameters; ++i) {
+        if (strcmp(descriptions[i].name, name) == 0) {
+            return static_cast<id>(i);
+        }
+    }
+    return id::number_of;
+}
+
+// From Table 9-2. Format of Setup Data, as seen by the host.
+struct setup_packet {
+    uint8_t bmRequestType;
+    uint8_t bRequest;
+    uint16_t wValue;
+    uint16_t wIndex;
+    uint16_t wLength;
+};
+
+// Values are sent little endian in a 2 byte data stage.
+const uint16_t value_length = 2;
+
+// get_parameter: IN, wIndex is the parameter, the data is the value.
+inline setup_packet encode_get(const id parameter) {
+    return {
+        .bmRequestType = 0x80 | 0x40 | 0x00,  // device to host, vendor, device
+        .bRequest = static_cast<uint8_t>(usb_device::vendor_request::get_parameter),
+        .wValue = 0,
+        .wIndex = static_cast<uint16_t>(parameter),
+        .wLength = value_length
+    };
+}
+
+// set_parameter: OUT, wIndex is the parameter and wValue is the value, there's no data stage.
+inline setup_packet encode_set(const id parameter, const uint16_t value) {
+    return {
+        .bmRequestType = 0x00 | 0x40 | 0x00,  // host to device, vendor, device
+        .bRequest = static_cast<uint8_t>(usb_device::vendor_request::set_parameter),
+        .wValue = value,
+        .wIndex = static_cast<uint16_t>(parameter),
+        .wLength = 0
+    };
+}
+
+inline void encode_value(const uint16_t value, uint8_t data[value_length]) {
+    data[0] = value & 0xff;
+    data[1] = (value & 0xff00) >> 8;
+}
+
+inline uint16_t decode_value(const uint8_t data[value_length]) {
+    return data[0] | (data[1] << 8);
+}
+
+}
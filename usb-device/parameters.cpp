@@ -0,0 +1,74 @@
+#include "parameters.h"
+
+#include "event-queue-stats.h"
+#include "main.h"
+#include "spi-rx.h"
+#include "tcm.h"
+#include "trace.h"
+
+#include <features/frameworks/mbed-client-cli/mbed-client-cli/ns_cmdline.h>
+#include <platform/mbed_assert.h>
+
+#include <array>
+#include <atomic>
+
+namespace parameters
+{
+
+namespace
+{
+
+// Parameters are set from the OTG ISR and the command line thread and read from everywhere.
+DTCM_DATA std::array<std::atomic<uint16_t>, number_of_parameters> values;
+
+size_t index_of(const id parameter) {
+    const auto index = static_cast<size_t>(parameter);
+    MBED_ASSERT(index < number_of_parameters);
+    return index;
+}
+
+}
+
+uint16_t get(const id parameter) {
+    return values[index_of(parameter)];
+}
+
+bool set(const id parameter, const uint16_t value) {
+    const auto index = index_of(parameter);
+    if (!descriptions[index].writable || !is_valid(parameter, value)) {
+        return false;
+    }
+
+    const auto previous_value = values[index].exchange(value);
+
+    // Starting and stopping the SPI uses the HAL which isn't a good idea from an ISR context.
+    // If the event queue is full the change is undone and refused, so the vendor request stalls
+    // rather than the parameter saying the SPI is running when it isn't.
+    if (parameter == id::spi_enabled && value != previous_value
+            && event_queue_stats::call(value != 0 ? spi_rx::start : spi_rx::stop) == 0) {
+        auto expected = value;
+        values[index].compare_exchange_strong(expected, previous_value);
+        return false;
+    }
+
+    trace::write(trace::event::parameter_set, index, value);
+    return true;
+}
+
+void increment(const id parameter) {
+    ++values[index_of(parameter)];
+}
+
+void print() {
+    for (auto i = 0u; i < number_of_parameters; ++i) {
+        cmd_printf("%-26s %5u %s\n", descriptions[i].name, static_cast<unsigned>(values[i]), descriptions[i].writable ? "" : "(read-only)");
+    }
+}
+
+void init() {
+    for (auto i = 0u; i < number_of_parameters; ++i) {
+        values[i] = descriptions[i].default_value;
+    }
+}
+
+}
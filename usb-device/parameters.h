@@ -0,0 +1,19 @@
+#pragma once
+
+#include "parameter-table.h"
+
+namespace parameters
+{
+
+uint16_t get(const id parameter);
+// Returns false if the parameter is read-only, the value is out of range or the change couldn't be
+// passed on, i.e. the event queue is full.
+bool set(const id parameter, const uint16_t value);
+// For the read-only counters, the value wraps.
+void increment(const id parameter);
+
+void print();
+
+void init();
+
+}
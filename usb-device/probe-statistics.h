@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// The profiler table, shared with usb-host.
+namespace profiler
+{
+
+enum class probe: uint8_t {
+    spi_dma_isr,
+    otg_hs_isr,
+    usb_loop,
+    get_empty_buffer,
+    set_buffer_empty,
+    get_full_buffer,
+    set_buffer_full,
+    crc_dma_isr,
+    frame_capture_isr,
+    load_sampler_isr,
+    number_of
+};
+
+const size_t number_of_probes = static_cast<size_t>(probe::number_of);
+
+const char *const probe_names[number_of_probes] = {
+    "spi_dma_isr",
+    "otg_hs_isr",
+    "usb_loop",
+    "get_empty_buffer",
+    "set_buffer_empty",
+    "get_full_buffer",
+    "set_buffer_full",
+    "crc_dma_isr",
+    "frame_capture_isr",
+    "load_sampler_isr"
+};
+
+// SYSCLK from system_clock.c, the DWT cycle counter runs at the core clock.
+const uint32_t core_clock_mhz = 216;
+
+// This is also the format sent over USB. Both ends are little endian and the members
+// have been ordered so there's no padding.
+struct probe_statistics {
+    uint64_t sum;
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint32_t reserved;
+};
+static_assert(sizeof(probe_statistics) == 24, "probe_statistics is sent over USB so its size must not change");
+
+const probe_statistics probe_statistics_init = { 0, 0, UINT32_MAX, 0, 0 };
+
+inline void accumulate(probe_statistics &stats, const uint32_t cycles) {
+    stats.sum += cycles;
+    ++stats.count;
+    if (cycles < stats.min) stats.min = cycles;
+    if (cycles > stats.max) stats.max = cycles;
+}
+
+inline uint32_t mean(const probe_statistics &stats) {
+    return stats.count != 0 ? static_cast<uint32_t>(stats.sum / stats.count) : 0;
+}
+
+}
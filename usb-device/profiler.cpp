@@ -0,0 +1,65 @@
+#include "profiler.h"
+
+#include "tcm.h"
+
+#include <features/frameworks/mbed-client-cli/mbed-client-cli/ns_cmdline.h>
+
+#include <array>
+#include <cinttypes>
+
+namespace profiler
+{
+
+namespace
+{
+
+DTCM_DATA std::array<probe_statistics, number_of_probes> table;
+
+}
+
+// Probes are recorded from threads and ISRs of various priorities, some probes from more than one context,
+// so the table is updated with interrupts disabled. It's only for a handful of instructions.
+void record(const probe p, const uint32_t cycles) {
+    const auto primask = __get_PRIMASK();
+    __disable_irq();
+    accumulate(table[static_cast<size_t>(p)], cycles);
+    __set_PRIMASK(primask);
+}
+
+probe_statistics read(const probe p) {
+    const auto primask = __get_PRIMASK();
+    __disable_irq();
+    const auto stats = table[static_cast<size_t>(p)];
+    __set_PRIMASK(primask);
+    return stats;
+}
+
+void reset() {
+    const auto primask = __get_PRIMASK();
+    __disable_irq();
+    table.fill(probe_statistics_init);
+    __set_PRIMASK(primask);
+}
+
+void print() {
+    cmd_printf("%-18s %10s %10s %10s %10s\n", "probe", "count", "min", "mean", "max");
+    for (auto i = 0u; i < number_of_probes; ++i) {
+        const auto stats = read(static_cast<probe>(i));
+        cmd_printf("%-18s %10" PRIu32 " %10" PRIu32 " %10" PRIu32 " %10" PRIu32 "\n",
+            probe_names[i], stats.count, stats.count != 0 ? stats.min : 0, mean(stats), stats.max);
+    }
+    cmd_printf("cycles at %" PRIu32 " MHz\n", core_clock_mhz);
+}
+
+void init() {
+    reset();
+
+    // From the ARMv7-M Architecture Reference Manual, TRCENA must be set before the DWT can be used.
+    // The Cortex-M7 also has a lock access register which must be unlocked before the DWT registers can be written.
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->LAR = 0xc5acce55;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "probe-statistics.h"
+
+#include <targets/TARGET_STM/TARGET_STM32F7/STM32Cube_FW/STM32F7xx_HAL_Driver/stm32f7xx_hal.h>
+
+namespace profiler
+{
+
+void record(const probe p, const uint32_t cycles);
+probe_statistics read(const probe p);
+void reset();
+
+void print();
+
+void init();
+
+// Measures the time between construction and destruction using the DWT cycle counter.
+// The counter wraps every ~20 s at 216 MHz which is fine for the durations being measured.
+class scoped_probe {
+public:
+    explicit scoped_probe(const probe p) : p(p), start(DWT->CYCCNT) {}
+    ~scoped_probe() { record(p, DWT->CYCCNT - start); }
+
+    scoped_probe(const scoped_probe&) = delete;
+    scoped_probe &operator=(const scoped_probe&) = delete;
+
+private:
+    const probe p;
+    const uint32_t start;
+};
+
+}
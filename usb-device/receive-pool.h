@@ -0,0 +1,114 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// The buffers for bulk OUT transfers are passed between the OTG ISR, which receives into them,
+// and a consumer thread, which does something with the data and gives them back.
+// There's exactly 1 producer and 1 consumer for each direction so lock free single producer,
+// single consumer queues are enough.
+namespace receive_pool
+{
+
+// 'N' must be a power of 2 so the free running indices wrap correctly.
+template<typename T, size_t N>
+class handoff_queue {
+    static_assert(N != 0 && (N & (N - 1)) == 0, "The capacity must be a power of 2");
+
+public:
+    // Only called by the producer, returns false if the queue is full.
+    bool try_push(const T &item) {
+        const auto tail = tail_index.load(std::memory_order_relaxed);
+        if (tail - head_index.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+        items[tail % N] = item;
+        tail_index.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Only called by the consumer, returns false if the queue is empty.
+    bool try_pop(T &item) {
+        const auto head = head_index.load(std::memory_order_relaxed);
+        if (head == tail_index.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = items[head % N];
+        head_index.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const {
+        return tail_index.load(std::memory_order_acquire) - head_index.load(std::memory_order_acquire);
+    }
+
+private:
+    std::array<T, N> items{};
+    std::atomic<size_t> head_index{0};
+    std::atomic<size_t> tail_index{0};
+};
+
+struct received {
+    uint8_t *buffer;
+    uint32_t length;
+};
+
+// 'Size' should be a multiple of the cache line size, 32 bytes, so the buffers can be invalidated
+// without touching anything else.
+template<size_t N, size_t Size>
+class pool {
+public:
+    static const size_t number_of = N;
+    static const size_t size_of = Size;
+
+    pool() {
+        for (auto &buffer: storage) {
+            empty.try_push(&buffer[0]);
+        }
+    }
+
+    // Called by the receiver when it wants a buffer to receive into.
+    // Returns nullptr if the consumer has them all, 'release' then says when to try again.
+    uint8_t *arm() {
+        uint8_t *buffer = nullptr;
+        if (!empty.try_pop(buffer)) {
+            starved.store(true);
+            ++starved_count;
+        }
+        return buffer;
+    }
+
+    // Called by the receiver when data has been received into a buffer from 'arm'.
+    void set_received(uint8_t *const buffer, const uint32_t length) {
+        // There are only N buffers so there's always room.
+        full.try_push(received{ buffer, length });
+    }
+
+    // Called by the consumer, returns false if nothing has been received.
+    bool take(received &r) {
+        return full.try_pop(r);
+    }
+
+    // Called by the consumer when it has finished with a buffer. Returns true if the receiver
+    // ran out of buffers in the mean time, i.e. it needs to call 'arm' again.
+    bool release(uint8_t *const buffer) {
+        empty.try_push(buffer);
+        return starved.exchange(false);
+    }
+
+    // The buffer being received into isn't counted.
+    size_t number_of_empty() const { return empty.size(); }
+    size_t number_of_full() const { return full.size(); }
+    uint32_t get_starved_count() const { return starved_count; }
+
+private:
+    alignas(32) uint8_t storage[N][Size] = { { 0 } };
+    handoff_queue<uint8_t*, N> empty;
+    handoff_queue<received, N> full;
+    std::atomic<bool> starved{false};
+    std::atomic<uint32_t> starved_count{0};
+};
+
+}
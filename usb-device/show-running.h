@@ -1,8 +0,0 @@
-#pragma once
-
-namespace show_running
-{
-
-void init();
-
-}
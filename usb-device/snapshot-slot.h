@@ -0,0 +1,103 @@
+#pragma once
+
+#include "usb-device.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// A copy of a full buffer that can be inspected whilst the SPI keeps receiving. A buffer is handed
+// back to the DMA as soon as the USB has transmitted it so anything reading the pool directly can
+// see it being overwritten. Instead a snapshot is requested, the USB consumer copies the next full
+// buffer into the slot before it releases the buffer, and then the slot is read. Nothing waits for
+// anything else, the consumer only pays for the copy when a snapshot has been requested.
+namespace buffer_snapshot
+{
+
+enum class state: uint8_t {
+    empty,  // Nothing has been requested
+    requested,  // Waiting for the consumer's next full buffer
+    capturing,  // The consumer is copying a buffer in
+    ready,  // Can be read, as many times as wanted, until the next request
+    reading  // A reader is copying it out
+};
+
+// get_snapshot: IN, the data is a 'header' followed by 'length' bytes of the snapshot.
+// 'length' is 0 unless 'state' is 'ready'.
+struct header {
+    uint32_t number;  // Counts the snapshots taken so a new one can be told from the previous one
+    usb_device::channel_tag tag;  // Of the buffer that was copied
+    uint16_t length;
+    uint8_t state;  // A 'buffer_snapshot::state'
+    uint8_t reserved;
+};
+static_assert(sizeof(header) == 12, "header is sent over USB so its size must not change");
+
+// Only the thread or ISR that wins the compare and exchange into 'capturing' or 'reading' touches the
+// copy, so the consumer and the readers can be in any context. A reader that loses, e.g. an ISR that
+// interrupted the consumer, is told the state rather than waiting.
+template<size_t Size>
+class slot {
+public:
+    // Any context. Asks for a copy of the next full buffer, the previous one can't be read until it's
+    // arrived. Returns false if a reader is copying the previous one out.
+    bool request() {
+        auto current = s.load(std::memory_order_relaxed);
+        for (;;) {
+            if (current == state::requested || current == state::capturing) {
+                return true;
+            } else if (current == state::reading) {
+                return false;
+            } else if (s.compare_exchange_weak(current, state::requested, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+    }
+
+    bool is_requested() const {
+        return s.load(std::memory_order_relaxed) == state::requested;
+    }
+
+    // The consumer, with a full buffer before it's released. Returns true if it was copied.
+    bool capture(const uint8_t *const data, const usb_device::channel_tag &tag) {
+        auto expected = state::requested;
+        if (!s.compare_exchange_strong(expected, state::capturing, std::memory_order_acquire)) {
+            return false;
+        }
+        memcpy(copy, data, Size);
+        info.number = ++number_of_snapshots;
+        info.tag = tag;
+        info.length = Size;
+        info.state = static_cast<uint8_t>(state::ready);
+        s.store(state::ready, std::memory_order_release);
+        return true;
+    }
+
+    // Any context. Copies the snapshot into 'data', which must have room for 'Size' bytes, if it's ready.
+    // The header is always filled in, with the state that stopped the copy if it wasn't.
+    bool read(header &h, uint8_t *const data) {
+        auto expected = state::ready;
+        if (!s.compare_exchange_strong(expected, state::reading, std::memory_order_acquire)) {
+            h = header{};
+            h.state = static_cast<uint8_t>(expected);
+            return false;
+        }
+        h = info;
+        memcpy(data, copy, Size);
+        s.store(state::ready, std::memory_order_release);
+        return true;
+    }
+
+    state get_state() const {
+        return s.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<state> s{state::empty};
+    uint32_t number_of_snapshots = 0;
+    header info = {};
+    uint8_t copy[Size];
+};
+
+}
@@ -1,125 +1,444 @@
 #include "spi-rx.h"
 
+#include "buffer-crc.h"
+#include "buffer-handoff.h"
+#include "buffer-snapshot.h"
 #include "buffers.h"
+#include "dma-buffer.h"
+#include "event-queue-stats.h"
+#include "frame-capture.h"
+#include "irq-priorities.h"
 #include "main.h"
+#include "parameters.h"
+#include "profiler.h"
+#include "tcm.h"
+#include "trace.h"
 
 #include <platform/mbed_assert.h>
-#include <rtos/ThisThread.h>
-#include <rtos/Thread.h>
 #include <targets/TARGET_STM/TARGET_STM32F7/STM32Cube_FW/STM32F7xx_HAL_Driver/stm32f7xx_hal.h>
 #include <targets/TARGET_STM/TARGET_STM32F7/STM32Cube_FW/STM32F7xx_HAL_Driver/stm32f7xx_ll_exti.h>
 #include <targets/TARGET_STM/TARGET_STM32F7/STM32Cube_FW/STM32F7xx_HAL_Driver/stm32f7xx_ll_gpio.h>
 #include <targets/TARGET_STM/TARGET_STM32F7/STM32Cube_FW/STM32F7xx_HAL_Driver/stm32f7xx_ll_system.h>
 
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cinttypes>
 #include <climits>
+#include <cstring>
 
 #undef CHECK_OVERFLOW_BUFFERS
 
+// Define SPI_RX_DMA_FIFO_BURST, e.g. in the "macros" of mbed_app.json, to use 'fifo_burst_mode' instead of 'direct_mode'.
+// Define SPI_RX_DUAL_CHANNEL to receive on SPI1 as well as SPI2, see 'spi1_channel'.
+// Define SPI_RX_NSS_FRAMED to use the SPI2 NSS pin and record where the frames start, see frame-capture.h.
+
 namespace spi_rx
 {
 
 namespace
 {
 
-extern DMA_HandleTypeDef hdma;
-
-SPI_HandleTypeDef hspi = {
-    .Instance = SPI2,
-    .Init = {
-        .Mode = SPI_MODE_SLAVE,
-        .Direction = SPI_DIRECTION_2LINES_RXONLY,  // Disable the output, MISO, although it probably doesn't make much difference.
-        .DataSize = SPI_DATASIZE_8BIT,
-        .CLKPolarity = SPI_POLARITY_LOW,
-        .CLKPhase = SPI_PHASE_1EDGE,
-        // We're not using the NSS pin hence should enable 'software slave management'.
-        // This means CR1_SSI is used instead of the NSS pin. I.e. 'SPI2->SSI |= SPI_CR1_SSI' means data will not be received.
-        // It is possible to ignore NSS and have 'software slave management' enabled or disabled.
-        // When 'software slave management' is disabled and the NSS pin is *not* configured the peripheral sees the NSS as low
-        // and the peripheral receives data.
-        // When 'software slave management' is enabled SSI defaults to 0 and again data is received without doing anything explicit.
-        // There must be some difference between setting SSI and disabling the peripheral, with CR1_SPE, but at the moment that difference
-        // is not clear to me.
-        .NSS = SPI_NSS_SOFT,
-        // Baud rate prescaler irrelevant for slave device
-        .BaudRatePrescaler = SPI_BAUDRATEPRESCALER_16,
-        .FirstBit = SPI_FIRSTBIT_MSB,
-        .TIMode = SPI_TIMODE_DISABLE,
-        .CRCCalculation = SPI_CRCCALCULATION_DISABLE,
-        .CRCPolynomial = 1,
-        .CRCLength = SPI_CRC_LENGTH_DATASIZE,
-        .NSSPMode = SPI_NSS_PULSE_DISABLE
-    },
-    .pTxBuffPtr = nullptr,
-    .TxXferSize = 0,
-    .TxXferCount = 0,
-    .pRxBuffPtr = nullptr,
-    .RxXferSize = 0,
-    .RxXferCount = 0,
-    .CRCSize = 0,
-    .RxISR = nullptr,
-    .TxISR = nullptr,
-    .hdmatx = nullptr,
-    .hdmarx = &hdma,
-    .Lock = HAL_UNLOCKED,
-    .State = HAL_SPI_STATE_RESET,
-    .ErrorCode = HAL_SPI_ERROR_NONE
+// How the DMA writes the received bytes to the buffers, selected at compile time.
+// In direct mode every byte read from the SPI data register is a separate single byte write on the AHB.
+// In FIFO mode the DMA packs the bytes into words in its 4 word FIFO and writes the FIFO to the buffer
+// as one burst of 4 words, i.e. 1 bus transaction per 16 bytes instead of 16. This is what spi-master
+// does on the transmit side. Use the 'bus-load' command to measure the difference, see bus-load.h.
+struct direct_mode {
+    static constexpr const char *name = "direct";
+    static constexpr uint32_t fifo_mode = DMA_FIFOMODE_DISABLE;
+    // In direct mode PSIZE and MSIZE should be the same.
+    // From the reference manual:
+    //     In direct mode (DMDIS = 0 in the DMA_SxFCR register), the packing/unpacking of data is
+    //     not possible. In this case, it is not allowed to have different source and destination transfer
+    //     data widths: both are equal and defined by the PSIZE bits in the DMA_SxCR register.
+    //     MSIZE bits are not relevant.
+    // Which made me think MemDataAlignment was irrelevant in direct mode.
+    // But to complicate things HAL_SPI_TransmitReceive_DMA checks MemDataAlignment when
+    // configuring the SPI FIFO threshold:
+    //       /* Set RX Fifo threshold according the reception data length: 16bit */
+    static constexpr uint32_t mem_data_alignment = DMA_MDATAALIGN_BYTE;
+    // MemBurst and PeriphBurst are ignored when the FIFO is disabled.
+    // From reference manual:
+    //     In direct mode, the stream can only generate single transfers and the MBURST[1:0] and PBURST[1:0] bits are forced by hardware.
+    static constexpr uint32_t mem_burst = DMA_MBURST_SINGLE;
+    static constexpr size_t burst_size = 1;
+};
+
+// The peripheral side stays a byte at a time, the SPI data size is 8-bits, and with MemDataAlignment
+// anything other than half-word the HAL leaves the SPI RX FIFO threshold at 8-bits so RXNE is per byte.
+// The FIFO threshold must be a whole number of bursts, a full FIFO is exactly one 4 word burst.
+struct fifo_burst_mode {
+    static constexpr const char *name = "fifo-burst";
+    static constexpr uint32_t fifo_mode = DMA_FIFOMODE_ENABLE;
+    static constexpr uint32_t mem_data_alignment = DMA_MDATAALIGN_WORD;
+    static constexpr uint32_t mem_burst = DMA_MBURST_INC4;  // MSIZE = word so max MBURST = 4, i.e. 4x4 = 16
+    static constexpr size_t burst_size = 4 * sizeof(uint32_t);
+};
+
+// From the reference manual, a burst mustn't cross a 1 KB address boundary. The buffers are aligned to
+// a cache line, see 'DMA_BUFFER', so it's enough for a buffer to be a whole number of bursts. The buffer
+// also has to be a whole number of bursts so the FIFO is empty when the DMA switches to the other buffer.
+template<typename Mode>
+constexpr bool is_valid_mode() {
+    return buffers::size_of % Mode::burst_size == 0 && dma_buffer::cache_line_size % Mode::burst_size == 0;
+}
+static_assert(is_valid_mode<direct_mode>(), "The buffers don't suit direct mode");
+static_assert(is_valid_mode<fifo_burst_mode>(), "The buffers don't suit FIFO burst mode");
+
+#if defined(SPI_RX_DMA_FIFO_BURST)
+using dma_mode = fifo_burst_mode;
+#else
+using dma_mode = direct_mode;
+#endif
+
+// The SPI and DMA configuration is the same for every channel, only the instances differ.
+SPI_HandleTypeDef make_spi_handle(SPI_TypeDef *const instance, const uint32_t nss, DMA_HandleTypeDef *const hdmarx) {
+    return {
+        .Instance = instance,
+        .Init = {
+            .Mode = SPI_MODE_SLAVE,
+            .Direction = SPI_DIRECTION_2LINES_RXONLY,  // Disable the output, MISO, although it probably doesn't make much difference.
+            .DataSize = SPI_DATASIZE_8BIT,
+            .CLKPolarity = SPI_POLARITY_LOW,
+            .CLKPhase = SPI_PHASE_1EDGE,
+            // Unless the channel is framed we're not using the NSS pin hence should enable 'software slave management'.
+            // This means CR1_SSI is used instead of the NSS pin. I.e. 'SPI2->SSI |= SPI_CR1_SSI' means data will not be received.
+            // It is possible to ignore NSS and have 'software slave management' enabled or disabled.
+            // When 'software slave management' is disabled and the NSS pin is *not* configured the peripheral sees the NSS as low
+            // and the peripheral receives data.
+            // When 'software slave management' is enabled SSI defaults to 0 and again data is received without doing anything explicit.
+            // There must be some difference between setting SSI and disabling the peripheral, with CR1_SPE, but at the moment that difference
+            // is not clear to me.
+            // With the NSS pin, 'SPI_NSS_HARD_INPUT', data is only received whilst NSS is low.
+            .NSS = nss,
+            // Baud rate prescaler irrelevant for slave device
+            .BaudRatePrescaler = SPI_BAUDRATEPRESCALER_16,
+            .FirstBit = SPI_FIRSTBIT_MSB,
+            .TIMode = SPI_TIMODE_DISABLE,
+            .CRCCalculation = SPI_CRCCALCULATION_DISABLE,
+            .CRCPolynomial = 1,
+            .CRCLength = SPI_CRC_LENGTH_DATASIZE,
+            .NSSPMode = SPI_NSS_PULSE_DISABLE
+        },
+        .pTxBuffPtr = nullptr,
+        .TxXferSize = 0,
+        .TxXferCount = 0,
+        .pRxBuffPtr = nullptr,
+        .RxXferSize = 0,
+        .RxXferCount = 0,
+        .CRCSize = 0,
+        .RxISR = nullptr,
+        .TxISR = nullptr,
+        .hdmatx = nullptr,
+        .hdmarx = hdmarx,
+        .Lock = HAL_UNLOCKED,
+        .State = HAL_SPI_STATE_RESET,
+        .ErrorCode = HAL_SPI_ERROR_NONE
+    };
+}
+
+DMA_HandleTypeDef make_dma_handle(DMA_Stream_TypeDef *const instance, const uint32_t channel, SPI_HandleTypeDef *const parent) {
+    return {
+        .Instance = instance,
+        .Init = {
+            .Channel = channel,
+            .Direction = DMA_PERIPH_TO_MEMORY,
+            .PeriphInc = DMA_PINC_DISABLE,
+            .MemInc = DMA_MINC_ENABLE,
+            .PeriphDataAlignment = DMA_PDATAALIGN_BYTE,
+            .MemDataAlignment = dma_mode::mem_data_alignment,
+            // Circular transfer will keep going until it is stopped from software.
+            .Mode = DMA_NORMAL,
+            .Priority = DMA_PRIORITY_LOW,
+            .FIFOMode = dma_mode::fifo_mode,
+            .FIFOThreshold = DMA_FIFO_THRESHOLD_FULL,
+            .MemBurst = dma_mode::mem_burst,
+            .PeriphBurst = DMA_PBURST_SINGLE
+        },
+        .Lock = HAL_UNLOCKED,
+        .State = HAL_DMA_STATE_RESET,
+        .Parent = parent,
+        .XferCpltCallback = nullptr,
+        .XferHalfCpltCallback = nullptr,
+        .XferM1CpltCallback = nullptr,
+        .XferM1HalfCpltCallback = nullptr,
+        .XferErrorCallback = nullptr,
+        .XferAbortCallback = nullptr,
+        .ErrorCode = HAL_DMA_ERROR_NONE,
+        .StreamBaseAddress = 0,
+        .StreamIndex = 0
+    };
+}
+
+// Everything that differs between the SPI instances that can be received from.
+// SPI2 is on the PMOD connector, P2, and was the only channel before there were channels.
+struct spi2_channel {
+    static constexpr uint8_t id = 0;
+#if defined(SPI_RX_NSS_FRAMED)
+    static constexpr uint32_t nss = SPI_NSS_HARD_INPUT;
+#else
+    static constexpr uint32_t nss = SPI_NSS_SOFT;
+#endif
+    static SPI_TypeDef *spi() { return SPI2; }
+    // From RM0431 Table 27 DMA1 request mapping, SPI2_RX is stream 3 channel 0.
+    static DMA_Stream_TypeDef *dma_stream() { return DMA1_Stream3; }
+    static constexpr uint32_t dma_channel = DMA_CHANNEL_0;
+    static constexpr IRQn_Type dma_irqn = DMA1_Stream3_IRQn;
+
+    static void msp_init() {
+        __HAL_RCC_SPI2_CLK_ENABLE();
+        __HAL_RCC_DMA1_CLK_ENABLE();
+        __HAL_RCC_GPIOH_CLK_ENABLE();
+        __HAL_RCC_GPIOI_CLK_ENABLE();
+
+        // PH15, PMOD SEL 0, 0 == SPI, pulled up on board
+        LL_GPIO_SetPinMode(GPIOH, LL_GPIO_PIN_15, LL_GPIO_MODE_OUTPUT);
+        LL_GPIO_SetPinSpeed(GPIOH, LL_GPIO_PIN_15, LL_GPIO_SPEED_FREQ_LOW);
+        LL_GPIO_SetPinOutputType(GPIOH, LL_GPIO_PIN_15, LL_GPIO_OUTPUT_PUSHPULL);
+        LL_GPIO_SetPinPull(GPIOH, LL_GPIO_PIN_15, LL_GPIO_PULL_NO);
+        LL_GPIO_ResetOutputPin(GPIOH, LL_GPIO_PIN_15);
+
+        // PI10, PMOD SEL 1, 0 == SPI, no strictly necessary as pulled down on board
+        LL_GPIO_SetPinMode(GPIOI, LL_GPIO_PIN_10, LL_GPIO_MODE_OUTPUT);
+        LL_GPIO_SetPinSpeed(GPIOI, LL_GPIO_PIN_10, LL_GPIO_SPEED_FREQ_LOW);
+        LL_GPIO_SetPinOutputType(GPIOI, LL_GPIO_PIN_10, LL_GPIO_OUTPUT_PUSHPULL);
+        LL_GPIO_SetPinPull(GPIOI, LL_GPIO_PIN_10, LL_GPIO_PULL_NO);
+        LL_GPIO_ResetOutputPin(GPIOI, LL_GPIO_PIN_10);
+
+        // SCLK PI1, P2 PMOD#4
+        LL_GPIO_SetPinMode(GPIOI, LL_GPIO_PIN_1, LL_GPIO_MODE_ALTERNATE);
+        LL_GPIO_SetAFPin_0_7(GPIOI, LL_GPIO_PIN_1, LL_GPIO_AF_5);
+        LL_GPIO_SetPinSpeed(GPIOI, LL_GPIO_PIN_1, LL_GPIO_SPEED_FREQ_VERY_HIGH);
+        LL_GPIO_SetPinOutputType(GPIOI, LL_GPIO_PIN_1, LL_GPIO_OUTPUT_PUSHPULL);
+        LL_GPIO_SetPinPull(GPIOI, LL_GPIO_PIN_1, LL_GPIO_PULL_NO);
+
+        // MISO PI2, P2 PMOD#3
+        LL_GPIO_SetPinMode(GPIOI, LL_GPIO_PIN_2, LL_GPIO_MODE_ALTERNATE);
+        LL_GPIO_SetAFPin_0_7(GPIOI, LL_GPIO_PIN_2, LL_GPIO_AF_5);
+        LL_GPIO_SetPinSpeed(GPIOI, LL_GPIO_PIN_2, LL_GPIO_SPEED_FREQ_VERY_HIGH);
+        LL_GPIO_SetPinPull(GPIOI, LL_GPIO_PIN_2, LL_GPIO_PULL_NO);
+
+        // MOSI PI3, P2 PMOD#2
+        LL_GPIO_SetPinMode(GPIOI, LL_GPIO_PIN_3, LL_GPIO_MODE_ALTERNATE);
+        LL_GPIO_SetAFPin_0_7(GPIOI, LL_GPIO_PIN_3, LL_GPIO_AF_5);
+        LL_GPIO_SetPinSpeed(GPIOI, LL_GPIO_PIN_3, LL_GPIO_SPEED_FREQ_VERY_HIGH);
+        LL_GPIO_SetPinOutputType(GPIOI, LL_GPIO_PIN_3, LL_GPIO_OUTPUT_PUSHPULL);
+        LL_GPIO_SetPinPull(GPIOI, LL_GPIO_PIN_3, LL_GPIO_PULL_NO);
+
+#if defined(SPI_RX_NSS_FRAMED)
+        // NSS PI0, P2 PMOD#1, pulled up so nothing is received if spi-master isn't connected.
+        // It must also be connected to the frame capture input, see frame-capture.cpp.
+        LL_GPIO_SetPinMode(GPIOI, LL_GPIO_PIN_0, LL_GPIO_MODE_ALTERNATE);
+        LL_GPIO_SetAFPin_0_7(GPIOI, LL_GPIO_PIN_0, LL_GPIO_AF_5);
+        LL_GPIO_SetPinSpeed(GPIOI, LL_GPIO_PIN_0, LL_GPIO_SPEED_FREQ_VERY_HIGH);
+        LL_GPIO_SetPinPull(GPIOI, LL_GPIO_PIN_0, LL_GPIO_PULL_UP);
+#endif
+    }
 };
 
-DMA_HandleTypeDef hdma = {
-    .Instance = DMA1_Stream3,
-    .Init = {
-        .Channel = DMA_CHANNEL_0,
-        .Direction = DMA_PERIPH_TO_MEMORY,
-        .PeriphInc = DMA_PINC_DISABLE,
-        .MemInc = DMA_MINC_ENABLE,
-        // In direct mode PSIZE and MSIZE should be the same.
-        // From the reference manual:
-        //     In direct mode (DMDIS = 0 in the DMA_SxFCR register), the packing/unpacking of data is
-        //     not possible. In this case, it is not allowed to have different source and destination transfer
-        //     data widths: both are equal and defined by the PSIZE bits in the DMA_SxCR register.
-        //     MSIZE bits are not relevant.
-        // Which made me think MemDataAlignment was irrelevant in direct mode.
-        // But to complicate things HAL_SPI_TransmitReceive_DMA checks MemDataAlignment when
-        // configuring the SPI FIFO threshold:
-        //       /* Set RX Fifo threshold according the reception data length: 16bit */
-        .PeriphDataAlignment = DMA_PDATAALIGN_BYTE,
-        .MemDataAlignment = DMA_MDATAALIGN_BYTE,
-        // Circular transfer will keep going until it is stopped from software.
-        .Mode = DMA_NORMAL,
-        .Priority = DMA_PRIORITY_LOW,
-        .FIFOMode = DMA_FIFOMODE_DISABLE,
-        .FIFOThreshold = DMA_FIFO_THRESHOLD_FULL,
-        // MemBurst and PeriphBurst are ignored when the FIFO is disabled.
-        // From reference manual:
-        //     In direct mode, the stream can only generate single transfers and the MBURST[1:0] and PBURST[1:0] bits are forced by hardware.
-        .MemBurst = DMA_MBURST_SINGLE,
-        .PeriphBurst = DMA_PBURST_SINGLE
-    },
-    .Lock = HAL_UNLOCKED,
-    .State = HAL_DMA_STATE_RESET,
-    .Parent = &hspi,
-    .XferCpltCallback = nullptr,
-    .XferHalfCpltCallback = nullptr,
-    .XferM1CpltCallback = nullptr,
-    .XferM1HalfCpltCallback = nullptr,
-    .XferErrorCallback = nullptr,
-    .XferAbortCallback = nullptr,
-    .ErrorCode = HAL_DMA_ERROR_NONE,
-    .StreamBaseAddress = 0,
-    .StreamIndex = 0
+#if defined(SPI_RX_DUAL_CHANNEL)
+// SPI1 is on the Arduino connector, only SCLK and MOSI are needed by a receive only slave.
+struct spi1_channel {
+    static constexpr uint8_t id = 1;
+    static constexpr uint32_t nss = SPI_NSS_SOFT;
+    static SPI_TypeDef *spi() { return SPI1; }
+    // From RM0431 Table 28 DMA2 request mapping, SPI1_RX is stream 0 or stream 2 channel 3.
+    // Stream 0 is used by 'buffer_crc'.
+    static DMA_Stream_TypeDef *dma_stream() { return DMA2_Stream2; }
+    static constexpr uint32_t dma_channel = DMA_CHANNEL_3;
+    static constexpr IRQn_Type dma_irqn = DMA2_Stream2_IRQn;
+
+    static void msp_init() {
+        __HAL_RCC_SPI1_CLK_ENABLE();
+        __HAL_RCC_DMA2_CLK_ENABLE();
+        __HAL_RCC_GPIOA_CLK_ENABLE();
+        __HAL_RCC_GPIOB_CLK_ENABLE();
+
+        // SCLK PA5, Arduino D13
+        LL_GPIO_SetPinMode(GPIOA, LL_GPIO_PIN_5, LL_GPIO_MODE_ALTERNATE);
+        LL_GPIO_SetAFPin_0_7(GPIOA, LL_GPIO_PIN_5, LL_GPIO_AF_5);
+        LL_GPIO_SetPinSpeed(GPIOA, LL_GPIO_PIN_5, LL_GPIO_SPEED_FREQ_VERY_HIGH);
+        LL_GPIO_SetPinOutputType(GPIOA, LL_GPIO_PIN_5, LL_GPIO_OUTPUT_PUSHPULL);
+        LL_GPIO_SetPinPull(GPIOA, LL_GPIO_PIN_5, LL_GPIO_PULL_NO);
+
+        // MOSI PB5, Arduino D11
+        LL_GPIO_SetPinMode(GPIOB, LL_GPIO_PIN_5, LL_GPIO_MODE_ALTERNATE);
+        LL_GPIO_SetAFPin_0_7(GPIOB, LL_GPIO_PIN_5, LL_GPIO_AF_5);
+        LL_GPIO_SetPinSpeed(GPIOB, LL_GPIO_PIN_5, LL_GPIO_SPEED_FREQ_VERY_HIGH);
+        LL_GPIO_SetPinOutputType(GPIOB, LL_GPIO_PIN_5, LL_GPIO_OUTPUT_PUSHPULL);
+        LL_GPIO_SetPinPull(GPIOB, LL_GPIO_PIN_5, LL_GPIO_PULL_NO);
+    }
 };
+#endif
+
+// Set by the button ISR until the pattern check has run so bouncing can't queue more than one.
+std::atomic_flag check_pending = ATOMIC_FLAG_INIT;
+
+// The overflow buffers are written by the DMA and only read when checking them, see 'find_expected_rx_pattern_'.
+// They can't be members of 'receiver' because members can't be put in a section.
+DMA_BUFFER uint8_t overflow_buffers[number_of_channels][2][buffers::size_of];
+
+// Written by the DMA ISRs when a buffer is full and read once the buffer has been taken from the full buffer queue.
+DTCM_DATA std::array<usb_device::channel_tag, buffers::number_of> tags;
+
+bool receiving = false;
+
+// Receives into the shared 'buffers' using one SPI instance in slave mode and one DMA stream in
+// double-buffer mode. The DMA ISR does the handoff, see buffer-handoff.h, so nothing else runs
+// unless there's something to do with a full buffer. Every buffer the DMA fills, including the
+// overflow buffers, gets the next sequence number so the host can tell which buffers of each
+// channel were lost.
+// The DMA ISRs of all the channels must have the same priority because 'buffer_crc' and 'tags'
+// aren't protected from each other.
+template<typename Channel>
+class receiver {
+public:
+    receiver() : hspi(make_spi_handle(Channel::spi(), Channel::nss, &hdma)), hdma(make_dma_handle(Channel::dma_stream(), Channel::dma_channel, &hspi)) {}
+
+    receiver(const receiver&) = delete;
+    receiver &operator=(const receiver&) = delete;
+
+    void init() {
+        // 'HAL_SPI_Init' calls 'HAL_SPI_MspInit' which enables the DMA clock.
+        MBED_UNUSED auto status = HAL_SPI_Init(&hspi);
+        MBED_ASSERT(status == HAL_OK);
+
+        status = HAL_DMA_Init(&hdma);
+        MBED_ASSERT(status == HAL_OK);
+
+        irq_priority::enable(Channel::dma_irqn, irq_priority::spi_dma);
+    }
+
+    void start() {
+        // Buffers should be available during initialisation but after 'stop' they could all be waiting for the USB.
+        handoff_hooks hooks;
+        uint8_t *const pData0 = buffer_handoff::arm(hooks, m0_overflow_buffer());
+        uint8_t *const pData1 = buffer_handoff::arm(hooks, m1_overflow_buffer());
+
+        // Any data received whilst stopped will have overrun.
+        __HAL_SPI_CLEAR_OVRFLAG(&hspi);
 
-const size_t stack_size = OS_STACK_SIZE; // /Normal/ stack size
-MBED_ALIGN(8) unsigned char stack[stack_size];
-rtos::Thread thread(osPriorityNormal, sizeof(stack), stack, "spi_rx");
+        // When the double-buffer mode is enabled, the circular mode is automatically enabled
+        // which means it runs continuously until stopped by the software.
+        MBED_UNUSED const auto status = HAL_SPI_Receive_MultiBufferDMA(&hspi, pData0, pData1, buffers::size_of);
+        MBED_ASSERT(status == HAL_OK);
+    }
+
+    void stop() {
+        // Returns HAL_ERROR if already stopped but I don't think it matters.
+        HAL_SPI_DMAStop(&hspi);
+        // 'HAL_SPI_DMAStop' leaves the SPI enabled, disable it so the RX FIFO doesn't overrun.
+        __HAL_SPI_DISABLE(&hspi);
+
+        release_dma_buffer(hdma.Instance->M0AR, m0_overflow_buffer());
+        release_dma_buffer(hdma.Instance->M1AR, m1_overflow_buffer());
+    }
+
+    bool owns(const SPI_HandleTypeDef *const h) const {
+        return h == &hspi;
+    }
+
+    void msp_init() {
+        Channel::msp_init();
+    }
+
+    // The DMA has switched to memory 1 so memory 0 is full.
+    void m0_complete() {
+        MBED_ASSERT((hdma.Instance->CR & DMA_SxCR_CT) == DMA_SxCR_CT);
+        buffer_complete(hdma.Instance->M0AR, m0_overflow_buffer());
+    }
+
+    // The DMA has switched to memory 0 so memory 1 is full.
+    void m1_complete() {
+        MBED_ASSERT((hdma.Instance->CR & DMA_SxCR_CT) == 0);
+        buffer_complete(hdma.Instance->M1AR, m1_overflow_buffer());
+    }
+
+    void dma_irq_handler() {
+        HAL_DMA_IRQHandler(&hdma);
+    }
+
+    // Where the DMA will write the next byte received, false if it's writing to an overflow buffer.
+    // Only consistent whilst the SPI isn't being clocked or from an ISR of the same priority as the DMA's.
+    bool position(uint8_t *&buffer_ptr, uint16_t &offset) const {
+        const auto m1 = (hdma.Instance->CR & DMA_SxCR_CT) == DMA_SxCR_CT;
+        buffer_ptr = reinterpret_cast<uint8_t*>(m1 ? hdma.Instance->M1AR : hdma.Instance->M0AR);
+        // NDTR counts down the bytes remaining, when it reaches 0 the DMA reloads it and switches buffer.
+        offset = buffers::size_of - hdma.Instance->NDTR;
+        return buffer_ptr != (m1 ? m1_overflow_buffer() : m0_overflow_buffer());
+    }
 
-const uint32_t rx_complete_flag = 1 << 0;
+    // Every buffer the DMA has filled, wraps.
+    uint16_t buffers_filled() const {
+        return next_sequence.load(std::memory_order_relaxed);
+    }
+
+    static uint8_t *m0_overflow_buffer() { return &overflow_buffers[Channel::id][0][0]; }
+    static uint8_t *m1_overflow_buffer() { return &overflow_buffers[Channel::id][1][0]; }
+
+private:
+    // See buffer-handoff.h.
+    struct handoff_hooks {
+        void full(uint8_t *const buffer_ptr, const uint16_t sequence) {
+            tags[buffers::index_of(buffer_ptr)] = { Channel::id, 0, sequence };
+            buffer_crc::submit(buffer_ptr);
+            trace::write(trace::event::spi_buffer_full, Channel::id, sequence);
+        }
+
+        void overflowed(const uint16_t sequence) {
+            trace::write(trace::event::spi_overflow, Channel::id, sequence);
+        }
+
+        uint8_t *get_empty() {
+            return buffers::get_empty_buffer();
+        }
 
-std::atomic_flag led_dwell = ATOMIC_FLAG_INIT;
+        void no_empty() {
+            parameters::increment(parameters::id::spi_overflows);
+        }
+
+        void armed(const uint8_t *const buffer_ptr) {
+            frame_capture::buffer_armed(buffer_ptr);
+        }
+    };
+
+    void buffer_complete(volatile uint32_t &memory_address, uint8_t *const overflow_buffer) {
+        // Only this ISR writes the sequence number so there's no need for a read-modify-write.
+        const auto sequence = next_sequence.load(std::memory_order_relaxed);
+        next_sequence.store(sequence + 1, std::memory_order_relaxed);
 
-uint8_t m0_overflow_buffer[buffers::size_of];
-uint8_t m1_overflow_buffer[buffers::size_of];
+        handoff_hooks hooks;
+        uint8_t *const full_buffer_ptr = reinterpret_cast<uint8_t*>(memory_address);
+        memory_address = reinterpret_cast<uint32_t>(buffer_handoff::buffer_complete(hooks, full_buffer_ptr, overflow_buffer, sequence));
+    }
+
+    // The data in the buffer is lost, it was only partially filled.
+    static void release_dma_buffer(const uint32_t address, const uint8_t *const overflow_buffer) {
+        uint8_t *const buffer_ptr = reinterpret_cast<uint8_t*>(address);
+        if (buffer_ptr != overflow_buffer) {
+            buffers::set_buffer_empty(buffer_ptr);
+        }
+    }
+
+    SPI_HandleTypeDef hspi;
+    DMA_HandleTypeDef hdma;
+    std::atomic<uint16_t> next_sequence{0};
+};
+
+// The handles are read by every DMA interrupt so they're in the DTCM, see tcm.h.
+DTCM_DATA receiver<spi2_channel> spi2_receiver;
+#if defined(SPI_RX_DUAL_CHANNEL)
+DTCM_DATA receiver<spi1_channel> spi1_receiver;
+#endif
+
+template<typename Function>
+void for_each_receiver(Function function) {
+    function(spi2_receiver);
+#if defined(SPI_RX_DUAL_CHANNEL)
+    function(spi1_receiver);
+#endif
+}
 
 // 'spi-master' repeatedly transmits 4 characters, 's', 'p', 'i' and ' '.
 // There is no synchronisation so these will end up in the SPI rx buffer with an unknown bit offset.
@@ -139,37 +458,9 @@ const union byte_array_to_word_hack {
 const auto num_bits = sizeof(expected) * CHAR_BIT;
 std::array<uint32_t, num_bits> possible_rx_patterns;
 
-void spi_init() {
-    MBED_UNUSED const auto status = HAL_SPI_Init(&hspi);
-    MBED_ASSERT(status == HAL_OK);
-}
-
-void dma_init() {
-    __HAL_RCC_DMA1_CLK_ENABLE();
-
-    MBED_UNUSED const auto status = HAL_DMA_Init(&hdma);
-    MBED_ASSERT(status == HAL_OK);
-
-    HAL_NVIC_SetPriority(DMA1_Stream3_IRQn, 1, 0);
-    HAL_NVIC_EnableIRQ(DMA1_Stream3_IRQn);
-}
-
-// Use red LED to indicate receiving SPI data.
-void led_init() {
-    __HAL_RCC_GPIOA_CLK_ENABLE();
-
-    // PA7, SYS_LD_USER1, red
-    LL_GPIO_SetPinMode(GPIOA, LL_GPIO_PIN_7, LL_GPIO_MODE_OUTPUT);
-    LL_GPIO_SetPinSpeed(GPIOA, LL_GPIO_PIN_7, LL_GPIO_SPEED_FREQ_LOW);
-    LL_GPIO_SetPinOutputType(GPIOA, LL_GPIO_PIN_7, LL_GPIO_OUTPUT_PUSHPULL);
-    LL_GPIO_SetPinPull(GPIOA, LL_GPIO_PIN_7, LL_GPIO_PULL_NO);
-    LL_GPIO_ResetOutputPin(GPIOA, LL_GPIO_PIN_7);
-}
-
 // Use blue user button to request data check.
 void button_init() {
-    // GPIOA already enabled by led_init.
-    // __HAL_RCC_GPIOA_CLK_ENABLE();
+    __HAL_RCC_GPIOA_CLK_ENABLE();
 
     // PA0, SYS_B_USER, blue, pulled down on the board
     LL_GPIO_SetPinMode(GPIOA, LL_GPIO_PIN_0, LL_GPIO_MODE_INPUT);
@@ -180,8 +471,7 @@ void button_init() {
     LL_EXTI_EnableFallingTrig_0_31(LL_EXTI_LINE_0);
     LL_EXTI_ClearFlag_0_31(LL_EXTI_LINE_0);
 
-    HAL_NVIC_SetPriority(EXTI0_IRQn, 15, 15);
-    HAL_NVIC_EnableIRQ(EXTI0_IRQn);
+    irq_priority::enable(EXTI0_IRQn, irq_priority::button);
 }
 
 uint32_t rotate_word(const uint32_t word, const uint32_t shift) {
@@ -196,31 +486,49 @@ void possible_rx_patterns_init() {
 
 #if !defined(CHECK_OVERFLOW_BUFFERS)
 
+// The snapshot is taken the next time the USB consumer takes a full buffer, every few hundred us whilst streaming.
+const auto snapshot_wait = std::chrono::milliseconds(20);
+
+void check_snapshot_pattern() {
+    // Static because it's a buffer's worth and the event queue's thread has the main stack.
+    static uint8_t snapshot[buffer_snapshot::max_response_length];
+    if (buffer_snapshot::read(snapshot) == sizeof(buffer_snapshot::header)) {
+        puts("no snapshot, the host has to be reading unless streaming is 0");
+        return;
+    }
+
+    uint32_t rx_pattern[4];
+    memcpy(rx_pattern, &snapshot[sizeof(buffer_snapshot::header)], sizeof(rx_pattern));
+    printf("rx_pattern 0x%" PRIx32 " 0x%" PRIx32 " 0x%" PRIx32 " 0x%" PRIx32 "\n", rx_pattern[0], rx_pattern[1], rx_pattern[2], rx_pattern[3]);
+    bool rx_pattern_recognised = false;
+    for (auto shift = 0u; shift < num_bits; ++shift) {
+        if (rx_pattern[0] == possible_rx_patterns[shift]) {
+            rx_pattern_recognised = true;
+            break;
+        }
+    }
+    if (!rx_pattern_recognised) {
+        puts("rx_pattern unrecognised");
+    }
+}
+
 void find_expected_rx_pattern() {
     puts("check buffers");
 
     // Only check 1 full buffer, I think it's enough for now.
     // The goal is to perform this check on the host.
-    const auto buffer_ptr = buffers::peek_full_buffer();
-    if (buffer_ptr != nullptr) {
-        const uint32_t *const rx_pattern = reinterpret_cast<uint32_t*>(buffer_ptr);
-        printf("rx_pattern 0x%" PRIx32 " 0x%" PRIx32 " 0x%" PRIx32 " 0x%" PRIx32 "\n", *rx_pattern, *(rx_pattern + 1), *(rx_pattern + 2), *(rx_pattern + 3));
-        bool rx_pattern_recognised = false;
-        for (auto shift = 0u; shift < num_bits; ++shift) {
-            if (*rx_pattern == possible_rx_patterns[shift]) {
-                rx_pattern_recognised = true;
-                break;
-            }
-        }
-        if (!rx_pattern_recognised) {
-            puts("rx_pattern unrecognised");
-        }
+    // A copy is checked because the buffer itself could be refilled by the DMA whilst it's being read.
+    if (buffer_snapshot::request()) {
+        event_queue_stats::call_in(snapshot_wait, check_snapshot_pattern);
+    } else {
+        puts("the previous snapshot is being read");
     }
 }
 
 #else
 
 void find_expected_rx_pattern_(uint8_t *buffer_ptr, const size_t length) {
+    dma_buffer::invalidate(buffer_ptr, length);
     const uint32_t *rx_pattern = reinterpret_cast<uint32_t*>(buffer_ptr);
     printf("rx_pattern 0x%" PRIx32 "\n", *rx_pattern);
     bool rx_pattern_recognised = false;
@@ -240,147 +548,125 @@ void find_expected_rx_pattern_(uint8_t *buffer_ptr, const size_t length) {
         if (((i + 1) % 8) == 0) putchar('\n');
     }
     memset(buffer_ptr, 0, length);
+    dma_buffer::clean(buffer_ptr, length);
 }
 
 void find_expected_rx_pattern() {
-    puts("check m0_overflow_buffer");
-    find_expected_rx_pattern_(&m0_overflow_buffer[0], sizeof(m0_overflow_buffer));
+    for (auto channel = 0u; channel < number_of_channels; ++channel) {
+        printf("check channel %u m0 overflow buffer\n", channel);
+        find_expected_rx_pattern_(&overflow_buffers[channel][0][0], buffers::size_of);
 
-    puts("check m1_overflow_buffer");
-    find_expected_rx_pattern_(&m1_overflow_buffer[0], sizeof(m1_overflow_buffer));
+        printf("check channel %u m1 overflow buffer\n", channel);
+        find_expected_rx_pattern_(&overflow_buffers[channel][1][0], buffers::size_of);
+    }
 }
 
 #endif
 
-void toggle_led() {
-    if (!led_dwell.test_and_set()) {
-        using std::chrono_literals::operator""ms;
-
-        LL_GPIO_TogglePin(GPIOA, LL_GPIO_PIN_7);
+void button_pressed_check() {
+    check_pending.clear();
+    find_expected_rx_pattern();
+}
 
-        MBED_UNUSED const auto id = event_queue.call_in(500ms, mbed::callback(&led_dwell, &std::atomic_flag::clear), std::memory_order_seq_cst);
-        MBED_ASSERT(id != 0);
-    }
 }
 
-void spi_rx() {
-    spi_init();
-    dma_init();
-    led_init();
+void init() {
+    for_each_receiver([](auto &r) { r.init(); });
     button_init();
 
     possible_rx_patterns_init();
 
-    // Assume buffers available during initialisation.
-    uint8_t *const pData0 = buffers::get_empty_buffer();
-    MBED_ASSERT(pData0 != nullptr);
-    uint8_t *const pData1 = buffers::get_empty_buffer();
-    MBED_ASSERT(pData1 != nullptr);
+    start();
+}
 
-    // When the double-buffer mode is enabled, the circular mode is automatically enabled
-    // which means it runs continuously until stopped by the software.
-    MBED_UNUSED const auto status = HAL_SPI_Receive_MultiBufferDMA(&hspi, pData0, pData1, buffers::size_of);
-    MBED_ASSERT(status == HAL_OK);
+const char *dma_mode_name() {
+    return dma_mode::name;
+}
 
-    while (1) {
-        const auto result = rtos::ThisThread::flags_wait_all(rx_complete_flag);
-        MBED_ASSERT(!(result & osFlagsError));
+void start() {
+    if (receiving) {
+        return;
     }
+
+    frame_capture::started();
+    for_each_receiver([](auto &r) { r.start(); });
+
+    receiving = true;
 }
 
+void stop() {
+    if (!receiving) {
+        return;
+    }
+
+    for_each_receiver([](auto &r) { r.stop(); });
+
+    receiving = false;
 }
 
-void init() {
-    MBED_UNUSED const auto status = thread.start(spi_rx);
-    MBED_ASSERT(status == osOK);
+usb_device::channel_tag get_tag(const uint8_t *const buffer_ptr) {
+    return tags[buffers::index_of(buffer_ptr)];
+}
+
+uint32_t buffers_filled() {
+    uint32_t count = 0;
+    for_each_receiver([&count](const auto &r) { count += r.buffers_filled(); });
+    return count;
+}
+
+bool framed_position(uint8_t *&buffer_ptr, uint16_t &offset) {
+    return spi2_receiver.position(buffer_ptr, offset);
 }
 
 // Override /weak/ implementation provided by stm32f7xx_hal_spi.c.
 // The clocks and IO could just be initialised before calling 'HAL_SPI_Init'
 // but this method is a common theme in all HAL drivers so I'm going to
 // give it a go here.
-extern "C" void HAL_SPI_MspInit(SPI_HandleTypeDef *) {
-    __HAL_RCC_SPI2_CLK_ENABLE();
-    __HAL_RCC_GPIOH_CLK_ENABLE();
-    __HAL_RCC_GPIOI_CLK_ENABLE();
-
-    // PH15, PMOD SEL 0, 0 == SPI, pulled up on board
-    LL_GPIO_SetPinMode(GPIOH, LL_GPIO_PIN_15, LL_GPIO_MODE_OUTPUT);
-    LL_GPIO_SetPinSpeed(GPIOH, LL_GPIO_PIN_15, LL_GPIO_SPEED_FREQ_LOW);
-    LL_GPIO_SetPinOutputType(GPIOH, LL_GPIO_PIN_15, LL_GPIO_OUTPUT_PUSHPULL);
-    LL_GPIO_SetPinPull(GPIOH, LL_GPIO_PIN_15, LL_GPIO_PULL_NO);
-    LL_GPIO_ResetOutputPin(GPIOH, LL_GPIO_PIN_15);
-
-    // PI10, PMOD SEL 1, 0 == SPI, no strictly necessary as pulled down on board
-    LL_GPIO_SetPinMode(GPIOI, LL_GPIO_PIN_10, LL_GPIO_MODE_OUTPUT);
-    LL_GPIO_SetPinSpeed(GPIOI, LL_GPIO_PIN_10, LL_GPIO_SPEED_FREQ_LOW);
-    LL_GPIO_SetPinOutputType(GPIOI, LL_GPIO_PIN_10, LL_GPIO_OUTPUT_PUSHPULL);
-    LL_GPIO_SetPinPull(GPIOI, LL_GPIO_PIN_10, LL_GPIO_PULL_NO);
-    LL_GPIO_ResetOutputPin(GPIOI, LL_GPIO_PIN_10);
-
-    // SCLK PI1, P2 PMOD#4
-    LL_GPIO_SetPinMode(GPIOI, LL_GPIO_PIN_1, LL_GPIO_MODE_ALTERNATE);
-    LL_GPIO_SetAFPin_0_7(GPIOI, LL_GPIO_PIN_1, LL_GPIO_AF_5);
-    LL_GPIO_SetPinSpeed(GPIOI, LL_GPIO_PIN_1, LL_GPIO_SPEED_FREQ_VERY_HIGH);
-    LL_GPIO_SetPinOutputType(GPIOI, LL_GPIO_PIN_1, LL_GPIO_OUTPUT_PUSHPULL);
-    LL_GPIO_SetPinPull(GPIOI, LL_GPIO_PIN_1, LL_GPIO_PULL_NO);
-
-    // MISO PI2, P2 PMOD#3
-    LL_GPIO_SetPinMode(GPIOI, LL_GPIO_PIN_2, LL_GPIO_MODE_ALTERNATE);
-    LL_GPIO_SetAFPin_0_7(GPIOI, LL_GPIO_PIN_2, LL_GPIO_AF_5);
-    LL_GPIO_SetPinSpeed(GPIOI, LL_GPIO_PIN_2, LL_GPIO_SPEED_FREQ_VERY_HIGH);
-    LL_GPIO_SetPinPull(GPIOI, LL_GPIO_PIN_2, LL_GPIO_PULL_NO);
-
-    // MOSI PI3, P2 PMOD#2
-    LL_GPIO_SetPinMode(GPIOI, LL_GPIO_PIN_3, LL_GPIO_MODE_ALTERNATE);
-    LL_GPIO_SetAFPin_0_7(GPIOI, LL_GPIO_PIN_3, LL_GPIO_AF_5);
-    LL_GPIO_SetPinSpeed(GPIOI, LL_GPIO_PIN_3, LL_GPIO_SPEED_FREQ_VERY_HIGH);
-    LL_GPIO_SetPinOutputType(GPIOI, LL_GPIO_PIN_3, LL_GPIO_OUTPUT_PUSHPULL);
-    LL_GPIO_SetPinPull(GPIOI, LL_GPIO_PIN_3, LL_GPIO_PULL_NO);
+extern "C" void HAL_SPI_MspInit(SPI_HandleTypeDef *hspi) {
+    for_each_receiver([hspi](auto &r) {
+        if (r.owns(hspi)) {
+            r.msp_init();
+        }
+    });
 }
 
 // Override /weak/ implementation provided by stm32f7xx_hal_spi.c.
-extern "C" void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef *hspi) {
-    toggle_led();
-
-    MBED_UNUSED const auto result = thread.flags_set(rx_complete_flag);
-    MBED_ASSERT(!(result & osFlagsError));
-
-    MBED_ASSERT((hdma.Instance->CR & DMA_SxCR_CT) == DMA_SxCR_CT);
-    uint8_t *const full_buffer_ptr = reinterpret_cast<uint8_t*>(hdma.Instance->M0AR);
-    if (full_buffer_ptr != &m0_overflow_buffer[0]) {
-        buffers::set_buffer_full(full_buffer_ptr);
-    }
-    uint8_t *const empty_buffer_ptr = buffers::get_empty_buffer();
-    uint8_t *const buffer_ptr = empty_buffer_ptr != nullptr ? empty_buffer_ptr : &m0_overflow_buffer[0];
-    hdma.Instance->M0AR = reinterpret_cast<uint32_t>(buffer_ptr);
+extern "C" ITCM_CODE void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef *hspi) {
+    for_each_receiver([hspi](auto &r) {
+        if (r.owns(hspi)) {
+            r.m0_complete();
+        }
+    });
 }
 
-extern "C" void HAL_SPI_M1RxCpltCallback(SPI_HandleTypeDef *hspi) {
-    toggle_led();
-
-    MBED_UNUSED const auto result = thread.flags_set(rx_complete_flag);
-    MBED_ASSERT(!(result & osFlagsError));
+extern "C" ITCM_CODE void HAL_SPI_M1RxCpltCallback(SPI_HandleTypeDef *hspi) {
+    for_each_receiver([hspi](auto &r) {
+        if (r.owns(hspi)) {
+            r.m1_complete();
+        }
+    });
+}
 
-    MBED_ASSERT((hdma.Instance->CR & DMA_SxCR_CT) == 0);
-    uint8_t *const full_buffer_ptr = reinterpret_cast<uint8_t*>(hdma.Instance->M1AR);
-    if (full_buffer_ptr != &m1_overflow_buffer[0]) {
-        buffers::set_buffer_full(full_buffer_ptr);
-    }
-    uint8_t *const empty_buffer_ptr = buffers::get_empty_buffer();
-    uint8_t *const buffer_ptr = empty_buffer_ptr != nullptr ? empty_buffer_ptr : &m1_overflow_buffer[0];
-    hdma.Instance->M1AR = reinterpret_cast<uint32_t>(buffer_ptr);
+// Override /weak/ implementation provided by startup_stm32f723xx.s.
+extern "C" ITCM_CODE void DMA1_Stream3_IRQHandler() {
+    profiler::scoped_probe probe(profiler::probe::spi_dma_isr);
+    spi2_receiver.dma_irq_handler();
 }
 
+#if defined(SPI_RX_DUAL_CHANNEL)
 // Override /weak/ implementation provided by startup_stm32f723xx.s.
-extern "C" void DMA1_Stream3_IRQHandler() {
-    HAL_DMA_IRQHandler(&hdma);
+extern "C" ITCM_CODE void DMA2_Stream2_IRQHandler() {
+    profiler::scoped_probe probe(profiler::probe::spi_dma_isr);
+    spi1_receiver.dma_irq_handler();
 }
+#endif
 
 // Override /weak/ implementation provided by startup_stm32f723xx.s.
 extern "C" void EXTI0_IRQHandler() {
     if (LL_EXTI_IsActiveFlag_0_31(LL_EXTI_LINE_0)) {
-        event_queue.call(find_expected_rx_pattern);
+        if (!check_pending.test_and_set()) {
+            event_queue_stats::call(button_pressed_check);
+        }
 
         LL_EXTI_ClearFlag_0_31(LL_EXTI_LINE_0);
     }
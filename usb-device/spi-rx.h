@@ -1,8 +1,40 @@
 #pragma once
 
+#include "usb-device.h"
+
+#include <cstddef>
+#include <cstdint>
+
 namespace spi_rx
 {
 
+// Each SPI instance being received from is a channel, see 'SPI_RX_DUAL_CHANNEL' in spi-rx.cpp.
+// All the channels share 'buffers', the host uses the tags to separate them.
+#if defined(SPI_RX_DUAL_CHANNEL)
+const size_t number_of_channels = 2;
+#else
+const size_t number_of_channels = 1;
+#endif
+
+// Called from 'main', the receiving is done by the DMA ISRs from then on.
 void init();
 
+// Start and stop receiving, called from the event queue.
+void start();
+void stop();
+
+// The DMA mode selected at compile time, see 'SPI_RX_DMA_FIFO_BURST' in spi-rx.cpp.
+const char *dma_mode_name();
+
+// The channel and sequence number of a full buffer.
+usb_device::channel_tag get_tag(const uint8_t *const buffer_ptr);
+
+// The number of buffers the DMA has filled on all the channels, including the overflow buffers.
+// It wraps so it's only good for seeing if there's been any activity, see activity-led.h.
+uint32_t buffers_filled();
+
+// Where the next byte received on the framed channel, SPI2, will be written, see frame-capture.h.
+// Returns false if there wasn't an empty buffer so the byte will be lost.
+bool framed_position(uint8_t *&buffer_ptr, uint16_t &offset);
+
 }
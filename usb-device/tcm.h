@@ -0,0 +1,15 @@
+#pragma once
+
+// The ITCM and DTCM are zero wait state memories on the M7's own buses, they don't go through the
+// caches or the AXI bus matrix so an ISR running from them takes the same time however busy the
+// DMA engines are and whatever the caches hold. They're small, 16 KB and 64 KB less the ISR stack,
+// so only the ISRs' hot paths and the data they touch on every interrupt go in them, see STM32F723xE.ld.
+// Reset_Handler copies both from flash before the C library starts. 'usb-host placement' checks
+// the link map against placement-rules.txt so they can't quietly drop out.
+//
+// The ITCM isn't reachable by the DMA engines so nothing a DMA engine reads or writes can be in it.
+// Calls between the ITCM and flash are out of range of a BL, the linker adds veneers for them.
+#define ITCM_CODE __attribute__((section(".itcm_text"), noinline))
+
+// DMA buffers stay in '.dma_buffers' in SRAM1, see dma-buffer.h.
+#define DTCM_DATA __attribute__((section(".dtcm_data")))
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <atomic>
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Binary trace records, the ring they are written into and the format they are read out in.
+// Shared with usb-host, which keeps the decoding.
+// Only the event ids are used by usb-device so the names and formats aren't linked into it.
+namespace trace
+{
+
+enum class event: uint16_t {
+    spi_buffer_full,
+    spi_overflow,
+    iso_transmit,
+    bulk_transmit,
+    usb_reset,
+    bulk_out_received,
+    parameter_set,
+    number_of
+};
+
+const size_t number_of_events = static_cast<size_t>(event::number_of);
+
+// Each format is given the 2 arguments as unsigned ints.
+struct event_description {
+    const char *name;
+    const char *format;
+};
+
+const event_description event_descriptions[number_of_events] = {
+    { "spi_buffer_full", "channel %u sequence %u" },
+    { "spi_overflow", "channel %u sequence %u" },
+    { "iso_transmit", "buffers %u payload %u bytes" },
+    { "bulk_transmit", "buffers %u length %u bytes" },
+    { "usb_reset", "" },
+    { "bulk_out_received", "length %u bytes" },
+    { "parameter_set", "parameter %u value %u" }
+};
+
+// The DWT cycle counter, see profiler.h.
+const uint32_t timestamp_hz = 216000000;
+
+// The sequence is the low bits of the record's position in the ring, the reader uses it to tell a
+// record that's been written from one that's still being written or has already been overwritten.
+struct record {
+    uint16_t id;
+    uint16_t sequence;
+    uint32_t timestamp;
+    uint32_t args[2];
+};
+static_assert(sizeof(record) == 16, "record is sent over USB so its size must not change");
+
+// get_trace: IN, the data is a 'block_header' followed by the records, oldest first.
+// The data stage is short when there are fewer records, an empty block means there are none.
+struct block_header {
+    uint32_t lost;  // Records overwritten before they were read since the previous block
+    uint16_t number_of_records;
+    uint16_t reserved;
+};
+static_assert(sizeof(block_header) == 8, "block_header is sent over USB so its size must not change");
+
+const size_t max_records_per_block = 32;
+const size_t max_block_size = sizeof(block_header) + max_records_per_block * sizeof(record);
+
+// Written from any context without locking, each writer claims a record with an atomic increment.
+// A writer interrupted by another just means their records are in the order they were claimed,
+// not the order their timestamps were taken. There must only be one reader at a time.
+template<size_t Size>
+class ring {
+    static_assert(Size != 0 && (Size & (Size - 1)) == 0, "Size must be a power of 2 so the indexes can wrap");
+    static_assert(Size <= UINT16_MAX / 2, "The sequence must tell a lapped record from a new one");
+
+public:
+    ring() {
+        clear();
+    }
+
+    void write(const event e, const uint32_t timestamp, const uint32_t arg0, const uint32_t arg1) {
+        const uint32_t index = write_index.fetch_add(1, std::memory_order_relaxed);
+        auto &r = records[index % Size];
+        r.id = static_cast<uint16_t>(e);
+        r.timestamp = timestamp;
+        r.args[0] = arg0;
+        r.args[1] = arg1;
+        std::atomic_thread_fence(std::memory_order_release);
+        r.sequence = static_cast<uint16_t>(index);
+    }
+
+    // Copies up to 'max' records, oldest first, and counts the records lost since the previous read.
+    // Stops early at a record that's still being written.
+    size_t read(record *const out, const size_t max, uint32_t &lost) {
+        lost = 0;
+        size_t count = 0;
+        while (count < max) {
+            const uint32_t written = write_index.load(std::memory_order_acquire);
+            if (written - read_index > Size) {
+                lost += written - read_index - Size;
+                read_index = written - Size;
+            }
+            if (read_index == written) {
+                break;
+            }
+
+            const auto &r = records[read_index % Size];
+            const uint16_t expected = static_cast<uint16_t>(read_index);
+            const uint16_t before = r.sequence;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            out[count] = r;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (before != expected || r.sequence != expected) {
+                // Not finished yet, or overwritten whilst it was being copied, in which case
+                // the next time round the loop counts it as lost.
+                if (write_index.load(std::memory_order_acquire) - read_index <= Size) {
+                    break;
+                }
+                continue;
+            }
+            out[count].sequence = expected;
+            ++count;
+            ++read_index;
+        }
+        return count;
+    }
+
+    // Forgets everything written so far. Anything being written at the same time might be lost too.
+    void clear() {
+        read_index = write_index.load(std::memory_order_acquire);
+        for (auto i = 0u; i < Size; ++i) {
+            // Never the sequence of the record that will be written there next.
+            records[i].sequence = static_cast<uint16_t>(read_index + i + Size);
+        }
+    }
+
+private:
+    std::atomic<uint32_t> write_index{0};
+    uint32_t read_index = 0;
+    record records[Size];
+};
+
+// The "trace" command prints each record as a line, in hex: lost, id, sequence, timestamp, arg0 and arg1.
+// The lost count is only non-zero on the first line after a loss.
+const char *const dump_line_format = "T %" PRIx32 " %x %x %" PRIx32 " %" PRIx32 " %" PRIx32 "\n";
+
+// Writes a block for the records, returns its length. 'data' must have room for 'max_block_size'.
+inline size_t encode_block(uint8_t *const data, const record *const records, const size_t number_of_records, const uint32_t lost) {
+    const block_header header = { lost, static_cast<uint16_t>(number_of_records), 0 };
+    memcpy(data, &header, sizeof(header));
+    memcpy(data + sizeof(header), records, number_of_records * sizeof(record));
+    return sizeof(header) + number_of_records * sizeof(record);
+}
+
+}
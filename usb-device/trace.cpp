@@ -1,16 +1,75 @@
 #include "trace.h"
 
-#include "serial-mutex.h"
+#include "console-output.h"
+#include "tcm.h"
 
+#include <features/frameworks/mbed-client-cli/mbed-client-cli/ns_cmdline.h>
 #include <features/frameworks/mbed-trace/mbed-trace/mbed_trace.h>
+#include <rtos/Mutex.h>
+
+#include <cinttypes>
 
 namespace trace {
 
+namespace
+{
+
+// 4 KB, at a few records per SPI buffer that's about 10 ms of streaming.
+const size_t ring_size = 256;
+DTCM_DATA ring<ring_size> records;
+
+// mbed_trace's own line buffer needs a mutex but not the command line's, its lines go straight
+// into the console ring so a trace never waits for the command line to finish printing.
+rtos::Mutex line_mutex;
+
+void line_lock() {
+    line_mutex.lock();
+}
+
+void line_unlock() {
+    line_mutex.unlock();
+}
+
+}
+
+ITCM_CODE void write(const event e, const uint32_t arg0, const uint32_t arg1) {
+    records.write(e, DWT->CYCCNT, arg0, arg1);
+}
+
+size_t read(record *const out, const size_t max, uint32_t &lost) {
+    const auto primask = __get_PRIMASK();
+    __disable_irq();
+    const auto count = records.read(out, max, lost);
+    __set_PRIMASK(primask);
+    return count;
+}
+
+// See 'dump_line_format'. At most a ring's worth is printed, otherwise it would never finish whilst streaming.
+void dump() {
+    record block[max_records_per_block];
+    uint32_t lost;
+    size_t count;
+    for (size_t total = 0; total < ring_size && (count = read(block, max_records_per_block, lost)) != 0; total += count) {
+        for (auto i = 0u; i < count; ++i) {
+            const auto &r = block[i];
+            cmd_printf(dump_line_format, i == 0 ? lost : 0, r.id, r.sequence, r.timestamp, r.args[0], r.args[1]);
+        }
+    }
+}
+
+void clear() {
+    const auto primask = __get_PRIMASK();
+    __disable_irq();
+    records.clear();
+    __set_PRIMASK(primask);
+}
+
 void init() {
-    mbed_trace_mutex_wait_function_set(serial_mutex::out_lock);
-    mbed_trace_mutex_release_function_set(serial_mutex::out_unlock);
+    mbed_trace_mutex_wait_function_set(line_lock);
+    mbed_trace_mutex_release_function_set(line_unlock);
 
     mbed_trace_init();
+    mbed_trace_print_function_set(console_output::trace_print);
 }
 
 }
@@ -1,7 +1,28 @@
 #pragma once
 
+#include "trace-records.h"
+
+#include <targets/TARGET_STM/TARGET_STM32F7/STM32Cube_FW/STM32F7xx_HAL_Driver/stm32f7xx_hal.h>
+
+#include <cstddef>
+
 namespace trace {
 
+// mbed_trace formats lines into the console ring, see console-output.h, which drops them when it's
+// full, it's far too slow to leave on whilst streaming. 'write' only puts a 'trace::record' into a RAM ring so it
+// can be used from any context, including ISRs. The ring is read out with the get_trace vendor
+// request, see 'usb_device::vendor_request', or dumped with the "trace" command, and usb-host
+// decodes it. The timestamps come from the DWT cycle counter so 'profiler::init' must be called first.
+void write(const event e, const uint32_t arg0 = 0, const uint32_t arg1 = 0);
+
+// The only reader of the ring, see 'ring::read'. Called by the OTG ISR and the command line
+// thread so the reading is done with interrupts disabled.
+size_t read(record *const records, const size_t max, uint32_t &lost);
+
+// Prints the records as hex, one per line, for 'usb-host trace-decode'.
+void dump();
+void clear();
+
 void init();
 
 }
@@ -1,8 +1,86 @@
 #pragma once
 
+#include <cstdint>
+
 namespace usb_device
 {
 
 const auto bulk_transfer_length = 1024;
 
+// In loopback mode bulk OUT packets are received into the SPI buffers, see 'out_consumer_t' in parameter-table.h,
+// so this many can be in the device at once.
+const auto loopback_buffers = 8;
+
+// Interface 0 alternate setting 1 replaces the bulk endpoints with a high-bandwidth isochronous IN endpoint.
+const uint8_t bulk_alternate_setting = 0;
+const uint8_t iso_alternate_setting = 1;
+
+// From 5.6.3 Isochronous Transfer Packet Size Constraints, a high-bandwidth endpoint
+// can do up to 3 transactions of 1024 bytes per microframe.
+const auto iso_packet_size = 1024;
+const auto iso_transactions_per_microframe = 3;
+const auto iso_max_microframe_payload = iso_packet_size * iso_transactions_per_microframe;
+
+// Every isochronous microframe payload starts with this header. The host uses the sequence
+// number to detect lost microframes because isochronous transfers are never retried.
+struct iso_header {
+    uint32_t sequence;
+    uint16_t length;  // Number of bytes following the header
+    uint16_t flags;  // See 'header_flag_crc32', 'header_flag_channel_tag' and 'header_flag_frames'
+};
+static_assert(sizeof(iso_header) == 8, "The header is shared with usb-host");
+
+// With the 'crc' parameter on, every buffer in an isochronous or framed bulk payload is followed by the
+// CRC of the buffer, little endian. It's the common CRC-32, i.e. the one used by zlib and Ethernet:
+// polynomial 0x04c11db7 reflected, initial value 0xffffffff and final XOR 0xffffffff.
+const uint16_t header_flag_crc32 = 1 << 0;
+const auto crc32_trailer_size = 4;
+const auto crc32_buffer_size = 512;  // The size of the SPI buffers, i.e. the number of bytes each CRC covers
+
+// With the 'channel-tags' parameter on, every buffer in an isochronous or framed bulk payload is followed by
+// the tag of the SPI channel it was received from, after the CRC if there is one. Each channel numbers its
+// buffers so the host can tell which buffers were lost, e.g. overwritten because the USB didn't keep up.
+const uint16_t header_flag_channel_tag = 1 << 1;
+struct channel_tag {
+    uint8_t channel;
+    uint8_t reserved;
+    uint16_t sequence;
+};
+static_assert(sizeof(channel_tag) == 4, "The tag is shared with usb-host");
+
+// When usb-device is built with SPI_RX_NSS_FRAMED, every buffer in an isochronous or framed bulk payload
+// is followed by the starts of the frames received into it, after the CRC and the tag if there are any.
+// A frame is the data received whilst NSS is low so it starts byte aligned. The timestamp is when NSS fell,
+// in 'frame_timestamp_hz' ticks, and the offset is where the first byte of the frame is in the buffer.
+// Frames that started in a buffer after 'max_frames_per_buffer' are counted in 'lost_frames'.
+const uint16_t header_flag_frames = 1 << 2;
+const auto max_frames_per_buffer = 4;
+const uint32_t frame_timestamp_hz = 108000000;
+struct frame_start {
+    uint16_t offset;
+    uint16_t reserved;
+    uint32_t timestamp;
+};
+struct frame_trailer {
+    uint8_t number_of_frames;
+    uint8_t lost_frames;
+    uint16_t reserved;
+    frame_start frames[max_frames_per_buffer];
+};
+static_assert(sizeof(frame_trailer) == 36, "The trailer is shared with usb-host");
+
+// bRequest values for vendor device requests.
+enum class vendor_request: uint8_t {
+    test = 0,  // usb-host sends "some data" and receives "send request"
+    get_profile = 1,  // IN, wIndex is the probe, the data is a 'profiler::probe_statistics'
+    reset_profile = 2,  // OUT, no data
+    get_parameter = 3,  // See parameter-table.h
+    set_parameter = 4,  // See parameter-table.h
+    get_trace = 5,  // IN, the data is a 'trace::block_header' and records, see trace-records.h
+    get_load = 6,  // IN, wIndex is the window, the data is a 'load::window_statistics', see load-statistics.h
+    request_snapshot = 7,  // OUT, no data, see snapshot-slot.h
+    get_snapshot = 8,  // IN, the data is a 'buffer_snapshot::header' and the snapshot, see snapshot-slot.h
+    number_of
+};
+
 }
@@ -0,0 +1,114 @@
+#include "bulk-stream.h"
+
+#include "libusb-error.h"
+
+#include <cassert>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <numeric>
+#include <vector>
+
+namespace bulk_stream
+{
+
+namespace
+{
+
+// usb-device receives each bulk OUT packet into a buffer of its own so a transfer of several
+// packets exercises the handoff between the OTG ISR and the bulk OUT consumer.
+const auto out_transfer_length = 512 * 8;
+
+bool running = false;
+int transfers_outstanding = 0;
+uint64_t bytes_written = 0;
+
+void out_transfer_callback(libusb_transfer *const transfer) {
+    if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+        bytes_written += transfer->actual_length;
+    } else if (transfer->status != LIBUSB_TRANSFER_CANCELLED) {
+        printf("bulk transfer failed, status %d\n", transfer->status);
+        running = false;
+    }
+
+    if (running) {
+        const auto error = libusb_submit_transfer(transfer);
+        if (error == 0) {
+            return;
+        }
+        print_libusb_error(static_cast<libusb_error>(error), "libusb_submit_transfer");
+        running = false;
+    }
+
+    --transfers_outstanding;
+}
+
+}
+
+bool write(libusb_device_handle *const device_handle, const uint8_t out_endpoint_address, const unsigned duration_s, const int queue_depth) {
+    assert(device_handle);
+    assert(queue_depth > 0);
+
+    bytes_written = 0;
+    transfers_outstanding = 0;
+
+    std::vector<unsigned char> data(static_cast<size_t>(queue_depth) * out_transfer_length);
+    std::iota(std::begin(data), std::end(data), 0);
+    std::vector<libusb_transfer*> transfers;
+
+    running = true;
+    for (auto i = 0; i < queue_depth; ++i) {
+        const auto transfer = libusb_alloc_transfer(0);
+        if (transfer == nullptr) {
+            puts("libusb_alloc_transfer failed");
+            running = false;
+            break;
+        }
+        transfers.push_back(transfer);
+
+        unsigned char *const buffer = &data[static_cast<size_t>(i) * out_transfer_length];
+        libusb_fill_bulk_transfer(transfer, device_handle, out_endpoint_address, buffer, out_transfer_length, out_transfer_callback, nullptr, 1000);
+
+        const auto error = libusb_submit_transfer(transfer);
+        if (error < 0) {
+            print_libusb_error(static_cast<libusb_error>(error), "libusb_submit_transfer");
+            running = false;
+            break;
+        }
+        ++transfers_outstanding;
+    }
+    const auto success = running;
+
+    const auto start = std::chrono::steady_clock::now();
+    const auto stop = start + std::chrono::seconds(duration_s);
+
+    while (running && std::chrono::steady_clock::now() < stop) {
+        const auto error = libusb_handle_events(nullptr);
+        if (error < 0 && error != LIBUSB_ERROR_INTERRUPTED) {
+            print_libusb_error(static_cast<libusb_error>(error), "libusb_handle_events");
+            break;
+        }
+    }
+    const auto duration_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+    // The transfers must all come back before they can be freed.
+    running = false;
+    for (const auto transfer: transfers) {
+        libusb_cancel_transfer(transfer);
+    }
+    while (transfers_outstanding > 0) {
+        libusb_handle_events(nullptr);
+    }
+    for (const auto transfer: transfers) {
+        libusb_free_transfer(transfer);
+    }
+
+    printf("queue depth %d\n", queue_depth);
+    printf("duration_us %lld us\n", static_cast<long long>(duration_us));
+    printf("bytes written %" PRIu64 "\n", bytes_written);
+    printf("throughput MB/s %f\n", static_cast<double>(bytes_written) / duration_us);
+
+    return success;
+}
+
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <libusb-1.0/libusb.h>
+
+#include <cstdint>
+
+// Asynchronous bulk OUT transfers with several transfers queued so the endpoint is never idle.
+// See loopback-benchmark.h for reading and writing at the same time.
+// The interface must already be claimed with the bulk alternate setting selected.
+namespace bulk_stream
+{
+
+const auto default_queue_depth = 4;
+
+// Writes to the bulk OUT endpoint for 'duration_s' and prints the throughput.
+bool write(libusb_device_handle *const device_handle, const uint8_t out_endpoint_address, const unsigned duration_s, const int queue_depth);
+
+}
@@ -0,0 +1,44 @@
+#include "channel-demux.h"
+
+#include <cinttypes>
+#include <cstdio>
+
+namespace channel_demux
+{
+
+demultiplexer::demultiplexer(sink_t sink) : sink(sink) {
+}
+
+void demultiplexer::add(const usb_device::channel_tag &tag, const uint8_t *const data, const size_t length) {
+    auto &state = states[tag.channel];
+    auto &s = stats[tag.channel];
+
+    // The first sequence number is whatever the channel happens to be up to.
+    if (state.synchronised) {
+        // Unsigned arithmetic so the wrap is handled naturally.
+        const uint16_t gap = tag.sequence - state.expected_sequence;
+        if (gap > UINT16_MAX / 2) {
+            ++s.repeated_buffers;
+            return;
+        }
+        s.lost_buffers += gap;
+    }
+    state.synchronised = true;
+    state.expected_sequence = tag.sequence + 1;
+
+    ++s.buffers;
+    s.bytes += length;
+    if (sink) {
+        sink(tag.channel, data, length);
+    }
+}
+
+void print_statistics(const std::map<uint8_t, channel_statistics> &stats) {
+    for (const auto &entry: stats) {
+        const auto &s = entry.second;
+        printf("channel %u buffers %" PRIu64 " bytes %" PRIu64 " lost buffers %" PRIu64 " repeated buffers %" PRIu64 "\n",
+            static_cast<unsigned>(entry.first), s.buffers, s.bytes, s.lost_buffers, s.repeated_buffers);
+    }
+}
+
+}
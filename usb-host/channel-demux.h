@@ -0,0 +1,47 @@
+#pragma once
+
+#include "../usb-device/usb-device.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+
+// Separates the buffers of the usb-device SPI channels using their tags, see 'header_flag_channel_tag'.
+// Each channel numbers its buffers so the gaps are the buffers lost on the device.
+// Nothing in here depends on libusb so it can be fed synthetic streams, see synthetic-stream.h.
+namespace channel_demux
+{
+
+struct channel_statistics {
+    uint64_t buffers = 0;
+    uint64_t bytes = 0;
+    uint64_t lost_buffers = 0;  // Gaps in the sequence numbers
+    uint64_t repeated_buffers = 0;  // Sequence numbers that went backwards
+};
+
+class demultiplexer {
+public:
+    using sink_t = std::function<void(const uint8_t channel, const uint8_t *const data, const size_t length)>;
+
+    explicit demultiplexer(sink_t sink = nullptr);
+
+    void add(const usb_device::channel_tag &tag, const uint8_t *const data, const size_t length);
+
+    const std::map<uint8_t, channel_statistics> &get_statistics() const { return stats; }
+
+private:
+    struct channel_state {
+        bool synchronised = false;
+        uint16_t expected_sequence = 0;
+    };
+
+    sink_t sink;
+    std::map<uint8_t, channel_state> states;
+    std::map<uint8_t, channel_statistics> stats;
+};
+
+// Prints nothing if there weren't any tagged buffers.
+void print_statistics(const std::map<uint8_t, channel_statistics> &stats);
+
+}
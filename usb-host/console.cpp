@@ -0,0 +1,34 @@
+#include "console.h"
+
+#include <cctype>
+#include <cstdlib>
+
+namespace console
+{
+
+std::string command(transport &t, const std::string &line, const unsigned quiet_ms) {
+    t.read_until_quiet(0);
+    if (!t.write_line(line)) {
+        return {};
+    }
+    return t.read_until_quiet(quiet_ms);
+}
+
+bool find_value(const std::string &response, const std::string &name, unsigned long &value) {
+    for (auto position = response.find(name); position != std::string::npos; position = response.find(name, position + 1)) {
+        auto p = position + name.size();
+        if (p >= response.size() || response[p] != ' ') {
+            continue;  // Part of a longer name
+        }
+        while (p < response.size() && response[p] == ' ') {
+            ++p;
+        }
+        if (p < response.size() && isdigit(static_cast<unsigned char>(response[p]))) {
+            value = strtoul(response.c_str() + p, nullptr, 10);
+            return true;
+        }
+    }
+    return false;
+}
+
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+
+// Talking to the ns_cmdline consoles of spi-master and usb-device. The transport is abstract
+// so the code driving the consoles can be tested against fakes, see fake-console.h.
+namespace console
+{
+
+class transport {
+public:
+    // Sends the line followed by a carriage return, which is what ns_cmdline executes on.
+    virtual bool write_line(const std::string &line) = 0;
+
+    // Returns whatever arrives until nothing has arrived for 'quiet_ms'.
+    virtual std::string read_until_quiet(const unsigned quiet_ms) = 0;
+
+protected:
+    ~transport() = default;
+};
+
+// Sends the command and returns the response, including ns_cmdline's echo and prompt.
+// Anything left over from earlier commands is discarded first.
+std::string command(transport &t, const std::string &line, const unsigned quiet_ms = 200);
+
+// Finds 'name' followed by spaces and a number in a response, e.g. "spi-overflows    12" from
+// usb-device's "parameter" command. Returns false if the name isn't there or isn't followed by a number.
+bool find_value(const std::string &response, const std::string &name, unsigned long &value);
+
+}
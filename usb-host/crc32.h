@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// The CRC-32 usb-device appends to each buffer when the 'crc' parameter is on, see 'header_flag_crc32' in usb-device.h.
+// Nothing in here depends on libusb so it can be checked, and benchmarked, without the device.
+namespace crc32
+{
+
+// Continues a CRC, start with 'compute' or pass 0 as the 'crc' for the first block.
+uint32_t update(uint32_t crc, const uint8_t *data, size_t length);
+
+inline uint32_t compute(const uint8_t *const data, const size_t length) {
+    return update(0, data, length);
+}
+
+// The STM32 CRC unit processes words MSB first, so usb-device configures it to reverse the input
+// and output to get the reflected CRC. This does the same, a bit at a time, so the configuration
+// can be checked here. 'length' must be a multiple of 4.
+uint32_t stm32_model(const uint8_t *data, size_t length);
+
+// Checks the table driven CRC against the known check value, a bitwise version and the STM32 model.
+bool self_test();
+
+// Prints the table driven CRC throughput for a buffer of 'length' bytes.
+void benchmark(const size_t length, const unsigned duration_ms);
+
+}
@@ -0,0 +1,98 @@
+#include "fake-console.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace fake_console
+{
+
+namespace
+{
+
+// Like ns_cmdline's "/>" prompt, printed after every command.
+const char prompt[] = "\r\n/>";
+
+}
+
+device::device(handler_t handler) : handler(handler) {
+}
+
+device::~device() {
+    stopping = true;
+    if (thread.joinable()) {
+        thread.join();
+    }
+    if (master >= 0) {
+        ::close(master);
+    }
+}
+
+bool device::open() {
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        printf("pseudo-terminal failed: %s\n", strerror(errno));
+        return false;
+    }
+    slave_path = ptsname(master);
+
+    thread = std::thread(&device::serve, this);
+    return true;
+}
+
+void device::serve() {
+    std::string line;
+    pollfd pfd = { master, POLLIN, 0 };
+    while (!stopping) {
+        // Until the slave is opened the master reports POLLHUP, so don't spin.
+        if (poll(&pfd, 1, 20) <= 0 || (pfd.revents & POLLIN) == 0) {
+            if ((pfd.revents & POLLHUP) != 0) {
+                usleep(20000);
+            }
+            continue;
+        }
+
+        char buffer[256];
+        const auto result = ::read(master, buffer, sizeof(buffer));
+        if (result <= 0) {
+            continue;
+        }
+
+        for (auto i = 0; i < result; ++i) {
+            const auto c = buffer[i];
+            if (c == '\r') {
+                std::string output = handler(line);
+                // The boards use '\n' but the console is raw so the terminal does no translation, ns_cmdline adds the '\r'.
+                for (auto p = output.find('\n'); p != std::string::npos; p = output.find('\n', p + 2)) {
+                    output.insert(p, 1, '\r');
+                }
+                write("\r\n" + output + prompt);
+                line.clear();
+            } else {
+                write(std::string(1, c));  // Echo
+                line += c;
+            }
+        }
+    }
+}
+
+void device::write(const std::string &data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        const auto result = ::write(master, data.data() + written, data.size() - written);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        written += result;
+    }
+}
+
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+// Pretends to be one of the boards' ns_cmdline consoles on a pseudo-terminal so anything that
+// drives the consoles, see console.h, can be run without the boards. Open 'path()' with
+// serial_port::port, the other end echoes what it receives and answers each line with 'handler'.
+namespace fake_console
+{
+
+class device {
+public:
+    // Given the command line, returns the output, e.g. "SPI transmitting\n".
+    using handler_t = std::function<std::string(const std::string &line)>;
+
+    explicit device(handler_t handler);
+    ~device();
+
+    device(const device&) = delete;
+    device &operator=(const device&) = delete;
+
+    // Creates the pseudo-terminal and starts answering.
+    bool open();
+    const std::string &path() const { return slave_path; }
+
+private:
+    void serve();
+    void write(const std::string &data);
+
+    handler_t handler;
+    int master = -1;
+    std::string slave_path;
+    std::thread thread;
+    std::atomic_bool stopping{false};
+};
+
+}
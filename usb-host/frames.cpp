@@ -0,0 +1,87 @@
+#include "frames.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+
+namespace frames
+{
+
+assembler::assembler(sink_t sink) : sink(sink) {
+}
+
+void assembler::add_buffer(const uint8_t *const data, const size_t length, const usb_device::frame_trailer &trailer) {
+    const auto number_of_frames = std::min<size_t>(trailer.number_of_frames, usb_device::max_frames_per_buffer);
+    size_t position = 0;
+    for (auto i = 0u; i < number_of_frames; ++i) {
+        const auto &start = trailer.frames[i];
+        // The device records the starts in order, anything else means the trailer is corrupt.
+        const size_t offset = std::min<size_t>(std::max<size_t>(start.offset, position), length);
+        append(data + position, offset - position);
+        pass_on();
+
+        in_frame = true;
+        current.timestamp = start.timestamp;
+        current.complete = true;
+        position = offset;
+    }
+    append(data + position, length - position);
+
+    // The lost frames started after the last one recorded so their data has been merged into it.
+    if (trailer.lost_frames > 0) {
+        stats.lost_frames += trailer.lost_frames;
+        current.complete = false;
+    }
+}
+
+void assembler::lost_data() {
+    if (in_frame) {
+        current.complete = false;
+    }
+    pass_on();
+}
+
+void assembler::flush() {
+    pass_on();
+}
+
+void assembler::append(const uint8_t *const data, const size_t length) {
+    if (in_frame) {
+        current.data.insert(current.data.end(), data, data + length);
+    } else {
+        stats.unframed_bytes += length;
+    }
+}
+
+void assembler::pass_on() {
+    if (!in_frame) {
+        return;
+    }
+
+    if (current.complete) {
+        ++stats.frames;
+    } else {
+        ++stats.incomplete_frames;
+    }
+    stats.bytes += current.data.size();
+    if (sink) {
+        sink(current);
+    }
+
+    in_frame = false;
+    current.data.clear();
+}
+
+void print_statistics(const statistics &stats) {
+    if (stats.frames == 0 && stats.incomplete_frames == 0 && stats.lost_frames == 0) {
+        return;
+    }
+
+    printf("frames %" PRIu64 "\n", stats.frames);
+    printf("incomplete frames %" PRIu64 "\n", stats.incomplete_frames);
+    printf("lost frames %" PRIu64 "\n", stats.lost_frames);
+    printf("frame bytes %" PRIu64 "\n", stats.bytes);
+    printf("unframed bytes %" PRIu64 "\n", stats.unframed_bytes);
+}
+
+}
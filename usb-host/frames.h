@@ -0,0 +1,60 @@
+#pragma once
+
+#include "../usb-device/usb-device.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Reassembles the SPI frames using the frame trailers, see 'header_flag_frames'.
+// A frame is what spi-master sent whilst NSS was low, it can span buffers and a buffer can hold several frames.
+// Nothing in here depends on libusb so it can be fed synthetic buffers.
+namespace frames
+{
+
+struct frame {
+    uint32_t timestamp;  // When NSS fell, in 'usb_device::frame_timestamp_hz' ticks
+    std::vector<uint8_t> data;
+    bool complete;  // False if some of the data might be missing
+};
+
+struct statistics {
+    uint64_t frames = 0;  // Complete frames passed on
+    uint64_t incomplete_frames = 0;  // Frames passed on that might be missing data
+    uint64_t lost_frames = 0;  // Frames the device couldn't record the start of, their data is merged into the previous frame
+    uint64_t bytes = 0;  // In the frames passed on
+    uint64_t unframed_bytes = 0;  // Received after lost data and before the next frame started
+};
+
+class assembler {
+public:
+    using sink_t = std::function<void(const frame &f)>;
+
+    explicit assembler(sink_t sink = nullptr);
+
+    // The buffers must be given in the order they were received.
+    void add_buffer(const uint8_t *const data, const size_t length, const usb_device::frame_trailer &trailer);
+
+    // Data between the previous buffer and the next one was lost, the frame in progress is passed on as incomplete.
+    void lost_data();
+
+    // Passes on the frame in progress, it's complete unless data was lost because the end of a frame isn't marked.
+    void flush();
+
+    const statistics &get_statistics() const { return stats; }
+
+private:
+    void append(const uint8_t *const data, const size_t length);
+    void pass_on();
+
+    sink_t sink;
+    bool in_frame = false;
+    frame current = {};
+    statistics stats;
+};
+
+// Prints nothing if there weren't any frames.
+void print_statistics(const statistics &stats);
+
+}
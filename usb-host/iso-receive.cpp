@@ -0,0 +1,138 @@
+#include "iso-receive.h"
+
+#include "libusb-error.h"
+
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+namespace iso_receive
+{
+
+namespace
+{
+
+// Keep plenty of transfers queued so there's always one waiting for the next microframe,
+// 8 transfers of 64 packets is 64 ms worth of microframes.
+const auto number_of_transfers = 8;
+const auto packets_per_transfer = 64;
+
+bool running = false;
+int transfers_outstanding = 0;
+iso_stream::reassembler *reassembler_ptr = nullptr;
+
+void transfer_callback(libusb_transfer *const transfer) {
+    assert(reassembler_ptr != nullptr);
+
+    if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+        for (auto i = 0; i < transfer->num_iso_packets; ++i) {
+            const auto &packet = transfer->iso_packet_desc[i];
+            reassembler_ptr->add_packet(
+                packet.status == LIBUSB_TRANSFER_COMPLETED,
+                libusb_get_iso_packet_buffer_simple(transfer, i),
+                packet.actual_length);
+        }
+    } else if (transfer->status != LIBUSB_TRANSFER_CANCELLED) {
+        printf("isochronous transfer failed, status %d\n", transfer->status);
+        running = false;
+    }
+
+    if (running) {
+        const auto error = libusb_submit_transfer(transfer);
+        if (error == 0) {
+            return;
+        }
+        print_libusb_error(static_cast<libusb_error>(error), "libusb_submit_transfer");
+        running = false;
+    }
+
+    --transfers_outstanding;
+}
+
+}
+
+bool run(libusb_device_handle *const device_handle, const uint8_t endpoint_address, const unsigned duration_s,
+    iso_stream::reassembler::sink_t sink, summary *const s) {
+    assert(device_handle);
+
+    const auto packet_size = libusb_get_max_iso_packet_size(libusb_get_device(device_handle), endpoint_address);
+    if (packet_size < 0) {
+        print_libusb_error(static_cast<libusb_error>(packet_size), "libusb_get_max_iso_packet_size");
+        return false;
+    }
+    printf("isochronous packet size %d\n", packet_size);
+
+    iso_stream::reassembler reassembler(sink, [&sink](const uint8_t channel, const uint8_t *const data, const size_t length) {
+        if (channel == 0 && sink) {
+            sink(data, length);
+        }
+    });
+    reassembler_ptr = &reassembler;
+
+    std::vector<unsigned char> data(static_cast<size_t>(number_of_transfers) * packets_per_transfer * packet_size);
+    std::vector<libusb_transfer*> transfers;
+
+    running = true;
+    for (auto i = 0; i < number_of_transfers; ++i) {
+        const auto transfer = libusb_alloc_transfer(packets_per_transfer);
+        if (transfer == nullptr) {
+            puts("libusb_alloc_transfer failed");
+            running = false;
+            break;
+        }
+        transfers.push_back(transfer);
+
+        unsigned char *const buffer = &data[static_cast<size_t>(i) * packets_per_transfer * packet_size];
+        libusb_fill_iso_transfer(transfer, device_handle, endpoint_address, buffer, packets_per_transfer * packet_size, packets_per_transfer, transfer_callback, nullptr, 1000);
+        libusb_set_iso_packet_lengths(transfer, packet_size);
+
+        const auto error = libusb_submit_transfer(transfer);
+        if (error < 0) {
+            print_libusb_error(static_cast<libusb_error>(error), "libusb_submit_transfer");
+            running = false;
+            break;
+        }
+        ++transfers_outstanding;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const auto stop = start + std::chrono::seconds(duration_s);
+
+    while (running && std::chrono::steady_clock::now() < stop) {
+        const auto error = libusb_handle_events(nullptr);
+        if (error < 0 && error != LIBUSB_ERROR_INTERRUPTED) {
+            print_libusb_error(static_cast<libusb_error>(error), "libusb_handle_events");
+            break;
+        }
+    }
+    const auto duration_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+    // The transfers must all come back before they can be freed.
+    running = false;
+    for (const auto transfer: transfers) {
+        libusb_cancel_transfer(transfer);
+    }
+    while (transfers_outstanding > 0) {
+        libusb_handle_events(nullptr);
+    }
+    for (const auto transfer: transfers) {
+        libusb_free_transfer(transfer);
+    }
+    reassembler_ptr = nullptr;
+
+    const auto &stats = reassembler.get_statistics();
+    iso_stream::print_statistics(stats);
+    channel_demux::print_statistics(reassembler.get_channel_statistics());
+    reassembler.flush_frames();
+    frames::print_statistics(reassembler.get_frame_statistics());
+    printf("duration_us %lld us\n", static_cast<long long>(duration_us));
+    printf("throughput MB/s %f\n", static_cast<double>(stats.bytes) / duration_us);
+    if (s != nullptr) {
+        *s = { stats, duration_us / 1e6 };
+    }
+
+    return transfers.size() == number_of_transfers;
+}
+
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "iso-stream.h"
+
+#include <libusb-1.0/libusb.h>
+
+#include <cstdint>
+
+namespace iso_receive
+{
+
+struct summary {
+    iso_stream::statistics stream;
+    double duration_s;
+};
+
+// The interface must already be claimed with the isochronous alternate setting selected.
+// The data, or that of channel 0 if the buffers are tagged, is given to 'sink', e.g. to check it.
+bool run(libusb_device_handle *const device_handle, const uint8_t endpoint_address, const unsigned duration_s,
+    iso_stream::reassembler::sink_t sink = nullptr, summary *const s = nullptr);
+
+}
@@ -0,0 +1,158 @@
+#include "iso-stream.h"
+
+#include "crc32.h"
+
+#include "../usb-device/usb-device.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+namespace iso_stream
+{
+
+namespace
+{
+
+const size_t buffer_size = usb_device::crc32_buffer_size;
+const uint16_t trailer_flags = usb_device::header_flag_crc32 | usb_device::header_flag_channel_tag | usb_device::header_flag_frames;
+// The frames are only recorded for the first SPI channel, see spi-rx.cpp on the device.
+const uint8_t framed_channel = 0;
+
+size_t unit_size(const uint16_t flags) {
+    return buffer_size
+        + ((flags & usb_device::header_flag_crc32) != 0 ? usb_device::crc32_trailer_size : 0)
+        + ((flags & usb_device::header_flag_channel_tag) != 0 ? sizeof(usb_device::channel_tag) : 0)
+        + ((flags & usb_device::header_flag_frames) != 0 ? sizeof(usb_device::frame_trailer) : 0);
+}
+
+}
+
+reassembler::reassembler(sink_t sink, channel_demux::demultiplexer::sink_t channel_sink, frames::assembler::sink_t frame_sink)
+    : sink(sink), channels(channel_sink), frame_assembler(frame_sink) {
+}
+
+void reassembler::add_packet(const bool completed, const uint8_t *const data, const size_t actual_length) {
+    ++stats.packets;
+
+    if (!completed) {
+        ++stats.error_packets;
+        return;
+    }
+
+    if (actual_length == 0) {
+        ++stats.empty_packets;
+        return;
+    }
+
+    usb_device::iso_header header;
+    if (actual_length < sizeof(header)) {
+        ++stats.malformed_packets;
+        return;
+    }
+    memcpy(&header, data, sizeof(header));
+    const auto with_trailers = (header.flags & trailer_flags) != 0;
+    if (header.length != actual_length - sizeof(header) || (with_trailers && header.length % unit_size(header.flags) != 0)) {
+        ++stats.malformed_packets;
+        return;
+    }
+
+    ++stats.microframes;
+
+    // The first sequence number is whatever the device happens to be up to.
+    if (synchronised) {
+        // Unsigned arithmetic so the wrap is handled naturally.
+        const uint32_t gap = header.sequence - expected_sequence;
+        if (gap > UINT32_MAX / 2) {
+            ++stats.repeated_microframes;
+            return;
+        }
+        stats.lost_microframes += gap;
+        if (gap > 0) {
+            frame_assembler.lost_data();
+        }
+    }
+    synchronised = true;
+    expected_sequence = header.sequence + 1;
+
+    if (with_trailers) {
+        split_buffers(header.flags, data + sizeof(header), header.length);
+    } else {
+        stats.bytes += header.length;
+        if (sink) {
+            sink(data + sizeof(header), header.length);
+        }
+    }
+}
+
+// Each buffer is followed by its trailers so the buffers are passed on one at a time.
+void reassembler::split_buffers(const uint16_t flags, const uint8_t *data, size_t length) {
+    const auto size = unit_size(flags);
+    for (; length > 0; data += size, length -= size) {
+        auto trailer = data + buffer_size;
+
+        if ((flags & usb_device::header_flag_crc32) != 0) {
+            uint32_t expected;
+            memcpy(&expected, trailer, sizeof(expected));
+            trailer += sizeof(expected);
+            ++stats.crc_checked;
+            if (crc32::compute(data, buffer_size) != expected) {
+                ++stats.crc_errors;
+            }
+        }
+
+        stats.bytes += buffer_size;
+        auto framed = true;
+        if ((flags & usb_device::header_flag_channel_tag) != 0) {
+            usb_device::channel_tag tag;
+            memcpy(&tag, trailer, sizeof(tag));
+            trailer += sizeof(tag);
+            framed = add_tagged_buffer(tag, data);
+        } else if (sink) {
+            sink(data, buffer_size);
+        }
+
+        if ((flags & usb_device::header_flag_frames) != 0 && framed) {
+            usb_device::frame_trailer frame_trailer;
+            memcpy(&frame_trailer, trailer, sizeof(frame_trailer));
+            frame_assembler.add_buffer(data, buffer_size, frame_trailer);
+        }
+    }
+}
+
+// Returns true if the buffer should go to the frame assembler, i.e. it's from the framed channel and
+// isn't a repeat. Buffers of the framed channel lost on the device mean the frame in progress is incomplete.
+bool reassembler::add_tagged_buffer(const usb_device::channel_tag &tag, const uint8_t *const data) {
+    const auto &channel_stats = channels.get_statistics();
+    const auto before = channel_stats.find(tag.channel);
+    const auto buffers_before = before != channel_stats.end() ? before->second.buffers : 0;
+    const auto lost_before = before != channel_stats.end() ? before->second.lost_buffers : 0;
+
+    channels.add(tag, data, buffer_size);
+
+    const auto &after = channel_stats.at(tag.channel);
+    if (tag.channel != framed_channel || after.buffers == buffers_before) {
+        return false;
+    }
+    if (after.lost_buffers != lost_before) {
+        frame_assembler.lost_data();
+    }
+    return true;
+}
+
+void print_statistics(const statistics &stats) {
+    printf("packets %" PRIu64 "\n", stats.packets);
+    printf("error packets %" PRIu64 "\n", stats.error_packets);
+    printf("empty packets %" PRIu64 "\n", stats.empty_packets);
+    printf("malformed packets %" PRIu64 "\n", stats.malformed_packets);
+    printf("microframes %" PRIu64 "\n", stats.microframes);
+    printf("lost microframes %" PRIu64 "\n", stats.lost_microframes);
+    printf("repeated microframes %" PRIu64 "\n", stats.repeated_microframes);
+    printf("bytes %" PRIu64 "\n", stats.bytes);
+    if (stats.crc_checked > 0) {
+        printf("crc checked %" PRIu64 "\n", stats.crc_checked);
+        printf("crc errors %" PRIu64 "\n", stats.crc_errors);
+    }
+}
+
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "channel-demux.h"
+#include "frames.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// Reassembles the payloads received from the isochronous endpoint into a stream and accounts for the packets.
+// This doesn't know anything about libusb so it can be fed from a simulated isochronous source.
+namespace iso_stream
+{
+
+struct statistics {
+    uint64_t packets = 0;  // Every packet, whatever its status
+    uint64_t error_packets = 0;  // The host controller reported an error, the contents are unusable
+    uint64_t empty_packets = 0;  // The device didn't have anything ready for the microframe
+    uint64_t malformed_packets = 0;  // Too short for the header or the header length doesn't match
+    uint64_t microframes = 0;  // Packets with a valid header
+    uint64_t lost_microframes = 0;  // Gaps in the sequence numbers
+    uint64_t repeated_microframes = 0;  // Sequence numbers that went backwards
+    uint64_t bytes = 0;  // Payload bytes passed on, i.e. excluding the headers and trailers
+    uint64_t crc_checked = 0;  // Buffers that came with a CRC, see 'header_flag_crc32'
+    uint64_t crc_errors = 0;  // Buffers whose CRC didn't match
+};
+
+class reassembler {
+public:
+    using sink_t = std::function<void(const uint8_t *const data, const size_t length)>;
+
+    // Tagged buffers go to 'channel_sink' instead of 'sink'. With frame trailers the buffers, of channel 0
+    // if they are tagged, are also reassembled into frames for 'frame_sink'.
+    explicit reassembler(sink_t sink = nullptr, channel_demux::demultiplexer::sink_t channel_sink = nullptr, frames::assembler::sink_t frame_sink = nullptr);
+
+    // 'completed' is false if the packet status was anything other than success.
+    // The trailers, see usb-device.h, are checked and removed before the data is given to the sink.
+    void add_packet(const bool completed, const uint8_t *const data, const size_t actual_length);
+
+    const statistics &get_statistics() const { return stats; }
+    const std::map<uint8_t, channel_demux::channel_statistics> &get_channel_statistics() const { return channels.get_statistics(); }
+    const frames::statistics &get_frame_statistics() const { return frame_assembler.get_statistics(); }
+
+    // Passes on the frame in progress.
+    void flush_frames() { frame_assembler.flush(); }
+
+private:
+    void split_buffers(const uint16_t flags, const uint8_t *data, size_t length);
+    bool add_tagged_buffer(const usb_device::channel_tag &tag, const uint8_t *const data);
+
+    sink_t sink;
+    channel_demux::demultiplexer channels;
+    frames::assembler frame_assembler;
+    bool synchronised = false;
+    uint32_t expected_sequence = 0;
+    statistics stats;
+};
+
+void print_statistics(const statistics &stats);
+
+}
@@ -0,0 +1,7 @@
+#include "libusb-error.h"
+
+#include <cstdio>
+
+void print_libusb_error(const libusb_error error, const char *const libusb_api_function)  {
+    printf("'%s' failed, error value %d, error name '%s', error description '%s'\n", libusb_api_function, error, libusb_error_name(error), libusb_strerror(error));
+}
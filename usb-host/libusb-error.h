@@ -0,0 +1,5 @@
+#pragma once
+
+#include <libusb-1.0/libusb.h>
+
+void print_libusb_error(const libusb_error error, const char *const libusb_api_function);
@@ -0,0 +1,129 @@
+#include "libusb-transport.h"
+
+#include "libusb-error.h"
+
+#include <cassert>
+#include <cinttypes>
+#include <cstdio>
+
+namespace libusb_transport
+{
+
+bulk_transport::bulk_transport(libusb_device_handle *const device_handle, const uint8_t out_endpoint_address, const uint8_t in_endpoint_address)
+    : device_handle(device_handle), out_endpoint_address(out_endpoint_address), in_endpoint_address(in_endpoint_address) {
+    assert(device_handle);
+}
+
+bulk_transport::~bulk_transport() {
+    stop();
+}
+
+bool bulk_transport::start(client &c, const size_t write_length, const int queue_depth) {
+    assert(transfers.empty());
+
+    this->c = &c;
+    out_data.resize(write_length * queue_depth);
+    in_data.resize(loopback_benchmark::unit_size * queue_depth);
+
+    running = true;
+    for (auto i = 0; running && i < queue_depth; ++i) {
+        running = submit(in_endpoint_address, &in_data[i * loopback_benchmark::unit_size], loopback_benchmark::unit_size, in_transfer_callback);
+        if (running) {
+            unsigned char *const buffer = &out_data[i * write_length];
+            c.fill(buffer, write_length);
+            running = submit(out_endpoint_address, buffer, write_length, out_transfer_callback);
+        }
+    }
+    return running;
+}
+
+bool bulk_transport::handle_events() {
+    const auto error = libusb_handle_events(nullptr);
+    if (error < 0 && error != LIBUSB_ERROR_INTERRUPTED) {
+        print_libusb_error(static_cast<libusb_error>(error), "libusb_handle_events");
+        return false;
+    }
+    return running;
+}
+
+// The transfers must all come back before they can be freed.
+void bulk_transport::stop() {
+    running = false;
+    for (const auto transfer: transfers) {
+        libusb_cancel_transfer(transfer);
+    }
+    while (transfers_outstanding > 0) {
+        libusb_handle_events(nullptr);
+    }
+    free_transfers();
+}
+
+void bulk_transport::out_transfer_callback(libusb_transfer *const transfer) {
+    const auto self = static_cast<bulk_transport*>(transfer->user_data);
+    if (self->completed(transfer)) {
+        self->c->written(transfer->actual_length);
+        self->c->fill(transfer->buffer, transfer->length);
+    }
+    self->resubmit(transfer);
+}
+
+void bulk_transport::in_transfer_callback(libusb_transfer *const transfer) {
+    const auto self = static_cast<bulk_transport*>(transfer->user_data);
+    if (self->completed(transfer)) {
+        self->c->read(transfer->buffer, transfer->actual_length);
+    }
+    self->resubmit(transfer);
+}
+
+bool bulk_transport::completed(libusb_transfer *const transfer) {
+    if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+        return true;
+    }
+    if (transfer->status != LIBUSB_TRANSFER_CANCELLED) {
+        printf("bulk transfer failed, endpoint 0x%" PRIx8 " status %d\n", transfer->endpoint, transfer->status);
+        running = false;
+    }
+    return false;
+}
+
+// Resubmits the transfer until 'running' is cleared.
+void bulk_transport::resubmit(libusb_transfer *const transfer) {
+    if (running) {
+        const auto error = libusb_submit_transfer(transfer);
+        if (error == 0) {
+            return;
+        }
+        print_libusb_error(static_cast<libusb_error>(error), "libusb_submit_transfer");
+        running = false;
+    }
+
+    --transfers_outstanding;
+}
+
+bool bulk_transport::submit(const uint8_t endpoint_address, unsigned char *const buffer, const size_t length, const libusb_transfer_cb_fn callback) {
+    const auto transfer = libusb_alloc_transfer(0);
+    if (transfer == nullptr) {
+        puts("libusb_alloc_transfer failed");
+        return false;
+    }
+    transfers.push_back(transfer);
+
+    libusb_fill_bulk_transfer(transfer, device_handle, endpoint_address, buffer, length, callback, this, 1000);
+
+    const auto error = libusb_submit_transfer(transfer);
+    if (error < 0) {
+        print_libusb_error(static_cast<libusb_error>(error), "libusb_submit_transfer");
+        return false;
+    }
+    ++transfers_outstanding;
+    return true;
+}
+
+void bulk_transport::free_transfers() {
+    for (const auto transfer: transfers) {
+        libusb_free_transfer(transfer);
+    }
+    transfers.clear();
+}
+
+}
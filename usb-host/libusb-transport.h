@@ -0,0 +1,43 @@
+#pragma once
+
+#include "loopback-benchmark.h"
+
+#include <libusb-1.0/libusb.h>
+
+#include <vector>
+
+namespace libusb_transport
+{
+
+// Asynchronous bulk transfers on the bulk OUT and IN endpoints.
+// The interface must already be claimed with the bulk alternate setting selected.
+class bulk_transport: public loopback_benchmark::transport {
+public:
+    bulk_transport(libusb_device_handle *const device_handle, const uint8_t out_endpoint_address, const uint8_t in_endpoint_address);
+    ~bulk_transport() override;
+
+    bool start(client &c, const size_t write_length, const int queue_depth) override;
+    bool handle_events() override;
+    void stop() override;
+
+private:
+    static void out_transfer_callback(libusb_transfer *const transfer);
+    static void in_transfer_callback(libusb_transfer *const transfer);
+    bool completed(libusb_transfer *const transfer);
+    void resubmit(libusb_transfer *const transfer);
+    bool submit(const uint8_t endpoint_address, unsigned char *const buffer, const size_t length, const libusb_transfer_cb_fn callback);
+    void free_transfers();
+
+    libusb_device_handle *const device_handle;
+    const uint8_t out_endpoint_address;
+    const uint8_t in_endpoint_address;
+
+    client *c = nullptr;
+    bool running = false;
+    int transfers_outstanding = 0;
+    std::vector<unsigned char> out_data;
+    std::vector<unsigned char> in_data;
+    std::vector<libusb_transfer*> transfers;
+};
+
+}
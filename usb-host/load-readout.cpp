@@ -0,0 +1,66 @@
+#include "load-readout.h"
+
+#include "libusb-error.h"
+
+#include "../usb-device/load-statistics.h"
+#include "../usb-device/usb-device.h"
+
+#include <cinttypes>
+#include <cstdio>
+
+namespace load_readout
+{
+
+namespace
+{
+
+bool get_window_statistics(libusb_device_handle *const device_handle, const size_t window, load::window_statistics &stats) {
+    const auto bytes_transferred = libusb_control_transfer(
+            device_handle,
+            LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE, // bmRequestType
+            static_cast<uint8_t>(usb_device::vendor_request::get_load), // bRequest
+            0, // wValue
+            static_cast<uint16_t>(window), // wIndex
+            reinterpret_cast<unsigned char*>(&stats),
+            sizeof(stats), // wLength
+            100
+        );
+    if (bytes_transferred < 0) {
+        print_libusb_error(static_cast<libusb_error>(bytes_transferred), "libusb_control_transfer");
+        return false;
+    } else if (bytes_transferred != sizeof(stats)) {
+        printf("bytes_transferred %d, expected %zu\n", bytes_transferred, sizeof(stats));
+        return false;
+    } else {
+        return true;
+    }
+}
+
+}
+
+bool print(libusb_device_handle *const device_handle) {
+    load::window_statistics stats[load::number_of_windows];
+    for (auto w = 0u; w < load::number_of_windows; ++w) {
+        if (!get_window_statistics(device_handle, w, stats[w])) return false;
+    }
+
+    printf("%-12s", "window ms");
+    for (const auto &s: stats) {
+        printf(" %8" PRIu32, s.intervals * load::interval_ms);
+    }
+    printf("\n%-12s", "load %");
+    for (const auto &s: stats) {
+        printf(" %8.1f", load::load_permille(s) / 10.0);
+    }
+    printf("\n");
+    for (auto c = 0u; c < load::number_of_contexts; ++c) {
+        printf("%-12s", load::context_names[c]);
+        for (const auto &s: stats) {
+            printf(" %8.1f", load::share_permille(s, static_cast<load::context>(c)) / 10.0);
+        }
+        printf("\n");
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <libusb-1.0/libusb.h>
+
+// Fetches the usb-device CPU load windows using vendor requests.
+namespace load_readout
+{
+
+bool print(libusb_device_handle *const device_handle);
+
+}
@@ -0,0 +1,212 @@
+#include "loopback-benchmark.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace loopback_benchmark
+{
+
+namespace
+{
+
+const uint32_t magic = 0x4c4f4f50;  // "LOOP"
+
+struct unit_header {
+    uint32_t magic;
+    uint32_t sequence;
+    int64_t timestamp_ns;  // steady_clock when the unit was filled
+};
+static_assert(sizeof(unit_header) <= unit_size, "The header must fit in a unit");
+
+int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class benchmark: public transport::client {
+public:
+    void fill(unsigned char *const data, const size_t length) override {
+        assert(length % unit_size == 0);
+
+        const auto timestamp_ns = now_ns();
+        for (auto offset = 0u; offset < length; offset += unit_size) {
+            const unit_header header = { magic, write_sequence++, timestamp_ns };
+            memcpy(data + offset, &header, sizeof(header));
+        }
+    }
+
+    void written(const size_t length) override {
+        bytes_written += length;
+    }
+
+    void read(const unsigned char *const data, const size_t length) override {
+        bytes_read += length;
+
+        const auto timestamp_ns = now_ns();
+        for (auto offset = 0u; offset + sizeof(unit_header) <= length; offset += unit_size) {
+            unit_header header;
+            memcpy(&header, data + offset, sizeof(header));
+            if (header.magic != magic) {
+                ++units_foreign;
+                continue;
+            }
+
+            if (!accept_sequence(header.sequence)) {
+                continue;
+            }
+
+            rtt_ns.push_back(timestamp_ns - header.timestamp_ns);
+        }
+    }
+
+    uint64_t bytes_written = 0;
+    uint64_t bytes_read = 0;
+    uint64_t units_in_sequence = 0;
+    uint64_t units_lost = 0;
+    uint64_t units_late = 0;
+    uint64_t units_duplicated = 0;
+    uint64_t units_foreign = 0;
+    std::vector<int64_t> rtt_ns;
+
+private:
+    // Counts the unit and returns false if it's a duplicate, whose round trip time would be meaningless.
+    // A unit behind the one expected was either counted as lost when a later one arrived or has already
+    // been seen, so the last 'window_size' sequence numbers received are remembered to tell which.
+    bool accept_sequence(const uint32_t sequence) {
+        if (!read_sequence_valid) {
+            read_sequence_valid = true;
+            read_sequence = sequence + 1;
+            // Nothing before the first unit was counted as lost so it can't turn up late.
+            received_window = ~uint64_t(0);
+            ++units_in_sequence;
+            return true;
+        }
+
+        // Unsigned arithmetic so the wrap is handled naturally.
+        const uint32_t gap = sequence - read_sequence;
+        if (gap <= UINT32_MAX / 2) {
+            if (gap == 0) {
+                ++units_in_sequence;
+            }
+            units_lost += gap;
+            received_window = (gap + 1 < window_size ? received_window << (gap + 1) : 0) | 1;
+            read_sequence = sequence + 1;
+            return true;
+        }
+
+        // Bit 0 of the window is 'read_sequence' - 1.
+        const uint32_t age = read_sequence - 1 - sequence;
+        if (age >= window_size || (received_window & (uint64_t(1) << age)) != 0) {
+            ++units_duplicated;
+            return false;
+        }
+        received_window |= uint64_t(1) << age;
+        --units_lost;
+        ++units_late;
+        return true;
+    }
+
+    static const uint32_t window_size = 64;
+
+    uint32_t write_sequence = 0;
+    bool read_sequence_valid = false;
+    uint32_t read_sequence = 0;
+    uint64_t received_window = 0;
+};
+
+// 'sorted' mustn't be empty.
+double percentile_us(const std::vector<int64_t> &sorted, const unsigned percent) {
+    const auto index = (sorted.size() - 1) * percent / 100;
+    return sorted[index] / 1000.0;
+}
+
+}
+
+result run(transport &t, const settings &s) {
+    assert(s.write_length > 0 && s.write_length % unit_size == 0);
+    assert(s.queue_depth > 0);
+
+    benchmark b;
+    result r = {};
+    r.run_settings = s;
+
+    r.success = t.start(b, s.write_length, s.queue_depth);
+
+    const auto start = std::chrono::steady_clock::now();
+    const auto stop = start + std::chrono::milliseconds(s.duration_ms);
+    while (r.success && std::chrono::steady_clock::now() < stop) {
+        r.success = t.handle_events();
+    }
+    r.duration_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+    t.stop();
+
+    r.bytes_written = b.bytes_written;
+    r.bytes_read = b.bytes_read;
+    r.units_in_sequence = b.units_in_sequence;
+    r.units_lost = b.units_lost;
+    r.units_late = b.units_late;
+    r.units_duplicated = b.units_duplicated;
+    r.units_foreign = b.units_foreign;
+
+    if (!b.rtt_ns.empty()) {
+        std::sort(b.rtt_ns.begin(), b.rtt_ns.end());
+        r.rtt_min_us = b.rtt_ns.front() / 1000.0;
+        r.rtt_p50_us = percentile_us(b.rtt_ns, 50);
+        r.rtt_p90_us = percentile_us(b.rtt_ns, 90);
+        r.rtt_p99_us = percentile_us(b.rtt_ns, 99);
+        r.rtt_max_us = b.rtt_ns.back() / 1000.0;
+    }
+
+    return r;
+}
+
+void print_result_header() {
+    puts("  length depth  write MB/s   read MB/s  in-seq    lost    late     dup foreign  rtt min/p50/p90/p99/max us");
+}
+
+void print_result(const result &r) {
+    printf("%8zu %5d %11.3f %11.3f %7" PRIu64 " %7" PRIu64 " %7" PRIu64 " %7" PRIu64 " %7" PRIu64 "  %.1f/%.1f/%.1f/%.1f/%.1f%s\n",
+        r.run_settings.write_length, r.run_settings.queue_depth,
+        r.duration_us > 0 ? static_cast<double>(r.bytes_written) / r.duration_us : 0.0,
+        r.duration_us > 0 ? static_cast<double>(r.bytes_read) / r.duration_us : 0.0,
+        r.units_in_sequence, r.units_lost, r.units_late, r.units_duplicated, r.units_foreign,
+        r.rtt_min_us, r.rtt_p50_us, r.rtt_p90_us, r.rtt_p99_us, r.rtt_max_us,
+        r.success ? "" : " failed");
+}
+
+bool run_from_arguments(transport &t, int argc, char *argv[], const std::function<bool(const result &)> check) {
+    const unsigned duration_ms = argc > 0 ? strtoul(argv[0], nullptr, 0) : 1000;
+
+    std::vector<size_t> write_lengths = { 512, 2048, 4096, 16384 };
+    std::vector<int> queue_depths = { 1, 2, 4, 8 };
+    if (argc > 2) {
+        const size_t write_length = strtoul(argv[1], nullptr, 0);
+        const int queue_depth = strtol(argv[2], nullptr, 0);
+        if (write_length == 0 || write_length % unit_size != 0 || queue_depth <= 0) {
+            printf("the write length must be a multiple of %zu and the queue depth must be positive\n", unit_size);
+            return false;
+        }
+        write_lengths = { write_length };
+        queue_depths = { queue_depth };
+    }
+
+    print_result_header();
+    for (const auto write_length: write_lengths) {
+        for (const auto queue_depth: queue_depths) {
+            const auto r = run(t, { write_length, queue_depth, duration_ms });
+            print_result(r);
+            if (!r.success || (check && !check(r))) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// Measures round trip time and full duplex throughput through usb-device in loopback mode.
+// Every buffer written carries a sequence number and the time it was written so the reader can
+// work out how long it took to come back. The transfers are done by a 'transport' so the benchmark
+// can be run against a simulated loopback without a device.
+namespace loopback_benchmark
+{
+
+// usb-device loops back whole 512 byte buffers so data is written and read in units of 1 buffer.
+const size_t unit_size = 512;
+
+class transport {
+public:
+    // Implemented by the benchmark, called by the transport from 'handle_events'.
+    class client {
+    public:
+        // Called before every write is submitted, 'length' is a multiple of 'unit_size'.
+        virtual void fill(unsigned char *const data, const size_t length) = 0;
+        virtual void written(const size_t length) = 0;
+        virtual void read(const unsigned char *const data, const size_t length) = 0;
+
+    protected:
+        ~client() = default;
+    };
+
+    virtual ~transport() = default;
+
+    // Keeps 'queue_depth' writes of 'write_length' and 'queue_depth' reads of 'unit_size' outstanding.
+    virtual bool start(client &c, const size_t write_length, const int queue_depth) = 0;
+    // Waits for and processes completions, returns false if something has gone wrong.
+    virtual bool handle_events() = 0;
+    // Returns once all the outstanding transfers have completed or been cancelled.
+    virtual void stop() = 0;
+};
+
+struct settings {
+    size_t write_length;
+    int queue_depth;
+    unsigned duration_ms;
+};
+
+struct result {
+    settings run_settings;
+    bool success;
+    long long duration_us;
+    uint64_t bytes_written;
+    uint64_t bytes_read;
+    uint64_t units_in_sequence;
+    uint64_t units_lost;  // Not counting those that turned up late
+    uint64_t units_late;  // Arrived after a later unit, i.e. reordered
+    uint64_t units_duplicated;  // Arrived again, or so late they can't be told from a duplicate
+    uint64_t units_foreign;  // E.g. SPI data that was already queued on the device
+    // Round trip times in microseconds, they include the time spent queued on the host.
+    double rtt_min_us;
+    double rtt_p50_us;
+    double rtt_p90_us;
+    double rtt_p99_us;
+    double rtt_max_us;
+};
+
+result run(transport &t, const settings &s);
+
+// The arguments are "[<duration ms> [<write length> <queue depth>]]", without a write length and queue depth
+// a range of them is tried. Prints each result and stops at the first that fails or that 'check' rejects.
+bool run_from_arguments(transport &t, int argc, char *argv[], const std::function<bool(const result &)> check = nullptr);
+
+void print_result_header();
+void print_result(const result &r);
+
+}
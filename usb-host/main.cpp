@@ -1,13 +1,38 @@
 #include "../usb-device/usb-device.h"
 
+#include "bulk-stream.h"
+#include "crc32.h"
+#include "iso-receive.h"
+#include "iso-stream.h"
+#include "libusb-error.h"
+#include "libusb-transport.h"
+#include "load-readout.h"
+#include "loopback-benchmark.h"
+#include "memory-map.h"
+#include "orchestrator.h"
+#include "parameter-client.h"
+#include "prbs-checker.h"
+#include "profile-readout.h"
+#include "rate-sweep.h"
+#include "serial-port.h"
+#include "snapshot-readout.h"
+#include "trace-decoder.h"
+#include "trace-readout.h"
+
 #include <libusb-1.0/libusb.h>
 
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <chrono>
 #include <cinttypes>
+#include <climits>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <numeric>
+#include <string>
 #include <vector>
 
 #undef CHECK_BULK_IN_DATA
@@ -20,6 +45,7 @@ uint8_t epbulk_in_address = invalid_ep_address;
 uint16_t epbulk_in_mps = 0;
 uint8_t epbulk_out_address = invalid_ep_address;
 uint16_t epbulk_out_mps = 0;
+uint8_t episo_in_address = invalid_ep_address;
 
 // 'spi-master' repeatedly transmits 4 characters, 's', 'p', 'i' and ' '.
 // There is no synchronisation so these will end up in the SPI rx buffer with an unknown bit offset.
@@ -39,10 +65,6 @@ const union byte_array_to_word_hack {
 const auto num_bits = sizeof(expected) * CHAR_BIT;
 std::array<uint32_t, num_bits> possible_rx_patterns;
 
-void print_libusb_error(const libusb_error error, const char *const libusb_api_function)  {
-    printf("'%s' failed, error value %d, error name '%s', error description '%s'\n", libusb_api_function, error, libusb_error_name(error), libusb_strerror(error));
-}
-
 void print_device_list(libusb_device **device_list) {
     puts("Print USB device list");
 
@@ -91,7 +113,7 @@ bool get_endpoint_addresses(libusb_device *const device) {
         printf("unexpected number of interfaces %" PRIi8 "\n", config_descriptor->bNumInterfaces);
         goto free_and_exit;
     }
-    if (config_descriptor->interface->num_altsetting != 1) {
+    if (config_descriptor->interface->num_altsetting != 2) {
         printf("unexpected number of alternate settings %" PRIi8 "\n", config_descriptor->interface->num_altsetting);
         goto free_and_exit;
     }
@@ -147,6 +169,28 @@ bool get_endpoint_addresses(libusb_device *const device) {
         goto free_and_exit;
     }
 
+    interface_descriptor = &config_descriptor->interface->altsetting[usb_device::iso_alternate_setting];
+    endpoint_descriptor = interface_descriptor->endpoint;
+    for (auto i = 0; i < interface_descriptor->bNumEndpoints; ++i) {
+        const auto bEndpointAddress = endpoint_descriptor->bEndpointAddress;
+        const auto bmAttributes = endpoint_descriptor->bmAttributes;
+        const auto wMaxPacketSize = endpoint_descriptor->wMaxPacketSize;
+        printf("bEndpointAddress 0x%" PRIx8 " bmAttributes 0x%" PRIx8 " wMaxPacketSize 0x%" PRIx16 "\n", bEndpointAddress, bmAttributes, wMaxPacketSize);
+
+        const bool is_in = (bEndpointAddress & LIBUSB_ENDPOINT_IN) == LIBUSB_ENDPOINT_IN;
+        const bool is_iso = (bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS;
+        if (is_in && is_iso) {
+            episo_in_address = bEndpointAddress;
+            break;
+        }
+
+        ++endpoint_descriptor;
+    }
+    if (episo_in_address == invalid_ep_address) {
+        puts("failed to find isochronous in endpoint");
+        goto free_and_exit;
+    }
+
     success = true;
 free_and_exit:
     libusb_free_config_descriptor(config_descriptor);
@@ -223,6 +267,16 @@ bool claim_interface(libusb_device_handle *const device_handle) {
     }
 }
 
+bool set_alternate_setting(libusb_device_handle *const device_handle, const uint8_t alternate_setting) {
+    const auto error = libusb_set_interface_alt_setting(device_handle, 0, alternate_setting);
+    if (error) {
+        print_libusb_error(static_cast<libusb_error>(error), "libusb_set_interface_alt_setting");
+        return false;
+    } else {
+        return true;
+    }
+}
+
 bool release_interface(libusb_device_handle *const device_handle) {
     const auto error = libusb_release_interface(device_handle, 0);
     if (error) {
@@ -390,28 +444,431 @@ bool bulk_transfer_out(libusb_device_handle *const device_handle) {
     }
 }
 
-void do_somthing_with_device(libusb_device_handle *const device_handle) {
+bool do_somthing_with_device(libusb_device_handle *const device_handle) {
     assert(device_handle);
 
-    if (!check_configuration_value(device_handle)) return;
+    if (!check_configuration_value(device_handle)) return false;
 
     // Control endpoint, i.e. endpoint 0, available regardless of whether or not interface is claimed
-    if (!control_transfer_out(device_handle)) return;
-    if (!control_transfer_in(device_handle)) return;
+    if (!control_transfer_out(device_handle)) return false;
+    if (!control_transfer_in(device_handle)) return false;
+
+    if (!claim_interface(device_handle)) return false;
+
+    if (!repeat_bulk_in_transfer(device_handle)) return false;
+    if (!bulk_transfer_out(device_handle)) return false;
+
+    return release_interface(device_handle);
+}
+
+bool iso_receive_from_device(libusb_device_handle *const device_handle, const unsigned duration_s, iso_stream::reassembler::sink_t sink = nullptr) {
+    assert(device_handle);
+    assert(episo_in_address != invalid_ep_address);
+
+    if (!check_configuration_value(device_handle)) return false;
+
+    if (!claim_interface(device_handle)) return false;
+
+    auto success = false;
+    if (set_alternate_setting(device_handle, usb_device::iso_alternate_setting)) {
+        success = iso_receive::run(device_handle, episo_in_address, duration_s, sink);
+        set_alternate_setting(device_handle, usb_device::bulk_alternate_setting);
+    }
+
+    release_interface(device_handle);
+    return success;
+}
+
+// Sets the spi-master prescaler using its serial console and empties the usb-device buffers using the isochronous endpoint.
+class device_sweep_rig: public rate_sweep::rig {
+public:
+    device_sweep_rig(libusb_device_handle *const device_handle, serial_port::port &spi_master)
+        : device_handle(device_handle), spi_master(spi_master) {}
+
+    bool set_prescaler(const unsigned prescaler) override {
+        if (!spi_master.write_line("prescaler " + std::to_string(prescaler))) {
+            return false;
+        }
+        // Give spi-master time to restart the SPI, it prints the new SCLK when it has.
+        spi_master.read_until_quiet(200);
+        return true;
+    }
+
+    bool read_overflows(uint16_t &overflows) override {
+        return parameter_client::get(device_handle, parameters::id::spi_overflows, overflows);
+    }
 
-    if (!claim_interface(device_handle)) return;
+    bool stream(const unsigned duration_s) override {
+        return iso_receive::run(device_handle, episo_in_address, duration_s);
+    }
+
+private:
+    libusb_device_handle *const device_handle;
+    serial_port::port &spi_master;
+};
+
+// spi-master must already be transmitting, the sweep only changes its prescaler.
+bool sweep_subcommand(libusb_device_handle *const device_handle, int argc, char *argv[]) {
+    assert(episo_in_address != invalid_ep_address);
+
+    if (argc < 1) {
+        puts("the spi-master serial port is required");
+        return false;
+    }
+    const unsigned duration_s = argc > 1 ? strtoul(argv[1], nullptr, 0) : 2;
+    const uint32_t max_sclk_hz = argc > 2 ? strtoul(argv[2], nullptr, 0) : rate_sweep::default_max_sclk_hz;
+
+    serial_port::port spi_master;
+    if (!spi_master.open(argv[0])) return false;
+
+    if (!check_configuration_value(device_handle)) return false;
+    if (!claim_interface(device_handle)) return false;
 
-    if (!repeat_bulk_in_transfer(device_handle)) return;
-    if (!bulk_transfer_out(device_handle)) return;
+    auto success = false;
+    if (set_alternate_setting(device_handle, usb_device::iso_alternate_setting)) {
+        device_sweep_rig rig(device_handle, spi_master);
+        const auto result = rate_sweep::run(rig, duration_s, max_sclk_hz);
+        rate_sweep::print_result(result);
+        success = result.success;
+        set_alternate_setting(device_handle, usb_device::bulk_alternate_setting);
+    }
 
-    if (!release_interface(device_handle)) return;
+    release_interface(device_handle);
+    return success;
 }
 
+// Captures from the isochronous endpoint for the orchestrator, the interface must already be set up.
+class device_capture: public orchestrator::capture {
+public:
+    explicit device_capture(libusb_device_handle *const device_handle) : device_handle(device_handle) {}
+
+    bool run(const orchestrator::test &t, orchestrator::capture_result &result) override {
+        orchestrator::pattern_checker checker(t);
+        iso_receive::summary summary;
+        const auto success = iso_receive::run(device_handle, episo_in_address, t.duration_s, [&checker](const uint8_t *const data, const size_t length) {
+            checker.add(data, length);
+        }, &summary);
+
+        result.bytes = summary.stream.bytes;
+        result.duration_s = summary.duration_s;
+        result.lost_microframes = summary.stream.lost_microframes;
+        result.crc_errors = summary.stream.crc_errors;
+        checker.get_result(result);
+        return success;
+    }
+
+private:
+    libusb_device_handle *const device_handle;
+};
+
+bool orchestrate_subcommand(libusb_device_handle *const device_handle, int argc, char *argv[]) {
+    assert(episo_in_address != invalid_ep_address);
+
+    if (argc < 2) {
+        puts("the spi-master and usb-device serial ports are required");
+        return false;
+    }
+    std::vector<orchestrator::test> tests;
+    if (!orchestrator::parse_tests(argc - 2, argv + 2, tests)) return false;
+
+    serial_port::port spi_master;
+    serial_port::port usb_device;
+    if (!spi_master.open(argv[0]) || !usb_device.open(argv[1])) return false;
+
+    if (!check_configuration_value(device_handle)) return false;
+    if (!claim_interface(device_handle)) return false;
+
+    auto passed = false;
+    if (set_alternate_setting(device_handle, usb_device::iso_alternate_setting)) {
+        device_capture capture(device_handle);
+        const auto results = orchestrator::run(spi_master, usb_device, capture, tests);
+        orchestrator::print_report(results);
+        passed = results.size() == tests.size()
+            && std::all_of(results.begin(), results.end(), [](const orchestrator::test_result &r) { return r.success && r.passed(); });
+        set_alternate_setting(device_handle, usb_device::bulk_alternate_setting);
+    }
+
+    release_interface(device_handle);
+    return passed;
 }
 
-int main() {
+// With a PRBS degree the data is checked against the sequence, see spi-master's "prbs" command.
+bool iso_subcommand(libusb_device_handle *const device_handle, int argc, char *argv[]) {
+    const unsigned duration_s = argc > 0 ? strtoul(argv[0], nullptr, 0) : 10;
+    if (argc < 2) {
+        return iso_receive_from_device(device_handle, duration_s);
+    }
+
+    const auto polynomial = prbs::find(strtoul(argv[1], nullptr, 0));
+    if (polynomial == nullptr) {
+        puts("invalid PRBS degree, expected 7, 15, 23 or 31");
+        return false;
+    }
+    prbs_checker::checker checker(*polynomial);
+    const auto success = iso_receive_from_device(device_handle, duration_s, [&checker](const uint8_t *const data, const size_t length) {
+        checker.add(data, length);
+    });
+    prbs_checker::print_statistics(*polynomial, checker.get_statistics());
+    return success && checker.get_statistics().bit_errors == 0;
+}
+
+bool bulk_out_subcommand(libusb_device_handle *const device_handle, int argc, char *argv[]) {
+    assert(epbulk_out_address != invalid_ep_address);
+
+    const unsigned duration_s = argc > 0 ? strtoul(argv[0], nullptr, 0) : 10;
+    const int queue_depth = argc > 1 ? strtol(argv[1], nullptr, 0) : bulk_stream::default_queue_depth;
+    if (queue_depth <= 0) {
+        puts("invalid queue depth");
+        return false;
+    }
+
+    if (!check_configuration_value(device_handle)) return false;
+    if (!claim_interface(device_handle)) return false;
+
+    const auto success = bulk_stream::write(device_handle, epbulk_out_address, duration_s, queue_depth);
+
+    release_interface(device_handle);
+    return success;
+}
+
+// The SPI is stopped whilst looping back otherwise the SPI data would be mixed up with the looped back data.
+bool loopback_subcommand(libusb_device_handle *const device_handle, int argc, char *argv[]) {
+    assert(epbulk_out_address != invalid_ep_address);
+    assert(epbulk_in_address != invalid_ep_address);
+
+    if (!check_configuration_value(device_handle)) return false;
+    if (!claim_interface(device_handle)) return false;
+
+    auto success = false;
+    if (parameter_client::set(device_handle, parameters::id::spi_enabled, 0)
+            && parameter_client::set(device_handle, parameters::id::out_consumer, static_cast<uint16_t>(parameters::out_consumer_t::loopback))) {
+        libusb_transport::bulk_transport transport(device_handle, epbulk_out_address, epbulk_in_address);
+        success = loopback_benchmark::run_from_arguments(transport, argc, argv);
+    }
+
+    parameter_client::set(device_handle, parameters::id::out_consumer, static_cast<uint16_t>(parameters::out_consumer_t::discard));
+    parameter_client::set(device_handle, parameters::id::spi_enabled, 1);
+
+    release_interface(device_handle);
+    return success;
+}
+
+// Checks the CRC used by 'header_flag_crc32' and measures how fast the host can check it,
+// by default for the length of a usb-device SPI buffer.
+bool crc_bench_subcommand(libusb_device_handle *const, int argc, char *argv[]) {
+    const unsigned duration_ms = argc > 0 ? strtoul(argv[0], nullptr, 0) : 1000;
+    const size_t length = argc > 1 ? strtoul(argv[1], nullptr, 0) : usb_device::crc32_buffer_size;
+
+    if (!crc32::self_test()) {
+        return false;
+    }
+    crc32::benchmark(length, duration_ms);
+    return true;
+}
+
+// Meant to be run after building the firmware, the exit status is non-zero if a budget has been overrun
+// so it can stop a build script.
+bool footprint_subcommand(libusb_device_handle *const, int argc, char *argv[]) {
+    if (argc < 1) {
+        puts("footprint needs a map file");
+        return false;
+    }
+
+    std::ifstream map_file(argv[0]);
+    memory_map::map m;
+    if (!map_file || !memory_map::parse(map_file, m)) {
+        printf("can't read '%s'\n", argv[0]);
+        return false;
+    }
+    const auto f = memory_map::attribute(m);
+    memory_map::print(m, f);
+
+    if (argc > 1) {
+        std::ifstream budget_file(argv[1]);
+        std::vector<memory_map::budget> budgets;
+        if (!budget_file || !memory_map::parse_budgets(budget_file, budgets)) {
+            printf("can't read '%s'\n", argv[1]);
+            return false;
+        }
+        if (!memory_map::check(f, budgets)) {
+            puts("over budget");
+            return false;
+        }
+        printf("within %zu budgets\n", budgets.size());
+    }
+    return true;
+}
+
+// Also meant to be run after building the firmware, checks the sections that have to be in the
+// TCMs, or mustn't be, are, see usb-device/placement-rules.txt.
+bool placement_subcommand(libusb_device_handle *const, int argc, char *argv[]) {
+    if (argc < 2) {
+        puts("placement needs a map file and a rules file");
+        return false;
+    }
+
+    std::ifstream map_file(argv[0]);
+    memory_map::map m;
+    if (!map_file || !memory_map::parse(map_file, m)) {
+        printf("can't read '%s'\n", argv[0]);
+        return false;
+    }
+
+    std::ifstream rules_file(argv[1]);
+    std::vector<memory_map::placement_rule> rules;
+    if (!rules_file || !memory_map::parse_placement_rules(rules_file, rules)) {
+        printf("can't read '%s'\n", argv[1]);
+        return false;
+    }
+    if (!memory_map::check_placement(m, rules)) {
+        puts("misplaced");
+        return false;
+    }
+    printf("%zu placement rules followed\n", rules.size());
+    return true;
+}
+
+bool profile_subcommand(libusb_device_handle *const device_handle, int argc, char *argv[]) {
+    // Control endpoint, i.e. endpoint 0, available regardless of whether or not interface is claimed
+    if (argc > 0 && strcmp(argv[0], "reset") == 0) {
+        return profile_readout::reset(device_handle);
+    } else {
+        return profile_readout::print(device_handle);
+    }
+}
+
+bool load_subcommand(libusb_device_handle *const device_handle, int, char *[]) {
+    // Control endpoint, i.e. endpoint 0, available regardless of whether or not interface is claimed
+    return load_readout::print(device_handle);
+}
+
+bool parameter_subcommand(libusb_device_handle *const device_handle, int argc, char *argv[]) {
+    // Control endpoint, i.e. endpoint 0, available regardless of whether or not interface is claimed
+    if (argc == 0) {
+        return parameter_client::print_all(device_handle);
+    }
+
+    const auto parameter = parameters::find(argv[0]);
+    if (parameter == parameters::id::number_of) {
+        printf("unknown parameter '%s'\n", argv[0]);
+        return false;
+    }
+
+    if (argc == 1) {
+        uint16_t value = 0;
+        if (!parameter_client::get(device_handle, parameter, value)) {
+            return false;
+        }
+        printf("%s %u\n", argv[0], value);
+        return true;
+    } else {
+        const auto value = strtoul(argv[1], nullptr, 0);
+        if (value > UINT16_MAX || !parameters::is_valid(parameter, value)) {
+            printf("invalid value for '%s'\n", argv[0]);
+            return false;
+        }
+        return parameter_client::set(device_handle, parameter, value);
+    }
+}
+
+bool snapshot_subcommand(libusb_device_handle *const device_handle, int, char *[]) {
+    // Control endpoint, i.e. endpoint 0, available regardless of whether or not interface is claimed
+    return snapshot_readout::print(device_handle);
+}
+
+bool trace_subcommand(libusb_device_handle *const device_handle, int, char *[]) {
+    // Control endpoint, i.e. endpoint 0, available regardless of whether or not interface is claimed
+    trace_decoder::decoder decoder;
+    const auto success = trace_readout::read(device_handle, decoder);
+    trace_decoder::print_statistics(decoder.get_statistics());
+    return success;
+}
+
+// Decodes the output of the usb-device "trace" command, e.g. a terminal log.
+bool trace_decode_subcommand(libusb_device_handle *const, int argc, char *argv[]) {
+    if (argc < 1) {
+        puts("trace-decode needs a file name, or - for stdin");
+        return false;
+    }
+    FILE *const file = strcmp(argv[0], "-") == 0 ? stdin : fopen(argv[0], "r");
+    if (file == nullptr) {
+        perror(argv[0]);
+        return false;
+    }
+
+    trace_decoder::decoder decoder;
+    char line[256];
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        decoder.add_line(line);
+    }
+    if (file != stdin) {
+        fclose(file);
+    }
+    const auto statistics = decoder.get_statistics();
+    trace_decoder::print_statistics(statistics);
+    return statistics.malformed == 0;
+}
+
+// Subcommands are given the arguments following the subcommand name.
+// Running usb-host without a subcommand does the original control and bulk transfer tests.
+// Subcommands that don't need the device are given a nullptr device handle.
+struct subcommand {
+    const char *name;
+    bool (*function)(libusb_device_handle *const device_handle, int argc, char *argv[]);
+    const char *usage;
+    bool needs_device;
+};
+
+const subcommand subcommands[] = {
+    { "crc-bench", crc_bench_subcommand, "crc-bench [<duration ms> [<length>]]", false },
+    { "footprint", footprint_subcommand, "footprint <map file> [<budget file>]", false },
+    { "placement", placement_subcommand, "placement <map file> <rules file>", false },
+    { "iso", iso_subcommand, "iso [<duration s> [<PRBS degree>]]", true },
+    { "load", load_subcommand, "load", true },
+    { "loopback", loopback_subcommand, "loopback [<duration ms> [<write length> <queue depth>]]", true },
+    { "orchestrate", orchestrate_subcommand, "orchestrate <spi-master serial port> <usb-device serial port> [<duration s> [<prescaler,...> [<mode,...>]]]", true },
+    { "out", bulk_out_subcommand, "out [<duration s> [<queue depth>]]", true },
+    { "param", parameter_subcommand, "param [<name> [<value>]]", true },
+    { "profile", profile_subcommand, "profile [reset]", true },
+    { "snapshot", snapshot_subcommand, "snapshot", true },
+    { "sweep", sweep_subcommand, "sweep <spi-master serial port> [<duration s> [<max sclk Hz>]]", true },
+    { "trace", trace_subcommand, "trace", true },
+    { "trace-decode", trace_decode_subcommand, "trace-decode <file|->", false }
+};
+
+const subcommand *find_subcommand(const char *const name) {
+    for (const auto &subcommand: subcommands) {
+        if (strcmp(subcommand.name, name) == 0) {
+            return &subcommand;
+        }
+    }
+    return nullptr;
+}
+
+void print_usage() {
+    puts("usage: usb-host [<subcommand> [<args>]]");
+    for (const auto &subcommand: subcommands) {
+        printf("    %s\n", subcommand.usage);
+    }
+}
+
+}
+
+int main(int argc, char *argv[]) {
     puts("usb-host");
 
+    const subcommand *subcommand = nullptr;
+    if (argc > 1) {
+        subcommand = find_subcommand(argv[1]);
+        if (subcommand == nullptr) {
+            print_usage();
+            return 1;
+        }
+        if (!subcommand->needs_device) {
+            return subcommand->function(nullptr, argc - 2, argv + 2) ? 0 : 1;
+        }
+    }
+
     const auto error = libusb_init(NULL);
     if (error < 0) {
         print_libusb_error(static_cast<libusb_error>(error), "libusb_init");
@@ -432,11 +889,18 @@ int main() {
 
     libusb_free_device_list(device_list, 1);
 
-    do_somthing_with_device(device_handle);
+    auto success = false;
+    if (device_handle != nullptr) {
+        if (subcommand != nullptr) {
+            success = subcommand->function(device_handle, argc - 2, argv + 2);
+        } else {
+            success = do_somthing_with_device(device_handle);
+        }
+    }
 
     libusb_close(device_handle);
 
     libusb_exit(NULL);
 
-    return 0;
+    return success ? 0 : 1;
 }
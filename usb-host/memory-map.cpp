@@ -0,0 +1,344 @@
+#include "memory-map.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+namespace memory_map
+{
+
+namespace
+{
+
+bool is_hex(const std::string &s) {
+    return s.size() > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X');
+}
+
+uint64_t parse_hex(const std::string &s) {
+    return std::stoull(s, nullptr, 16);
+}
+
+std::vector<std::string> split(const std::string &line) {
+    std::istringstream words(line);
+    std::vector<std::string> result;
+    std::string word;
+    while (words >> word) {
+        result.push_back(word);
+    }
+    return result;
+}
+
+const region *find_region(const map &m, const uint64_t address) {
+    for (const auto &r: m.regions) {
+        if (address >= r.origin && address - r.origin < r.length) {
+            return &r;
+        }
+    }
+    return nullptr;
+}
+
+// Debug information and the like are listed at address 0, which is the ITCM, so they're picked out by name.
+bool is_allocated(const input_section &s) {
+    for (const auto prefix: { ".debug", ".comment", ".ARM.attributes", ".stab" }) {
+        if (s.output_section.compare(0, strlen(prefix), prefix) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Mbed OS's linker scripts pad '.heap' out to the end of RAM so the heap gets whatever's left, and
+// '.stack_dummy' only works out where the ISR stack goes. Neither is RAM any module has used.
+bool is_free_space(const input_section &s) {
+    return s.output_section == ".heap" || s.output_section == ".stack_dummy";
+}
+
+// "Name Origin Length [Attributes]", the *default* region covers everything so it's ignored.
+void parse_region(const std::vector<std::string> &words, map &m) {
+    if (words.size() >= 3 && words[0] != "*default*" && is_hex(words[1]) && is_hex(words[2])) {
+        m.regions.push_back({ words[0], parse_hex(words[1]), parse_hex(words[2]) });
+    }
+}
+
+}
+
+// The interesting bits of a map look like this, a section name that's too long for its column
+// pushes the rest of the line on to the next:
+//
+//     Memory Configuration
+//
+//     Name             Origin             Length             Attributes
+//     FLASH            0x08000000         0x00080000         xr
+//     RAM              0x200001f8         0x0003ee08         xrw
+//
+//     Linker script and memory map
+//
+//     .text           0x08000000    0x1f2c4
+//      *(.text*)
+//      .text.main     0x08000190       0x54 ./BUILD/DISCO_F723IE/GCC_ARM-DEBUG/main.o
+//                     0x08000190                main
+//      .text._ZN6spi_rx4initEv
+//                     0x080001e4       0x9c ./BUILD/DISCO_F723IE/GCC_ARM-DEBUG/spi-rx.o
+//      *fill*         0x08000280        0x4
+//     .data           0x20000200      0x1c4 load address 0x0801f2c4
+bool parse(std::istream &in, map &m) {
+    enum class part { preamble, memory_configuration, memory_map } current = part::preamble;
+    bool found_memory_map = false;
+    std::string output_section;
+    uint64_t load_offset = 0;  // Load address minus address for the current output section
+    std::string pending_name;  // A section name whose address and size are on the next line
+
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+
+        if (line == "Memory Configuration") {
+            current = part::memory_configuration;
+            continue;
+        } else if (line == "Linker script and memory map") {
+            current = part::memory_map;
+            found_memory_map = true;
+            continue;
+        }
+
+        const auto words = split(line);
+        if (current == part::memory_configuration) {
+            parse_region(words, m);
+            continue;
+        } else if (current != part::memory_map || words.empty()) {
+            continue;
+        }
+
+        // An output section starts at the beginning of the line.
+        if (line[0] == '.') {
+            output_section = words[0];
+            load_offset = 0;
+            pending_name.clear();
+            if (words.size() >= 6 && words[3] == "load" && words[4] == "address" && is_hex(words[1]) && is_hex(words[5])) {
+                load_offset = parse_hex(words[5]) - parse_hex(words[1]);
+            }
+            continue;
+        }
+
+        // An input section starts with one space, followed by its address, size and file unless they're on the next line.
+        std::vector<std::string> fields;
+        std::string name;
+        if (line.size() > 1 && line[0] == ' ' && line[1] != ' ') {
+            name = words[0];
+            fields.assign(words.begin() + 1, words.end());
+            if (fields.empty()) {
+                pending_name = name;
+                continue;
+            }
+        } else if (!pending_name.empty()) {
+            name = pending_name;
+            fields = words;
+        } else {
+            continue;
+        }
+        pending_name.clear();
+
+        // Symbols and assignments have an address but no size, patterns like '*(.text*)' have neither.
+        if (name[0] == '*' && name != "*fill*") {
+            continue;
+        }
+        if (fields.size() < 2 || !is_hex(fields[0]) || !is_hex(fields[1])) {
+            continue;
+        }
+
+        const auto address = parse_hex(fields[0]);
+        const auto size = parse_hex(fields[1]);
+        if (size == 0) {
+            continue;
+        }
+
+        std::string file;
+        for (auto i = 2u; i < fields.size(); ++i) {
+            file += (i > 2 ? " " : "") + fields[i];
+        }
+        m.sections.push_back({ output_section, name, address, address + load_offset, size, file });
+    }
+
+    if (!found_memory_map) {
+        puts("no \"Linker script and memory map\", is it a GNU ld map file?");
+        return false;
+    }
+    if (m.regions.empty()) {
+        puts("no \"Memory Configuration\"");
+        return false;
+    }
+    return true;
+}
+
+std::string module_of(const std::string &file) {
+    if (file.empty()) {
+        return "other";
+    }
+    if (file.find("mbed-os/") != std::string::npos || file.find("mbed-os\\") != std::string::npos) {
+        return "mbed-os";
+    }
+    if (file.find(".a(") != std::string::npos || file.find("arm-none-eabi") != std::string::npos) {
+        return "toolchain";
+    }
+
+    const auto separator = file.find_last_of("/\\");
+    auto stem = file.substr(separator == std::string::npos ? 0 : separator + 1);
+    const auto extension = stem.rfind(".o");
+    if (extension == std::string::npos || extension + 2 != stem.size()) {
+        return "other";
+    }
+    stem.erase(extension);
+    for (auto &c: stem) {
+        if (c == '-') c = '_';
+    }
+    return stem;
+}
+
+footprint attribute(const map &m) {
+    footprint f;
+    for (const auto &s: m.sections) {
+        const auto module = s.name == "*fill*" ? std::string("fill") : module_of(s.file);
+        const auto r = find_region(m, s.address);
+        if (r == nullptr || !is_allocated(s) || is_free_space(s)) {
+            continue;
+        }
+        f[module][r->name] += s.size;
+
+        const auto load_region = find_region(m, s.load_address);
+        if (load_region != nullptr && load_region != r) {
+            f[module][load_region->name] += s.size;
+        }
+    }
+    return f;
+}
+
+bool parse_budgets(std::istream &in, std::vector<budget> &budgets) {
+    std::string line;
+    auto line_number = 0;
+    while (std::getline(in, line)) {
+        ++line_number;
+        const auto comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.erase(comment);
+        }
+        const auto words = split(line);
+        if (words.empty()) {
+            continue;
+        }
+
+        char *end = nullptr;
+        const auto max_bytes = words.size() == 3 ? strtoull(words[2].c_str(), &end, 0) : 0;
+        if (words.size() != 3 || end == nullptr || *end != '\0') {
+            printf("budget line %d should be \"<module> <region> <max bytes>\"\n", line_number);
+            return false;
+        }
+        budgets.push_back({ words[0], words[1], max_bytes });
+    }
+    return true;
+}
+
+uint64_t usage(const footprint &f, const std::string &module, const std::string &region) {
+    uint64_t bytes = 0;
+    for (const auto &m: f) {
+        if (module == total_module || m.first == module) {
+            const auto r = m.second.find(region);
+            if (r != m.second.end()) {
+                bytes += r->second;
+            }
+        }
+    }
+    return bytes;
+}
+
+bool check(const footprint &f, const std::vector<budget> &budgets) {
+    auto within_budget = true;
+    for (const auto &b: budgets) {
+        const auto bytes = usage(f, b.module, b.region);
+        if (bytes > b.max_bytes) {
+            printf("%s uses %" PRIu64 " bytes of %s, over its budget of %" PRIu64 " by %" PRIu64 "\n",
+                b.module.c_str(), bytes, b.region.c_str(), b.max_bytes, bytes - b.max_bytes);
+            within_budget = false;
+        }
+    }
+    return within_budget;
+}
+
+bool parse_placement_rules(std::istream &in, std::vector<placement_rule> &rules) {
+    std::string line;
+    auto line_number = 0;
+    while (std::getline(in, line)) {
+        ++line_number;
+        const auto comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.erase(comment);
+        }
+        const auto words = split(line);
+        if (words.empty()) {
+            continue;
+        }
+
+        if (words.size() != 2 && words.size() != 3) {
+            printf("placement rule line %d should be \"<section> <region> [<module>]\"\n", line_number);
+            return false;
+        }
+        rules.push_back({ words[0], words[1], words.size() == 3 ? words[2] : std::string() });
+    }
+    return true;
+}
+
+bool check_placement(const map &m, const std::vector<placement_rule> &rules) {
+    auto all_followed = true;
+    for (const auto &rule: rules) {
+        auto matches = 0;
+        for (const auto &s: m.sections) {
+            if (s.name.compare(0, rule.section.size(), rule.section) != 0 || !is_allocated(s)
+                || (!rule.module.empty() && module_of(s.file) != rule.module)) {
+                continue;
+            }
+            ++matches;
+            const auto r = find_region(m, s.address);
+            if (r == nullptr || r->name != rule.region) {
+                printf("%s from %s is at 0x%08" PRIx64 " in %s, it should be in %s\n", s.name.c_str(), module_of(s.file).c_str(),
+                    s.address, r != nullptr ? r->name.c_str() : "no region", rule.region.c_str());
+                all_followed = false;
+            }
+        }
+        if (matches == 0) {
+            printf("nothing matches %s%s%s\n", rule.section.c_str(), rule.module.empty() ? "" : " from ", rule.module.c_str());
+            all_followed = false;
+        }
+    }
+    return all_followed;
+}
+
+void print(const map &m, const footprint &f) {
+    printf("%-24s", "module");
+    for (const auto &r: m.regions) {
+        printf(" %10s", r.name.c_str());
+    }
+    printf("\n");
+
+    for (const auto &module: f) {
+        printf("%-24s", module.first.c_str());
+        for (const auto &r: m.regions) {
+            printf(" %10" PRIu64, usage(f, module.first, r.name));
+        }
+        printf("\n");
+    }
+
+    printf("%-24s", total_module);
+    for (const auto &r: m.regions) {
+        printf(" %10" PRIu64, usage(f, total_module, r.name));
+    }
+    printf("\n%-24s", "size");
+    for (const auto &r: m.regions) {
+        printf(" %10" PRIu64, r.length);
+    }
+    printf("\n");
+}
+
+}
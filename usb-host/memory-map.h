@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <string>
+#include <vector>
+
+// Attributes the RAM and flash used by a firmware image to the modules it's built from by parsing
+// the GNU ld map file Mbed OS writes next to the image, e.g. BUILD/DISCO_F723IE/GCC_ARM-DEBUG/usb-device.map.
+// A module is an object file of the application, named like its namespace, so spi-rx.o is 'spi_rx',
+// or one of 'mbed-os' and 'toolchain' for everything in those. The usage can be checked against
+// budgets so a build step can fail when something grows, see usb-device/footprint-budgets.txt.
+// Where sections ended up can be checked as well, e.g. that the ISRs' hot code is in the ITCM.
+namespace memory_map
+{
+
+// From the map's "Memory Configuration", e.g. FLASH and RAM.
+struct region {
+    std::string name;
+    uint64_t origin;
+    uint64_t length;
+};
+
+struct input_section {
+    std::string output_section;
+    std::string name;
+    uint64_t address;
+    uint64_t load_address;  // Different to 'address' for initialised data, which is copied from flash
+    uint64_t size;
+    std::string file;
+};
+
+struct map {
+    std::vector<region> regions;
+    std::vector<input_section> sections;
+};
+
+// Returns false, having printed why, if it doesn't look like a GNU ld map.
+bool parse(std::istream &in, map &m);
+
+// 'spi-rx.o' is 'spi_rx', anything from mbed-os is 'mbed-os' and anything from a library archive, or the
+// toolchain's own directories, e.g. crti.o, is 'toolchain'.
+std::string module_of(const std::string &file);
+
+// Bytes used by each module in each region. Initialised data is counted in both the region it lives
+// in and the one it's loaded from. The alignment padding is module 'fill'.
+using footprint = std::map<std::string, std::map<std::string, uint64_t>>;
+
+footprint attribute(const map &m);
+
+// One line per budget, "<module> <region> <max bytes>", '#' starts a comment.
+// Module 'total' is the sum of all the modules in the region.
+struct budget {
+    std::string module;
+    std::string region;
+    uint64_t max_bytes;
+};
+
+bool parse_budgets(std::istream &in, std::vector<budget> &budgets);
+
+const char *const total_module = "total";
+
+uint64_t usage(const footprint &f, const std::string &module, const std::string &region);
+
+// Prints each budget that's been overrun, returns false if there were any.
+bool check(const footprint &f, const std::vector<budget> &budgets);
+
+// One line per rule, "<section> <region> [<module>]", '#' starts a comment. Every input section whose
+// name starts with <section>, from <module> if there is one, must be in <region>, see usb-device/placement-rules.txt.
+// There must be at least one so a rule can't pass because the section was renamed or the module's gone.
+struct placement_rule {
+    std::string section;
+    std::string region;
+    std::string module;  // Empty for any module
+};
+
+bool parse_placement_rules(std::istream &in, std::vector<placement_rule> &rules);
+
+// Prints each section that's in the wrong region and each rule nothing matches, returns false if there were any.
+bool check_placement(const map &m, const std::vector<placement_rule> &rules);
+
+void print(const map &m, const footprint &f);
+
+}
@@ -0,0 +1,314 @@
+#include "orchestrator.h"
+
+#include "rate-sweep.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace orchestrator
+{
+
+namespace
+{
+
+// spi-master queues most commands on its event queue, the output arrives after the prompt.
+const unsigned quiet_ms = 300;
+
+// { 's', 'p', 'i', ' ' } as received, i.e. big endian, see 'tx_buffer_init' in spi-master/main.cpp.
+const uint32_t spi_word = 's' << 24 | 'p' << 16 | 'i' << 8 | ' ';
+
+uint32_t rotate_word(const uint32_t word, const unsigned shift) {
+    return shift == 0 ? word : word << shift | word >> (32 - shift);
+}
+
+uint32_t big_endian_word(const uint8_t *const data) {
+    return static_cast<uint32_t>(data[0]) << 24 | data[1] << 16 | data[2] << 8 | data[3];
+}
+
+bool contains(const std::string &response, const char *const text) {
+    return response.find(text) != std::string::npos;
+}
+
+// "toggle-dma" prints "SPI transmitting" or "SPI not transmitting", there's no way to ask without toggling.
+bool set_transmitting(console::transport &spi_master, const bool transmitting) {
+    for (auto attempt = 0; attempt < 2; ++attempt) {
+        const auto response = console::command(spi_master, "toggle-dma", quiet_ms);
+        const auto stopped = contains(response, "SPI not transmitting");
+        if (!stopped && !contains(response, "SPI transmitting")) {
+            puts("spi-master didn't answer toggle-dma");
+            return false;
+        }
+        if (stopped != transmitting) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool read_spi_overflows(console::transport &usb_device, uint16_t &overflows) {
+    unsigned long value;
+    if (!console::find_value(console::command(usb_device, "parameter", quiet_ms), "spi-overflows", value)) {
+        puts("usb-device didn't report spi-overflows");
+        return false;
+    }
+    overflows = static_cast<uint16_t>(value);
+    return true;
+}
+
+std::string mode_command(const test &t) {
+    switch (t.mode) {
+    case data_mode::constant: return "constant-data";
+    case data_mode::counter: return "changing-data";
+    case data_mode::prbs: return "prbs " + std::to_string(t.prbs_degree);
+    }
+    return {};
+}
+
+bool run_test(console::transport &spi_master, console::transport &usb_device, capture &c, test_result &result) {
+    const auto &t = result.t;
+
+    const auto prescaler = std::to_string(t.prescaler);
+    if (!contains(console::command(spi_master, "prescaler " + prescaler, quiet_ms), ("prescaler " + prescaler + " SCLK").c_str())) {
+        puts("spi-master didn't accept the prescaler");
+        return false;
+    }
+    // The data commands restart the DMA, except "constant-data" when it's already constant.
+    console::command(spi_master, mode_command(t), quiet_ms);
+    if (!set_transmitting(spi_master, true)) return false;
+    console::command(spi_master, "underruns reset", quiet_ms);
+
+    uint16_t before;
+    uint16_t after;
+    if (!read_spi_overflows(usb_device, before)) return false;
+    const auto captured = c.run(t, result.capture);
+    if (!read_spi_overflows(usb_device, after)) return false;
+    // Unsigned arithmetic so the wrap is handled naturally.
+    result.spi_overflows = after - before;
+
+    if (!console::find_value(console::command(spi_master, "underruns", quiet_ms), "underruns", result.underruns)) {
+        puts("spi-master didn't report underruns");
+        return false;
+    }
+
+    return set_transmitting(spi_master, false) && captured;
+}
+
+}
+
+bool parse_mode(const std::string &name, test &t) {
+    if (name == "constant") {
+        t.mode = data_mode::constant;
+        return true;
+    }
+    if (name == "counter") {
+        t.mode = data_mode::counter;
+        return true;
+    }
+    if (name.compare(0, 4, "prbs") == 0 && prbs::find(strtoul(name.c_str() + 4, nullptr, 10)) != nullptr) {
+        t.mode = data_mode::prbs;
+        t.prbs_degree = strtoul(name.c_str() + 4, nullptr, 10);
+        return true;
+    }
+    return false;
+}
+
+std::string mode_name(const test &t) {
+    switch (t.mode) {
+    case data_mode::constant: return "constant";
+    case data_mode::counter: return "counter";
+    case data_mode::prbs: return "prbs" + std::to_string(t.prbs_degree);
+    }
+    return {};
+}
+
+bool parse_tests(int argc, char *argv[], std::vector<test> &tests) {
+    const unsigned duration_s = argc > 0 ? strtoul(argv[0], nullptr, 0) : 2;
+    const std::string prescalers = argc > 1 ? argv[1] : "64,16,4";
+    const std::string modes = argc > 2 ? argv[2] : "constant,prbs31";
+
+    for (size_t p = 0; p < prescalers.size(); p = prescalers.find(',', p) + 1) {
+        const auto prescaler = strtoul(prescalers.c_str() + p, nullptr, 0);
+        if (std::find(std::begin(rate_sweep::prescalers), std::end(rate_sweep::prescalers), prescaler) == std::end(rate_sweep::prescalers)) {
+            puts("invalid prescaler");
+            return false;
+        }
+        for (size_t m = 0; m < modes.size(); m = modes.find(',', m) + 1) {
+            test t = { static_cast<unsigned>(prescaler), data_mode::constant, 0, duration_s };
+            if (!parse_mode(modes.substr(m, modes.find(',', m) - m), t)) {
+                puts("invalid mode, expected constant, counter or prbs<degree>");
+                return false;
+            }
+            tests.push_back(t);
+            if (modes.find(',', m) == std::string::npos) break;
+        }
+        if (prescalers.find(',', p) == std::string::npos) break;
+    }
+    return !tests.empty();
+}
+
+pattern_checker::pattern_checker(const test &t) : mode(t.mode) {
+    if (mode == data_mode::prbs) {
+        prbs.reset(new prbs_checker::checker(*prbs::find(t.prbs_degree)));
+    }
+}
+
+void pattern_checker::add(const uint8_t *const data, const size_t length) {
+    if (mode == data_mode::prbs) {
+        prbs->add(data, length);
+        return;
+    }
+    if (mode != data_mode::constant) {
+        return;
+    }
+
+    for (auto i = 0u; i + sizeof(uint32_t) <= length; i += sizeof(uint32_t)) {
+        const auto word = big_endian_word(data + i);
+        if (!synchronised) {
+            expected_word = spi_word;
+            for (auto shift = 1u; shift < 32; ++shift) {
+                if (__builtin_popcount(rotate_word(spi_word, shift) ^ word) < __builtin_popcount(expected_word ^ word)) {
+                    expected_word = rotate_word(spi_word, shift);
+                }
+            }
+            synchronised = true;
+        }
+        bits += 32;
+        errors += __builtin_popcount(expected_word ^ word);
+    }
+}
+
+void pattern_checker::get_result(capture_result &result) const {
+    result.pattern_checked = mode != data_mode::counter;
+    if (mode == data_mode::prbs) {
+        const auto &stats = prbs->get_statistics();
+        result.pattern_bits = stats.bits;
+        result.pattern_errors = stats.bit_errors;
+    } else {
+        result.pattern_bits = bits;
+        result.pattern_errors = errors;
+    }
+}
+
+bool test_result::passed() const {
+    return success && spi_overflows == 0 && underruns == 0 && capture.lost_microframes == 0 && capture.crc_errors == 0
+        && (!capture.pattern_checked || (capture.pattern_bits > 0 && capture.pattern_errors == 0));
+}
+
+std::vector<test_result> run(console::transport &spi_master, console::transport &usb_device, capture &c, const std::vector<test> &tests) {
+    std::vector<test_result> results;
+    for (const auto &t: tests) {
+        printf("prescaler %u %s for %u s\n", t.prescaler, mode_name(t).c_str(), t.duration_s);
+        test_result result;
+        result.t = t;
+        result.success = run_test(spi_master, usb_device, c, result);
+        results.push_back(result);
+        if (!result.success) {
+            // Something isn't answering, the rest of the tests would fail the same way.
+            break;
+        }
+    }
+    return results;
+}
+
+void print_report(const std::vector<test_result> &results) {
+    printf("%9s %10s %9s %8s %9s %9s %9s %6s %12s %10s %6s\n",
+        "prescaler", "sclk Hz", "mode", "MB/s", "overflows", "underruns", "lost uf", "crc", "pattern bits", "bit errors", "result");
+    for (const auto &r: results) {
+        const auto &c = r.capture;
+        const auto mb_per_s = c.duration_s > 0 ? c.bytes / c.duration_s / 1e6 : 0;
+        printf("%9u %10" PRIu32 " %9s %8.3f %9u %9lu %9" PRIu64 " %6" PRIu64,
+            r.t.prescaler, rate_sweep::sclk_hz(r.t.prescaler), mode_name(r.t).c_str(), mb_per_s,
+            static_cast<unsigned>(r.spi_overflows), r.underruns, c.lost_microframes, c.crc_errors);
+        if (c.pattern_checked) {
+            printf(" %12" PRIu64 " %10" PRIu64, c.pattern_bits, c.pattern_errors);
+        } else {
+            printf(" %12s %10s", "-", "-");
+        }
+        printf(" %6s\n", !r.success ? "error" : r.passed() ? "pass" : "fail");
+    }
+}
+
+std::string simulated_boards::start_transmitting() {
+    const auto output = transmitting ? std::string("SPI not transmitting\nSPI transmitting\n") : std::string("SPI transmitting\n");
+    transmitting = true;
+    return output;
+}
+
+std::string simulated_boards::spi_master_command(const std::string &line) {
+    char argument[32] = {};
+    unsigned value = 0;
+    if (line == "toggle-dma" || line == "td") {
+        transmitting = !transmitting;
+        return transmitting ? "SPI transmitting\n" : "SPI not transmitting\n";
+    }
+    if (sscanf(line.c_str(), "prescaler %u", &value) == 1) {
+        prescaler = value;
+        return "prescaler " + std::to_string(prescaler) + " SCLK " + std::to_string(rate_sweep::sclk_hz(prescaler)) + " Hz\n";
+    }
+    if (line == "constant-data") {
+        if (mode == data_mode::constant) {
+            return {};
+        }
+        mode = data_mode::constant;
+        return start_transmitting();
+    }
+    if (line == "changing-data") {
+        if (mode == data_mode::counter) {
+            return {};
+        }
+        mode = data_mode::counter;
+        return start_transmitting();
+    }
+    if (sscanf(line.c_str(), "prbs %u", &value) == 1) {
+        mode = data_mode::prbs;
+        return start_transmitting() + "prbs" + std::to_string(value) + "\n";
+    }
+    if (sscanf(line.c_str(), "underruns %31s", argument) == 1 || line == "underruns") {
+        return "refill isr size 256 underruns 0\n";
+    }
+    return "Command '" + line + "' not found.\n";
+}
+
+std::string simulated_boards::usb_device_command(const std::string &line) {
+    if (line == "parameter" || line == "param") {
+        char row[80];
+        snprintf(row, sizeof(row), "%-26s %5u %s\n", "spi-overflows", static_cast<unsigned>(spi_overflows), "(read-only)");
+        return std::string("streaming                      1 \n") + row;
+    }
+    return "Command '" + line + "' not found.\n";
+}
+
+// Doesn't take 'duration_s', the data is a sample of what spi-master would send, received at an odd bit offset.
+bool simulated_boards::run(const test &t, capture_result &result) {
+    const auto sclk_hz = rate_sweep::sclk_hz(prescaler);
+    if (transmitting && sclk_hz > capacity_hz) {
+        spi_overflows += 1 + t.duration_s * 10;
+    }
+
+    std::vector<uint8_t> sample(64 * 1024 + sizeof(uint32_t));
+    if (t.mode == data_mode::prbs) {
+        prbs::generator(*prbs::find(t.prbs_degree)).fill(sample.data(), sample.size());
+    } else {
+        for (auto i = 0u; i < sample.size(); i += sizeof(uint32_t)) {
+            memcpy(&sample[i], "spi ", sizeof(uint32_t));
+        }
+    }
+    const unsigned bit_offset = 5;
+    for (auto i = 0u; i + 1 < sample.size(); ++i) {
+        sample[i] = static_cast<uint8_t>((sample[i] << bit_offset) | (sample[i + 1] >> (8 - bit_offset)));
+    }
+    sample.resize(sample.size() - sizeof(uint32_t));
+
+    pattern_checker checker(t);
+    checker.add(sample.data(), sample.size());
+    checker.get_result(result);
+
+    result.duration_s = t.duration_s;
+    result.bytes = static_cast<uint64_t>(std::min(sclk_hz, capacity_hz)) / 8 * t.duration_s;
+    return transmitting;
+}
+
+}
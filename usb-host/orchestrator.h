@@ -0,0 +1,114 @@
+#pragma once
+
+#include "console.h"
+#include "prbs-checker.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Runs throughput tests across all three programs: spi-master is set up and started using its console,
+// usb-device's counters are read using its console and the data is captured by usb-host. Everything
+// to do with the boards is behind 'console::transport' and 'capture' so the sequencing can be run
+// against 'simulated_boards'.
+namespace orchestrator
+{
+
+// What spi-master transmits, see its "constant-data", "changing-data" and "prbs" commands.
+enum class data_mode {
+    constant,
+    counter,
+    prbs
+};
+
+struct test {
+    unsigned prescaler;  // See 'rate_sweep::prescalers'
+    data_mode mode;
+    unsigned prbs_degree;  // Only for 'data_mode::prbs'
+    unsigned duration_s;
+};
+
+// "constant", "counter" or "prbs<degree>", e.g. "prbs31". Returns false if 'name' isn't one of them.
+bool parse_mode(const std::string &name, test &t);
+std::string mode_name(const test &t);
+
+// Every combination of the comma separated prescalers and modes, see 'parse_mode'.
+// The arguments are "[<duration s> [<prescaler,...> [<mode,...>]]]".
+bool parse_tests(int argc, char *argv[], std::vector<test> &tests);
+
+struct capture_result {
+    uint64_t bytes = 0;
+    double duration_s = 0;
+    uint64_t lost_microframes = 0;
+    uint64_t crc_errors = 0;
+    bool pattern_checked = false;  // The counter isn't checked, it's received with an unknown bit offset
+    uint64_t pattern_bits = 0;
+    uint64_t pattern_errors = 0;
+};
+
+class capture {
+public:
+    // Receives from usb-device for 't.duration_s', checking the data with a 'pattern_checker'.
+    virtual bool run(const test &t, capture_result &result) = 0;
+
+protected:
+    ~capture() = default;
+};
+
+// Checks the received data against what spi-master was told to transmit. The constant "spi " is
+// received with an unknown bit offset but it's still the same 32 bits repeated, so every word is
+// compared with the rotation of "spi " nearest the first word. The data comes in whole SPI buffers
+// so any bytes short of a word at the end of a call are ignored.
+class pattern_checker {
+public:
+    explicit pattern_checker(const test &t);
+
+    void add(const uint8_t *const data, const size_t length);
+    void get_result(capture_result &result) const;
+
+private:
+    data_mode mode;
+    std::unique_ptr<prbs_checker::checker> prbs;
+    bool synchronised = false;
+    uint32_t expected_word = 0;
+    uint64_t bits = 0;
+    uint64_t errors = 0;
+};
+
+struct test_result {
+    test t;
+    bool success = false;  // False if a console or the capture failed, the rest isn't valid
+    uint16_t spi_overflows = 0;  // usb-device buffers lost, from the difference of its read-only counter
+    unsigned long underruns = 0;  // spi-master buffers transmitted before they were refilled
+    capture_result capture;
+
+    bool passed() const;
+};
+
+std::vector<test_result> run(console::transport &spi_master, console::transport &usb_device, capture &c, const std::vector<test> &tests);
+
+void print_report(const std::vector<test_result> &results);
+
+// The state shared by the fake consoles and the fake capture, the pipeline loses buffers above 'capacity_hz'.
+// The fakes answer the same commands as the boards, with the same output, so the sequencing and parsing are tested.
+class simulated_boards: public capture {
+public:
+    explicit simulated_boards(const uint32_t capacity_hz) : capacity_hz(capacity_hz) {}
+
+    std::string spi_master_command(const std::string &line);
+    std::string usb_device_command(const std::string &line);
+    bool run(const test &t, capture_result &result) override;
+
+private:
+    std::string start_transmitting();
+
+    const uint32_t capacity_hz;
+    bool transmitting = false;
+    unsigned prescaler = 16;
+    data_mode mode = data_mode::constant;
+    uint16_t spi_overflows = 65530;  // Near the wrap to check the difference is taken correctly
+};
+
+}
@@ -0,0 +1,72 @@
+#include "parameter-client.h"
+
+#include "libusb-error.h"
+
+#include <cstdio>
+
+namespace parameter_client
+{
+
+bool get(libusb_device_handle *const device_handle, const parameters::id parameter, uint16_t &value) {
+    const auto setup = parameters::encode_get(parameter);
+    uint8_t data[parameters::value_length] = { 0 };
+    const auto bytes_transferred = libusb_control_transfer(
+            device_handle,
+            setup.bmRequestType,
+            setup.bRequest,
+            setup.wValue,
+            setup.wIndex,
+            &data[0],
+            setup.wLength,
+            100
+        );
+    if (bytes_transferred < 0) {
+        print_libusb_error(static_cast<libusb_error>(bytes_transferred), "libusb_control_transfer");
+        return false;
+    } else if (bytes_transferred != parameters::value_length) {
+        printf("bytes_transferred %d, expected %d\n", bytes_transferred, parameters::value_length);
+        return false;
+    } else {
+        value = parameters::decode_value(data);
+        return true;
+    }
+}
+
+bool set(libusb_device_handle *const device_handle, const parameters::id parameter, const uint16_t value) {
+    const auto setup = parameters::encode_set(parameter, value);
+    const auto bytes_transferred = libusb_control_transfer(
+            device_handle,
+            setup.bmRequestType,
+            setup.bRequest,
+            setup.wValue,
+            setup.wIndex,
+            nullptr,
+            setup.wLength,
+            100
+        );
+    if (bytes_transferred < 0) {
+        // The device stalls, i.e. LIBUSB_ERROR_PIPE, if the parameter is read-only or the value is out of range.
+        print_libusb_error(static_cast<libusb_error>(bytes_transferred), "libusb_control_transfer");
+        return false;
+    } else {
+        return true;
+    }
+}
+
+bool print_all(libusb_device_handle *const device_handle) {
+    for (auto i = 0u; i < parameters::number_of_parameters; ++i) {
+        uint16_t value = 0;
+        if (!get(device_handle, static_cast<parameters::id>(i), value)) return false;
+
+        const auto &description = parameters::descriptions[i];
+        printf("%-26s %5u", description.name, value);
+        if (description.writable) {
+            printf("  [%u..%u]\n", description.min, description.max);
+        } else {
+            puts("  (read-only)");
+        }
+    }
+    return true;
+}
+
+}
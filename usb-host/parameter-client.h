@@ -0,0 +1,16 @@
+#pragma once
+
+#include "../usb-device/parameter-table.h"
+
+#include <libusb-1.0/libusb.h>
+
+// Reads and writes the usb-device runtime parameters using vendor requests, see parameter-table.h.
+namespace parameter_client
+{
+
+bool get(libusb_device_handle *const device_handle, const parameters::id parameter, uint16_t &value);
+bool set(libusb_device_handle *const device_handle, const parameters::id parameter, const uint16_t value);
+
+bool print_all(libusb_device_handle *const device_handle);
+
+}
@@ -0,0 +1,156 @@
+#include "prbs-checker.h"
+
+#include <cinttypes>
+#include <cstdio>
+
+namespace prbs_checker
+{
+
+namespace
+{
+
+// The seed is only trusted once this many words after it have been generated without an error,
+// the chance of random data getting this far is 2^-128.
+const unsigned words_to_confirm = 4;
+
+// Random data gets half its bits wrong, a word with more errors than this is counted as bad. Once
+// there have been this many bad words in a row the checker has lost the stream, e.g. data was lost
+// on the device, and synchronises again. The errors in the bad words are still counted.
+const unsigned bad_word_errors = 8;
+const unsigned bad_words_to_lose_sync = 4;
+
+}
+
+checker::checker(const prbs::polynomial &p) : generator(p) {
+}
+
+void checker::add(const uint8_t *data, size_t length) {
+    for (; partial_bytes != 0 && length > 0; ++data, --length) {
+        partial_word = partial_word << 8 | *data;
+        if (++partial_bytes == sizeof(uint32_t)) {
+            add_word(partial_word);
+            partial_bytes = 0;
+        }
+    }
+
+    for (; length >= sizeof(uint32_t); data += sizeof(uint32_t), length -= sizeof(uint32_t)) {
+        add_word(static_cast<uint32_t>(data[0]) << 24 | data[1] << 16 | data[2] << 8 | data[3]);
+    }
+
+    for (; length > 0; ++data, --length) {
+        partial_word = partial_word << 8 | *data;
+        ++partial_bytes;
+    }
+}
+
+void checker::lost_data() {
+    partial_bytes = 0;
+    hunt();
+}
+
+void checker::add_word(const uint32_t word) {
+    const unsigned bits = sizeof(word) * 8;
+
+    switch (state) {
+    case state_t::seeding:
+        stats.hunting_bits += bits;
+        seed_words[seed_count++] = word;
+        if (seed_count == generator.words_to_seed()) {
+            generator.seed(seed_words);
+            state = state_t::confirming;
+            confirmed_words = 0;
+        }
+        break;
+
+    case state_t::confirming:
+        stats.hunting_bits += bits;
+        if (generator.next_word() != word) {
+            // The word that didn't match might be the first good one, start seeding from it.
+            hunt();
+            add_word(word);
+            break;
+        }
+        if (++confirmed_words == words_to_confirm) {
+            state = state_t::locked;
+            bad_words = 0;
+            ++stats.synchronisations;
+        }
+        break;
+
+    case state_t::locked:
+        {
+            const unsigned errors = __builtin_popcount(generator.next_word() ^ word);
+            stats.bits += bits;
+            stats.bit_errors += errors;
+            bad_words = errors > bad_word_errors ? bad_words + 1 : 0;
+            if (bad_words == bad_words_to_lose_sync) {
+                hunt();
+            }
+        }
+        break;
+    }
+}
+
+void checker::hunt() {
+    state = state_t::seeding;
+    seed_count = 0;
+}
+
+bool self_test() {
+    for (const auto &p: prbs::polynomials) {
+        prbs::generator generator(p);
+
+        // The same all ones start as 'prbs::generator::seed', bit 0 is the newest. The word at a time
+        // generator's history includes the bits generated whilst seeding so skip those.
+        uint64_t history = (uint64_t{1} << p.degree) - 1;
+        auto next_bit = [&p, &history]() {
+            const uint32_t bit = ((history >> (p.degree - 1)) ^ (history >> (p.tap - 1))) & 1;
+            history = history << 1 | bit;
+            return bit;
+        };
+        auto history_bits = p.degree;
+        for (auto tap = p.tap; tap < prbs::generator::word_bits; tap *= 2) {
+            history_bits *= 2;
+        }
+        for (auto bit = p.degree; bit < history_bits; ++bit) {
+            next_bit();
+        }
+
+        for (auto word = 0u; word < 1024; ++word) {
+            uint32_t expected = 0;
+            for (auto bit = 0u; bit < prbs::generator::word_bits; ++bit) {
+                expected = expected << 1 | next_bit();
+            }
+            if (generator.next_word() != expected) {
+                printf("%s self test failed at word %u\n", p.name, word);
+                return false;
+            }
+        }
+    }
+
+    // PRBS7 is short enough to check it repeats every 127 bits, i.e. 127 words is 32 repeats.
+    prbs::generator generator(prbs::prbs7);
+    uint32_t words[127 + 1];
+    for (auto &word: words) {
+        word = generator.next_word();
+    }
+    if (words[127] != words[0]) {
+        puts("prbs7 self test failed, the period isn't 127");
+        return false;
+    }
+
+    return true;
+}
+
+void print_statistics(const prbs::polynomial &p, const statistics &stats, const double duration_s) {
+    printf("%s bits %" PRIu64 " bit errors %" PRIu64 " synchronisations %" PRIu64 " hunting bits %" PRIu64 "\n",
+        p.name, stats.bits, stats.bit_errors, stats.synchronisations, stats.hunting_bits);
+    if (stats.bits > 0) {
+        printf("%s bit error rate %.3g\n", p.name, static_cast<double>(stats.bit_errors) / stats.bits);
+    }
+    if (duration_s > 0) {
+        printf("%s checked %.1f Mbit/s\n", p.name, (stats.bits + stats.hunting_bits) / duration_s / 1e6);
+    }
+}
+
+}
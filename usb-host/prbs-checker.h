@@ -0,0 +1,61 @@
+#pragma once
+
+#include "../spi-master/prbs.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Checks a received stream against a PRBS, see spi-master/prbs.h, and counts the bit errors.
+// It synchronises to whatever bit offset the stream was received with so it doesn't need to know where
+// spi-master started. Nothing in here depends on libusb so it can be cross-tested with the generator.
+namespace prbs_checker
+{
+
+struct statistics {
+    uint64_t bits = 0;  // Checked whilst synchronised
+    uint64_t bit_errors = 0;
+    uint64_t synchronisations = 0;
+    uint64_t hunting_bits = 0;  // Received whilst synchronising, not checked
+};
+
+class checker {
+public:
+    explicit checker(const prbs::polynomial &p);
+
+    // Any length, the bytes don't need to be word aligned with the stream.
+    void add(const uint8_t *data, size_t length);
+
+    // Data between the previous call to 'add' and the next one was lost, the checker synchronises again.
+    void lost_data();
+
+    bool is_synchronised() const { return state == state_t::locked; }
+    const statistics &get_statistics() const { return stats; }
+
+private:
+    enum class state_t {
+        seeding,  // Collecting the words to seed the generator
+        confirming,  // Checking the seed wasn't a corrupted part of the stream
+        locked
+    };
+
+    void add_word(const uint32_t word);
+    void hunt();
+
+    prbs::generator generator;
+    state_t state = state_t::seeding;
+    uint32_t seed_words[2] = {};
+    unsigned seed_count = 0;
+    unsigned confirmed_words = 0;
+    unsigned bad_words = 0;
+    uint32_t partial_word = 0;
+    unsigned partial_bytes = 0;
+    statistics stats;
+};
+
+// Compares the word at a time generator with a bit at a time one for every polynomial.
+bool self_test();
+
+// 'duration_s' is how long the checking took, the rate isn't printed if it's 0.
+void print_statistics(const prbs::polynomial &p, const statistics &stats, const double duration_s = 0);
+
+}
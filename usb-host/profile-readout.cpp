@@ -0,0 +1,79 @@
+#include "profile-readout.h"
+
+#include "libusb-error.h"
+
+#include "../usb-device/probe-statistics.h"
+#include "../usb-device/usb-device.h"
+
+#include <cinttypes>
+#include <cstdio>
+
+namespace profile_readout
+{
+
+namespace
+{
+
+bool get_probe_statistics(libusb_device_handle *const device_handle, const profiler::probe p, profiler::probe_statistics &stats) {
+    const auto bytes_transferred = libusb_control_transfer(
+            device_handle,
+            LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE, // bmRequestType
+            static_cast<uint8_t>(usb_device::vendor_request::get_profile), // bRequest
+            0, // wValue
+            static_cast<uint16_t>(p), // wIndex
+            reinterpret_cast<unsigned char*>(&stats),
+            sizeof(stats), // wLength
+            100
+        );
+    if (bytes_transferred < 0) {
+        print_libusb_error(static_cast<libusb_error>(bytes_transferred), "libusb_control_transfer");
+        return false;
+    } else if (bytes_transferred != sizeof(stats)) {
+        printf("bytes_transferred %d, expected %zu\n", bytes_transferred, sizeof(stats));
+        return false;
+    } else {
+        return true;
+    }
+}
+
+double cycles_to_us(const double cycles) {
+    return cycles / profiler::core_clock_mhz;
+}
+
+}
+
+bool print(libusb_device_handle *const device_handle) {
+    printf("%-18s %10s %10s %10s %10s %10s %10s\n", "probe", "count", "min", "mean", "max", "mean us", "max us");
+    for (auto i = 0u; i < profiler::number_of_probes; ++i) {
+        profiler::probe_statistics stats;
+        if (!get_probe_statistics(device_handle, static_cast<profiler::probe>(i), stats)) return false;
+
+        const auto min = stats.count != 0 ? stats.min : 0;
+        const auto mean = profiler::mean(stats);
+        printf("%-18s %10" PRIu32 " %10" PRIu32 " %10" PRIu32 " %10" PRIu32 " %10.3f %10.3f\n",
+            profiler::probe_names[i], stats.count, min, mean, stats.max, cycles_to_us(mean), cycles_to_us(stats.max));
+    }
+    printf("cycles at %" PRIu32 " MHz\n", profiler::core_clock_mhz);
+    return true;
+}
+
+bool reset(libusb_device_handle *const device_handle) {
+    const auto bytes_transferred = libusb_control_transfer(
+            device_handle,
+            LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE, // bmRequestType
+            static_cast<uint8_t>(usb_device::vendor_request::reset_profile), // bRequest
+            0, // wValue
+            0, // wIndex
+            nullptr,
+            0, // wLength
+            100
+        );
+    if (bytes_transferred < 0) {
+        print_libusb_error(static_cast<libusb_error>(bytes_transferred), "libusb_control_transfer");
+        return false;
+    } else {
+        return true;
+    }
+}
+
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <libusb-1.0/libusb.h>
+
+// Fetches the usb-device cycle profiler table using vendor requests.
+namespace profile_readout
+{
+
+bool print(libusb_device_handle *const device_handle);
+bool reset(libusb_device_handle *const device_handle);
+
+}
@@ -0,0 +1,58 @@
+#include "rate-sweep.h"
+
+#include <cinttypes>
+#include <cstdio>
+
+namespace rate_sweep
+{
+
+result run(rig &r, const unsigned duration_s, const uint32_t max_sclk_hz) {
+    result res;
+
+    for (const auto prescaler: prescalers) {
+        if (sclk_hz(prescaler) > max_sclk_hz) {
+            break;
+        }
+
+        uint16_t before;
+        uint16_t after;
+        if (!r.set_prescaler(prescaler) || !r.read_overflows(before) || !r.stream(duration_s) || !r.read_overflows(after)) {
+            return res;
+        }
+
+        // Unsigned arithmetic so the wrap is handled naturally.
+        const uint16_t overflows = after - before;
+        res.steps.push_back({ prescaler, sclk_hz(prescaler), overflows });
+        if (overflows != 0) {
+            break;
+        }
+        res.highest_sustained_prescaler = prescaler;
+    }
+
+    res.success = true;
+    return res;
+}
+
+void print_result(const result &res) {
+    printf("%10s %14s %10s\n", "prescaler", "sclk Hz", "overflows");
+    for (const auto &s: res.steps) {
+        printf("%10u %14" PRIu32 " %10u\n", s.prescaler, s.sclk_hz, static_cast<unsigned>(s.overflows));
+    }
+    if (!res.success) {
+        puts("sweep failed");
+    }
+    if (res.highest_sustained_prescaler != 0) {
+        printf("highest sustained SCLK %" PRIu32 " Hz, prescaler %u\n", res.highest_sustained_sclk_hz(), res.highest_sustained_prescaler);
+    } else {
+        puts("no rate sustained without overflow");
+    }
+}
+
+bool simulated_rig::stream(const unsigned duration_s) {
+    if (sclk_hz(prescaler) > capacity_hz) {
+        overflows += 1 + duration_s * 10;
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Finds the highest spi-master SCLK the usb-device pipeline sustains without losing SPI buffers.
+// The rates are tried slowest first, each for a fixed duration, and the sweep stops at the first
+// rate that overflows. Everything to do with the boards is behind 'rig' so the control logic
+// can be run against 'simulated_rig'.
+namespace rate_sweep
+{
+
+// SPI1 in spi-master is clocked by APB2, see 'set_prescaler' in spi-master/main.cpp.
+const uint32_t spi_master_clock_hz = 108000000;
+const unsigned prescalers[] = { 256, 128, 64, 32, 16, 8, 4, 2 };
+
+constexpr uint32_t sclk_hz(const unsigned prescaler) {
+    return spi_master_clock_hz / prescaler;
+}
+
+// The fastest rate 'sweep' tries unless it's told otherwise.
+const uint32_t default_max_sclk_hz = sclk_hz(2);
+
+class rig {
+public:
+    virtual bool set_prescaler(const unsigned prescaler) = 0;
+    // The usb-device 'spi-overflows' counter, it's read-only so it can't be reset and it wraps.
+    virtual bool read_overflows(uint16_t &overflows) = 0;
+    // Receives from usb-device for 'duration_s' so the buffers are emptied as fast as the USB allows.
+    virtual bool stream(const unsigned duration_s) = 0;
+
+protected:
+    ~rig() = default;
+};
+
+struct step {
+    unsigned prescaler;
+    uint32_t sclk_hz;
+    uint16_t overflows;
+};
+
+struct result {
+    bool success = false;  // False if the rig failed, the steps so far are still valid
+    std::vector<step> steps;
+    unsigned highest_sustained_prescaler = 0;  // 0 if even the slowest rate overflowed
+
+    uint32_t highest_sustained_sclk_hz() const {
+        return highest_sustained_prescaler != 0 ? sclk_hz(highest_sustained_prescaler) : 0;
+    }
+};
+
+// Rates above 'max_sclk_hz' aren't tried.
+result run(rig &r, const unsigned duration_s, const uint32_t max_sclk_hz);
+
+void print_result(const result &res);
+
+// Overflows whenever SCLK is above 'capacity_hz'.
+class simulated_rig: public rig {
+public:
+    explicit simulated_rig(const uint32_t capacity_hz) : capacity_hz(capacity_hz) {}
+
+    bool set_prescaler(const unsigned p) override { prescaler = p; return true; }
+    bool read_overflows(uint16_t &o) override { o = overflows; return true; }
+    bool stream(const unsigned duration_s) override;
+
+private:
+    const uint32_t capacity_hz;
+    unsigned prescaler = 16;
+    uint16_t overflows = 65530;  // Near the wrap to check the difference is taken correctly
+};
+
+}
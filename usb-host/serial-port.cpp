@@ -0,0 +1,86 @@
+#include "serial-port.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace serial_port
+{
+
+port::~port() {
+    close();
+}
+
+bool port::open(const char *const path) {
+    close();
+
+    fd = ::open(path, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        printf("open %s failed: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    // A pseudo-terminal doesn't care about the baud rate but it doesn't object either.
+    termios settings;
+    if (tcgetattr(fd, &settings) != 0) {
+        printf("tcgetattr %s failed: %s\n", path, strerror(errno));
+        close();
+        return false;
+    }
+    cfmakeraw(&settings);
+    cfsetispeed(&settings, B115200);
+    cfsetospeed(&settings, B115200);
+    settings.c_cflag |= CLOCAL | CREAD;
+    if (tcsetattr(fd, TCSANOW, &settings) != 0) {
+        printf("tcsetattr %s failed: %s\n", path, strerror(errno));
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void port::close() {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+bool port::write_line(const std::string &line) {
+    const auto data = line + '\r';
+    size_t written = 0;
+    while (written < data.size()) {
+        const auto result = ::write(fd, data.data() + written, data.size() - written);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("serial write failed: %s\n", strerror(errno));
+            return false;
+        }
+        written += result;
+    }
+    return true;
+}
+
+std::string port::read_until_quiet(const unsigned quiet_ms) {
+    std::string received;
+    pollfd pfd = { fd, POLLIN, 0 };
+    while (poll(&pfd, 1, quiet_ms) > 0 && (pfd.revents & POLLIN) != 0) {
+        char buffer[256];
+        const auto result = ::read(fd, buffer, sizeof(buffer));
+        if (result <= 0) {
+            break;
+        }
+        received.append(buffer, result);
+    }
+    return received;
+}
+
+}
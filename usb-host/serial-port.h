@@ -0,0 +1,33 @@
+#pragma once
+
+#include "console.h"
+
+#include <string>
+
+// A POSIX serial port for talking to the ns_cmdline consoles of spi-master and usb-device.
+// Both use 'platform.stdio-baud-rate' from their mbed_app.json, 115200.
+// Pseudo-terminals work too, see fake-console.h.
+namespace serial_port
+{
+
+class port: public console::transport {
+public:
+    port() = default;
+    ~port();
+
+    port(const port&) = delete;
+    port &operator=(const port&) = delete;
+
+    // Raw 8N1 at 115200 baud.
+    bool open(const char *const path);
+    void close();
+    bool is_open() const { return fd >= 0; }
+
+    bool write_line(const std::string &line) override;
+    std::string read_until_quiet(const unsigned quiet_ms) override;
+
+private:
+    int fd = -1;
+};
+
+}
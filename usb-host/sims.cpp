@@ -0,0 +1,1414 @@
+#include "../usb-device/buffer-handoff.h"
+#include "../usb-device/console-ring.h"
+#include "../usb-device/control-transfer.h"
+#include "../usb-device/load-statistics.h"
+#include "../usb-device/parameter-table.h"
+#include "../usb-device/probe-statistics.h"
+#include "../usb-device/receive-pool.h"
+#include "../usb-device/snapshot-slot.h"
+#include "../usb-device/usb-device.h"
+
+#include "channel-demux.h"
+#include "fake-console.h"
+#include "iso-stream.h"
+#include "loopback-benchmark.h"
+#include "memory-map.h"
+#include "orchestrator.h"
+#include "prbs-checker.h"
+#include "rate-sweep.h"
+#include "serial-port.h"
+#include "simulated-transport.h"
+#include "synthetic-stream.h"
+#include "trace-decoder.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// usb-host-sims runs the host checks. Each one drives usb-host's stream handling, or a header shared
+// with usb-device, against a simulated device or a fake of the firmware around it, so none of them
+// need a board. 'make check' runs every one of them with its defaults.
+namespace
+{
+
+// Runs the orchestrator through real serial ports connected to pseudo-terminals that behave like
+// the boards' consoles, with a simulated pipeline that loses buffers above 'capacity Hz'.
+bool orchestrate_sim_subcommand(int argc, char *argv[]) {
+    const uint32_t capacity_hz = argc > 0 ? strtoul(argv[0], nullptr, 0) : 20000000;
+    std::vector<orchestrator::test> tests;
+    if (!orchestrator::parse_tests(argc - 1, argv + 1, tests)) return false;
+
+    orchestrator::simulated_boards boards(capacity_hz);
+    fake_console::device fake_spi_master([&boards](const std::string &line) { return boards.spi_master_command(line); });
+    fake_console::device fake_usb_device([&boards](const std::string &line) { return boards.usb_device_command(line); });
+    if (!fake_spi_master.open() || !fake_usb_device.open()) return false;
+
+    serial_port::port spi_master;
+    serial_port::port usb_device;
+    if (!spi_master.open(fake_spi_master.path().c_str()) || !usb_device.open(fake_usb_device.path().c_str())) return false;
+
+    const auto results = orchestrator::run(spi_master, usb_device, boards, tests);
+    orchestrator::print_report(results);
+
+    // Everything at or below the capacity should pass and everything above it should overflow.
+    auto as_expected = results.size() == tests.size();
+    for (const auto &r: results) {
+        as_expected = as_expected && r.passed() == (rate_sweep::sclk_hz(r.t.prescaler) <= capacity_hz);
+    }
+    puts(as_expected ? "passed" : "failed");
+    return as_expected;
+}
+
+// Runs the sweep against a simulated pipeline that overflows above 'capacity Hz'.
+bool sweep_sim_subcommand(int argc, char *argv[]) {
+    const uint32_t capacity_hz = argc > 0 ? strtoul(argv[0], nullptr, 0) : 20000000;
+    const uint32_t max_sclk_hz = argc > 1 ? strtoul(argv[1], nullptr, 0) : rate_sweep::default_max_sclk_hz;
+
+    rate_sweep::simulated_rig rig(capacity_hz);
+    const auto result = rate_sweep::run(rig, 1, max_sclk_hz);
+    rate_sweep::print_result(result);
+
+    // The fastest rate tried that's within the capacity should be the one found.
+    uint32_t expected_sclk_hz = 0;
+    for (const auto prescaler: rate_sweep::prescalers) {
+        const auto sclk_hz = rate_sweep::sclk_hz(prescaler);
+        if (sclk_hz <= max_sclk_hz && sclk_hz <= capacity_hz) {
+            expected_sclk_hz = std::max(expected_sclk_hz, sclk_hz);
+        }
+    }
+    const auto passed = result.success && result.highest_sustained_sclk_hz() == expected_sclk_hz;
+    puts(passed ? "sweep-sim passed" : "sweep-sim FAILED");
+    return passed;
+}
+
+// Feeds the reassembler microframes the way libusb would hand them over when the bus misbehaves: some
+// are dropped, some complete with an error status, some are repeated and some are empty. The sequence
+// numbers start just before they wrap. Checks the statistics count exactly what was injected and that
+// only the first copy of each microframe reaches the sink, in order.
+bool iso_sim_subcommand(int argc, char *argv[]) {
+    const unsigned number_of_microframes = argc > 0 ? strtoul(argv[0], nullptr, 0) : 100000;
+    const unsigned drop_percent = argc > 1 ? strtoul(argv[1], nullptr, 0) : 5;
+
+    uint32_t last_sequence = 0;
+    auto first_sequence = true;
+    auto out_of_order = 0u;
+    auto corrupted = 0u;
+    iso_stream::reassembler reassembler([&](const uint8_t *const data, const size_t length) {
+        uint32_t sequence;
+        memcpy(&sequence, data, sizeof(sequence));
+        if (!first_sequence && static_cast<int32_t>(sequence - last_sequence) <= 0) {
+            ++out_of_order;
+        }
+        for (auto i = sizeof(sequence); i < length; ++i) {
+            if (data[i] != static_cast<uint8_t>(sequence + i)) {
+                ++corrupted;
+                break;
+            }
+        }
+        first_sequence = false;
+        last_sequence = sequence;
+    });
+
+    // Each payload holds its sequence number followed by a pattern derived from it.
+    const auto make_microframe = [](const uint32_t sequence, const size_t payload_length) {
+        std::vector<uint8_t> packet(sizeof(usb_device::iso_header) + payload_length);
+        const usb_device::iso_header header = { sequence, static_cast<uint16_t>(payload_length), 0 };
+        memcpy(&packet[0], &header, sizeof(header));
+        memcpy(&packet[sizeof(header)], &sequence, sizeof(sequence));
+        for (auto i = sizeof(sequence); i < payload_length; ++i) {
+            packet[sizeof(header) + i] = static_cast<uint8_t>(sequence + i);
+        }
+        return packet;
+    };
+
+    std::mt19937 random;
+    iso_stream::statistics expected;
+    std::deque<std::vector<uint8_t>> delivered;  // Recently, so they can be repeated
+    const uint32_t start = UINT32_MAX - number_of_microframes / 2;
+    for (auto i = 0u; i < number_of_microframes; ++i) {
+        const uint32_t sequence = start + i;
+        const auto payload_length = std::uniform_int_distribution<size_t>(sizeof(uint32_t), 512)(random);
+        const auto packet = make_microframe(sequence, payload_length);
+        // The first and last microframes always arrive so every microframe missing in between is counted.
+        const auto fate = i == 0 || i + 1 == number_of_microframes ? 100u : std::uniform_int_distribution<unsigned>(0, 99)(random);
+
+        if (fate < drop_percent) {
+            ++expected.lost_microframes;
+        } else if (fate < drop_percent + 3) {
+            // The contents of a packet with an error status can't be trusted, even the header.
+            reassembler.add_packet(false, packet.data(), packet.size());
+            ++expected.packets;
+            ++expected.error_packets;
+            ++expected.lost_microframes;
+        } else {
+            reassembler.add_packet(true, packet.data(), packet.size());
+            ++expected.packets;
+            ++expected.microframes;
+            expected.bytes += payload_length;
+            delivered.push_back(packet);
+            if (delivered.size() > 8) {
+                delivered.pop_front();
+            }
+        }
+
+        if (std::uniform_int_distribution<>(0, 99)(random) < 3) {
+            const auto &repeat = delivered[std::uniform_int_distribution<size_t>(0, delivered.size() - 1)(random)];
+            reassembler.add_packet(true, repeat.data(), repeat.size());
+            ++expected.packets;
+            ++expected.microframes;
+            ++expected.repeated_microframes;
+        }
+        if (std::uniform_int_distribution<>(0, 99)(random) < 2) {
+            reassembler.add_packet(true, nullptr, 0);
+            ++expected.packets;
+            ++expected.empty_packets;
+        }
+    }
+
+    const auto &stats = reassembler.get_statistics();
+    iso_stream::print_statistics(stats);
+    auto passed = stats.packets == expected.packets
+        && stats.error_packets == expected.error_packets
+        && stats.empty_packets == expected.empty_packets
+        && stats.malformed_packets == 0
+        && stats.microframes == expected.microframes
+        && stats.lost_microframes == expected.lost_microframes
+        && stats.repeated_microframes == expected.repeated_microframes
+        && stats.bytes == expected.bytes;
+    if (!passed) {
+        printf("expected packets %" PRIu64 " error %" PRIu64 " empty %" PRIu64 " microframes %" PRIu64 " lost %" PRIu64 " repeated %" PRIu64 " bytes %" PRIu64 "\n",
+            expected.packets, expected.error_packets, expected.empty_packets, expected.microframes,
+            expected.lost_microframes, expected.repeated_microframes, expected.bytes);
+    }
+    if (out_of_order != 0 || corrupted != 0) {
+        printf("out of order %u corrupted %u\n", out_of_order, corrupted);
+        passed = false;
+    }
+    puts(passed ? "iso-sim passed" : "iso-sim FAILED");
+    return passed;
+}
+
+// Cross-tests the checker with the generator spi-master uses. The stream starts at a random bit offset,
+// has random bit errors and slips a byte half way through without telling the checker, so the checker
+// has to synchronise twice and count every error injected plus the errors seen before it lost the stream.
+bool prbs_sim_subcommand(int argc, char *argv[]) {
+    const auto polynomial = prbs::find(argc > 0 ? strtoul(argv[0], nullptr, 0) : 31);
+    const size_t length = (argc > 1 ? strtoul(argv[1], nullptr, 0) : 64) * 1024 * 1024;
+    const double error_rate = argc > 2 ? strtod(argv[2], nullptr) : 1e-6;
+    if (polynomial == nullptr || length == 0 || error_rate < 0 || error_rate > 1e-3) {
+        puts("invalid settings");
+        return false;
+    }
+
+    if (!prbs_checker::self_test()) {
+        return false;
+    }
+
+    std::mt19937 random(1);
+    std::vector<uint8_t> stream(length + sizeof(uint32_t));
+    prbs::generator generator(*polynomial);
+    generator.fill(stream.data(), stream.size() & ~(sizeof(uint32_t) - 1));
+
+    // Shift the stream by up to 31 bits, i.e. a byte offset and a bit offset.
+    const auto offset = std::uniform_int_distribution<unsigned>(1, 31)(random);
+    const auto byte_offset = offset / 8;
+    const auto bit_offset = offset % 8;
+    for (auto i = 0u; i < length; ++i) {
+        const unsigned pair = stream[i + byte_offset] << 8 | stream[i + byte_offset + 1];
+        stream[i] = static_cast<uint8_t>(pair >> (8 - bit_offset));
+    }
+    stream.resize(length);
+
+    // The errors are kept clear of the start and the slip so the checker is synchronised for all of them.
+    const size_t slip = length / 2;
+    const size_t margin = 1024;
+    uint64_t errors_injected = 0;
+    std::geometric_distribution<uint64_t> gap(error_rate > 0 ? error_rate : 1);
+    for (uint64_t bit = margin * 8 + gap(random); error_rate > 0 && bit < (length - margin) * 8; bit += 1 + gap(random)) {
+        if (bit / 8 + margin > slip && bit / 8 < slip + margin) {
+            continue;
+        }
+        stream[bit / 8] ^= 0x80 >> (bit % 8);
+        ++errors_injected;
+    }
+    stream.erase(stream.begin() + slip);
+
+    prbs_checker::checker checker(*polynomial);
+    const auto start = std::chrono::steady_clock::now();
+    checker.add(stream.data(), stream.size());
+    const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+
+    const auto &stats = checker.get_statistics();
+    prbs_checker::print_statistics(*polynomial, stats, duration.count());
+    printf("offset %u bits, errors injected %" PRIu64 "\n", offset, errors_injected);
+
+    // Losing the stream takes 4 words with at least 9 errors each and at most all 32 wrong.
+    const auto slip_errors = stats.bit_errors - errors_injected;
+    const auto passed = stats.synchronisations == 2 && stats.bit_errors >= errors_injected && slip_errors <= 4 * 32;
+    puts(passed ? "passed" : "failed");
+    return passed;
+}
+
+// Runs the loopback benchmark without a device, the simulated device has as many buffers as usb-device.
+// The simulated device drops, reorders and repeats a few units and each run's accounting has to match.
+bool loopback_sim_subcommand(int argc, char *argv[]) {
+    simulated_transport::faults faults;
+    faults.drop_percent = 1;
+    faults.reorder_percent = 1;
+    faults.repeat_percent = 1;
+    simulated_transport::loopback_transport transport(usb_device::loopback_buffers, std::chrono::microseconds(125), faults);
+
+    const auto passed = loopback_benchmark::run_from_arguments(transport, argc, argv, [&transport](const loopback_benchmark::result &r) {
+        const auto &stats = transport.get_statistics();
+        const auto as_expected = r.units_lost == stats.units_dropped
+            && r.units_late == stats.units_reordered
+            && r.units_duplicated == stats.units_repeated
+            && r.units_in_sequence == stats.units_read - stats.units_reordered - stats.units_repeated - stats.units_ahead
+            && r.units_foreign == 0
+            && r.bytes_read == stats.units_read * loopback_benchmark::unit_size;
+        if (!as_expected) {
+            printf("expected lost %" PRIu64 " late %" PRIu64 " dup %" PRIu64 " in sequence %" PRIu64 "\n",
+                stats.units_dropped, stats.units_reordered, stats.units_repeated,
+                stats.units_read - stats.units_reordered - stats.units_repeated - stats.units_ahead);
+        }
+        return as_expected;
+    });
+    puts(passed ? "loopback-sim passed" : "loopback-sim FAILED");
+    return passed;
+}
+
+// Checks the parsing, the budgets and the placement rules against a map, by default the trimmed one
+// GNU ld wrote for 'testdata/usb-device.map'. It has the awkward bits of a real one: wrapped section names,
+// fill, symbols, initialised data with a load address, code and data copied to the TCMs, DMA buffers,
+// COMMON, an archive, discarded sections, the heap padded out to the end of RAM and debug sections.
+bool footprint_sim_subcommand(int argc, char *argv[]) {
+    const auto map_name = argc > 1 ? argv[1] : "testdata/usb-device.map";
+    const auto rules_name = argc > 2 ? argv[2] : "../usb-device/placement-rules.txt";
+    const auto budgets_name = argc > 3 ? argv[3] : "../usb-device/footprint-budgets.txt";
+
+    std::ifstream in(map_name);
+    memory_map::map m;
+    if (!in || !memory_map::parse(in, m)) {
+        printf("can't read '%s'\n", map_name);
+        puts("footprint-sim FAILED");
+        return false;
+    }
+    auto passed = true;
+    const auto f = memory_map::attribute(m);
+    memory_map::print(m, f);
+
+    // What's in 'testdata/usb-device.map', a different map will fail these but still checks the files.
+    const struct {
+        const char *module;
+        const char *region;
+        uint64_t bytes;
+    } expected[] = {
+        { "spi_rx", "ITCM", 0x45 },
+        { "spi_rx", "DTCM", 0x30 },
+        { "spi_rx", "RAM", 0xc0 + 0x800 },
+        { "spi_rx", "FLASH", 220 },  // Not .text.spi_rx_unused, it was discarded
+        { "evk_usb_device_hal", "ITCM", 0x32 },
+        { "evk_usb_device_hal", "DTCM", 0x4e0 },
+        { "buffers", "DTCM", 0x68 },
+        { "buffers", "RAM", 0x1000 },  // .dma_buffers
+        { "bulk_out", "RAM", 0x1000 + 0x1000 },
+        { "command_line", "RAM", 0x100 + 0x1000 },
+        { "parameters", "FLASH", 0x11 + 0x18 },
+        { "parameters", "DTCM", 0x18 },
+        { "parameters", "RAM", 0 },
+        { "toolchain", "FLASH", 0x1d },
+        { "mbed-os", "ITCM", 154 },  // HAL_DMA_IRQHandler, HAL_PCD_IRQHandler and the like
+        { "mbed-os", "RAM", 1388 },  // Including os_idle_thread_stack in COMMON
+        { "fill", "RAM", 308 },  // Not the heap
+        { "main", "RAM", 0x600 },
+        { "main", "ITCM", 0 },  // Not the debug information
+        { memory_map::total_module, "FLASH", 0x1e0 + 0x150 + 0x240 + 0x18 + 0x790 },
+        { memory_map::total_module, "ITCM", 0x150 },
+        { memory_map::total_module, "DTCM", 0x790 },
+        { memory_map::total_module, "RAM", 0x100 + 0x18 + 0x73c0 + 0x2000 }
+    };
+    if (argc <= 1) {
+        for (const auto &e: expected) {
+            const auto bytes = memory_map::usage(f, e.module, e.region);
+            if (bytes != e.bytes) {
+                printf("%s %s is %" PRIu64 " expected %" PRIu64 "\n", e.module, e.region, bytes, e.bytes);
+                passed = false;
+            }
+        }
+    }
+
+    // The image's own budgets and rules have to pass.
+    std::ifstream budgets_file(budgets_name);
+    std::vector<memory_map::budget> budgets;
+    if (!budgets_file || !memory_map::parse_budgets(budgets_file, budgets) || !memory_map::check(f, budgets)) {
+        printf("'%s' not met\n", budgets_name);
+        passed = false;
+    }
+    std::ifstream rules_file(rules_name);
+    std::vector<memory_map::placement_rule> rules;
+    if (!rules_file || !memory_map::parse_placement_rules(rules_file, rules) || !memory_map::check_placement(m, rules)) {
+        printf("'%s' not followed\n", rules_name);
+        passed = false;
+    }
+
+    std::istringstream budget_text(
+        "# module region max bytes\n"
+        "command_line RAM 0x1100\n"
+        "buffers RAM 4096  # exactly full is fine\n"
+        "total FLASH 1000\n");
+    budgets.clear();
+    if (!memory_map::parse_budgets(budget_text, budgets) || budgets.size() != 3) {
+        puts("budgets not parsed");
+        passed = false;
+    } else if (memory_map::check(f, budgets) || !memory_map::check(f, { budgets[0], budgets[1] })) {
+        // Only the total is over.
+        puts("budgets not checked");
+        passed = false;
+    }
+
+    std::istringstream bad_budget("buffers RAM\n");
+    if (memory_map::parse_budgets(bad_budget, budgets)) {
+        puts("bad budget accepted");
+        passed = false;
+    }
+
+    // Misplaced, and a rule that matches nothing.
+    const std::vector<memory_map::placement_rule> broken_rules[] = {
+        { { ".text.startup.main", "ITCM", "" } },
+        { { ".itcm_text", "ITCM", "bus_load" } }
+    };
+    if (memory_map::check_placement(m, broken_rules[0]) || memory_map::check_placement(m, broken_rules[1])) {
+        puts("placement not checked");
+        passed = false;
+    }
+
+    std::istringstream bad_rule(".itcm_text\n");
+    if (memory_map::parse_placement_rules(bad_rule, rules)) {
+        puts("bad placement rule accepted");
+        passed = false;
+    }
+
+    puts(passed ? "footprint-sim passed" : "footprint-sim FAILED");
+    return passed;
+}
+
+// Fakes the buffer pools and the consumers for the usb-device SPI DMA ISR handoff, see buffer-handoff.h.
+struct fake_handoff_hooks {
+    std::deque<uint8_t*> empty_buffers;
+    std::deque<std::pair<uint8_t*, uint16_t>> full_buffers;
+    std::set<const uint8_t*> armed_buffers;
+    std::vector<uint16_t> sequences;  // Full and overflowed, in the order they were handed over
+    uint64_t overflows = 0;
+    uint64_t no_empty_count = 0;
+    bool passed = true;
+
+    void full(uint8_t *const buffer, const uint16_t sequence) {
+        if (armed_buffers.erase(buffer) != 1) {
+            printf("buffer %p full without being armed\n", static_cast<void*>(buffer));
+            passed = false;
+        }
+        full_buffers.emplace_back(buffer, sequence);
+        sequences.push_back(sequence);
+    }
+
+    void overflowed(const uint16_t sequence) {
+        ++overflows;
+        sequences.push_back(sequence);
+    }
+
+    uint8_t *get_empty() {
+        if (empty_buffers.empty()) {
+            return nullptr;
+        }
+        const auto buffer = empty_buffers.front();
+        empty_buffers.pop_front();
+        return buffer;
+    }
+
+    void no_empty() {
+        ++no_empty_count;
+    }
+
+    void armed(const uint8_t *const buffer) {
+        if (!armed_buffers.insert(buffer).second) {
+            printf("buffer %p armed twice\n", static_cast<const void*>(buffer));
+            passed = false;
+        }
+    }
+};
+
+// Runs a fake double-buffered DMA against a consumer that takes the full buffers in random bursts,
+// like the USB does, and checks no buffer is lost, duplicated or overwritten whilst it's full.
+bool handoff_sim_subcommand(int argc, char *argv[]) {
+    const size_t number_of_buffers = argc > 0 ? strtoul(argv[0], nullptr, 0) : 8;
+    const unsigned number_of_completions = argc > 1 ? strtoul(argv[1], nullptr, 0) : 100000;
+
+    std::mt19937 random;
+    // The DMA writes the sequence number at the start of each buffer.
+    std::vector<std::array<uint8_t, sizeof(uint16_t)>> storage(number_of_buffers);
+    std::array<std::array<uint8_t, sizeof(uint16_t)>, 2> overflow_storage;
+    fake_handoff_hooks hooks;
+    for (auto &buffer: storage) {
+        hooks.empty_buffers.push_back(buffer.data());
+    }
+
+    uint8_t *const overflow_buffers[2] = { overflow_storage[0].data(), overflow_storage[1].data() };
+    uint8_t *memory[2] = { buffer_handoff::arm(hooks, overflow_buffers[0]), buffer_handoff::arm(hooks, overflow_buffers[1]) };
+    auto current_target = 0;
+    uint16_t next_sequence = 0;
+    uint64_t delivered = 0;
+
+    for (auto completion = 0u; completion < number_of_completions; ++completion) {
+        memcpy(memory[current_target], &next_sequence, sizeof(next_sequence));
+        memory[current_target] = buffer_handoff::buffer_complete(hooks, memory[current_target], overflow_buffers[current_target], next_sequence++);
+        current_target ^= 1;
+
+        // The consumer sometimes falls behind so there are overflows.
+        if (std::uniform_int_distribution<>(0, 3)(random) == 0) {
+            auto burst = std::uniform_int_distribution<size_t>(0, number_of_buffers)(random);
+            while (burst-- > 0 && !hooks.full_buffers.empty()) {
+                const auto full = hooks.full_buffers.front();
+                hooks.full_buffers.pop_front();
+                uint16_t sequence;
+                memcpy(&sequence, full.first, sizeof(sequence));
+                if (sequence != full.second) {
+                    printf("buffer with sequence %u was overwritten by %u\n", full.second, sequence);
+                    hooks.passed = false;
+                }
+                hooks.empty_buffers.push_back(full.first);
+                ++delivered;
+            }
+        }
+    }
+
+    auto passed = hooks.passed;
+    for (auto i = 0u; i < hooks.sequences.size(); ++i) {
+        if (hooks.sequences[i] != static_cast<uint16_t>(i)) {
+            printf("sequence %u handed over as %u\n", i, hooks.sequences[i]);
+            passed = false;
+            break;
+        }
+    }
+    const auto in_dma = (memory[0] != overflow_buffers[0] ? 1u : 0u) + (memory[1] != overflow_buffers[1] ? 1u : 0u);
+    if (hooks.empty_buffers.size() + hooks.full_buffers.size() + in_dma != number_of_buffers || hooks.armed_buffers.size() != in_dma) {
+        puts("buffers have gone missing");
+        passed = false;
+    }
+    if (hooks.sequences.size() != number_of_completions || delivered + hooks.full_buffers.size() + hooks.overflows != number_of_completions) {
+        puts("completions not accounted for");
+        passed = false;
+    }
+
+    printf("completions %u delivered %" PRIu64 " overflows %" PRIu64 " no empty %" PRIu64 "\n",
+        number_of_completions, delivered, hooks.overflows, hooks.no_empty_count);
+    puts(passed ? "handoff-sim passed" : "handoff-sim FAILED");
+    return passed;
+}
+
+// Runs usb-device's bulk OUT receive pool with the receiver and the consumer on their own threads and
+// checks every buffer arrives once and in order, none go missing, and the queues stop at full and empty.
+bool pool_sim_subcommand(int argc, char *argv[]) {
+    const unsigned transfers = argc > 0 ? strtoul(argv[0], nullptr, 0) : 100000;
+
+    bool passed = true;
+
+    // The queue on its own, going round several times so the indices wrap.
+    receive_pool::handoff_queue<unsigned, 4> queue;
+    unsigned item = 0;
+    if (queue.try_pop(item) || queue.size() != 0) {
+        puts("popped from an empty queue");
+        passed = false;
+    }
+    for (unsigned round = 0, next_push = 0, next_pop = 0; round < 10 && passed; ++round) {
+        const unsigned pushes = round % 4 + 1;
+        for (auto i = 0u; i < pushes; ++i) {
+            passed &= queue.try_push(next_push++);
+        }
+        if (pushes == 4 && (queue.try_push(0) || queue.size() != 4)) {
+            puts("pushed onto a full queue");
+            passed = false;
+        }
+        for (auto i = 0u; i < pushes; ++i) {
+            if (!queue.try_pop(item) || item != next_pop++) {
+                printf("popped %u expected %u\n", item, next_pop - 1);
+                passed = false;
+            }
+        }
+        if (queue.try_pop(item)) {
+            puts("popped from an emptied queue");
+            passed = false;
+        }
+    }
+
+    // The pool on its own. The receiver can have every buffer and then it's starved.
+    const size_t number_of = 8;
+    const size_t size_of = 64;
+    auto edges = std::make_unique<receive_pool::pool<number_of, size_of>>();
+    std::set<uint8_t*> armed;
+    for (auto i = 0u; i < number_of; ++i) {
+        armed.insert(edges->arm());
+    }
+    if (armed.size() != number_of || armed.count(nullptr) != 0 || edges->arm() != nullptr || edges->get_starved_count() != 1) {
+        puts("the pool didn't hand out each buffer once before starving");
+        passed = false;
+    }
+    for (const auto buffer: armed) {
+        edges->set_received(buffer, 1);
+    }
+    receive_pool::received r;
+    auto released = 0u;
+    auto rearm_requests = 0u;
+    while (edges->take(r)) {
+        rearm_requests += edges->release(r.buffer) ? 1 : 0;
+        ++released;
+    }
+    if (released != number_of || rearm_requests != 1 || edges->number_of_empty() != number_of || edges->number_of_full() != 0) {
+        puts("the pool didn't ask for the receiver to be re-armed once");
+        passed = false;
+    }
+
+    // The receiver is the OTG ISR, which the consumer thread can't interrupt, so 'arm' and 'release' are
+    // serialised. Each buffer holds its transfer number and the length depends on it.
+    auto pool = std::make_unique<receive_pool::pool<number_of, size_of>>();
+    std::mutex isr;
+    std::atomic<bool> rearm{false};
+    uint8_t *receiving = nullptr;
+    std::thread receiver([&]() {
+        std::mt19937 random(1);
+        {
+            std::lock_guard<std::mutex> lock(isr);
+            receiving = pool->arm();
+        }
+        for (uint32_t transfer = 0; transfer < transfers; ++transfer) {
+            while (receiving == nullptr) {
+                if (rearm.exchange(false)) {
+                    std::lock_guard<std::mutex> lock(isr);
+                    receiving = pool->arm();
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+            memcpy(receiving, &transfer, sizeof(transfer));
+            std::lock_guard<std::mutex> lock(isr);
+            pool->set_received(receiving, sizeof(transfer) + transfer % (size_of - sizeof(transfer) + 1));
+            receiving = pool->arm();
+            // Bursts of packets, then a pause.
+            if (std::uniform_int_distribution<>(0, 15)(random) == 0) {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    std::mt19937 random(2);
+    uint32_t expected = 0;
+    std::set<uint8_t*> seen;
+    while (expected < transfers) {
+        if (!pool->take(r)) {
+            std::this_thread::yield();
+            continue;
+        }
+        uint32_t transfer;
+        memcpy(&transfer, r.buffer, sizeof(transfer));
+        if (transfer != expected || r.length != sizeof(transfer) + transfer % (size_of - sizeof(transfer) + 1)) {
+            printf("received transfer %u length %u, expected %u\n", transfer, r.length, expected);
+            passed = false;
+            break;
+        }
+        ++expected;
+        seen.insert(r.buffer);
+        // The consumer sometimes falls behind so the receiver is starved.
+        if (std::uniform_int_distribution<>(0, 63)(random) == 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        std::lock_guard<std::mutex> lock(isr);
+        if (pool->release(r.buffer)) {
+            rearm = true;
+        }
+    }
+    receiver.join();
+
+    // Whatever's left is back in the pool or with the receiver, and there are still 'number_of' of them.
+    if (receiving == nullptr && rearm.exchange(false)) {
+        receiving = pool->arm();
+    }
+    std::set<uint8_t*> remaining;
+    if (receiving != nullptr) {
+        remaining.insert(receiving);
+    }
+    while (pool->take(r)) {
+        remaining.insert(r.buffer);
+    }
+    for (uint8_t *buffer; (buffer = pool->arm()) != nullptr;) {
+        remaining.insert(buffer);
+    }
+    if (remaining.size() != number_of || remaining.count(nullptr) != 0
+            || !std::includes(remaining.begin(), remaining.end(), seen.begin(), seen.end())) {
+        printf("%zu buffers used, %zu left\n", seen.size(), remaining.size());
+        passed = false;
+    }
+
+    printf("transfers %u, starved %u\n", expected, pool->get_starved_count());
+    puts(passed ? "pool-sim passed" : "pool-sim FAILED");
+    return passed;
+}
+
+// Feeds synthetic interleaved channels, with some buffers dropped, through the isochronous reassembler
+// and checks every buffer reaches the right channel and the lost buffers are all accounted for.
+bool demux_sim_subcommand(int argc, char *argv[]) {
+    synthetic_stream::settings settings = { 2, 10000, 5, true, 1 };
+    if (argc > 0) settings.channels = strtoul(argv[0], nullptr, 0);
+    if (argc > 1) settings.buffers_per_channel = strtoul(argv[1], nullptr, 0);
+    if (argc > 2) settings.drop_percent = strtoul(argv[2], nullptr, 0);
+    if (settings.channels == 0 || settings.channels > UINT8_MAX + 1 || settings.buffers_per_channel == 0 || settings.drop_percent >= 100) {
+        puts("invalid settings");
+        return false;
+    }
+
+    const auto stream = synthetic_stream::generate(settings);
+
+    uint64_t misplaced_buffers = 0;
+    iso_stream::reassembler reassembler(nullptr, [&misplaced_buffers](const uint8_t channel, const uint8_t *const data, const size_t length) {
+        if (!synthetic_stream::check_buffer(channel, data, length)) {
+            ++misplaced_buffers;
+        }
+    });
+    for (const auto &payload: stream.payloads) {
+        reassembler.add_packet(true, payload.data(), payload.size());
+    }
+
+    iso_stream::print_statistics(reassembler.get_statistics());
+    const auto &channel_stats = reassembler.get_channel_statistics();
+    channel_demux::print_statistics(channel_stats);
+
+    auto passed = misplaced_buffers == 0 && reassembler.get_statistics().crc_errors == 0 && channel_stats.size() == settings.channels;
+    for (const auto &entry: channel_stats) {
+        const auto &expected = stream.expected[entry.first];
+        if (entry.second.buffers != expected.delivered || entry.second.lost_buffers != expected.dropped || entry.second.repeated_buffers != 0) {
+            printf("channel %u expected %" PRIu64 " buffers and %" PRIu64 " lost\n", static_cast<unsigned>(entry.first), expected.delivered, expected.dropped);
+            passed = false;
+        }
+    }
+    printf("misplaced buffers %" PRIu64 "\n", misplaced_buffers);
+    puts(passed ? "demux-sim passed" : "demux-sim FAILED");
+    return passed;
+}
+
+// Checks the profiler's accumulation, which is shared with usb-device in probe-statistics.h, against
+// a reference. The durations are measured like 'scoped_probe' does, from a 32 bit cycle counter that
+// wraps part way through, and include the extremes a probe can record.
+bool probe_sim_subcommand(int argc, char *argv[]) {
+    const unsigned samples = argc > 0 ? strtoul(argv[0], nullptr, 0) : 100000;
+
+    auto passed = true;
+
+    // No samples, the readouts show a min of 0 when the count is 0.
+    auto stats = profiler::probe_statistics_init;
+    if (stats.count != 0 || profiler::mean(stats) != 0 || stats.max != 0 || stats.min != UINT32_MAX) {
+        puts("the mean of no samples isn't 0");
+        passed = false;
+    }
+
+    // One sample is the min, the max and the mean.
+    profiler::accumulate(stats, 1234);
+    if (stats.count != 1 || stats.min != 1234 || stats.max != 1234 || profiler::mean(stats) != 1234) {
+        puts("a single sample is wrong");
+        passed = false;
+    }
+
+    // The longest durations mustn't overflow the sum.
+    stats = profiler::probe_statistics_init;
+    for (auto i = 0; i < 1000; ++i) {
+        profiler::accumulate(stats, UINT32_MAX);
+    }
+    if (stats.sum != 1000ull * UINT32_MAX || profiler::mean(stats) != UINT32_MAX || stats.min != UINT32_MAX) {
+        puts("the sum of the longest durations overflowed");
+        passed = false;
+    }
+
+    // The counter starts close enough to wrapping that it wraps several times.
+    std::mt19937 random;
+    uint32_t cycle_counter = UINT32_MAX - 1000;
+    stats = profiler::probe_statistics_init;
+    uint64_t sum = 0;
+    uint32_t min = UINT32_MAX;
+    uint32_t max = 0;
+    auto wraps = 0u;
+    for (auto i = 0u; i < samples; ++i) {
+        // Mostly short, like an ISR, with the odd one of up to the counter's range.
+        const uint32_t duration = std::uniform_int_distribution<>(0, 999)(random) == 0
+            ? std::uniform_int_distribution<uint32_t>(0, UINT32_MAX)(random)
+            : std::uniform_int_distribution<uint32_t>(0, 10000)(random);
+        const uint32_t start = cycle_counter;
+        cycle_counter += duration;
+        wraps += cycle_counter < start ? 1 : 0;
+        profiler::accumulate(stats, cycle_counter - start);
+        cycle_counter += std::uniform_int_distribution<uint32_t>(0, 100000)(random);
+
+        sum += duration;
+        min = std::min(min, duration);
+        max = std::max(max, duration);
+    }
+    if (samples > 0 && (stats.count != samples || stats.sum != sum || stats.min != min || stats.max != max
+            || profiler::mean(stats) != sum / samples)) {
+        printf("count %" PRIu32 " min %" PRIu32 " max %" PRIu32 " mean %" PRIu32 ", expected min %" PRIu32 " max %" PRIu32 " mean %" PRIu64 "\n",
+            stats.count, stats.min, stats.max, profiler::mean(stats), min, max, sum / samples);
+        passed = false;
+    }
+
+    printf("samples %u, counter wrapped %u times\n", samples, wraps);
+    puts(passed ? "probe-sim passed" : "probe-sim FAILED");
+    return passed;
+}
+
+// Feeds random intervals to the usb-device load history and checks the windows against a plain sum.
+bool load_sim_subcommand(int argc, char *argv[]) {
+    const unsigned number_of_intervals = argc > 0 ? strtoul(argv[0], nullptr, 0) : 1000;
+
+    std::mt19937 random;
+    const uint32_t cycles_per_interval = profiler::core_clock_mhz * 1000 * load::interval_ms;
+    load::history history;
+    std::vector<load::interval> intervals;
+    bool passed = true;
+
+    for (auto n = 0u; n < number_of_intervals; ++n) {
+        // The event queue is sometimes late so the intervals vary.
+        load::interval i = {};
+        i.cycles = cycles_per_interval + std::uniform_int_distribution<uint32_t>(0, cycles_per_interval / 10)(random);
+        i.idle_cycles = std::uniform_int_distribution<uint32_t>(0, i.cycles)(random);
+        for (auto &samples: i.samples) {
+            samples = std::uniform_int_distribution<uint32_t>(0, 50)(random);
+        }
+        history.add(i);
+        intervals.push_back(i);
+
+        for (const auto window: load::window_intervals) {
+            const auto stats = history.sum(window);
+            load::window_statistics expected = {};
+            for (auto k = intervals.size() - std::min(window, intervals.size()); k < intervals.size(); ++k) {
+                expected.cycles += intervals[k].cycles;
+                expected.idle_cycles += intervals[k].idle_cycles;
+                for (auto c = 0u; c < load::number_of_contexts; ++c) {
+                    expected.samples[c] += intervals[k].samples[c];
+                }
+                ++expected.intervals;
+            }
+            if (memcmp(&stats, &expected, sizeof(stats)) != 0) {
+                printf("interval %u window %zu doesn't match\n", n, window);
+                passed = false;
+            }
+            if (load::load_permille(stats) > 1000) {
+                printf("interval %u window %zu load out of range\n", n, window);
+                passed = false;
+            }
+        }
+    }
+
+    // 75% busy split evenly between the contexts.
+    load::window_statistics stats = {};
+    stats.cycles = 1000;
+    stats.idle_cycles = 250;
+    for (auto &samples: stats.samples) {
+        samples = 10;
+    }
+    if (load::load_permille(stats) != 750 || load::share_permille(stats, load::context::usb) != 1000 / load::number_of_contexts) {
+        puts("permille calculations wrong");
+        passed = false;
+    }
+
+    puts(passed ? "load-sim passed" : "load-sim FAILED");
+    return passed;
+}
+
+// What usb-device's set_parameter handler and 'parameters::set' decide, from the setup packet alone.
+bool device_accepts_set(const parameters::setup_packet &setup) {
+    if ((setup.bmRequestType & 0x80) != 0 || setup.wLength != 0 || !parameters::is_valid(setup.wIndex)) {
+        return false;
+    }
+    const auto parameter = static_cast<parameters::id>(setup.wIndex);
+    return parameters::descriptions[setup.wIndex].writable && parameters::is_valid(parameter, setup.wValue);
+}
+
+// Round trips every parameter through the encoding shared with usb-device, and checks unknown ids and
+// values out of range are rejected the way the device would reject them.
+bool param_sim_subcommand(int, char *[]) {
+    auto passed = true;
+    const auto check = [&passed](const bool ok, const char *const name, const char *const what) {
+        if (!ok) {
+            printf("%s: %s\n", name, what);
+            passed = false;
+        }
+    };
+
+    for (auto i = 0u; i < parameters::number_of_parameters; ++i) {
+        const auto parameter = static_cast<parameters::id>(i);
+        const auto &description = parameters::descriptions[i];
+        const auto name = description.name;
+
+        check(parameters::find(name) == parameter, name, "not found by name");
+        check(description.min <= description.default_value && description.default_value <= description.max, name, "default out of range");
+
+        const auto get = parameters::encode_get(parameter);
+        check(get.bmRequestType == 0xc0 && get.bRequest == static_cast<uint8_t>(usb_device::vendor_request::get_parameter)
+            && get.wIndex == i && get.wValue == 0 && get.wLength == parameters::value_length, name, "get request wrong");
+
+        for (const uint16_t value: { description.min, description.max, description.default_value, uint16_t(0x1234), uint16_t(0xff00) }) {
+            uint8_t data[parameters::value_length];
+            parameters::encode_value(value, data);
+            check(data[0] == (value & 0xff) && data[1] == (value >> 8) && parameters::decode_value(data) == value, name, "value not little endian");
+
+            const auto set = parameters::encode_set(parameter, value);
+            check(set.bmRequestType == 0x40 && set.bRequest == static_cast<uint8_t>(usb_device::vendor_request::set_parameter)
+                && set.wIndex == i && set.wValue == value && set.wLength == 0, name, "set request wrong");
+
+            const auto in_range = value >= description.min && value <= description.max;
+            check(parameters::is_valid(parameter, value) == in_range, name, "range check wrong");
+            check(device_accepts_set(set) == (description.writable && in_range), name, "set accepted wrongly");
+        }
+
+        if (description.min > 0) {
+            check(!device_accepts_set(parameters::encode_set(parameter, description.min - 1)), name, "below the minimum accepted");
+        }
+        if (description.max < UINT16_MAX) {
+            check(!device_accepts_set(parameters::encode_set(parameter, description.max + 1)), name, "above the maximum accepted");
+        }
+
+        for (auto j = i + 1; j < parameters::number_of_parameters; ++j) {
+            check(strcmp(name, parameters::descriptions[j].name) != 0, name, "name used twice");
+        }
+    }
+
+    check(parameters::find("no-such-parameter") == parameters::id::number_of, "no-such-parameter", "found");
+    for (const uint16_t index: { uint16_t(parameters::number_of_parameters), uint16_t(0x100), uint16_t(UINT16_MAX) }) {
+        check(!parameters::is_valid(index), "bad id", "valid");
+        auto set = parameters::encode_set(parameters::id::streaming, 0);
+        set.wIndex = index;
+        check(!device_accepts_set(set), "bad id", "set accepted");
+    }
+    check(!parameters::is_valid(parameters::encode_get(parameters::id::number_of).wIndex), "id::number_of", "get valid");
+
+    printf("%zu parameters\n", parameters::number_of_parameters);
+    puts(passed ? "param-sim passed" : "param-sim FAILED");
+    return passed;
+}
+
+// Runs a consumer and two readers on their own threads, like usb-device's usb thread, OTG ISR and
+// command line, and checks every snapshot is one whole buffer taken after it was requested.
+bool snapshot_sim_subcommand(int argc, char *argv[]) {
+    const unsigned snapshots = argc > 0 ? strtoul(argv[0], nullptr, 0) : 10000;
+
+    const size_t size = 512;
+    buffer_snapshot::slot<size> slot;
+    bool passed = true;
+
+    // The handshake on its own.
+    uint8_t data[size];
+    buffer_snapshot::header h;
+    const uint8_t filled[size] = { 1 };
+    if (slot.read(h, data) || h.state != static_cast<uint8_t>(buffer_snapshot::state::empty) || slot.capture(filled, {})
+        || !slot.request() || slot.read(h, data) || h.state != static_cast<uint8_t>(buffer_snapshot::state::requested)
+        || !slot.capture(filled, { 0, 0, 7 }) || slot.capture(filled, {})
+        || !slot.read(h, data) || h.number != 1 || h.tag.sequence != 7 || h.length != size || data[0] != 1
+        || !slot.read(h, data) || h.number != 1) {
+        puts("the handshake is wrong");
+        passed = false;
+    }
+
+    // Every buffer is filled with its sequence number so a copy that was torn shows up as a mixture.
+    std::atomic<bool> done{false};
+    std::thread consumer([&]() {
+        uint32_t buffer[size / sizeof(uint32_t)];
+        for (uint16_t sequence = 0; !done; ++sequence) {
+            std::fill(std::begin(buffer), std::end(buffer), sequence);
+            slot.capture(reinterpret_cast<const uint8_t*>(buffer), { 0, 0, sequence });
+            // Like the usb thread waiting for the next buffer.
+            std::this_thread::yield();
+        }
+    });
+
+    std::atomic<unsigned> taken{0};
+    std::atomic<unsigned> busy{0};
+    std::atomic<unsigned> torn{0};
+    std::atomic<unsigned> stale{0};
+    const auto reader = [&]() {
+        uint32_t previous = 0;
+        uint32_t words[size / sizeof(uint32_t)];
+        while (taken < snapshots) {
+            if (!slot.request()) {
+                ++busy;
+                continue;
+            }
+            buffer_snapshot::header header;
+            while (!slot.read(header, reinterpret_cast<uint8_t*>(words))) {
+                std::this_thread::yield();
+            }
+            if (header.number <= previous) {
+                ++stale;
+            }
+            previous = header.number;
+            if (header.length != size || std::any_of(std::begin(words), std::end(words), [&](const uint32_t w) { return w != header.tag.sequence; })) {
+                ++torn;
+            }
+            ++taken;
+        }
+    };
+    std::thread command_line(reader);
+    reader();
+    command_line.join();
+    done = true;
+    consumer.join();
+
+    printf("taken %u, request busy %u, torn %u, stale %u\n", taken.load(), busy.load(), torn.load(), stale.load());
+    if (torn != 0 || stale != 0) {
+        passed = false;
+    }
+    puts(passed ? "snapshot-sim passed" : "snapshot-sim FAILED");
+    return passed;
+}
+
+// Writes records into a ring like the one in usb-device, letting it wrap between reads, and checks
+// they come out the other side of both the block and the line encodings.
+bool trace_sim_subcommand(int argc, char *argv[]) {
+    const unsigned rounds = argc > 0 ? strtoul(argv[0], nullptr, 0) : 1000;
+
+    std::mt19937 random;
+    const size_t ring_size = 64;
+    trace::ring<ring_size> ring;
+    uint32_t timestamp = 0;
+    uint32_t next_arg = 0;
+    uint64_t written = 0;
+
+    uint64_t expected_lost = 0;
+    uint32_t expected_arg = 0;
+    bool passed = true;
+    trace_decoder::decoder block_decoder([](const std::string &) {});
+    trace_decoder::decoder line_decoder([](const std::string &) {});
+
+    for (auto round = 0u; round < rounds; ++round) {
+        // Sometimes more than the ring holds so records are lost.
+        const auto to_write = std::uniform_int_distribution<size_t>(0, ring_size * 3 / 2)(random);
+        for (auto i = 0u; i < to_write; ++i) {
+            // Long enough gaps for the timestamp to wrap now and again.
+            timestamp += std::uniform_int_distribution<uint32_t>(0, 100000000)(random);
+            ring.write(static_cast<trace::event>(next_arg % (trace::number_of_events + 1)), timestamp, next_arg, ~next_arg);
+            ++next_arg;
+        }
+        written += to_write;
+
+        // Drain it in blocks of varying sizes like the vendor request does.
+        for (;;) {
+            trace::record records[trace::max_records_per_block];
+            uint32_t lost;
+            const auto n = ring.read(records, std::uniform_int_distribution<size_t>(1, trace::max_records_per_block)(random), lost);
+            expected_lost += lost;
+            expected_arg += lost;
+            for (auto i = 0u; i < n; ++i) {
+                if (records[i].args[0] != expected_arg || records[i].args[1] != ~expected_arg) {
+                    printf("record %" PRIu32 " expected %" PRIu32 "\n", records[i].args[0], expected_arg);
+                    passed = false;
+                    expected_arg = records[i].args[0];
+                }
+                ++expected_arg;
+
+                char line[128];
+                snprintf(line, sizeof(line), trace::dump_line_format, i == 0 ? lost : 0, static_cast<unsigned>(records[i].id),
+                    static_cast<unsigned>(records[i].sequence), records[i].timestamp, records[i].args[0], records[i].args[1]);
+                line_decoder.add_line(line);
+            }
+
+            uint8_t block[trace::max_block_size];
+            block_decoder.add_block(block, trace::encode_block(block, records, n, lost));
+            if (n == 0) {
+                break;
+            }
+        }
+    }
+
+    const auto &block_stats = block_decoder.get_statistics();
+    const auto &line_stats = line_decoder.get_statistics();
+    trace_decoder::print_statistics(block_stats);
+    trace_decoder::print_statistics(line_stats);
+    printf("written %" PRIu64 " expected lost %" PRIu64 "\n", written, expected_lost);
+    if (block_stats.records + block_stats.lost_records != written || block_stats.lost_records != expected_lost || block_stats.malformed != 0) {
+        passed = false;
+    }
+    // Some of the event ids are past the end so the decoder's handling of newer devices gets exercised.
+    if (line_stats.records != block_stats.records || line_stats.lost_records != block_stats.lost_records || line_stats.malformed != 0
+        || block_stats.unknown_events != line_stats.unknown_events || block_stats.unknown_events == 0) {
+        passed = false;
+    }
+    puts(passed ? "trace-sim passed" : "trace-sim FAILED");
+    return passed;
+}
+
+// Formats with 'console_output::format_line' the way the command line's output function does.
+size_t format_console_line(char *const line, bool &truncated, const char *const format, ...) {
+    va_list args;
+    va_start(args, format);
+    const auto length = console_output::format_line(line, format, args, truncated);
+    va_end(args);
+    return length;
+}
+
+// Writes lines into a ring like usb-device's console output whilst a simulated DMA drains it in
+// contiguous blocks, and checks every byte that wasn't dropped comes out in order.
+bool console_sim_subcommand(int argc, char *argv[]) {
+    const unsigned rounds = argc > 0 ? strtoul(argv[0], nullptr, 0) : 10000;
+
+    std::mt19937 random;
+    const size_t ring_size = 256;
+    uint8_t storage[ring_size];
+    console_output::ring<ring_size> ring(storage);
+    std::deque<uint8_t> expected;
+    uint8_t next_byte = 0;
+    uint64_t expected_dropped_bytes = 0;
+    uint32_t expected_dropped_writes = 0;
+    bool passed = true;
+
+    for (auto round = 0u; round < rounds; ++round) {
+        // A burst of writes, sometimes more than the ring holds.
+        const auto writes = std::uniform_int_distribution<unsigned>(0, 8)(random);
+        for (auto i = 0u; i < writes; ++i) {
+            char data[ring_size / 2];
+            const auto length = std::uniform_int_distribution<size_t>(1, sizeof(data))(random);
+            for (auto k = 0u; k < length; ++k) {
+                data[k] = static_cast<char>(next_byte + k);
+            }
+            const auto room = ring.room();
+            const auto written = ring.write(data, length);
+            if (written != (length <= room)) {
+                printf("write of %zu with %zu room returned %d\n", length, room, written);
+                passed = false;
+            }
+            if (written) {
+                expected.insert(expected.end(), data, data + length);
+                next_byte += length;
+            } else {
+                expected_dropped_bytes += length;
+                ++expected_dropped_writes;
+            }
+        }
+
+        // The DMA transmits at most one contiguous block per completion.
+        const uint8_t *data;
+        const auto length = ring.peek(data);
+        if (data < storage || data + length > storage + ring_size || (length == 0 && ring.used() != 0)) {
+            printf("peek returned %zu bytes at offset %td\n", length, data - storage);
+            passed = false;
+            break;
+        }
+        const auto transmitted = std::uniform_int_distribution<size_t>(0, 3)(random) == 0 ? length / 2 : length;
+        for (auto k = 0u; k < transmitted; ++k) {
+            if (expected.empty() || data[k] != expected.front()) {
+                printf("transmitted 0x%02x, expected 0x%02x\n", data[k], expected.empty() ? 0 : expected.front());
+                passed = false;
+                break;
+            }
+            expected.pop_front();
+        }
+        ring.consume(transmitted);
+        if (ring.used() != expected.size()) {
+            printf("ring has %zu bytes, expected %zu\n", ring.used(), expected.size());
+            passed = false;
+        }
+        if (!passed) {
+            break;
+        }
+    }
+
+    const auto &stats = ring.statistics();
+    printf("written %" PRIu32 " bytes, dropped %" PRIu32 " bytes in %" PRIu32 " writes, most used %" PRIu32 "\n",
+        stats.written_bytes, stats.dropped_bytes, stats.dropped_writes, stats.max_used);
+    if (stats.dropped_bytes != static_cast<uint32_t>(expected_dropped_bytes) || stats.dropped_writes != expected_dropped_writes
+        || stats.dropped_writes == 0 || stats.max_used > ring_size) {
+        passed = false;
+    }
+
+    // Long lines are cut at 'max_line' - 1 characters and still terminated.
+    char line[console_output::max_line];
+    bool truncated;
+    const std::string long_text(console_output::max_line * 2, 'x');
+    auto length = format_console_line(line, truncated, "%s\n", long_text.c_str());
+    if (!truncated || length != console_output::max_line - 1 || strlen(line) != length) {
+        printf("long line gave %zu characters, truncated %d\n", length, truncated);
+        passed = false;
+    }
+    length = format_console_line(line, truncated, "%s %d\n", "short", 42);
+    if (truncated || length != 9 || strcmp(line, "short 42\n") != 0) {
+        printf("short line gave \"%s\", truncated %d\n", line, truncated);
+        passed = false;
+    }
+    puts(passed ? "console-sim passed" : "console-sim FAILED");
+    return passed;
+}
+
+// Stands in for EP0 for 'control_transfer::engine'. Records what the engine asks for so a replay can
+// compare it with what the hardware should have been asked to do, and keeps the bytes transmitted.
+class fake_ep0_port: public control_transfer::port {
+public:
+    void transmit(const uint8_t *const data, const size_t length) override {
+        operations.push_back("transmit " + std::to_string(length));
+        if (length > 0) {
+            transmitted.insert(transmitted.end(), data, data + length);
+        }
+    }
+
+    void receive(uint8_t *const data, const size_t length) override {
+        operations.push_back("receive " + std::to_string(length));
+        receive_buffer = data;
+        receive_capacity = length;
+    }
+
+    void stall() override {
+        operations.push_back("stall");
+    }
+
+    // The host sends an OUT packet into the buffer last given to 'receive'.
+    void host_sends(control_transfer::engine &engine, const uint8_t *const data, const size_t length) {
+        if (length > 0) {
+            memcpy(receive_buffer, data, std::min(length, receive_capacity));
+        }
+        engine.out_complete(length);
+    }
+
+    std::vector<std::string> operations;
+    std::vector<uint8_t> transmitted;
+
+private:
+    uint8_t *receive_buffer = nullptr;
+    size_t receive_capacity = 0;
+};
+
+std::vector<uint8_t> control_sim_received;
+bool control_sim_accept = true;
+
+bool control_sim_out_complete(const uint8_t *const data, const size_t length) {
+    control_sim_received.assign(data, data + length);
+    return control_sim_accept;
+}
+
+struct control_replay {
+    const char *name;
+    void (*run)(control_transfer::engine &engine, fake_ep0_port &port, const std::vector<uint8_t> &data);
+    std::vector<std::string> expected_operations;
+    size_t expected_length;  // Of the data transmitted by the device or received by the callback
+    control_transfer::stage expected_stage;
+};
+
+// Each replay starts from a setup packet and drives the engine with the completions the OTG core
+// would report. The data is 0, 1, 2... so a packet sent from the wrong offset is spotted.
+const control_replay control_replays[] = {
+    { "IN, wLength shorter than the data", [](control_transfer::engine &engine, fake_ep0_port &port, const std::vector<uint8_t> &data) {
+            engine.setup_received();
+            engine.start_in(data.data(), 100, 10);
+            engine.in_complete();
+            port.host_sends(engine, nullptr, 0);
+        }, { "transmit 10", "receive 0" }, 10, control_transfer::stage::idle },
+    { "IN, data shorter than wLength", [](control_transfer::engine &engine, fake_ep0_port &port, const std::vector<uint8_t> &data) {
+            engine.setup_received();
+            engine.start_in(data.data(), 100, 255);
+            engine.in_complete();
+            engine.in_complete();
+            port.host_sends(engine, nullptr, 0);
+        }, { "transmit 64", "transmit 36", "receive 0" }, 100, control_transfer::stage::idle },
+    { "IN, multiple of the packet size shorter than wLength", [](control_transfer::engine &engine, fake_ep0_port &port, const std::vector<uint8_t> &data) {
+            engine.setup_received();
+            engine.start_in(data.data(), 128, 255);
+            engine.in_complete();
+            engine.in_complete();
+            engine.in_complete();
+            port.host_sends(engine, nullptr, 0);
+        }, { "transmit 64", "transmit 64", "transmit 0", "receive 0" }, 128, control_transfer::stage::idle },
+    { "IN, multiple of the packet size equal to wLength", [](control_transfer::engine &engine, fake_ep0_port &port, const std::vector<uint8_t> &data) {
+            engine.setup_received();
+            engine.start_in(data.data(), 200, 128);
+            engine.in_complete();
+            engine.in_complete();
+            port.host_sends(engine, nullptr, 0);
+        }, { "transmit 64", "transmit 64", "receive 0" }, 128, control_transfer::stage::idle },
+    { "IN, wLength 0", [](control_transfer::engine &engine, fake_ep0_port &, const std::vector<uint8_t> &data) {
+            engine.setup_received();
+            engine.start_in(data.data(), 100, 0);
+            engine.in_complete();
+        }, { "transmit 0" }, 0, control_transfer::stage::idle },
+    { "IN, host starts the status stage early", [](control_transfer::engine &engine, fake_ep0_port &port, const std::vector<uint8_t> &data) {
+            engine.setup_received();
+            engine.start_in(data.data(), 200, 200);
+            port.host_sends(engine, nullptr, 0);
+            // The rest of the data mustn't be sent.
+            engine.in_complete();
+        }, { "transmit 64" }, 64, control_transfer::stage::idle },
+    { "IN, setup packet aborts the data stage", [](control_transfer::engine &engine, fake_ep0_port &, const std::vector<uint8_t> &data) {
+            engine.setup_received();
+            engine.start_in(data.data(), 200, 200);
+            engine.setup_received();
+            engine.in_complete();
+        }, { "transmit 64" }, 64, control_transfer::stage::idle },
+    { "OUT, multiple packets", [](control_transfer::engine &engine, fake_ep0_port &port, const std::vector<uint8_t> &data) {
+            static uint8_t buffer[256];
+            engine.setup_received();
+            engine.start_out(buffer, sizeof(buffer), 150, control_sim_out_complete);
+            port.host_sends(engine, &data[0], 64);
+            port.host_sends(engine, &data[64], 64);
+            port.host_sends(engine, &data[128], 22);
+            engine.in_complete();
+        }, { "receive 64", "receive 64", "receive 64", "transmit 0" }, 150, control_transfer::stage::idle },
+    { "OUT, short packet ends the data stage early", [](control_transfer::engine &engine, fake_ep0_port &port, const std::vector<uint8_t> &data) {
+            static uint8_t buffer[256];
+            engine.setup_received();
+            engine.start_out(buffer, sizeof(buffer), 150, control_sim_out_complete);
+            port.host_sends(engine, &data[0], 64);
+            port.host_sends(engine, &data[64], 10);
+            engine.in_complete();
+        }, { "receive 64", "receive 64", "transmit 0" }, 74, control_transfer::stage::idle },
+    { "OUT, wLength 0", [](control_transfer::engine &engine, fake_ep0_port &, const std::vector<uint8_t> &) {
+            static uint8_t buffer[256];
+            engine.setup_received();
+            engine.start_out(buffer, sizeof(buffer), 0, control_sim_out_complete);
+            engine.in_complete();
+        }, { "transmit 0" }, 0, control_transfer::stage::idle },
+    { "OUT, wLength more than the capacity stalls", [](control_transfer::engine &engine, fake_ep0_port &, const std::vector<uint8_t> &) {
+            static uint8_t buffer[64];
+            engine.setup_received();
+            engine.start_out(buffer, sizeof(buffer), 65, control_sim_out_complete);
+        }, { "stall" }, 0, control_transfer::stage::idle },
+    { "OUT, callback rejecting the data stalls", [](control_transfer::engine &engine, fake_ep0_port &port, const std::vector<uint8_t> &data) {
+            static uint8_t buffer[256];
+            engine.setup_received();
+            control_sim_accept = false;
+            engine.start_out(buffer, sizeof(buffer), 100, control_sim_out_complete);
+            port.host_sends(engine, &data[0], 64);
+            port.host_sends(engine, &data[64], 36);
+            control_sim_accept = true;
+        }, { "receive 64", "receive 64", "stall" }, 100, control_transfer::stage::idle },
+    { "request stalled whilst idle", [](control_transfer::engine &engine, fake_ep0_port &, const std::vector<uint8_t> &) {
+            engine.setup_received();
+            engine.stall();
+            engine.in_complete();
+        }, { "stall" }, 0, control_transfer::stage::idle },
+    { "no data stage, status not yet complete", [](control_transfer::engine &engine, fake_ep0_port &, const std::vector<uint8_t> &) {
+            engine.setup_received();
+            engine.start_no_data();
+        }, { "transmit 0" }, 0, control_transfer::stage::status_in }
+};
+
+// Replays setup packets and packet completions through usb-device's control transfer engine and checks
+// the EP0 operations it asks for, the data that goes over the bus and the stage it ends in.
+bool control_sim_subcommand(int, char *[]) {
+    std::vector<uint8_t> data(256);
+    std::iota(data.begin(), data.end(), 0);
+
+    auto passed = true;
+    for (const auto &replay: control_replays) {
+        fake_ep0_port port;
+        control_transfer::engine engine(port);
+        control_sim_received.clear();
+        replay.run(engine, port, data);
+
+        // Only one of these is filled in, by a control read or a control write.
+        const auto &moved = port.transmitted.empty() ? control_sim_received : port.transmitted;
+        const auto data_correct = moved.size() == replay.expected_length && std::equal(moved.begin(), moved.end(), data.begin());
+        const auto replay_passed = port.operations == replay.expected_operations && data_correct && engine.get_stage() == replay.expected_stage;
+        if (!replay_passed) {
+            printf("%s: FAILED, operations:", replay.name);
+            for (const auto &operation: port.operations) {
+                printf(" %s,", operation.c_str());
+            }
+            printf(" %zu bytes, stage %d\n", moved.size(), static_cast<int>(engine.get_stage()));
+            passed = false;
+        } else {
+            printf("%s: passed\n", replay.name);
+        }
+    }
+
+    puts(passed ? "control-sim passed" : "control-sim FAILED");
+    return passed;
+}
+
+// Sims are given the arguments following the sim name.
+struct sim {
+    const char *name;
+    bool (*function)(int argc, char *argv[]);
+    const char *usage;
+};
+
+const sim sims[] = {
+    { "console-sim", console_sim_subcommand, "console-sim [<rounds>]" },
+    { "control-sim", control_sim_subcommand, "control-sim" },
+    { "demux-sim", demux_sim_subcommand, "demux-sim [<channels> [<buffers per channel> [<drop percent>]]]" },
+    { "footprint-sim", footprint_sim_subcommand, "footprint-sim [<map file> [<rules file> [<budget file>]]]" },
+    { "handoff-sim", handoff_sim_subcommand, "handoff-sim [<buffers> [<completions>]]" },
+    { "iso-sim", iso_sim_subcommand, "iso-sim [<microframes> [<drop percent>]]" },
+    { "load-sim", load_sim_subcommand, "load-sim [<intervals>]" },
+    { "loopback-sim", loopback_sim_subcommand, "loopback-sim [<duration ms> [<write length> <queue depth>]]" },
+    { "orchestrate-sim", orchestrate_sim_subcommand, "orchestrate-sim [<capacity Hz> [<duration s> [<prescaler,...> [<mode,...>]]]]" },
+    { "param-sim", param_sim_subcommand, "param-sim" },
+    { "pool-sim", pool_sim_subcommand, "pool-sim [<transfers>]" },
+    { "prbs-sim", prbs_sim_subcommand, "prbs-sim [<degree> [<MB> [<bit error rate>]]]" },
+    { "probe-sim", probe_sim_subcommand, "probe-sim [<samples>]" },
+    { "snapshot-sim", snapshot_sim_subcommand, "snapshot-sim [<snapshots>]" },
+    { "sweep-sim", sweep_sim_subcommand, "sweep-sim [<capacity Hz> [<max sclk Hz>]]" },
+    { "trace-sim", trace_sim_subcommand, "trace-sim [<rounds>]" }
+};
+
+const sim *find_sim(const char *const name) {
+    for (const auto &s: sims) {
+        if (strcmp(s.name, name) == 0) {
+            return &s;
+        }
+    }
+    return nullptr;
+}
+
+void print_usage() {
+    puts("usage: usb-host-sims [<sim> [<args>]]");
+    for (const auto &s: sims) {
+        printf("    %s\n", s.usage);
+    }
+}
+
+}
+
+// Without a sim every one is run with its defaults, the exit status is non-zero if any of them failed.
+int main(int argc, char *argv[]) {
+    if (argc > 1) {
+        const auto s = find_sim(argv[1]);
+        if (s == nullptr) {
+            print_usage();
+            return 1;
+        }
+        return s->function(argc - 2, argv + 2) ? 0 : 1;
+    }
+
+    char *no_arguments[] = { nullptr };
+    std::vector<const char*> failed;
+    for (const auto &s: sims) {
+        printf("---- %s\n", s.name);
+        if (!s.function(0, no_arguments)) {
+            failed.push_back(s.name);
+        }
+    }
+
+    printf("---- %zu of %zu sims passed\n", std::size(sims) - failed.size(), std::size(sims));
+    for (const auto name: failed) {
+        printf("%s FAILED\n", name);
+    }
+    return failed.empty() ? 0 : 1;
+}
@@ -0,0 +1,95 @@
+#include "simulated-transport.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace simulated_transport
+{
+
+loopback_transport::loopback_transport(const size_t device_buffers, const std::chrono::microseconds latency, const faults &f)
+    : device_buffers(device_buffers), latency(latency), f(f) {
+    assert(device_buffers > 0);
+}
+
+bool loopback_transport::start(client &c, const size_t write_length, const int queue_depth) {
+    this->c = &c;
+    this->write_length = write_length;
+    writes_outstanding = queue_depth;
+    reads_outstanding = queue_depth;
+    write_data.resize(write_length);
+    device.clear();
+    random.seed(f.seed);
+    units_dropped_unseen = 0;
+    stats = statistics();
+    return true;
+}
+
+// Nothing is really transmitted so each write is filled and completed in the same step.
+bool loopback_transport::handle_events() {
+    assert(c != nullptr);
+
+    const auto units_per_write = write_length / loopback_benchmark::unit_size;
+    const auto capacity = std::max(device_buffers, units_per_write);
+
+    // Complete as many writes as there's room for.
+    auto writes = writes_outstanding;
+    while (writes-- > 0 && device.size() + units_per_write <= capacity) {
+        c->fill(write_data.data(), write_length);
+        const auto ready = std::chrono::steady_clock::now() + latency;
+        for (auto i = 0u; i < units_per_write; ++i) {
+            const auto first = write_data.begin() + i * loopback_benchmark::unit_size;
+            device.push_back(unit{ ready, std::vector<unsigned char>(first, first + loopback_benchmark::unit_size) });
+        }
+        c->written(write_length);
+    }
+
+    // Complete as many reads as there are units ready. Swapping or repeating a unit takes 2 reads.
+    auto reads = reads_outstanding;
+    const auto now = std::chrono::steady_clock::now();
+    while (reads > 0 && !device.empty() && device.front().ready <= now) {
+        if (stats.units_read > 0 && inject(f.drop_percent)) {
+            ++units_dropped_unseen;
+            device.pop_front();
+        } else if (stats.units_read > 0 && reads >= 2 && device.size() >= 2 && device[1].ready <= now && inject(f.reorder_percent)) {
+            ++stats.units_ahead;
+            read_unit(device[1]);
+            read_unit(device[0]);
+            ++stats.units_reordered;
+            device.erase(device.begin(), device.begin() + 2);
+            reads -= 2;
+        } else if (stats.units_read > 0 && reads >= 2 && inject(f.repeat_percent)) {
+            stats.units_ahead += units_dropped_unseen > 0 ? 1 : 0;
+            read_unit(device.front());
+            read_unit(device.front());
+            ++stats.units_repeated;
+            device.pop_front();
+            reads -= 2;
+        } else {
+            stats.units_ahead += units_dropped_unseen > 0 ? 1 : 0;
+            read_unit(device.front());
+            device.pop_front();
+            --reads;
+        }
+    }
+
+    return true;
+}
+
+void loopback_transport::stop() {
+    c = nullptr;
+    device.clear();
+}
+
+bool loopback_transport::inject(const unsigned percent) {
+    return percent > 0 && std::uniform_int_distribution<unsigned>(0, 99)(random) < percent;
+}
+
+// The dropped units only count once a later unit has been read, the benchmark can't know about them before.
+void loopback_transport::read_unit(const unit &u) {
+    stats.units_dropped += units_dropped_unseen;
+    units_dropped_unseen = 0;
+    ++stats.units_read;
+    c->read(u.data.data(), u.data.size());
+}
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "loopback-benchmark.h"
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <random>
+#include <vector>
+
+namespace simulated_transport
+{
+
+// Units the transport has mistreated on purpose, so the benchmark's accounting can be checked.
+// None are injected until the first unit has been read, the benchmark synchronises on that.
+struct faults {
+    unsigned drop_percent = 0;  // Of the units ready to be read, a dropped unit is never read
+    unsigned reorder_percent = 0;  // The unit is read after the one that follows it
+    unsigned repeat_percent = 0;  // The unit is read twice
+    uint32_t seed = 1;
+};
+
+struct statistics {
+    uint64_t units_read = 0;  // Including the repeats
+    uint64_t units_dropped = 0;  // Only those followed by a unit that was read, i.e. that can be known to be lost
+    uint64_t units_reordered = 0;  // Read late
+    uint64_t units_repeated = 0;  // Read again
+    uint64_t units_ahead = 0;  // Read whilst units before them were dropped or still to be read
+};
+
+// Behaves like usb-device in loopback mode without needing the device, so the benchmark can be
+// checked anywhere. Written units are queued in a limited number of device buffers, a write doesn't
+// complete until there's room for all of it, and each unit can be read 'latency' after it was written.
+class loopback_transport: public loopback_benchmark::transport {
+public:
+    loopback_transport(const size_t device_buffers, const std::chrono::microseconds latency, const faults &f = faults());
+
+    bool start(client &c, const size_t write_length, const int queue_depth) override;
+    bool handle_events() override;
+    void stop() override;
+
+    // Since the last 'start'.
+    const statistics &get_statistics() const { return stats; }
+
+private:
+    struct unit {
+        std::chrono::steady_clock::time_point ready;
+        std::vector<unsigned char> data;
+    };
+
+    bool inject(const unsigned percent);
+    void read_unit(const unit &u);
+
+    const size_t device_buffers;
+    const std::chrono::microseconds latency;
+    const faults f;
+
+    client *c = nullptr;
+    size_t write_length = 0;
+    int writes_outstanding = 0;
+    int reads_outstanding = 0;
+    std::vector<unsigned char> write_data;
+    std::deque<unit> device;
+    std::mt19937 random;
+    uint64_t units_dropped_unseen = 0;
+    statistics stats;
+};
+
+}
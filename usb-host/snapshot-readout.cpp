@@ -0,0 +1,105 @@
+#include "snapshot-readout.h"
+
+#include "libusb-error.h"
+
+#include "../usb-device/snapshot-slot.h"
+#include "../usb-device/usb-device.h"
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+namespace snapshot_readout
+{
+
+namespace
+{
+
+// The USB consumer takes the snapshot with the next full buffer, which is almost immediate whilst streaming.
+const auto poll_interval = std::chrono::milliseconds(10);
+const auto max_polls = 100;
+
+// More than a buffer, the header says how much there is.
+const size_t max_response_length = 4096;
+
+bool request(libusb_device_handle *const device_handle) {
+    const auto bytes_transferred = libusb_control_transfer(
+            device_handle,
+            LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE, // bmRequestType
+            static_cast<uint8_t>(usb_device::vendor_request::request_snapshot), // bRequest
+            0, // wValue
+            0, // wIndex
+            nullptr,
+            0, // wLength
+            100
+        );
+    if (bytes_transferred < 0) {
+        // A stall means the previous snapshot was being read, e.g. by the usb-device "snapshot" command.
+        print_libusb_error(static_cast<libusb_error>(bytes_transferred), "libusb_control_transfer");
+        return false;
+    } else {
+        return true;
+    }
+}
+
+// Returns the number of bytes of the snapshot in 'data', 0 if it isn't ready, or -1 on an error.
+int get(libusb_device_handle *const device_handle, buffer_snapshot::header &h, uint8_t *const data) {
+    uint8_t response[max_response_length];
+    const auto bytes_transferred = libusb_control_transfer(
+            device_handle,
+            LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE, // bmRequestType
+            static_cast<uint8_t>(usb_device::vendor_request::get_snapshot), // bRequest
+            0, // wValue
+            0, // wIndex
+            response,
+            sizeof(response), // wLength
+            100
+        );
+    if (bytes_transferred < 0) {
+        print_libusb_error(static_cast<libusb_error>(bytes_transferred), "libusb_control_transfer");
+        return -1;
+    } else if (static_cast<size_t>(bytes_transferred) < sizeof(h)) {
+        printf("bytes_transferred %d, expected at least %zu\n", bytes_transferred, sizeof(h));
+        return -1;
+    }
+
+    memcpy(&h, response, sizeof(h));
+    if (sizeof(h) + h.length != static_cast<size_t>(bytes_transferred)) {
+        printf("bytes_transferred %d, the header says %zu\n", bytes_transferred, sizeof(h) + h.length);
+        return -1;
+    }
+    memcpy(data, &response[sizeof(h)], h.length);
+    return h.length;
+}
+
+}
+
+bool print(libusb_device_handle *const device_handle) {
+    if (!request(device_handle)) {
+        return false;
+    }
+
+    buffer_snapshot::header h;
+    uint8_t data[max_response_length];
+    for (auto polls = 0; polls < max_polls; ++polls) {
+        const auto length = get(device_handle, h, data);
+        if (length < 0) {
+            return false;
+        } else if (length > 0) {
+            printf("snapshot %" PRIu32 " channel %u sequence %u\n", h.number, h.tag.channel, h.tag.sequence);
+            for (auto i = 0; i + 4 <= length; i += 4) {
+                uint32_t word;
+                memcpy(&word, &data[i], sizeof(word));
+                printf("0x%" PRIx32 "%s", word, (i / 4 + 1) % 8 == 0 ? "\n" : " ");
+            }
+            return true;
+        }
+        std::this_thread::sleep_for(poll_interval);
+    }
+    puts("no full buffer was taken, the host has to be reading unless streaming is 0");
+    return false;
+}
+
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <libusb-1.0/libusb.h>
+
+// Takes a snapshot of the next full usb-device buffer, see snapshot-slot.h, using vendor requests.
+namespace snapshot_readout
+{
+
+// Requests a snapshot, polls until it's been taken and prints it as words, like the usb-device "snapshot" command.
+bool print(libusb_device_handle *const device_handle);
+
+}
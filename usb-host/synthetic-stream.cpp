@@ -0,0 +1,110 @@
+#include "synthetic-stream.h"
+
+#include "crc32.h"
+
+#include "../usb-device/usb-device.h"
+
+#include <cstring>
+#include <random>
+
+namespace synthetic_stream
+{
+
+namespace
+{
+
+const size_t buffer_size = usb_device::crc32_buffer_size;
+// The same as usb-device, see 'max_buffers_per_payload' in evk-usb-device-hal.cpp.
+const size_t max_buffers_per_payload = 5;
+
+// The first word is the channel and the sequence number, the rest is a simple function of them.
+void fill_buffer(const uint8_t channel, const uint16_t sequence, uint8_t *const data) {
+    const uint32_t seed = static_cast<uint32_t>(channel) << 16 | sequence;
+    uint32_t word = seed;
+    for (size_t i = 0; i < buffer_size; i += sizeof(word)) {
+        memcpy(data + i, &word, sizeof(word));
+        word = word * 1664525 + 1013904223;
+    }
+}
+
+}
+
+stream generate(const settings &s) {
+    stream result;
+    result.expected.resize(s.channels);
+
+    std::mt19937 generator(s.seed);
+    std::vector<unsigned> remaining(s.channels, s.buffers_per_channel);
+    // Start near the wrap so it gets exercised.
+    std::vector<uint16_t> sequences(s.channels, static_cast<uint16_t>(UINT16_MAX - s.buffers_per_channel / 2));
+
+    uint32_t payload_sequence = 0;
+    auto buffers_left = static_cast<uint64_t>(s.channels) * s.buffers_per_channel;
+    while (buffers_left > 0) {
+        const auto flags = static_cast<uint16_t>(usb_device::header_flag_channel_tag | (s.with_crc ? usb_device::header_flag_crc32 : 0));
+        std::vector<uint8_t> payload(sizeof(usb_device::iso_header));
+
+        const size_t buffers_in_payload = 1 + generator() % max_buffers_per_payload;
+        for (size_t i = 0; i < buffers_in_payload && buffers_left > 0; ++i) {
+            // Pick a channel that has buffers left.
+            auto channel = generator() % s.channels;
+            while (remaining[channel] == 0) {
+                channel = (channel + 1) % s.channels;
+            }
+            --remaining[channel];
+            --buffers_left;
+            const auto sequence = sequences[channel]++;
+
+            // The first and last buffers are never dropped otherwise the receiver couldn't know they were missing.
+            const auto first = remaining[channel] == s.buffers_per_channel - 1;
+            const auto last = remaining[channel] == 0;
+            if (!first && !last && generator() % 100 < s.drop_percent) {
+                ++result.expected[channel].dropped;
+                continue;
+            }
+            ++result.expected[channel].delivered;
+
+            const auto offset = payload.size();
+            payload.resize(offset + buffer_size);
+            fill_buffer(channel, sequence, &payload[offset]);
+            if (s.with_crc) {
+                const auto crc = crc32::compute(&payload[offset], buffer_size);
+                payload.resize(payload.size() + sizeof(crc));
+                memcpy(&payload[payload.size() - sizeof(crc)], &crc, sizeof(crc));
+            }
+            const usb_device::channel_tag tag = { static_cast<uint8_t>(channel), 0, sequence };
+            payload.resize(payload.size() + sizeof(tag));
+            memcpy(&payload[payload.size() - sizeof(tag)], &tag, sizeof(tag));
+        }
+
+        // Like the device, a microframe without any buffers isn't sent.
+        if (payload.size() == sizeof(usb_device::iso_header)) {
+            continue;
+        }
+        const usb_device::iso_header header = {
+            payload_sequence++,
+            static_cast<uint16_t>(payload.size() - sizeof(usb_device::iso_header)),
+            flags
+        };
+        memcpy(payload.data(), &header, sizeof(header));
+        result.payloads.push_back(std::move(payload));
+    }
+
+    return result;
+}
+
+bool check_buffer(const uint8_t channel, const uint8_t *const data, const size_t length) {
+    if (length != buffer_size) {
+        return false;
+    }
+    uint32_t seed;
+    memcpy(&seed, data, sizeof(seed));
+    if (seed >> 16 != channel) {
+        return false;
+    }
+    uint8_t expected[buffer_size];
+    fill_buffer(channel, seed & 0xffff, expected);
+    return memcmp(data, expected, buffer_size) == 0;
+}
+
+}
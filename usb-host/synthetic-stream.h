@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Generates the isochronous payloads usb-device would send for several SPI channels, see 'header_flag_channel_tag',
+// so the demultiplexing can be checked without a device. The channels' buffers are randomly interleaved
+// and randomly dropped, as if the device had overflowed, and each buffer's contents are derived from its
+// channel and sequence number so the receiver can tell if a buffer ended up in the wrong place.
+namespace synthetic_stream
+{
+
+struct settings {
+    unsigned channels;
+    unsigned buffers_per_channel;  // Including the dropped buffers
+    unsigned drop_percent;
+    bool with_crc;
+    uint32_t seed;
+};
+
+struct channel_expectation {
+    uint64_t delivered = 0;
+    uint64_t dropped = 0;
+};
+
+struct stream {
+    std::vector<std::vector<uint8_t>> payloads;  // Each starts with a 'usb_device::iso_header'
+    std::vector<channel_expectation> expected;  // Indexed by channel
+};
+
+stream generate(const settings &s);
+
+// Returns false if the buffer doesn't hold what 'generate' put in a buffer for 'channel'.
+bool check_buffer(const uint8_t channel, const uint8_t *const data, const size_t length);
+
+}
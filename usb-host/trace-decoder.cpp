@@ -0,0 +1,110 @@
+#include "trace-decoder.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+namespace trace_decoder
+{
+
+namespace
+{
+
+double cycles_to_us(const double cycles) {
+    return cycles * 1e6 / trace::timestamp_hz;
+}
+
+}
+
+decoder::decoder(output_t output) : output(output) {
+}
+
+size_t decoder::add_block(const uint8_t *const data, const size_t length) {
+    trace::block_header header;
+    if (length < sizeof(header)) {
+        ++stats.malformed;
+        return 0;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.number_of_records > trace::max_records_per_block || length != sizeof(header) + header.number_of_records * sizeof(trace::record)) {
+        ++stats.malformed;
+        return 0;
+    }
+
+    if (header.number_of_records == 0 && header.lost != 0) {
+        stats.lost_records += header.lost;
+    }
+    for (auto i = 0u; i < header.number_of_records; ++i) {
+        trace::record r;
+        memcpy(&r, data + sizeof(header) + i * sizeof(r), sizeof(r));
+        add_record(r, i == 0 ? header.lost : 0);
+    }
+    return header.number_of_records;
+}
+
+bool decoder::add_line(const std::string &line) {
+    const auto start = line.find("T ");
+    if (start == std::string::npos) {
+        return false;
+    }
+
+    uint32_t lost;
+    unsigned id;
+    unsigned sequence;
+    trace::record r;
+    if (sscanf(line.c_str() + start, "T %" SCNx32 " %x %x %" SCNx32 " %" SCNx32 " %" SCNx32,
+            &lost, &id, &sequence, &r.timestamp, &r.args[0], &r.args[1]) != 6 || id > UINT16_MAX || sequence > UINT16_MAX) {
+        ++stats.malformed;
+        return false;
+    }
+    r.id = id;
+    r.sequence = sequence;
+    add_record(r, lost);
+    return true;
+}
+
+void decoder::add_record(const trace::record &r, const uint32_t lost) {
+    if (lost != 0) {
+        stats.lost_records += lost;
+        char text[64];
+        snprintf(text, sizeof(text), "%" PRIu32 " records lost", lost);
+        output ? output(text) : static_cast<void>(puts(text));
+    }
+
+    // Unsigned arithmetic so the wrap is handled naturally, as long as records are less than ~20 s apart.
+    const uint32_t delta = started ? r.timestamp - previous_timestamp : 0;
+    elapsed_cycles += delta;
+    previous_timestamp = r.timestamp;
+    started = true;
+
+    ++stats.records;
+    if (r.id >= trace::number_of_events) {
+        ++stats.unknown_events;
+    }
+
+    const auto text = format(r, cycles_to_us(elapsed_cycles), cycles_to_us(delta));
+    output ? output(text) : static_cast<void>(puts(text.c_str()));
+}
+
+std::string format(const trace::record &r, const double time_us, const double delta_us) {
+    char arguments[128];
+    const char *name = "unknown";
+    if (r.id < trace::number_of_events) {
+        const auto &description = trace::event_descriptions[r.id];
+        name = description.name;
+        snprintf(arguments, sizeof(arguments), description.format, static_cast<unsigned>(r.args[0]), static_cast<unsigned>(r.args[1]));
+    } else {
+        snprintf(arguments, sizeof(arguments), "id %u 0x%" PRIx32 " 0x%" PRIx32, static_cast<unsigned>(r.id), r.args[0], r.args[1]);
+    }
+
+    char text[256];
+    snprintf(text, sizeof(text), "%14.3f %+10.3f %-18s %s", time_us, delta_us, name, arguments);
+    return text;
+}
+
+void print_statistics(const statistics &stats) {
+    printf("records %" PRIu64 " lost %" PRIu64 " unknown events %" PRIu64 " malformed %" PRIu64 "\n",
+        stats.records, stats.lost_records, stats.unknown_events, stats.malformed);
+}
+
+}
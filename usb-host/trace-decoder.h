@@ -0,0 +1,51 @@
+#pragma once
+
+#include "../usb-device/trace-records.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// Turns the usb-device binary trace records, see trace-records.h, back into text using the formats
+// kept here on the host. The records come either as the blocks read with the get_trace vendor
+// request or as the lines printed by the "trace" command.
+namespace trace_decoder
+{
+
+struct statistics {
+    uint64_t records = 0;
+    uint64_t lost_records = 0;  // Overwritten on the device before they were read
+    uint64_t unknown_events = 0;  // The device is newer than this decoder
+    uint64_t malformed = 0;  // Blocks or lines that couldn't be parsed
+};
+
+class decoder {
+public:
+    using output_t = std::function<void(const std::string &line)>;
+
+    // Prints the lines if 'output' isn't given.
+    explicit decoder(output_t output = nullptr);
+
+    // Returns the number of records in the block, 0 if it's empty or malformed.
+    size_t add_block(const uint8_t *const data, const size_t length);
+    // Lines that aren't records, e.g. the prompt, are ignored. Returns false if it wasn't a record.
+    bool add_line(const std::string &line);
+    void add_record(const trace::record &r, const uint32_t lost);
+
+    const statistics &get_statistics() const { return stats; }
+
+private:
+    output_t output;
+    bool started = false;
+    uint32_t previous_timestamp = 0;
+    uint64_t elapsed_cycles = 0;  // Since the first record, the timestamps wrap every ~20 s
+    statistics stats;
+};
+
+// "<time us> <delta us> <event> <formatted arguments>", the time is relative to the first record.
+std::string format(const trace::record &r, const double time_us, const double delta_us);
+
+void print_statistics(const statistics &stats);
+
+}
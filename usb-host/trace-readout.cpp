@@ -0,0 +1,47 @@
+#include "trace-readout.h"
+
+#include "libusb-error.h"
+
+#include "../usb-device/usb-device.h"
+
+#include <cstdio>
+
+namespace trace_readout
+{
+
+namespace
+{
+
+// Records keep arriving whilst the device is busy so don't chase the end of the ring forever.
+const auto max_blocks = 1000;
+
+}
+
+bool read(libusb_device_handle *const device_handle, trace_decoder::decoder &decoder) {
+    uint8_t block[trace::max_block_size];
+    for (auto i = 0; i < max_blocks; ++i) {
+        const auto bytes_transferred = libusb_control_transfer(
+                device_handle,
+                LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE, // bmRequestType
+                static_cast<uint8_t>(usb_device::vendor_request::get_trace), // bRequest
+                0, // wValue
+                0, // wIndex
+                block,
+                sizeof(block), // wLength
+                100
+            );
+        if (bytes_transferred < 0) {
+            print_libusb_error(static_cast<libusb_error>(bytes_transferred), "libusb_control_transfer");
+            return false;
+        }
+
+        // A block without any records means the ring has been drained.
+        if (decoder.add_block(block, bytes_transferred) == 0) {
+            return decoder.get_statistics().malformed == 0;
+        }
+    }
+    printf("stopped after %d blocks\n", max_blocks);
+    return true;
+}
+
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "trace-decoder.h"
+
+#include <libusb-1.0/libusb.h>
+
+// Drains the usb-device binary trace ring using get_trace vendor requests.
+namespace trace_readout
+{
+
+// Reads blocks until the ring is empty, the records are given to the decoder as they arrive.
+bool read(libusb_device_handle *const device_handle, trace_decoder::decoder &decoder);
+
+}